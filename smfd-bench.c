@@ -0,0 +1,936 @@
+/*
+ * Copyright 2021 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * The program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks for smfd's sensor, actuator & policy paths.  smfd.c is included directly, so
+ * that its static functions can be called, and the BMC is simulated by replacing ipmi_cmd_raw().
+ *
+ *	gcc -O3 -Wall -Wextra -o smfd-bench smfd-bench.c \
+ *		-lfreeipmi -latasmart -lyaml -ludev -lm -pthread -ldl
+ *
+ *	smfd-bench [-t MIN_TIME_MS] [-s SMART_BLOB] [-T TRIGGERS] [-D DISKS]
+ *	smfd-bench -S [-C CYCLES]		(scalability sweep)
+ *
+ * Results are written to stdout as JSON.  System calls are counted with the raw_syscalls:sys_enter
+ * tracepoint, which usually requires root (or a permissive perf_event_paranoid); they are reported
+ * as null if it can't be used.  A SMART blob can be saved with "skdump --save=FILE /dev/sdX".
+ */
+
+#define main smfd_main
+#include "smfd.c"
+#undef main
+
+#include <dlfcn.h>
+#include <ftw.h>
+#include <malloc.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Counters -- memory allocations & system calls
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long smfd_bench_allocs = 0;
+static int smfd_bench_perf_fd = -1;
+
+/* Count & forward memory allocations (glibc allows malloc to be replaced) */
+void *malloc(const size_t size)
+{
+	++smfd_bench_allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(const size_t nmemb, const size_t size)
+{
+	++smfd_bench_allocs;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *const ptr, const size_t size)
+{
+	++smfd_bench_allocs;
+	return __libc_realloc(ptr, size);
+}
+
+/* Open a counter for the system calls made by this thread, if possible */
+static void smfd_bench_perf_init(void)
+{
+	static const char *const paths[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+	};
+
+	struct perf_event_attr attr;
+	unsigned int i;
+	uint64_t id;
+	FILE *fp;
+
+	for (i = 0; i < sizeof paths / sizeof *paths; ++i) {
+
+		if ((fp = fopen(paths[i], "r")) == NULL)
+			continue;
+
+		if (fscanf(fp, "%" SCNu64, &id) != 1) {
+			fclose(fp);
+			continue;
+		}
+
+		fclose(fp);
+
+		memset(&attr, 0, sizeof attr);
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.size = sizeof attr;
+		attr.config = id;
+
+		smfd_bench_perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (smfd_bench_perf_fd >= 0)
+			return;
+	}
+
+	SMFD_WARNING("Can't count system calls; syscalls_per_op will be null\n");
+}
+
+/* Read the system call counter (0 if unavailable) */
+static uint64_t smfd_bench_syscalls(void)
+{
+	uint64_t count;
+
+	if (smfd_bench_perf_fd < 0)
+		return 0;
+
+	if (read(smfd_bench_perf_fd, &count, sizeof count) != (ssize_t)sizeof count)
+		SMFD_FATAL("read: %m\n");
+
+	return count;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Simulated BMC
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Simulated BMC state */
+static uint8_t smfd_bench_bmc_mode = SMFD_SUPERMICRO_FAN_MODE_FULL;
+static uint8_t smfd_bench_bmc_duty[SMFD_FAN_ZONE_COUNT] = { 100, 100 };
+
+/* Replaces the libfreeipmi function; answers the Supermicro fan commands that smfd sends */
+int ipmi_cmd_raw(ipmi_ctx_t ctx __attribute__((unused)), uint8_t lun __attribute__((unused)),
+		 uint8_t net_fn, const void *buf_rq, unsigned int buf_rq_len, void *buf_rs,
+		 unsigned int buf_rs_len)
+{
+	const uint8_t *const rq = buf_rq;
+	uint8_t *const rs = buf_rs;
+
+	if (buf_rs_len < 3)
+		return -1;
+
+	rs[0] = rq[0];
+	rs[1] = IPMI_COMP_CODE_COMMAND_SUCCESS;
+
+	if (net_fn != IPMI_NET_FN_OEM_SUPERMICRO_GENERIC_RQ || buf_rq_len < 2) {
+		rs[1] = 0xc1;	/* invalid command */
+		return 2;
+	}
+
+	if (rq[0] == SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE) {
+
+		if (rq[1] == 0x00) {
+			rs[2] = smfd_bench_bmc_mode;
+			return 3;
+		}
+
+		if (buf_rq_len == 3) {
+			smfd_bench_bmc_mode = rq[2];
+			return 2;
+		}
+	}
+	else if (rq[0] == IPMI_CMD_OEM_SUPERMICRO_GENERIC_EXTENSION
+			&& rq[1] == SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT && buf_rq_len >= 4
+			&& rq[3] < SMFD_FAN_ZONE_COUNT) {
+
+		if (rq[2] == 0x00) {
+			rs[2] = smfd_bench_bmc_duty[rq[3]];
+			return 3;
+		}
+
+		if (buf_rq_len == 5) {
+			smfd_bench_bmc_duty[rq[3]] = rq[4];
+			return 2;
+		}
+	}
+
+	rs[1] = 0xcc;	/* invalid data field */
+	return 2;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Benchmarks
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Benchmark settings */
+static int64_t smfd_bench_min_time = 500;	/* ms */
+static const char *smfd_bench_smart_blob = NULL;
+static unsigned int smfd_bench_triggers = 64;
+static unsigned int smfd_bench_disks = 64;
+static char smfd_bench_dir[] = "/dev/shm/smfd-bench.XXXXXX";
+static _Bool smfd_bench_first = 1;
+
+/* Fixtures */
+static FILE *smfd_bench_temp_fp;
+static struct smfd_temperature smfd_bench_temp;
+static struct smfd_disk smfd_bench_disk;
+static struct smfd_temp_threshold *smfd_bench_table;
+static struct smfd_process_temp_result smfd_bench_result;
+static int smfd_bench_table_temp;
+
+/* Monotonic time in nanoseconds */
+static int64_t smfd_bench_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		SMFD_FATAL("clock_gettime: %m\n");
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Run a benchmark, doubling the number of iterations until a run takes at least the minimum time,
+ * and print its results from the last run
+ */
+static void smfd_bench_run(const char *const name, void (*const op)(void))
+{
+	uint64_t syscalls;
+	unsigned long allocs, n, i;
+	int64_t start, elapsed;
+
+	op();	/* warm up caches & reach steady state (e.g. active triggers) */
+
+	for (n = 1; ; n *= 2) {
+
+		allocs = smfd_bench_allocs;
+		syscalls = smfd_bench_syscalls();
+		start = smfd_bench_ns();
+
+		for (i = 0; i < n; ++i)
+			op();
+
+		elapsed = smfd_bench_ns() - start;
+		syscalls = smfd_bench_syscalls() - syscalls;
+		allocs = smfd_bench_allocs - allocs;
+
+		if (elapsed >= smfd_bench_min_time * 1000000 || n >= 1UL << 30)
+			break;
+	}
+
+	printf("%s\n    { \"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, ",
+	       smfd_bench_first ? "" : ",", name, n, (double)elapsed / n);
+
+	if (smfd_bench_perf_fd >= 0)
+		printf("\"syscalls_per_op\": %.2f, ", (double)syscalls / n);
+	else
+		fputs("\"syscalls_per_op\": null, ", stdout);
+
+	printf("\"allocs_per_op\": %.2f }", (double)allocs / n);
+	fflush(stdout);
+
+	smfd_bench_first = 0;
+}
+
+/* Create a file in the benchmark directory */
+static char *smfd_bench_file(const char *const name, const char *const contents)
+{
+	char *path;
+	FILE *fp;
+
+	if (asprintf(&path, "%s/%s", smfd_bench_dir, name) < 0)
+		SMFD_ABORT("asprintf: %m\n");
+
+	if ((fp = fopen(path, "w")) == NULL)
+		SMFD_FATAL("%s: %m\n", path);
+
+	if (fputs(contents, fp) == EOF || fclose(fp) != 0)
+		SMFD_FATAL("%s: %m\n", path);
+
+	return path;
+}
+
+/* Threshold of trigger i of n; thresholds are spread from 27°C to 79°C, whatever their number */
+#define SMFD_BENCH_THRESHOLD(i, n)	(27 + (53 * (i)) / (n))
+
+/* Temperature in the middle of a synthetic trigger table */
+#define SMFD_BENCH_MID_TEMP		53
+
+/* Create a trigger table with evenly spaced thresholds */
+static struct smfd_temp_threshold *smfd_bench_make_table(const unsigned int count)
+{
+	struct smfd_temp_threshold *table;
+	unsigned int i;
+
+	if ((table = calloc(count + 1, sizeof *table)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (i = 0; i < count; ++i) {
+
+		if (asprintf(&table[i].name, "trigger%u", i) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+
+		table[i].threshold = SMFD_BENCH_THRESHOLD(i, count);
+		table[i].hysteresis = table[i].threshold - 2;
+		table[i].cpu_fan_percent = 35 + (65 * (i + 1)) / count;
+		table[i].sys_fan_percent = 75 + (25 * (i + 1)) / count;
+	}
+
+	return table;
+}
+
+/* Read a coretemp-style sysfs input from tmpfs */
+static void smfd_bench_temp_read(void)
+{
+	smfd_temp_read(smfd_bench_temp_fp, "Core 0", SMFD_GROUP_CPU, &smfd_bench_temp);
+	smfd_bench_temp.samples = 0;
+	smfd_bench_temp.accumulator = 0;
+}
+
+/* Decode the temperature from a recorded SMART blob */
+static void smfd_bench_smart_decode(void)
+{
+	if (!smfd_disk_read_one(&smfd_bench_disk))
+		SMFD_FATAL("%s: no temperature in SMART data\n", smfd_bench_smart_blob);
+	smfd_bench_disk.temp.samples = 0;
+	smfd_bench_disk.temp.accumulator = 0;
+}
+
+/* Query the fan mode of the simulated BMC */
+static void smfd_bench_ipmi_raw_cmd(void)
+{
+	static const uint8_t cmd[] = { SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE, 0x00 };
+	uint8_t mode;
+
+	smfd_ipmi_raw_cmd(cmd, sizeof cmd, &mode, sizeof mode);
+}
+
+/* Process 1 temperature (in the middle of the table) against a synthetic trigger table */
+static void smfd_bench_process_temp(void)
+{
+	smfd_process_temp(smfd_bench_table_temp, smfd_bench_table, "CPU", &smfd_bench_result);
+}
+
+/* Process every (synthetic) sensor; nothing is written, because fan speeds don't change */
+static void smfd_bench_process_all_temps(void)
+{
+	smfd_process_all_temps();
+}
+
+/* Reload the (synthetic) configuration file */
+static void smfd_bench_config_load(void)
+{
+	smfd_free_policy();
+	smfd_load_config(1);
+}
+
+/* Set up & run the SMART decode benchmark */
+static void smfd_bench_smart(void)
+{
+	void *blob;
+	long size;
+	FILE *fp;
+
+	if ((fp = fopen(smfd_bench_smart_blob, "r")) == NULL)
+		SMFD_FATAL("%s: %m\n", smfd_bench_smart_blob);
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+		SMFD_FATAL("%s: %m\n", smfd_bench_smart_blob);
+
+	if ((blob = malloc(size)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	if (fread(blob, 1, size, fp) != (size_t)size || fclose(fp) != 0)
+		SMFD_FATAL("%s: %m\n", smfd_bench_smart_blob);
+
+	if (sk_disk_open(NULL, &smfd_bench_disk.disk) < 0)
+		SMFD_FATAL("sk_disk_open: %m\n");
+
+	if (sk_disk_set_blob(smfd_bench_disk.disk, blob, size) < 0)
+		SMFD_FATAL("%s: %m\n", smfd_bench_smart_blob);
+
+	smfd_bench_disk.name = (char *)smfd_bench_smart_blob;
+	smfd_bench_disk.devnode = (char *)smfd_bench_smart_blob;
+
+	smfd_bench_run("smart_decode", smfd_bench_smart_decode);
+
+	sk_disk_free(smfd_bench_disk.disk);
+	free(blob);
+}
+
+/* Set up the synthetic sensors & trigger tables used by smfd_process_all_temps() */
+static void smfd_bench_sensors(void)
+{
+	unsigned int i;
+
+	smfd_default_profile.fan_base[SMFD_FAN_ZONE_CPU] = 35;
+	smfd_default_profile.fan_base[SMFD_FAN_ZONE_SYS] = 75;
+	smfd_default_profile.triggers[SMFD_GROUP_CPU] = smfd_bench_make_table(smfd_bench_triggers);
+	smfd_default_profile.triggers[SMFD_GROUP_PCH] = smfd_bench_make_table(smfd_bench_triggers);
+	smfd_default_profile.triggers[SMFD_GROUP_DISK] = smfd_bench_make_table(smfd_bench_triggers);
+
+	smfd_coretemp_count = 16;
+	if ((smfd_coretemps = calloc(smfd_coretemp_count, sizeof *smfd_coretemps)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (i = 0; i < smfd_coretemp_count; ++i) {
+		if (asprintf(&smfd_coretemps[i].name, "Core %u", i) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+		smfd_coretemps[i].temp.current = 40 + i % 8;
+	}
+
+	smfd_disk_count = smfd_bench_disks;
+	if ((smfd_disks = calloc(smfd_disk_count, sizeof *smfd_disks)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (i = 0; i < smfd_disk_count; ++i) {
+		if (asprintf(&smfd_disks[i].name, "/dev/disk/by-id/bench-%u", i) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+		smfd_disks[i].temp.current = 30 + i % 16;
+		smfd_disks[i].stat_fd = -1;
+	}
+
+	smfd_pch_temp.current = 55;
+
+	/* Nothing is written to the (non-existent) fans */
+	smfd_shadow = 1;
+}
+
+/* Write a configuration file with large trigger tables & many smart_disks patterns */
+static char *smfd_bench_config(void)
+{
+	static const char *const groups[] = { "cpu", "pch", "disk" };
+
+	char *yaml, *path;
+	unsigned int i, j;
+	size_t size;
+	FILE *fp;
+
+	if ((fp = open_memstream(&yaml, &size)) == NULL)
+		SMFD_ABORT("open_memstream: %m\n");
+
+	fputs("log_interval: 3600\ncpu_fan_base: 35\nsys_fan_base: 75\n"
+	      "ipmi_fans:\n  - name: CPU fan\n    record_id: 607\n    zone: cpu\n"
+	      "smart_disks:\n", fp);
+
+	for (i = 0; i < smfd_bench_disks; ++i)
+		fprintf(fp, "  - /dev/disk/by-id/bench-%u\n", i);
+
+	for (i = 0; i < sizeof groups / sizeof *groups; ++i) {
+
+		fprintf(fp, "%s_temp_triggers:\n", groups[i]);
+
+		for (j = 0; j < smfd_bench_triggers; ++j) {
+			fprintf(fp, "  - name: trigger%u\n    threshold: %u\n    hysteresis: %u\n"
+				"    cpu_fan_speed: %u\n    sys_fan_speed: %u\n",
+				j, SMFD_BENCH_THRESHOLD(j, smfd_bench_triggers),
+				SMFD_BENCH_THRESHOLD(j, smfd_bench_triggers) - 2,
+				35 + (65 * (j + 1)) / smfd_bench_triggers,
+				75 + (25 * (j + 1)) / smfd_bench_triggers);
+		}
+	}
+
+	if (fclose(fp) != 0)
+		SMFD_FATAL("fclose: %m\n");
+
+	path = smfd_bench_file("config.yaml", yaml);
+	free(yaml);
+
+	return path;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Scalability sweep -- complete control cycles on synthetic hosts
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Each point of the sweep runs in its own process, with its own fake sysfs tree (coretemp & PCH
+ * inputs), fake disks (see below) and the simulated BMC, so that its memory footprint isn't
+ * affected by the points before it.  Every cycle does what smfd's main loop does, minus the
+ * sleep.  The temperature of the first core alternates between 2 values every 50 cycles, so that
+ * trigger transitions and duty cycle changes are included.
+ *
+ * smfd has exactly 2 fan zones (SMFD_FAN_ZONE_COUNT), so the number of zones isn't swept.
+ */
+
+static const unsigned int smfd_sweep_coretemps[] = { 8, 64, 512 };
+static const unsigned int smfd_sweep_disks[] = { 4, 60, 240 };
+static const unsigned int smfd_sweep_triggers[] = { 10, 100, 1000 };
+
+static unsigned int smfd_sweep_cycles = 2000;
+static _Bool smfd_sweep = 0;
+
+/* Fake disks -- the "handle" of disk i points to its temperature (millikelvin) */
+#define SMFD_SWEEP_MAX_DISKS	240
+static uint64_t smfd_sweep_mkelvin[SMFD_SWEEP_MAX_DISKS];
+
+/* Is a libatasmart handle a fake disk? */
+static _Bool smfd_sweep_fake(const SkDisk *const d)
+{
+	return (const void *)d >= (const void *)smfd_sweep_mkelvin
+		&& (const void *)d < (const void *)(smfd_sweep_mkelvin + SMFD_SWEEP_MAX_DISKS);
+}
+
+/* Replace the libatasmart functions that smfd_disk_read_one() calls; real disks are forwarded */
+int sk_disk_smart_read_data(SkDisk *d)
+{
+	static int (*real)(SkDisk *);
+
+	if (smfd_sweep_fake(d))
+		return 0;
+
+	if (real == NULL && (real = dlsym(RTLD_NEXT, "sk_disk_smart_read_data")) == NULL)
+		SMFD_FATAL("dlsym: %s\n", dlerror());
+
+	return real(d);
+}
+
+int sk_disk_smart_get_temperature(SkDisk *d, uint64_t *mkelvin)
+{
+	static int (*real)(SkDisk *, uint64_t *);
+
+	if (smfd_sweep_fake(d)) {
+		*mkelvin = *(const uint64_t *)(const void *)d;
+		return 0;
+	}
+
+	if (real == NULL && (real = dlsym(RTLD_NEXT, "sk_disk_smart_get_temperature")) == NULL)
+		SMFD_FATAL("dlsym: %s\n", dlerror());
+
+	return real(d, mkelvin);
+}
+
+/* Create a directory and its parents */
+static void smfd_sweep_mkdir(const char *const path)
+{
+	char *copy, *p;
+
+	if ((copy = strdup(path)) == NULL)
+		SMFD_ABORT("strdup: %m\n");
+
+	for (p = strchr(copy + 1, '/'); ; p = strchr(p + 1, '/')) {
+
+		if (p != NULL)
+			*p = 0;
+
+		if (mkdir(copy, 0700) != 0 && errno != EEXIST)
+			SMFD_FATAL("%s: %m\n", copy);
+
+		if (p == NULL)
+			break;
+
+		*p = '/';
+	}
+
+	free(copy);
+}
+
+/* Write a sysfs-style file (a single line) below the sysfs root */
+static void smfd_sweep_write(const char *const dir, const char *const name, const char *const fmt,
+			     ...)
+{
+	va_list ap;
+	char *path;
+	FILE *fp;
+
+	if (asprintf(&path, "%s%s/%s", smfd_sysfs_root, dir, name) < 0)
+		SMFD_ABORT("asprintf: %m\n");
+
+	if ((fp = fopen(path, "w")) == NULL)
+		SMFD_FATAL("%s: %m\n", path);
+
+	va_start(ap, fmt);
+	vfprintf(fp, fmt, ap);
+	va_end(ap);
+
+	if (fclose(fp) != 0)
+		SMFD_FATAL("%s: %m\n", path);
+
+	free(path);
+}
+
+/* Remove 1 file or directory (nftw callback) */
+static int smfd_sweep_rm(const char *const path,
+			 const struct stat *const sb __attribute__((unused)),
+			 const int flag __attribute__((unused)),
+			 struct FTW *const ftw __attribute__((unused)))
+{
+	if (remove(path) != 0)
+		SMFD_ERR("%s: %m\n", path);
+
+	return 0;
+}
+
+/* Read a value (kB) from /proc/self/status */
+static unsigned long smfd_sweep_status(const char *const key)
+{
+	const size_t len = strlen(key);
+	unsigned long value;
+	size_t size;
+	char *line;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/status", "r")) == NULL)
+		SMFD_FATAL("/proc/self/status: %m\n");
+
+	for (value = 0, line = NULL, size = 0; getline(&line, &size, fp) > 0; ) {
+		if (strncmp(line, key, len) == 0 && line[len] == ':') {
+			value = strtoul(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	return value;
+}
+
+/* Compare 2 cycle times (for qsort) */
+static int smfd_sweep_cmp(const void *const a, const void *const b)
+{
+	const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Set up a synthetic host & run the control cycles (in a child process) */
+static void smfd_sweep_point(const unsigned int coretemps, const unsigned int disks,
+			     const unsigned int triggers)
+{
+	static const char coretemp_dir[] = "/sys/devices/platform/coretemp.0/hwmon/hwmon2";
+	static const char pch_dir[] = "/sys/devices/virtual/thermal/thermal_zone0/hwmon0";
+
+	struct timespec cpu_start, cpu_end;
+	int64_t *times, start;
+	unsigned int i;
+	char *path;
+	_Bool hot;
+
+	/* Fake sysfs */
+	if (asprintf(&path, "%s%s", smfd_sysfs_root, coretemp_dir) < 0)
+		SMFD_ABORT("asprintf: %m\n");
+	smfd_sweep_mkdir(path);
+	free(path);
+
+	if (asprintf(&path, "%s%s", smfd_sysfs_root, pch_dir) < 0)
+		SMFD_ABORT("asprintf: %m\n");
+	smfd_sweep_mkdir(path);
+	free(path);
+
+	for (i = 0; i < coretemps; ++i) {
+
+		char name[sizeof "temp4294967295_label"];
+
+		snprintf(name, sizeof name, "temp%u_label", i + 1);
+		smfd_sweep_write(coretemp_dir, name, "Core %u\n", i);
+		snprintf(name, sizeof name, "temp%u_input", i + 1);
+		smfd_sweep_write(coretemp_dir, name, "%d\n",
+				 (SMFD_BENCH_MID_TEMP - 5 + i % 5) * 1000);
+	}
+
+	smfd_sweep_write(pch_dir, "temp1_input", "%d\n", SMFD_BENCH_MID_TEMP * 1000);
+
+	smfd_coretemp_init();
+	smfd_pch_temp_init();
+
+	/* Fake disks */
+	smfd_disk_count = disks;
+	if ((smfd_disks = calloc(disks, sizeof *smfd_disks)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (i = 0; i < disks; ++i) {
+		if (asprintf(&smfd_disks[i].name, "/dev/disk/by-id/sweep-%u", i) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+		smfd_disks[i].devnode = smfd_disks[i].name;
+		smfd_sweep_mkelvin[i] = (SMFD_BENCH_MID_TEMP - 10 + i % 8) * 1000 + 273150;
+		smfd_disks[i].disk = (SkDisk *)(void *)&smfd_sweep_mkelvin[i];
+		smfd_temp_reset(&smfd_disks[i].temp);
+
+		if (asprintf(&path, "%s/sys/block/sweep-%u", smfd_sysfs_root, i) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+		smfd_sweep_mkdir(path);
+		free(path);
+
+		if (asprintf(&path, "/sys/block/sweep-%u", i) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+		smfd_sweep_write(path, "stat", "%u 0 0 0 %u 0 0 0 0 %u 0\n", i, i, i * 10);
+		free(path);
+
+		smfd_disk_stat_open(&smfd_disks[i]);
+	}
+
+	/* Policy & (simulated) BMC */
+	smfd_default_profile.fan_base[SMFD_FAN_ZONE_CPU] = 35;
+	smfd_default_profile.fan_base[SMFD_FAN_ZONE_SYS] = 75;
+	smfd_default_profile.triggers[SMFD_GROUP_CPU] = smfd_bench_make_table(triggers);
+	smfd_default_profile.triggers[SMFD_GROUP_PCH] = smfd_bench_make_table(triggers);
+	smfd_default_profile.triggers[SMFD_GROUP_DISK] = smfd_bench_make_table(triggers);
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		smfd_zones[i].ops = &smfd_ipmi_actuator;
+		smfd_zones[i].ipmi_zone = i;
+	}
+
+	if ((times = malloc(smfd_sweep_cycles * sizeof *times)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start) != 0)
+		SMFD_FATAL("clock_gettime: %m\n");
+
+	for (hot = 0, i = 0; i < smfd_sweep_cycles; ++i) {
+
+		if (i % 50 == 0) {
+			hot = !hot;
+			smfd_sweep_write(coretemp_dir, "temp1_input", "%d\n",
+					 (SMFD_BENCH_MID_TEMP + (hot ? 10 : -5)) * 1000);
+		}
+
+		start = smfd_bench_ns();
+
+		smfd_sample_time = smfd_mono_ms();
+		smfd_coretemp_read();
+		smfd_pch_temp_read();
+		smfd_disk_read();
+		smfd_peer_cycle();
+		smfd_process_all_temps();
+
+		times[i] = smfd_bench_ns() - start;
+	}
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end) != 0)
+		SMFD_FATAL("clock_gettime: %m\n");
+
+	qsort(times, smfd_sweep_cycles, sizeof *times, smfd_sweep_cmp);
+
+	printf("%s\n    { \"coretemps\": %u, \"disks\": %u, \"zones\": %u, \"triggers\": %u, "
+	       "\"cycles\": %u, \"latency_us\": { \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+	       "\"max\": %.1f }, \"cpu_us_per_cycle\": %.1f, \"rss_kb\": %lu, \"heap_kb\": %zu }",
+	       smfd_bench_first ? "" : ",", coretemps, disks, SMFD_FAN_ZONE_COUNT, triggers,
+	       smfd_sweep_cycles, times[smfd_sweep_cycles / 2] / 1000.0,
+	       times[smfd_sweep_cycles * 9 / 10] / 1000.0,
+	       times[smfd_sweep_cycles * 99 / 100] / 1000.0,
+	       times[smfd_sweep_cycles - 1] / 1000.0,
+	       ((cpu_end.tv_sec - cpu_start.tv_sec) * 1e6
+			+ (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e3) / smfd_sweep_cycles,
+	       smfd_sweep_status("VmRSS"), mallinfo2().uordblks / 1024);
+
+	free(times);
+}
+
+/* Run every combination of sensor, disk & trigger counts */
+static void smfd_sweep_run(void)
+{
+	static const unsigned int nc = sizeof smfd_sweep_coretemps / sizeof *smfd_sweep_coretemps;
+	static const unsigned int nd = sizeof smfd_sweep_disks / sizeof *smfd_sweep_disks;
+	static const unsigned int nt = sizeof smfd_sweep_triggers / sizeof *smfd_sweep_triggers;
+
+	unsigned int i, c, d, t;
+	char *root;
+	pid_t pid;
+	int status;
+
+	fputs("  \"sweep\": [", stdout);
+
+	for (i = 0; i < nc * nd * nt; ++i) {
+
+		c = i / (nd * nt);
+		d = (i / nt) % nd;
+		t = i % nt;
+
+		if (asprintf(&root, "%s/%u-%u-%u", smfd_bench_dir, smfd_sweep_coretemps[c],
+			     smfd_sweep_disks[d], smfd_sweep_triggers[t]) < 0) {
+			SMFD_ABORT("asprintf: %m\n");
+		}
+
+		fflush(stdout);
+
+		if ((pid = fork()) < 0)
+			SMFD_FATAL("fork: %m\n");
+
+		if (pid == 0) {
+			/* Trigger & fan change messages would otherwise flood the terminal */
+			if (freopen("/dev/null", "w", stderr) == NULL)
+				_exit(EXIT_FAILURE);
+			smfd_sysfs_root = root;
+			smfd_sweep_point(smfd_sweep_coretemps[c], smfd_sweep_disks[d],
+					 smfd_sweep_triggers[t]);
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		}
+
+		if (waitpid(pid, &status, 0) != pid)
+			SMFD_FATAL("waitpid: %m\n");
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			SMFD_FATAL("Sweep point %s failed\n", root);
+
+		if (nftw(root, smfd_sweep_rm, 16, FTW_DEPTH | FTW_PHYS) != 0)
+			SMFD_ERR("%s: %m\n", root);
+
+		smfd_bench_first = 0;
+		free(root);
+	}
+
+	fputs("\n  ]\n}\n", stdout);
+}
+
+/* Parse the command line */
+static void smfd_bench_parse_args(const int argc, char **const argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:s:T:D:SC:")) != -1) {
+
+		switch (opt) {
+
+			case 't':	smfd_bench_min_time = atoi(optarg);		break;
+			case 's':	smfd_bench_smart_blob = optarg;			break;
+			case 'T':	smfd_bench_triggers = atoi(optarg);		break;
+			case 'D':	smfd_bench_disks = atoi(optarg);		break;
+			case 'S':	smfd_sweep = 1;					break;
+			case 'C':	smfd_sweep_cycles = atoi(optarg);		break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-t MIN_TIME_MS] [-s SMART_BLOB] "
+						"[-T TRIGGERS] [-D DISKS]\n"
+						"       %s -S [-C CYCLES]\n", argv[0], argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (smfd_bench_min_time <= 0 || smfd_bench_triggers == 0 || smfd_bench_disks == 0
+			|| smfd_sweep_cycles == 0)
+		SMFD_FATAL("Invalid option value\n");
+}
+
+/* Run the microbenchmarks */
+static void smfd_bench_micro(void)
+{
+	char *temp_path, *config_path;
+
+	smfd_bench_perf_init();
+
+	printf("{\n  \"min_time_ms\": %" PRId64 ",\n  \"triggers\": %u,\n  \"disks\": %u,\n"
+	       "  \"benchmarks\": [", smfd_bench_min_time, smfd_bench_triggers, smfd_bench_disks);
+
+	temp_path = smfd_bench_file("temp1_input", "42000\n");
+	if ((smfd_bench_temp_fp = fopen(temp_path, "r")) == NULL)
+		SMFD_FATAL("%s: %m\n", temp_path);
+
+	smfd_bench_run("temp_read", smfd_bench_temp_read);
+
+	if (smfd_bench_smart_blob != NULL)
+		smfd_bench_smart();
+
+	smfd_bench_run("ipmi_raw_cmd", smfd_bench_ipmi_raw_cmd);
+
+	smfd_bench_table = smfd_bench_make_table(smfd_bench_triggers);
+	smfd_bench_table_temp = SMFD_BENCH_MID_TEMP;
+	smfd_bench_run("process_temp", smfd_bench_process_temp);
+
+	smfd_bench_sensors();
+	smfd_bench_run("process_all_temps", smfd_bench_process_all_temps);
+
+	config_path = smfd_bench_config();
+	smfd_config_file = config_path;
+	smfd_free_policy();
+	smfd_load_config(0);
+	smfd_bench_run("config_load", smfd_bench_config_load);
+
+	fputs("\n  ]\n}\n", stdout);
+
+	fclose(smfd_bench_temp_fp);
+	unlink(temp_path);
+	unlink(config_path);
+	free(temp_path);
+	free(config_path);
+	smfd_free_triggers(smfd_bench_table);
+}
+
+int main(const int argc, char **const argv)
+{
+	smfd_bench_parse_args(argc, argv);
+
+	if (mkdtemp(smfd_bench_dir) == NULL)
+		SMFD_FATAL("%s: %m\n", smfd_bench_dir);
+
+	if (smfd_sweep) {
+		printf("{\n  \"cycles\": %u,\n", smfd_sweep_cycles);
+		smfd_sweep_run();
+	}
+	else {
+		smfd_bench_micro();
+	}
+
+	if (rmdir(smfd_bench_dir) != 0)
+		SMFD_ERR("%s: %m\n", smfd_bench_dir);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,703 @@
+/*
+ * Copyright 2021 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * The program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Simulated Supermicro BMC, for testing fleet mode without hardware.  It answers IPMI 2.0 (lanplus)
+ * sessions on a loopback UDP port, using cipher suite 0 (no authentication, integrity or
+ * confidentiality), so any username & password are accepted.  It has 3 temperature sensors and
+ * implements the Supermicro fan mode & duty cycle commands; each fan change is printed to stdout.
+ *
+ *	gcc -O2 -Wall -Wextra -o smfd-bmcsim smfd-bmcsim.c
+ *
+ *	smfd-bmcsim [-p PORT] [-d]
+ *
+ * A line of the form "SENSOR TEMPERATURE" on stdin (e.g. "1 75") changes a sensor's reading.  -d
+ * simulates a dead BMC; requests are received but never answered.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Print an error and exit */
+#define SMFD_SIM_FATAL(...)	do { fprintf(stderr, __VA_ARGS__); exit(EXIT_FAILURE); } while (0)
+
+#define SMFD_SIM_SESSION_MAX	16
+
+/* IPMI network functions (requests) */
+#define SMFD_SIM_NETFN_SENSOR	0x04
+#define SMFD_SIM_NETFN_APP	0x06
+#define SMFD_SIM_NETFN_STORAGE	0x0a
+#define SMFD_SIM_NETFN_OEM	0x30		/* Supermicro */
+
+/* Completion codes */
+#define SMFD_SIM_CC_OK		0x00
+#define SMFD_SIM_CC_INVALID_CMD	0xc1
+#define SMFD_SIM_CC_LENGTH	0xc7
+#define SMFD_SIM_CC_RANGE	0xc9
+#define SMFD_SIM_CC_NOT_PRESENT	0xcb
+
+/* RMCP+ payload types */
+#define SMFD_SIM_PAYLOAD_IPMI	0x00
+#define SMFD_SIM_PAYLOAD_OPEN	0x10
+#define SMFD_SIM_PAYLOAD_RAKP1	0x12
+#define SMFD_SIM_PAYLOAD_RAKP3	0x14
+
+/* A simulated temperature sensor (its SDR record ID is its sensor number) */
+struct smfd_sim_sensor {
+	const char *name;
+	uint8_t number;
+	int temp;
+};
+
+/* An IPMI 2.0 session */
+struct smfd_sim_session {
+	uint32_t console_id;		/* remote console session ID */
+	uint32_t bmc_id;		/* managed system session ID (0 if slot is free) */
+	uint32_t seq;			/* outbound session sequence number */
+	uint8_t privilege;
+	_Bool active;			/* RAKP handshake complete */
+};
+
+static struct smfd_sim_sensor smfd_sim_sensors[] = {
+	{ "CPU Temp",		1,	45 },
+	{ "PCH Temp",		2,	50 },
+	{ "System Temp",	3,	30 }
+};
+
+#define SMFD_SIM_SENSOR_COUNT	(sizeof smfd_sim_sensors / sizeof smfd_sim_sensors[0])
+
+static const char *const smfd_sim_zone_names[2] = { "CPU", "system" };
+
+static struct smfd_sim_session smfd_sim_sessions[SMFD_SIM_SESSION_MAX];
+static uint32_t smfd_sim_next_id = 0x5d000001;
+static uint16_t smfd_sim_reservation = 0;
+static uint8_t smfd_sim_fan_mode = 0x00;		/* standard */
+static uint8_t smfd_sim_fan_percent[2] = { 50, 50 };
+static unsigned int smfd_sim_port = 6623;
+static _Bool smfd_sim_dead = 0;
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	IPMI commands
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* IPMI message checksum (2's complement of the byte sum) */
+static uint8_t smfd_sim_checksum(const uint8_t *const buf, const size_t len)
+{
+	uint8_t sum;
+	size_t i;
+
+	for (sum = 0, i = 0; i < len; ++i)
+		sum += buf[i];
+
+	return -sum;
+}
+
+/* Find a sensor by number (or SDR record ID) */
+static struct smfd_sim_sensor *smfd_sim_sensor(const unsigned int number)
+{
+	unsigned int i;
+
+	for (i = 0; i < SMFD_SIM_SENSOR_COUNT; ++i) {
+		if (smfd_sim_sensors[i].number == number)
+			return &smfd_sim_sensors[i];
+	}
+
+	return NULL;
+}
+
+/* Build a sensor's full sensor record (linear, 1°C per count); returns the record length */
+static size_t smfd_sim_record(const struct smfd_sim_sensor *const sensor, uint8_t *const rec)
+{
+	size_t name_len;
+
+	name_len = strlen(sensor->name);
+
+	memset(rec, 0, 48);
+	rec[0] = sensor->number;		/* record ID */
+	rec[2] = 0x51;				/* SDR version */
+	rec[3] = 0x01;				/* full sensor record */
+	rec[4] = 43 + name_len;			/* remaining record length */
+	rec[5] = 0x20;				/* sensor owner (BMC) */
+	rec[7] = sensor->number;
+	rec[8] = 0x07;				/* entity ID (system board) */
+	rec[9] = 0x01;				/* entity instance */
+	rec[10] = 0x7f;				/* sensor initialization */
+	rec[12] = 0x01;				/* sensor type (temperature) */
+	rec[13] = 0x01;				/* event/reading type (threshold) */
+	rec[21] = 0x01;				/* base unit (degrees C) */
+	rec[24] = 1;				/* M */
+	rec[32] = 127;				/* normal maximum */
+	rec[34] = 127;				/* sensor maximum */
+	rec[47] = 0xc0 | name_len;		/* ID string type (8-bit ASCII) & length */
+	memcpy(rec + 48, sensor->name, name_len);
+
+	return 48 + name_len;
+}
+
+/* Get SDR -- reservation ID, record ID, offset & byte count ==> next record ID & data */
+static size_t smfd_sim_get_sdr(const uint8_t *const data, const size_t len, uint8_t *const out,
+			       uint8_t *const cc)
+{
+	const struct smfd_sim_sensor *sensor;
+	unsigned int record_id, i;
+	size_t rec_len, count;
+	uint8_t rec[64];
+
+	if (len != 6) {
+		*cc = SMFD_SIM_CC_LENGTH;
+		return 0;
+	}
+
+	record_id = data[2] | data[3] << 8;
+	if (record_id == 0)
+		record_id = smfd_sim_sensors[0].number;
+
+	if ((sensor = smfd_sim_sensor(record_id)) == NULL) {
+		*cc = SMFD_SIM_CC_NOT_PRESENT;
+		return 0;
+	}
+
+	rec_len = smfd_sim_record(sensor, rec);
+
+	if (data[4] > rec_len) {
+		*cc = SMFD_SIM_CC_RANGE;
+		return 0;
+	}
+
+	count = (data[5] == 0xff || data[4] + data[5] > rec_len) ? rec_len - data[4] : data[5];
+
+	for (i = 0; i < SMFD_SIM_SENSOR_COUNT && &smfd_sim_sensors[i] != sensor; ++i);
+
+	if (++i < SMFD_SIM_SENSOR_COUNT) {
+		out[0] = smfd_sim_sensors[i].number;
+		out[1] = 0;
+	}
+	else {
+		out[0] = 0xff;
+		out[1] = 0xff;
+	}
+
+	memcpy(out + 2, rec + data[4], count);
+
+	return 2 + count;
+}
+
+/* Supermicro fan mode & duty cycle commands */
+static size_t smfd_sim_oem(const uint8_t cmd, const uint8_t *const data, const size_t len,
+			   uint8_t *const out, uint8_t *const cc)
+{
+	if (cmd == 0x45 && len == 1 && data[0] == 0x00) {
+		out[0] = smfd_sim_fan_mode;
+		return 1;
+	}
+
+	if (cmd == 0x45 && len == 2 && data[0] == 0x01) {
+		if (data[1] != smfd_sim_fan_mode)
+			printf("fan mode: 0x%02" PRIx8 "\n", data[1]);
+		smfd_sim_fan_mode = data[1];
+		return 0;
+	}
+
+	if (cmd == 0x70 && len >= 3 && data[0] == 0x66) {
+
+		if (data[2] > 1) {
+			*cc = SMFD_SIM_CC_RANGE;
+			return 0;
+		}
+
+		if (data[1] == 0x00 && len == 3) {
+			out[0] = smfd_sim_fan_percent[data[2]];
+			return 1;
+		}
+
+		if (data[1] == 0x01 && len == 4 && data[3] <= 100) {
+			printf("%s fan: %" PRIu8 "%%\n", smfd_sim_zone_names[data[2]], data[3]);
+			smfd_sim_fan_percent[data[2]] = data[3];
+			return 0;
+		}
+
+		*cc = SMFD_SIM_CC_RANGE;
+		return 0;
+	}
+
+	*cc = SMFD_SIM_CC_INVALID_CMD;
+	return 0;
+}
+
+/* Execute a command; returns the length of the response data (after the completion code) */
+static size_t smfd_sim_command(const uint8_t netfn, const uint8_t cmd, const uint8_t *const data,
+			       const size_t len, uint8_t *const out, uint8_t *const cc,
+			       struct smfd_sim_session *const session)
+{
+	const struct smfd_sim_sensor *sensor;
+
+	*cc = SMFD_SIM_CC_OK;
+
+	switch (netfn << 8 | cmd) {
+
+		case SMFD_SIM_NETFN_APP << 8 | 0x01:	/* Get Device ID */
+			memcpy(out, "\x20\x01\x01\x00\x02\x03\x7c\x2a\x00\x00\x00", 11);
+			return 11;
+
+		case SMFD_SIM_NETFN_APP << 8 | 0x38:	/* Get Channel Auth Capabilities */
+			/* IPMI 2.0 supported, non-null usernames enabled */
+			memcpy(out, "\x01\x81\x04\x03\x00\x00\x00\x00", 8);
+			return 8;
+
+		case SMFD_SIM_NETFN_APP << 8 | 0x3b:	/* Set Session Privilege Level */
+			if (session == NULL || len != 1) {
+				*cc = SMFD_SIM_CC_INVALID_CMD;
+				return 0;
+			}
+			if (data[0] != 0)
+				session->privilege = data[0];
+			out[0] = session->privilege;
+			return 1;
+
+		case SMFD_SIM_NETFN_APP << 8 | 0x3c:	/* Close Session */
+			if (session != NULL)
+				memset(session, 0, sizeof *session);
+			return 0;
+
+		case SMFD_SIM_NETFN_STORAGE << 8 | 0x20:	/* Get SDR Repository Info */
+			/* Constant timestamps, so that SDR caches remain valid across restarts */
+			memcpy(out, "\x51\x00\x00\x00\x00\x00\x00\x00\x60\x00\x00\x00\x60\x02", 14);
+			out[1] = SMFD_SIM_SENSOR_COUNT;
+			return 14;
+
+		case SMFD_SIM_NETFN_STORAGE << 8 | 0x22:	/* Reserve SDR Repository */
+			++smfd_sim_reservation;
+			out[0] = smfd_sim_reservation & 0xff;
+			out[1] = smfd_sim_reservation >> 8;
+			return 2;
+
+		case SMFD_SIM_NETFN_STORAGE << 8 | 0x23:	/* Get SDR */
+			return smfd_sim_get_sdr(data, len, out, cc);
+
+		case SMFD_SIM_NETFN_SENSOR << 8 | 0x2d:	/* Get Sensor Reading */
+			if (len != 1 || (sensor = smfd_sim_sensor(data[0])) == NULL) {
+				*cc = SMFD_SIM_CC_NOT_PRESENT;
+				return 0;
+			}
+			out[0] = (sensor->temp < 0) ? 0 : (sensor->temp > 255) ? 255 : sensor->temp;
+			out[1] = 0x40;		/* scanning enabled */
+			out[2] = 0xc0;
+			return 3;
+
+		case SMFD_SIM_NETFN_OEM << 8 | 0x45:
+		case SMFD_SIM_NETFN_OEM << 8 | 0x70:
+			return smfd_sim_oem(cmd, data, len, out, cc);
+	}
+
+	*cc = SMFD_SIM_CC_INVALID_CMD;
+	return 0;
+}
+
+/* Handle an IPMI request message; returns the response message length (0 to drop the request) */
+static size_t smfd_sim_message(const uint8_t *const rq, const size_t len, uint8_t *const rs,
+			       struct smfd_sim_session *const session)
+{
+	size_t data_len;
+
+	if (len < 7 || smfd_sim_checksum(rq, 2) != rq[2]
+			|| smfd_sim_checksum(rq + 3, len - 4) != rq[len - 1]) {
+		return 0;
+	}
+
+	rs[0] = rq[3];					/* requester address */
+	rs[1] = ((rq[1] >> 2 | 1) << 2) | (rq[4] & 3);	/* response netfn & requester LUN */
+	rs[2] = smfd_sim_checksum(rs, 2);
+	rs[3] = rq[0];					/* responder address */
+	rs[4] = (rq[4] & 0xfc) | (rq[1] & 3);		/* sequence number & responder LUN */
+	rs[5] = rq[5];					/* command */
+
+	data_len = smfd_sim_command(rq[1] >> 2, rq[5], rq + 6, len - 7, rs + 7, rs + 6, session);
+
+	rs[7 + data_len] = smfd_sim_checksum(rs + 3, 4 + data_len);
+
+	return 8 + data_len;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	RMCP & RMCP+ packets
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Store a 32-bit little-endian value */
+static void smfd_sim_put32(uint8_t *const buf, const uint32_t value)
+{
+	buf[0] = value;
+	buf[1] = value >> 8;
+	buf[2] = value >> 16;
+	buf[3] = value >> 24;
+}
+
+/* Load a 32-bit little-endian value */
+static uint32_t smfd_sim_get32(const uint8_t *const buf)
+{
+	return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+/* Find a session by its managed system session ID */
+static struct smfd_sim_session *smfd_sim_session(const uint32_t bmc_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < SMFD_SIM_SESSION_MAX; ++i) {
+		if (bmc_id != 0 && smfd_sim_sessions[i].bmc_id == bmc_id)
+			return &smfd_sim_sessions[i];
+	}
+
+	return NULL;
+}
+
+/* Open Session Request ==> Open Session Response (only cipher suite 0 is supported) */
+static size_t smfd_sim_open(const uint8_t *const rq, const size_t len, uint8_t *const rs)
+{
+	struct smfd_sim_session *session;
+	unsigned int i;
+
+	if (len < 32)
+		return 0;
+
+	memset(rs, 0, 36);
+	rs[0] = rq[0];					/* message tag */
+	memcpy(rs + 4, rq + 4, 4);			/* remote console session ID */
+
+	if (rq[12] != 0 || rq[20] != 0 || rq[28] != 0) {
+		rs[1] = 0x11;		/* no cipher suite match with proposed algorithms */
+		return 8;
+	}
+
+	for (session = NULL, i = 0; i < SMFD_SIM_SESSION_MAX; ++i) {
+		if (smfd_sim_sessions[i].bmc_id == 0) {
+			session = &smfd_sim_sessions[i];
+			break;
+		}
+	}
+
+	if (session == NULL) {
+		rs[1] = 0x01;		/* insufficient resources to create a session */
+		return 8;
+	}
+
+	session->console_id = smfd_sim_get32(rq + 4);
+	session->bmc_id = smfd_sim_next_id++;
+	session->seq = 0;
+	session->privilege = 0x02;	/* user */
+	session->active = 0;
+
+	rs[2] = (rq[1] & 0x0f) ? (rq[1] & 0x0f) : 0x04;	/* maximum privilege level */
+	smfd_sim_put32(rs + 8, session->bmc_id);
+	memcpy(rs + 12, "\x00\x00\x00\x08\x00\x00\x00\x00", 8);
+	memcpy(rs + 20, "\x01\x00\x00\x08\x00\x00\x00\x00", 8);
+	memcpy(rs + 28, "\x02\x00\x00\x08\x00\x00\x00\x00", 8);
+
+	return 36;
+}
+
+/* RAKP Message 1 ==> RAKP Message 2 (RAKP-none, so no key exchange authentication code) */
+static size_t smfd_sim_rakp1(const uint8_t *const rq, const size_t len, uint8_t *const rs)
+{
+	struct smfd_sim_session *session;
+
+	if (len < 28)
+		return 0;
+
+	memset(rs, 0, 40);
+	rs[0] = rq[0];
+
+	if ((session = smfd_sim_session(smfd_sim_get32(rq + 4))) == NULL) {
+		rs[1] = 0x02;		/* invalid session ID */
+		return 8;
+	}
+
+	smfd_sim_put32(rs + 4, session->console_id);
+	memset(rs + 8, 0x5a, 16);			/* managed system random number */
+	memcpy(rs + 24, "smfd-bmcsim-guid", 16);	/* managed system GUID */
+
+	return 40;
+}
+
+/* RAKP Message 3 ==> RAKP Message 4 (no integrity check value); activates the session */
+static size_t smfd_sim_rakp3(const uint8_t *const rq, const size_t len, uint8_t *const rs)
+{
+	struct smfd_sim_session *session;
+
+	if (len < 8)
+		return 0;
+
+	memset(rs, 0, 8);
+	rs[0] = rq[0];
+
+	if ((session = smfd_sim_session(smfd_sim_get32(rq + 4))) == NULL) {
+		rs[1] = 0x02;
+		return 8;
+	}
+
+	if (rq[1] != 0) {
+		memset(session, 0, sizeof *session);
+		return 0;
+	}
+
+	smfd_sim_put32(rs + 4, session->console_id);
+	session->active = 1;
+
+	return 8;
+}
+
+/* Handle an IPMI 1.5 packet -- only sessionless requests (e.g. Get Channel Auth Capabilities) */
+static size_t smfd_sim_lan(const uint8_t *const pkt, const size_t len, uint8_t *const out)
+{
+	size_t msg_len;
+
+	if (len < 14 || pkt[4] != 0x00 || smfd_sim_get32(pkt + 9) != 0 || len < 14U + pkt[13])
+		return 0;
+
+	if ((msg_len = smfd_sim_message(pkt + 14, pkt[13], out + 14, NULL)) == 0)
+		return 0;
+
+	memcpy(out, pkt, 4);				/* RMCP header */
+	memset(out + 4, 0, 9);				/* auth type, sequence & session ID */
+	out[13] = msg_len;
+
+	return 14 + msg_len;
+}
+
+/* Handle an IPMI 2.0 (RMCP+) packet */
+static size_t smfd_sim_lanplus(const uint8_t *const pkt, const size_t len, uint8_t *const out)
+{
+	uint32_t session_id, seq;
+	struct smfd_sim_session *session;
+	size_t payload_len, rs_len;
+
+	if (len < 16)
+		return 0;
+
+	payload_len = pkt[14] | pkt[15] << 8;
+	if (len < 16 + payload_len || (pkt[5] & 0xc0) != 0)
+		return 0;	/* truncated, or encrypted/authenticated */
+
+	session_id = seq = 0;
+
+	switch (pkt[5]) {
+
+		case SMFD_SIM_PAYLOAD_OPEN:
+			rs_len = smfd_sim_open(pkt + 16, payload_len, out + 16);
+			break;
+
+		case SMFD_SIM_PAYLOAD_RAKP1:
+			rs_len = smfd_sim_rakp1(pkt + 16, payload_len, out + 16);
+			break;
+
+		case SMFD_SIM_PAYLOAD_RAKP3:
+			rs_len = smfd_sim_rakp3(pkt + 16, payload_len, out + 16);
+			break;
+
+		case SMFD_SIM_PAYLOAD_IPMI:
+			session = smfd_sim_session(smfd_sim_get32(pkt + 6));
+			if (session == NULL || !session->active)
+				return 0;
+			session_id = session->console_id;	/* Close Session clears it */
+			seq = ++session->seq;
+			rs_len = smfd_sim_message(pkt + 16, payload_len, out + 16, session);
+			break;
+
+		default:
+			return 0;
+	}
+
+	if (rs_len == 0)
+		return 0;
+
+	memcpy(out, pkt, 4);				/* RMCP header */
+	out[4] = 0x06;					/* RMCP+ */
+	out[5] = (pkt[5] == SMFD_SIM_PAYLOAD_IPMI) ? pkt[5] : pkt[5] + 1;	/* response type */
+	smfd_sim_put32(out + 6, session_id);		/* 0 during session setup */
+	smfd_sim_put32(out + 10, seq);
+	out[14] = rs_len & 0xff;
+	out[15] = rs_len >> 8;
+
+	return 16 + rs_len;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Main loop
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Receive & answer 1 packet */
+static void smfd_sim_packet(const int fd)
+{
+	uint8_t pkt[512], out[512];
+	struct sockaddr_in from;
+	socklen_t from_len;
+	ssize_t len;
+	size_t rs_len;
+
+	from_len = sizeof from;
+
+	if ((len = recvfrom(fd, pkt, sizeof pkt, 0, (struct sockaddr *)&from, &from_len)) < 0) {
+		if (errno != EINTR)
+			SMFD_SIM_FATAL("recvfrom: %m\n");
+		return;
+	}
+
+	/* RMCP version 1.0, no ACK, class IPMI */
+	if (smfd_sim_dead || len < 5 || pkt[0] != 0x06 || pkt[2] != 0xff || (pkt[3] & 0x1f) != 0x07)
+		return;
+
+	if (pkt[4] == 0x06)
+		rs_len = smfd_sim_lanplus(pkt, len, out);
+	else
+		rs_len = smfd_sim_lan(pkt, len, out);
+
+	if (rs_len == 0)
+		return;
+
+	if (sendto(fd, out, rs_len, 0, (struct sockaddr *)&from, from_len) < 0)
+		fprintf(stderr, "sendto: %m\n");
+}
+
+/* Read a "SENSOR TEMPERATURE" line from stdin; returns 0 at end of file */
+static int smfd_sim_stdin(void)
+{
+	struct smfd_sim_sensor *sensor;
+	unsigned int number;
+	char line[128];
+	int temp;
+
+	if (fgets(line, sizeof line, stdin) == NULL)
+		return 0;
+
+	if (sscanf(line, "%u %d", &number, &temp) != 2
+			|| (sensor = smfd_sim_sensor(number)) == NULL) {
+		fprintf(stderr, "Expected SENSOR TEMPERATURE (sensors 1-%zu)\n",
+			SMFD_SIM_SENSOR_COUNT);
+		return 1;
+	}
+
+	sensor->temp = temp;
+	printf("%s: %d°C\n", sensor->name, temp);
+
+	return 1;
+}
+
+/* Parse the command line */
+static void smfd_sim_parse_args(const int argc, char **const argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:d")) != -1) {
+
+		switch (opt) {
+
+			case 'p':	smfd_sim_port = atoi(optarg);			break;
+			case 'd':	smfd_sim_dead = 1;				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-p PORT] [-d]\n", argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (smfd_sim_port == 0 || smfd_sim_port > 65535)
+		SMFD_SIM_FATAL("Invalid port\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	struct pollfd fds[2];
+
+	smfd_sim_parse_args(argc, argv);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if ((fds[0].fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+		SMFD_SIM_FATAL("socket: %m\n");
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(smfd_sim_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fds[0].fd, (struct sockaddr *)&addr, sizeof addr) != 0)
+		SMFD_SIM_FATAL("bind: %m\n");
+
+	printf("Simulated BMC listening on 127.0.0.1:%u%s\n",
+	       smfd_sim_port, smfd_sim_dead ? " (not responding)" : "");
+
+	fds[0].events = POLLIN;
+	fds[1].fd = STDIN_FILENO;
+	fds[1].events = POLLIN;
+
+	while (1) {
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			SMFD_SIM_FATAL("poll: %m\n");
+		}
+
+		if (fds[0].revents & POLLIN)
+			smfd_sim_packet(fds[0].fd);
+
+		if ((fds[1].revents & (POLLIN | POLLHUP)) && !smfd_sim_stdin())
+			fds[1].fd = -1;		/* end of file; keep serving */
+	}
+}
@@ -0,0 +1,521 @@
+/*
+ * Copyright 2021 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * The program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal fan control for the initramfs, from the time the IPMI driver loads until smfd starts.
+ * Only the IPMI fan zones are controlled, from the coretemp temperatures & the CPU triggers, and
+ * the configuration is a binary snapshot written by "smfd --boot-config FILE", so FreeIPMI is the
+ * only library needed (no LibYAML, libatasmart or libudev).  When smfd starts, it stops smfd-boot
+ * and continues from the duty cycles & trigger state in SMFD_BOOT_STATE.
+ *
+ *	gcc -Os -Wall -Wextra -static -o smfd-boot smfd-boot.c -lfreeipmi
+ *
+ *	smfd-boot [-d] [-s] [-c SNAPSHOT]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <freeipmi/freeipmi.h>
+
+#include "smfd-boot.h"
+
+#define SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE	0x45
+#define SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT	0x66
+#define SMFD_SUPERMICRO_FAN_MODE_FULL		0x01
+#define SMFD_FAN_ZONE_CPU			0x00
+#define SMFD_FAN_ZONE_SYS			0x01
+#define SMFD_FAN_ZONE_COUNT			2
+
+/* Time (ms) between attempts to find the in-band IPMI device (while its driver loads) */
+#define SMFD_IPMI_RETRY				20
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Global state & logging
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Log to syslog (instead of stderr)? */
+static _Bool smfd_use_syslog = 0;
+
+/* Log debug messages? */
+static _Bool smfd_debug = 0;
+
+/* Configuration snapshot */
+static const char *smfd_config_file = SMFD_BOOT_CONFIG;
+static struct smfd_boot_config smfd_config;
+
+/* State handed to smfd */
+static struct smfd_boot_state smfd_state;
+
+/* Which triggers are active */
+static _Bool smfd_active[SMFD_BOOT_MAX_TRIGGERS];
+
+/* coretemp inputs (none until the coretemp module is loaded) */
+static int *smfd_coretemp_fds = NULL;
+static unsigned int smfd_coretemp_count = 0;
+
+/* FreeIPMI context */
+static ipmi_ctx_t smfd_ipmi = NULL;
+
+/* Set by SIGTERM & SIGINT */
+static volatile sig_atomic_t smfd_quit_signal = 0;
+
+/* Print or log a message */
+static void smfd_log(const int level, const char *const format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+
+	if (smfd_use_syslog)
+		vsyslog(level, format, ap);
+	else
+		vfprintf(stderr, format, ap);
+
+	va_end(ap);
+}
+
+/* Preprocessor dance to "stringify" an expanded macro value (e.g. __LINE__) */
+#define SMFD_STR_RAW(x)		#x
+#define SMFD_STR(x)		SMFD_STR_RAW(x)
+
+/* Expands to a message preamble which specifies file & line */
+#define SMFD_LOCATION		__FILE__ ":" SMFD_STR(__LINE__) ": "
+
+/* Expands to syslog priority & full message preamble */
+#define SMFD_LOG_HDR(l)		LOG_ ## l, #l ": " SMFD_LOCATION
+
+/* Debug messages are logged at INFO priority to avoid syslog filtering */
+#define SMFD_DEBUG(...)										\
+	do {											\
+		if (!smfd_debug)								\
+			break;									\
+		smfd_log(LOG_INFO, "DEBUG: " SMFD_LOCATION __VA_ARGS__);			\
+	}											\
+	while (0)
+
+/* Print/log a message at the given priority */
+#define SMFD_INFO(...)		smfd_log(SMFD_LOG_HDR(INFO) __VA_ARGS__)
+#define SMFD_NOTICE(...)	smfd_log(SMFD_LOG_HDR(NOTICE) __VA_ARGS__)
+#define SMFD_WARNING(...)	smfd_log(SMFD_LOG_HDR(WARNING) __VA_ARGS__)
+#define SMFD_ERR(...)		smfd_log(SMFD_LOG_HDR(ERR) __VA_ARGS__)
+#define SMFD_CRIT(...)		smfd_log(SMFD_LOG_HDR(CRIT) __VA_ARGS__)
+
+/* Print/log an unexpected internal error and abort */
+#define SMFD_ABORT(...)		do { SMFD_CRIT(__VA_ARGS__); abort(); } while (0)
+
+/* Print a fatal error and exit immediately */
+#define SMFD_FATAL(...)		do { SMFD_ERR(__VA_ARGS__); exit(EXIT_FAILURE); } while (0)
+
+/* Parse the command line */
+static void smfd_parse_args(const int argc, char **const argv)
+{
+	static const char help_msg[] =
+			"Usage: %s [-h|--help]\n"
+			"       %s [-d] [-s] [-c SNAPSHOT]\n"
+			"\n"
+			"  -h, --help        show this message and exit\n"
+			"  -d                print/log debugging messages\n"
+			"  -s                log to syslog (when running in a terminal)\n"
+			"  -c SNAPSHOT       configuration snapshot [" SMFD_BOOT_CONFIG "]\n";
+
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			printf(help_msg, argv[0], argv[0]);
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	smfd_use_syslog = !isatty(STDERR_FILENO);
+
+	for (i = 1; i < argc; ++i) {
+
+		if (strcmp(argv[i], "-d") == 0) {
+			smfd_debug = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "-s") == 0) {
+			smfd_use_syslog = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "-c") == 0) {
+			if ((smfd_config_file = argv[++i]) == NULL)
+				SMFD_FATAL("-c option requires configuration snapshot\n");
+			continue;
+		}
+
+		SMFD_FATAL("Unknown option: %s\n", argv[i]);
+	}
+}
+
+/* Read & check the configuration snapshot */
+static void smfd_config_load(void)
+{
+	unsigned int i;
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(smfd_config_file, O_RDONLY | O_CLOEXEC)) < 0)
+		SMFD_FATAL("%s: %m\n", smfd_config_file);
+
+	if ((len = read(fd, &smfd_config, sizeof smfd_config)) < 0)
+		SMFD_FATAL("%s: %m\n", smfd_config_file);
+
+	if (close(fd) != 0)
+		SMFD_FATAL("close: %m\n");
+
+	if ((size_t)len != sizeof smfd_config
+			|| memcmp(smfd_config.magic, SMFD_BOOT_MAGIC, sizeof smfd_config.magic) != 0
+			|| smfd_config.version != SMFD_BOOT_VERSION) {
+		SMFD_FATAL("%s: not a configuration snapshot from this version of smfd\n",
+			   smfd_config_file);
+	}
+
+	if (smfd_config.trigger_count > SMFD_BOOT_MAX_TRIGGERS || smfd_config.sample_interval == 0
+			|| smfd_config.fan_base[SMFD_FAN_ZONE_CPU] > 100
+			|| smfd_config.fan_base[SMFD_FAN_ZONE_SYS] > 100) {
+		SMFD_FATAL("%s: invalid configuration snapshot\n", smfd_config_file);
+	}
+
+	for (i = 0; i < smfd_config.trigger_count; ++i) {
+		if (smfd_config.triggers[i].cpu_fan_percent > 100
+				|| smfd_config.triggers[i].sys_fan_percent > 100
+				|| smfd_config.triggers[i].hysteresis
+					> smfd_config.triggers[i].threshold) {
+			SMFD_FATAL("%s: invalid configuration snapshot\n", smfd_config_file);
+		}
+	}
+
+	SMFD_DEBUG("Loaded %s: %" PRIu32 " ms sample interval, %u CPU triggers\n",
+		   smfd_config_file, smfd_config.sample_interval, smfd_config.trigger_count);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	coretemp temperatures & IPMI fan control
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Open every coretemp input; returns 0 if the coretemp module hasn't been loaded yet */
+static _Bool smfd_coretemp_init(void)
+{
+	glob_t g;
+	size_t i;
+	int fd;
+
+	if (glob("/sys/devices/platform/coretemp.*/hwmon/hwmon*/temp*_input", 0, NULL, &g) != 0)
+		return 0;
+
+	if ((smfd_coretemp_fds = malloc(g.gl_pathc * sizeof *smfd_coretemp_fds)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	for (i = 0; i < g.gl_pathc; ++i) {
+		if ((fd = open(g.gl_pathv[i], O_RDONLY | O_CLOEXEC)) < 0)
+			SMFD_WARNING("%s: %m\n", g.gl_pathv[i]);
+		else
+			smfd_coretemp_fds[smfd_coretemp_count++] = fd;
+	}
+
+	globfree(&g);
+
+	SMFD_DEBUG("Found %u coretemp inputs\n", smfd_coretemp_count);
+
+	return smfd_coretemp_count > 0;
+}
+
+/* Highest coretemp temperature (°C); INT_MIN if none can be read */
+static int smfd_coretemp_read(void)
+{
+	int max, reading;
+	unsigned int i;
+	char buf[32];
+	ssize_t len;
+
+	if (smfd_coretemp_count == 0 && !smfd_coretemp_init())
+		return INT_MIN;
+
+	for (max = INT_MIN, i = 0; i < smfd_coretemp_count; ++i) {
+
+		if ((len = pread(smfd_coretemp_fds[i], buf, sizeof buf - 1, 0)) <= 0)
+			continue;
+
+		buf[len] = 0;
+
+		if (sscanf(buf, "%d", &reading) == 1 && (reading + 500) / 1000 > max)
+			max = (reading + 500) / 1000;
+	}
+
+	return max;
+}
+
+/* Send a raw Supermicro OEM command to the BMC; returns 0 on failure */
+static _Bool smfd_ipmi_cmd(const uint8_t *const cmd, const unsigned int cmd_len)
+{
+	uint8_t resp[256];
+	int rc;
+
+	rc = ipmi_cmd_raw(smfd_ipmi, 0, IPMI_NET_FN_OEM_SUPERMICRO_GENERIC_RQ, cmd, cmd_len,
+			  resp, sizeof resp);
+	if (rc < 0) {
+		SMFD_WARNING("ipmi_cmd_raw: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+		return 0;
+	}
+
+	if (rc < 2 || resp[1] != IPMI_COMP_CODE_COMMAND_SUCCESS) {
+		SMFD_WARNING("IPMI command 0x%" PRIx8 " failed (completion code 0x%" PRIx8 ")\n",
+			     cmd[0], (rc < 2) ? 0xff : resp[1]);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Wait for the in-band IPMI device & set the BMC fan management mode to full (manual) */
+static void smfd_ipmi_init(void)
+{
+	static const uint8_t cmd[] = {
+		SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE,
+		0x01,
+		SMFD_SUPERMICRO_FAN_MODE_FULL
+	};
+
+	static const struct timespec retry = {
+		.tv_sec		= 0,
+		.tv_nsec	= SMFD_IPMI_RETRY * 1000000L
+	};
+
+	_Bool waiting;
+	int rc;
+
+	if ((smfd_ipmi = ipmi_ctx_create()) == NULL)
+		SMFD_ABORT("ipmi_ctx_create: %m\n");
+
+	for (waiting = 0; !smfd_quit_signal; waiting = 1) {
+
+		if ((rc = ipmi_ctx_find_inband(smfd_ipmi, NULL, 0, 0, 0, NULL, 0, 0)) > 0)
+			break;
+
+		if (!waiting)
+			SMFD_NOTICE("Waiting for in-band IPMI device\n");
+
+		nanosleep(&retry, NULL);
+	}
+
+	if (smfd_quit_signal)
+		return;
+
+	SMFD_NOTICE("Setting BMC fan management mode to full (manual)\n");
+
+	while (!smfd_ipmi_cmd(cmd, sizeof cmd) && !smfd_quit_signal)
+		nanosleep(&retry, NULL);
+}
+
+/* Set the duty cycle of a zone (if it changed); failures are retried in the next cycle */
+static void smfd_set_fan_percent(const unsigned int zone, const uint8_t percent)
+{
+	uint8_t cmd[] = {
+		IPMI_CMD_OEM_SUPERMICRO_GENERIC_EXTENSION,
+		SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT,
+		0x01,
+		0x00,	/* zone goes here */
+		percent
+	};
+
+	if (smfd_config.ipmi_zone[zone] == SMFD_BOOT_NO_ZONE
+			|| smfd_state.fan_percent[zone] == percent) {
+		return;
+	}
+
+	cmd[3] = smfd_config.ipmi_zone[zone];
+
+	if (smfd_ipmi_cmd(cmd, sizeof cmd)) {
+		SMFD_INFO("%s fan zone set to %" PRIu8 "%%\n",
+			  (zone == SMFD_FAN_ZONE_CPU) ? "CPU" : "System", percent);
+		smfd_state.fan_percent[zone] = percent;
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Control loop & handoff to smfd
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Write the state file that smfd reads when it takes over */
+static void smfd_state_write(void)
+{
+	static const char tmp[] = SMFD_BOOT_STATE ".tmp";
+
+	int fd;
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+		SMFD_ERR("%s: %m\n", tmp);
+		return;
+	}
+
+	if (write(fd, &smfd_state, sizeof smfd_state) != (ssize_t)sizeof smfd_state)
+		SMFD_ERR("%s: %m\n", tmp);
+
+	if (close(fd) != 0)
+		SMFD_ERR("close: %m\n");
+
+	if (rename(tmp, SMFD_BOOT_STATE) != 0)
+		SMFD_ERR("%s: %m\n", SMFD_BOOT_STATE);
+}
+
+/* Apply the CPU triggers to the current temperature & set the fans */
+static void smfd_cycle(void)
+{
+	const struct smfd_boot_trigger *t, *max;
+	struct smfd_boot_state old;
+	unsigned int i;
+	int temp;
+
+	old = smfd_state;
+	temp = smfd_coretemp_read();
+
+	for (max = NULL, i = 0; i < smfd_config.trigger_count; ++i) {
+
+		t = &smfd_config.triggers[i];
+
+		if (temp == INT_MIN)
+			smfd_active[i] = 1;	/* no readable sensor -- maximum cooling */
+		else if (smfd_active[i])
+			smfd_active[i] = temp >= t->hysteresis;
+		else
+			smfd_active[i] = temp >= t->threshold;
+
+		if (smfd_active[i] && (max == NULL || t->threshold > max->threshold))
+			max = t;
+	}
+
+	SMFD_DEBUG("CPU temperature: %d°C\n", temp);
+
+	smfd_state.cpu_temp = (temp == INT_MIN) ? INT32_MIN : temp;
+	smfd_state.active_threshold = (max == NULL) ? INT32_MIN : max->threshold;
+
+	if (temp == INT_MIN && max == NULL) {
+		smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, 100);
+		smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, 100);
+	}
+	else if (max == NULL) {
+		smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, smfd_config.fan_base[SMFD_FAN_ZONE_CPU]);
+		smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, smfd_config.fan_base[SMFD_FAN_ZONE_SYS]);
+	}
+	else {
+		smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, max->cpu_fan_percent);
+		smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, max->sys_fan_percent);
+	}
+
+	if (memcmp(&old, &smfd_state, sizeof old) != 0)
+		smfd_state_write();
+}
+
+/* Handle SIGTERM & SIGINT */
+static void smfd_signal_handler(const int signum __attribute__((unused)))
+{
+	smfd_quit_signal = 1;
+}
+
+int main(const int argc, char **const argv)
+{
+	struct sigaction sa;
+	struct timespec ts;
+
+	smfd_parse_args(argc, argv);
+
+	/* Don't be killed when systemd switches to the real root file system */
+	argv[0][0] = '@';
+
+	smfd_config_load();
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = smfd_signal_handler;
+
+	if (sigaction(SIGTERM, &sa, NULL) != 0 || sigaction(SIGINT, &sa, NULL) != 0)
+		SMFD_FATAL("sigaction: %m\n");
+
+	memcpy(smfd_state.magic, SMFD_BOOT_MAGIC, sizeof smfd_state.magic);
+	smfd_state.version = SMFD_BOOT_VERSION;
+	smfd_state.pid = getpid();
+	smfd_state.cpu_temp = INT32_MIN;
+	smfd_state.active_threshold = INT32_MIN;
+	smfd_state.fan_percent[SMFD_FAN_ZONE_CPU] = SMFD_BOOT_NO_ZONE;
+	smfd_state.fan_percent[SMFD_FAN_ZONE_SYS] = SMFD_BOOT_NO_ZONE;
+
+	smfd_ipmi_init();
+
+	ts.tv_sec = smfd_config.sample_interval / 1000;
+	ts.tv_nsec = (smfd_config.sample_interval % 1000) * 1000000L;
+
+	while (!smfd_quit_signal) {
+		smfd_cycle();
+		nanosleep(&ts, NULL);
+	}
+
+	/* Leave the fans as they are; smfd continues from here */
+	SMFD_NOTICE("Got shutdown signal; leaving fans to smfd\n");
+	smfd_state_write();
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2021 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * The program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Definitions shared by smfd and smfd-boot (the minimal early boot daemon).  Both files are
+ * written & read on the same system, so they use the native byte order.
+ */
+
+#ifndef SMFD_BOOT_H
+#define SMFD_BOOT_H
+
+#include <stdint.h>
+
+#define SMFD_BOOT_MAGIC		"SMFDBOOT"
+#define SMFD_BOOT_VERSION	1
+
+/* Most CPU triggers in a configuration snapshot */
+#define SMFD_BOOT_MAX_TRIGGERS	16
+
+/* Zone not controlled by smfd-boot (not an IPMI zone) */
+#define SMFD_BOOT_NO_ZONE	0xff
+
+/* smfd-boot's configuration snapshot & state file */
+#define SMFD_BOOT_CONFIG	"/etc/smfd/boot.conf"
+#define SMFD_BOOT_STATE		"/run/smfd-boot.state"
+
+/* A CPU temperature trigger */
+struct smfd_boot_trigger {
+	int16_t threshold;
+	int16_t hysteresis;
+	uint8_t cpu_fan_percent;
+	uint8_t sys_fan_percent;
+};
+
+/* Configuration snapshot, written by "smfd --boot-config FILE" */
+struct smfd_boot_config {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_interval;		/* ms */
+	uint8_t fan_base[2];			/* CPU & system zones */
+	uint8_t ipmi_zone[2];			/* BMC zones (or SMFD_BOOT_NO_ZONE) */
+	uint8_t trigger_count;
+	struct smfd_boot_trigger triggers[SMFD_BOOT_MAX_TRIGGERS];
+};
+
+/* State handed to smfd, which takes over from smfd-boot */
+struct smfd_boot_state {
+	char magic[8];
+	uint32_t version;
+	int32_t pid;				/* smfd-boot process */
+	int32_t cpu_temp;			/* INT32_MIN if never read */
+	int32_t active_threshold;		/* highest active trigger (INT32_MIN if none) */
+	uint8_t fan_percent[2];			/* SMFD_BOOT_NO_ZONE if never set */
+};
+
+#endif	/* SMFD_BOOT_H */
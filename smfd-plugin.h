@@ -0,0 +1,93 @@
+/*
+ * Copyright 2021 Ian Pilcher <arequipeno@gmail.com>
+ *
+ * The program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * smfd sensor & actuator plugin ABI.  A plugin is a shared object that exports a struct
+ * smfd_plugin named smfd_plugin (SMFD_PLUGIN_SYMBOL).  smfd loads it with dlopen, checks its ABI
+ * version, and calls its functions from the control loop (a single thread), so they must not
+ * block for long.  Any function may be NULL if the plugin doesn't need it.
+ *
+ *	init		Called once, before the fan zones are taken over.  Sets sensor_names,
+ *			sensor_count & zone_count (and data, if the plugin wants it).  Returns 0 on
+ *			success; smfd won't start if it fails.
+ *
+ *	schedule	Called after each successful read of a sensor.  Returns the number of
+ *			milliseconds until the sensor should next be read (0 == next sample).  A
+ *			sensor whose values change slowly, or that is expensive to read, can be read
+ *			less often than smfd samples its other sensors.
+ *
+ *	read		Reads 1 sensor.  On success, stores the temperature (°C) in *temp and
+ *			returns 0.  temp points at the sensor's slot in smfd's sensor table, so it
+ *			must not be written if the read fails (the slot holds the last good reading,
+ *			which smfd may continue to use).  On failure, returns -1; smfd applies the
+ *			sensor group's failure policy.
+ *
+ *	close		Called once at exit, after smfd has released the fan zones.
+ *
+ *	set		Sets the duty cycle (percent) of 1 fan zone.  Returns 0 on success.
+ *
+ *	get		Queries the duty cycle (percent) of 1 fan zone.  Returns the duty cycle, or
+ *			-1 on failure.
+ *
+ * smfd treats a failure to set or query a fan zone as fatal.  Messages should be logged with the
+ * host's log function (syslog priorities; each message ends with a newline), so that they go
+ * wherever smfd's own messages go.
+ */
+
+#ifndef SMFD_PLUGIN_H
+#define SMFD_PLUGIN_H
+
+#include <stdint.h>
+
+/* Incremented when a change breaks existing plugins */
+#define SMFD_PLUGIN_ABI		1
+
+/* Name of the struct smfd_plugin that a plugin exports */
+#define SMFD_PLUGIN_SYMBOL	"smfd_plugin"
+
+struct smfd_plugin_instance;
+
+/* Services provided to plugins by smfd */
+struct smfd_plugin_host {
+	uint32_t abi;				/* SMFD_PLUGIN_ABI */
+	void (*log)(const struct smfd_plugin_instance *inst, int priority, const char *format, ...)
+		__attribute__((format(printf, 3, 4)));
+};
+
+/* An instance of a plugin (1 per plugin in the configuration file) */
+struct smfd_plugin_instance {
+	const struct smfd_plugin_host *host;	/* set by smfd */
+	const char *name;			/* set by smfd -- name in the configuration file */
+	const char *argument;			/* set by smfd (NULL if none) */
+	void *data;				/* plugin's private state */
+	const char *const *sensor_names;	/* set by init; must remain valid until close */
+	unsigned int sensor_count;		/* set by init */
+	unsigned int zone_count;		/* set by init -- fan zones it can control */
+};
+
+/* Plugin entry points, exported as SMFD_PLUGIN_SYMBOL */
+struct smfd_plugin {
+	uint32_t abi;				/* SMFD_PLUGIN_ABI */
+	int (*init)(struct smfd_plugin_instance *inst);
+	unsigned int (*schedule)(struct smfd_plugin_instance *inst, unsigned int sensor);
+	int (*read)(struct smfd_plugin_instance *inst, unsigned int sensor, int *temp);
+	void (*close)(struct smfd_plugin_instance *inst);
+	int (*set)(struct smfd_plugin_instance *inst, unsigned int zone, uint8_t percent);
+	int (*get)(struct smfd_plugin_instance *inst, unsigned int zone);
+};
+
+#endif	/* SMFD_PLUGIN_H */
@@ -19,24 +19,47 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+
 #include <atasmart.h>
 #include <freeipmi/freeipmi.h>
+#include <libudev.h>
 #include <yaml.h>
 
+#include "smfd-boot.h"
+#include "smfd-plugin.h"
+
 /*
  * https://forums.servethehome.com/index.php?resources/supermicro-x9-x10-x11-fan-speed-control.20/
  * https://www.supermicro.com/support/faqs/faq.cfm?faq=31537
@@ -46,6 +69,7 @@
 #define SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT	0x66
 #define SMFD_FAN_ZONE_CPU			0x00
 #define SMFD_FAN_ZONE_SYS			0x01
+#define SMFD_FAN_ZONE_COUNT			2
 #define SMFD_SUPERMICRO_FAN_MODE_STD		0x00
 #define SMFD_SUPERMICRO_FAN_MODE_FULL		0x01
 #define SMFD_SUPERMICRO_FAN_MODE_OPT		0x02
@@ -76,22 +100,195 @@ struct smfd_temp_threshold {
 	_Bool active;
 };
 
+/* Sensor groups; each has its own set of thresholds */
+enum smfd_group {
+	SMFD_GROUP_PCH = 0,
+	SMFD_GROUP_CPU,
+	SMFD_GROUP_DISK,
+	SMFD_GROUP_COUNT
+};
+
 /* Minimum fan percentages after processing all thresholds for a temperature */
 struct smfd_process_temp_result {
 	struct smfd_temp_threshold *cpu_threshold;
 	struct smfd_temp_threshold *sys_threshold;
+	enum smfd_group group;
+	int temp;		/* temperature that was processed (INT_MIN if none readable) */
+	_Bool failed;		/* failed sensor demands maximum cooling */
 	uint8_t	cpu_fan_percent;
 	uint8_t sys_fan_percent;
 	char name[sizeof "system"];
 };
 
+/* Log2 histogram of latencies (milliseconds) */
+struct smfd_histogram {
+	unsigned int buckets[24];	/* bucket n counts latencies < 2^n ms */
+	unsigned int count;
+	int64_t total;
+	int64_t max;
+};
+
+/* A fan zone's slot in the IPMI write queue -- at most 1 pending write (the newest) */
+struct smfd_ipmiq_slot {
+	int64_t queued;		/* when the oldest unsent write was queued (monotonic ms) */
+	int64_t sample;		/* sample time of the cycle that queued the pending write */
+	int64_t done_ms;	/* sample ==> written latency of the last write (-1 if taken) */
+	uint8_t ipmi_zone;	/* BMC zone number */
+	uint8_t percent;	/* pending duty cycle */
+	uint8_t written;	/* duty cycle last written to the BMC (255 == none) */
+	_Bool pending;
+	_Bool urgent;		/* safety write -- sent before any other zone's write */
+};
+
+/* IPMI write queue statistics */
+struct smfd_ipmiq_stats {
+	struct smfd_histogram wait;	/* queued ==> written */
+	unsigned int written;
+	unsigned int coalesced;		/* replaced by a newer write before they were sent */
+	unsigned int unchanged;		/* not sent; the BMC already had that duty cycle */
+	unsigned int urgent;		/* safety writes sent */
+	unsigned int mode_checks;	/* BMC fan mode verifications */
+	unsigned int mode_restores;	/* ... that found the BMC out of full (manual) mode */
+};
+
+/* Number of RPM samples kept while waiting for a zone's fans to settle */
+#define SMFD_RPM_SAMPLES	60
+
+/* Response of 1 fan zone to a duty cycle change */
+struct smfd_zone_response {
+	int64_t sample;				/* time of the triggering temperature sample */
+	int64_t rpm_time[SMFD_RPM_SAMPLES];
+	unsigned int rpm[SMFD_RPM_SAMPLES];
+	unsigned int rpm_count;
+	int group;				/* group that caused an increase (or -1) */
+	int last_temp;
+	_Bool rpm_pending;
+	_Bool temp_pending;
+};
+
+struct smfd_zone;
+
+/* Fan zone actuator backend */
+struct smfd_actuator_ops {
+	const char *name;
+	void (*init)(struct smfd_zone *zone);			/* take manual control */
+	void (*set)(struct smfd_zone *zone, uint8_t percent);
+	uint8_t (*get)(struct smfd_zone *zone);
+	void (*fini)(struct smfd_zone *zone);			/* release control */
+};
+
+/* A fan zone and the actuator that controls it */
+struct smfd_zone {
+	const struct smfd_actuator_ops *ops;
+	char *pwm;			/* hwmon: path of pwmN attribute */
+	int pwm_fd;			/* hwmon: pwmN */
+	int enable_fd;			/* hwmon: pwmN_enable */
+	int saved_enable;		/* hwmon: pwmN_enable value to restore */
+	char *plugin_name;		/* plugin: name in the configuration file */
+	struct smfd_plugin_lib *plugin;	/* plugin: set by smfd_plugin_zone_init */
+	unsigned int plugin_zone;	/* plugin: zone number within the plugin */
+	uint8_t ipmi_zone;		/* IPMI: Supermicro zone number */
+};
+
+/* A duty cycle override for 1 zone, set through the control socket */
+struct smfd_override {
+	int64_t expires;		/* monotonic ms */
+	uint8_t percent;
+	_Bool active;
+};
+
+/* A control socket client connection */
+struct smfd_ctl_client {
+	char buf[512];			/* partial request line */
+	size_t len;
+	uid_t uid;			/* from SO_PEERCRED */
+	int fd;				/* -1 if unused */
+};
+
+/* A temperature sensor on a remote (fleet mode) host -- BMC sensor or pushed external reading */
+struct smfd_fleet_sensor {
+	char *name;
+	int64_t updated;			/* time of last reading (monotonic ms) */
+	int value;
+	enum smfd_group group;
+	unsigned int record_len;		/* 0 for external sensors */
+	uint16_t record_id;
+	uint8_t record[IPMI_SDR_MAX_RECORD_LENGTH];
+};
+
+/* A remote host managed over IPMI LAN (fleet mode), with its own sensors & control state */
+struct smfd_fleet_host {
+	char *name;
+	char *address;
+	char *username;
+	char *password;
+	char *sdr_cache;
+	struct smfd_fleet_sensor *sensors;
+	struct smfd_temp_threshold *triggers[SMFD_GROUP_COUNT];
+	ipmi_ctx_t ipmi;			/* NULL when no session is open */
+	ipmi_sensor_read_ctx_t read;
+	int64_t retry;				/* earliest reconnect attempt (monotonic ms) */
+	pthread_t thread;			/* worker that owns the IPMI session */
+	pthread_mutex_t mutex;			/* protects sensor readings & the fields below */
+	pthread_cond_t cond;
+	unsigned int sensor_count;
+	unsigned int interval;			/* seconds */
+	unsigned int timeout;			/* seconds */
+	unsigned int cipher_suite;
+	unsigned int failures;			/* consecutive session failures */
+	int timer_fd;
+	uint8_t fan_percent[SMFD_FAN_ZONE_COUNT];
+	_Bool connected;
+	_Bool tick;				/* sampling timer has fired */
+	_Bool busy;				/* worker is sampling */
+	_Bool quit;
+};
+
+/* Linear thermal model of 1 sensor group, used by the optimizer */
+struct smfd_opt_group {
+	double gain[SMFD_FAN_ZONE_COUNT];	/* °C per duty cycle percent in each zone */
+	double slope;				/* smoothed temperature trend (°C/s) */
+	int limit;				/* highest allowed predicted temperature */
+	int last_temp;
+	_Bool configured;
+	_Bool have_gain;			/* gains set in config (not coupling file) */
+};
+
 /* Used to read & store 1 fan RPM via IPMI */
 struct smfd_ipmi_fan {
 	char *name;
 	unsigned int rpm;
 	unsigned int record_len;
 	uint16_t record_id;
+	uint8_t zone;		/* fan zone (SMFD_FAN_ZONE_COUNT if unknown) */
 	uint8_t record[IPMI_SDR_MAX_RECORD_LENGTH];
+	int64_t rpm_time;	/* monotonic time (ms) of last RPM reading (0 if never read) */
+};
+
+/* Sensor health -- a sensor that can't be read becomes stale, then failed */
+enum smfd_sensor_state {
+	SMFD_SENSOR_OK = 0,
+	SMFD_SENSOR_STALE,	/* last reading still used (hold policy) */
+	SMFD_SENSOR_FAILED	/* retried with backoff; handled according to policy */
+};
+
+/* What to do when a sensor can't be read */
+enum smfd_fail_policy {
+	SMFD_FAIL_HOLD = 0,	/* use last reading for up to hold_time, then as max */
+	SMFD_FAIL_IGNORE,	/* exclude the sensor from its group */
+	SMFD_FAIL_MAX		/* run both fan zones at 100% */
+};
+
+/* Failure policy for a sensor group */
+struct smfd_sensor_policy {
+	enum smfd_fail_policy policy;
+	unsigned int hold_time;		/* seconds */
+};
+
+/* Hard temperature limit of a sensor group, checked as soon as each of its sensors is read */
+struct smfd_safety_limit {
+	int limit;		/* °C (INT_MAX == none) */
+	uint8_t zones;		/* zones (bit mask) forced to 100% while the limit is exceeded */
 };
 
 /* A single temperature reading and associated periodic info */
@@ -101,6 +298,99 @@ struct smfd_temperature {
 	int low;		/* lowest reading in sample period */
 	int accumulator;	/* total of all readings in sample period */
 	int samples;		/* number of readings in sample period */
+	enum smfd_sensor_state state;
+	int64_t last_ok;	/* monotonic time (ms) of last good reading (0 if none) */
+	int64_t retry_at;	/* monotonic time (ms) at which to retry a failed sensor */
+	unsigned int retry_delay;	/* current retry backoff (ms) */
+};
+
+/* A temperature in a periodic report */
+struct smfd_report_temp {
+	char *name;		/* copy -- a disk can be detached before the report is logged */
+	struct smfd_temperature temp;
+};
+
+/* A fan speed in a periodic report */
+struct smfd_report_fan {
+	const char *name;
+	unsigned int rpm;
+	int64_t rpm_time;
+};
+
+/* Shadow mode comparison of smfd's decisions with the BMC's actual duty cycles */
+struct smfd_shadow_stats {
+	unsigned int samples;
+	double shadow_power[SMFD_FAN_ZONE_COUNT];	/* sum of (duty / 100)^3 */
+	double actual_power[SMFD_FAN_ZONE_COUNT];
+	double duty_diff[SMFD_FAN_ZONE_COUNT];		/* sum of (shadow - actual) */
+	double rpm[SMFD_FAN_ZONE_COUNT];		/* sum of measured zone RPMs */
+	unsigned int rpm_samples[SMFD_FAN_ZONE_COUNT];
+	double temp_delta[SMFD_GROUP_COUNT];		/* sum of projected °C changes */
+	double temp_delta_max[SMFD_GROUP_COUNT];
+	_Bool have_model[SMFD_GROUP_COUNT];
+};
+
+/* Control policy of an experiment arm */
+enum smfd_exp_policy {
+	SMFD_EXP_TRIGGERS = 0,	/* smfd, trigger tables only */
+	SMFD_EXP_OPTIMIZER,	/* smfd, with the optimizer */
+	SMFD_EXP_BMC		/* BMC "Optimal" fan mode */
+};
+
+/* Outcome of an experiment arm (cumulative, excluding each block's settling period) */
+struct smfd_exp_stats {
+	unsigned int samples;
+	unsigned int blocks;
+	unsigned int safety_ends;			/* blocks ended early by a safety limit */
+	double fan_power[SMFD_FAN_ZONE_COUNT];		/* sum of (duty / 100)^3 */
+	double cpu_energy;				/* RAPL package energy (J) */
+	double cpu_seconds;				/* time covered by cpu_energy */
+	unsigned long throttles;			/* CPU thermal throttling events */
+	double disk_aging;				/* sum of mean disk aging factors */
+	unsigned int aging_samples;			/* samples in disk_aging */
+	unsigned int temps[SMFD_GROUP_COUNT][128];	/* temperature histograms (°C) */
+};
+
+/* An experiment arm */
+struct smfd_exp_arm {
+	char *name;
+	enum smfd_exp_policy policy;
+	uint8_t cpu_fan_base;		/* 255 == use configured value */
+	uint8_t sys_fan_base;
+	struct smfd_exp_stats stats;
+};
+
+/* Snapshot of cached state & periodic statistics, logged by the reporting thread */
+struct smfd_report {
+	time_t start;				/* start of data collection */
+	int64_t taken;				/* monotonic time (ms) of snapshot */
+	struct smfd_report_temp *temps;
+	struct smfd_report_fan *fans;
+	unsigned int temp_count;
+	unsigned int fan_count;
+	struct smfd_histogram set_latency;
+	struct smfd_histogram rpm_latency;
+	struct smfd_histogram turn_latency;
+	struct smfd_ipmiq_stats ipmiq_stats;
+	struct smfd_shadow_stats shadow_stats;
+	struct smfd_exp_stats exp_stats[2];
+	const char *exp_names[2];		/* NULL if no experiment */
+	const char *exp_arm;			/* active arm */
+	unsigned int peer_events;		/* disk peer anomalies raised in period */
+	unsigned int peer_active;		/* disks currently reported as anomalies */
+	uint8_t fan_mode;			/* 0xff if no zone uses IPMI */
+	uint8_t fan_percent[SMFD_FAN_ZONE_COUNT];
+	_Bool shadow;
+	_Bool peers;				/* disk peer comparison enabled */
+	_Bool ipmiq;				/* IPMI writer thread running */
+};
+
+/* A fan control profile -- base duty cycles, trigger tables & ramp limit */
+struct smfd_profile {
+	char *name;
+	struct smfd_temp_threshold *triggers[SMFD_GROUP_COUNT];
+	uint8_t fan_base[SMFD_FAN_ZONE_COUNT];	/* 255 == not set (named profiles inherit it) */
+	uint8_t ramp_down;			/* max duty cycle decrease per sample (0 == none) */
 };
 
 /* Used to read & store 1 temperature from the coretemp module */
@@ -110,11 +400,89 @@ struct smfd_coretemp {
 	struct smfd_temperature temp;
 };
 
+/* A controller temperature source -- sysfs inputs matched by a glob or by their hwmon driver */
+struct smfd_ctrl_source {
+	char *name;
+	char *path;		/* glob of inputs (millidegrees; under smfd_sysfs_root) */
+	char *driver;		/* driver (mpt3sas, megaraid_sas, etc.) of hwmon devices */
+	enum smfd_group group;
+	_Bool have_group;
+};
+
+/* Used to read & store 1 RAID/HBA controller temperature */
+struct smfd_ctrl_temp {
+	char *name;
+	FILE *fp;
+	enum smfd_group group;
+	struct smfd_temperature temp;
+};
+
+/* A sensor/actuator plugin listed in the configuration file */
+struct smfd_plugin_lib {
+	char *name;			/* file name (without .so) in the plugin directory */
+	char *argument;			/* passed to the plugin (NULL if none) */
+	void *handle;			/* from dlopen (NULL if not loaded) */
+	const struct smfd_plugin *ops;
+	struct smfd_plugin_instance inst;
+	enum smfd_group group;		/* group of the plugin's sensors */
+	_Bool have_group;
+	_Bool initialized;		/* init succeeded (close must be called) */
+};
+
+/* 1 temperature provided by a plugin -- the plugin reads directly into temp.current */
+struct smfd_plugin_temp {
+	const char *name;		/* owned by the plugin */
+	struct smfd_plugin_lib *lib;
+	unsigned int sensor;		/* index within the plugin */
+	int64_t next_read;		/* monotonic time (ms) of next read (plugin's schedule) */
+	struct smfd_temperature temp;
+};
+
 /* Used to read & store 1 disk temperature via S.M.A.R.T. */
 struct smfd_disk {
-	char *name;
+	char *name;		/* device node or /dev/disk symlink that matched smart_disks */
+	char *devnode;		/* /dev/sdX */
 	SkDisk *disk;
+	int64_t last_read;	/* monotonic time (ms) of last read attempt (0 if never) */
+	int64_t deadline;	/* poll by this time (ms); set by smfd_disk_schedule */
 	struct smfd_temperature temp;
+	int stat_fd;		/* /sys/block/sdX/stat (-1 if unavailable) */
+	uint64_t io_ticks;	/* milliseconds spent doing I/O, at io_time */
+	int64_t io_time;	/* monotonic time (ms) of io_ticks (0 if never read) */
+	int util;		/* I/O utilization (percent) in the last cycle (-1 if unknown) */
+	unsigned int cage;	/* peer group (smfd_disk_cage_count == disks in no cage) */
+	double score;		/* smoothed deviation from peer median (°C, adjusted for load) */
+	int64_t outlier_since;	/* monotonic time (ms) score reached threshold (0 if it hasn't) */
+	_Bool anomaly;		/* persistent outlier (event raised) */
+	unsigned int aging;	/* index in smfd_agings (if smfd_aging_enabled) */
+	int64_t aging_time;	/* monotonic time (ms) of last aging sample (0 if none) */
+	int aging_temp;		/* temperature at aging_time */
+};
+
+/* Accumulated thermal stress of 1 disk (kept after the disk is removed) */
+struct smfd_aging {
+	char *id;		/* udev ID_SERIAL (device node if none) */
+	double hours;		/* time monitored */
+	double degree_hours;	/* hours x °C above the reference temperature */
+	double aged_hours;	/* hours at the reference temperature that would age it as much */
+};
+
+/* A background I/O rate limit (md resync speed or cgroup io.max), lowered when disks are hot */
+struct smfd_throttle_target {
+	char *name;		/* md array (mdX) or cgroup (relative to /sys/fs/cgroup) */
+	char *path;		/* sync_speed_max or io.max */
+	char *saved;		/* original contents (NULL if not throttled) */
+	dev_t *devs;		/* cgroup: devices whose limits smfd has set */
+	unsigned int dev_count;
+	unsigned long base;	/* md: original sync_speed_max (KiB/s) */
+	_Bool cgroup;
+};
+
+/* A disk cage -- disks that should run at similar temperatures (same airflow path) */
+struct smfd_disk_cage {
+	char *name;
+	char **patterns;	/* globs matched against device nodes & /dev/disk symlinks */
+	unsigned int pattern_count;
 };
 
 
@@ -141,9 +509,29 @@ static _Bool smfd_debug = 0;
 /* Dump configuration & exit? */
 static _Bool smfd_config_test = 0;
 
+/* Validate the configuration file (silently) & exit? */
+static _Bool smfd_config_check = 0;
+
+/* Write a configuration snapshot for smfd-boot to this file & exit (if not NULL) */
+static const char *smfd_boot_config_file = NULL;
+
 /* Configuration file */
 static const char *smfd_config_file = "/etc/smfd/config.yaml";
 
+/* Prefix of coretemp & PCH sysfs paths (a fake sysfs tree for testing) */
+static const char *smfd_sysfs_root = "";
+
+/* CPU affinity setting -- "auto" (housekeeping CPUs; the default), "none", or a CPU list */
+static char *smfd_cpu_affinity = NULL;
+
+/* CPUs to which all of smfd's threads are confined (if smfd_cpu_pinned) */
+static cpu_set_t smfd_cpus;
+static _Bool smfd_cpu_pinned = 0;
+
+/* Flight recorder -- seconds of cycles to keep (0 disables) & incident file directory */
+static unsigned int smfd_rec_window = 600;
+static char *smfd_rec_dir = NULL;		/* NULL == /var/lib/smfd */
+
 /* How often to log temperature & other information (seconds) */
 static unsigned int smfd_log_interval = UINT_MAX;
 
@@ -151,18 +539,23 @@ static unsigned int smfd_log_interval = UINT_MAX;
 static char smfd_sdr_cache_default[] = "/var/lib/smfd/sdr-cache";
 static char *smfd_sdr_cache = smfd_sdr_cache_default;
 
-/* Fan percent settings when no thresholds are triggered */
-static uint8_t smfd_cpu_fan_base = 255;
-static uint8_t smfd_sys_fan_base = 255;
-
-/* CPU temperature (package temperature or any core) thresholds */
-static struct smfd_temp_threshold *smfd_cfg_cpu_temp = NULL;
+/*
+ * Default profile -- base fan percents (when no thresholds are triggered), trigger tables (CPU:
+ * package temperature or any core) & ramp limit from the top level of the configuration file
+ */
+static char smfd_default_profile_name[] = "default";
+static struct smfd_profile smfd_default_profile = {
+	.name		= smfd_default_profile_name,
+	.fan_base	= { 255, 255 },
+	.ramp_down	= 0
+};
 
-/* PCH temperature thresholds */
-static struct smfd_temp_threshold *smfd_cfg_pch_temp = NULL;
+/* Named profiles -- all compiled when the configuration file is loaded */
+static struct smfd_profile *smfd_profiles = NULL;
+static unsigned int smfd_profile_count = 0;
 
-/* Disk temperature thresholds */
-static struct smfd_temp_threshold *smfd_cfg_disk_temp = NULL;
+/* Active profile; switching profiles only swaps this pointer */
+static struct smfd_profile *smfd_policy = &smfd_default_profile;
 
 /* IPMI fans */
 static struct smfd_ipmi_fan *smfd_ipmi_fans = NULL;
@@ -172,10 +565,81 @@ static unsigned int smfd_ipmi_fan_count = 0;
 static struct smfd_coretemp *smfd_coretemps;
 static unsigned int smfd_coretemp_count;
 
-/* S.M.A.R.T. disk temperatures */
+/* RAID/HBA controller temperature sources & the inputs they matched */
+static struct smfd_ctrl_source *smfd_ctrl_sources = NULL;
+static unsigned int smfd_ctrl_source_count = 0;
+static struct smfd_ctrl_temp *smfd_ctrl_temps = NULL;
+static unsigned int smfd_ctrl_temp_count = 0;
+
+/* Sensor & actuator plugins -- directory & the plugins in the configuration file */
+static char *smfd_plugin_dir = NULL;		/* NULL == /usr/local/lib64/smfd */
+static struct smfd_plugin_lib *smfd_plugin_libs = NULL;
+static unsigned int smfd_plugin_lib_count = 0;
+
+/* Temperatures provided by plugins */
+static struct smfd_plugin_temp *smfd_plugin_temps = NULL;
+static unsigned int smfd_plugin_temp_count = 0;
+
+/* S.M.A.R.T. disk temperatures (disks are attached & detached as they come and go) */
 static struct smfd_disk *smfd_disks = NULL;
 static unsigned int smfd_disk_count = 0;
 
+/* smart_disks patterns -- globs matched against device nodes & /dev/disk symlinks */
+static char **smfd_disk_patterns = NULL;
+static unsigned int smfd_disk_pattern_count = 0;
+
+/* Disk cages -- peer groups for anomaly detection (disks in no cage are peers of each other) */
+static struct smfd_disk_cage *smfd_disk_cages = NULL;
+static unsigned int smfd_disk_cage_count = 0;
+
+/*
+ * Disk peer anomalies -- threshold (°C above the peer median; 0 disables), how long (seconds) a
+ * disk must stay above it, and expected °C per 100% difference in I/O utilization
+ */
+static unsigned int smfd_peer_threshold = 8;
+static unsigned int smfd_peer_persistence = 600;
+static double smfd_peer_load_coeff = 5.0;
+
+/* Disk peer anomalies raised since the last report (or stats reset) */
+static unsigned int smfd_peer_events = 0;
+
+/*
+ * Disk thermal aging accounting -- state file, reference temperature (°C), activation energy (eV)
+ * & seconds between saves
+ */
+static _Bool smfd_aging_enabled = 0;
+static char *smfd_aging_file = NULL;		/* NULL == /var/lib/smfd/disk-aging */
+static int smfd_aging_reference = 40;
+static double smfd_aging_energy = 0.7;
+static unsigned int smfd_aging_save_interval = 3600;
+
+/*
+ * Background I/O throttling -- md arrays & cgroups, steps (each halves the rate), seconds before
+ * each step, lowest rate (MB/s) & unthrottled cgroup bandwidth (MB/s)
+ */
+static struct smfd_throttle_target *smfd_throttle_targets = NULL;
+static unsigned int smfd_throttle_count = 0;
+static unsigned int smfd_throttle_steps = 4;
+static unsigned int smfd_throttle_hold = 120;
+static unsigned int smfd_throttle_min_rate = 10;
+static unsigned int smfd_throttle_cgroup_rate = 400;
+
+/*
+ * Disk polling schedule -- staleness limit (ms), per-cycle time budget (ms) & disk limit (0 =
+ * none)
+ */
+static unsigned int smfd_disk_max_staleness = 0;
+static unsigned int smfd_disk_budget = 0;
+static unsigned int smfd_disk_max_per_cycle = 0;
+
+/* Scratch array of the disks that are due to be polled */
+static struct smfd_disk **smfd_disk_due = NULL;
+static unsigned int smfd_disk_due_size = 0;
+
+/* udev context & netlink monitor for disk hotplug */
+static struct udev *smfd_udev = NULL;
+static struct udev_monitor *smfd_udev_mon = NULL;
+
 /* PCH temperature */
 static struct smfd_temperature smfd_pch_temp;
 
@@ -188,11 +652,134 @@ static ipmi_sensor_read_ctx_t smfd_read = NULL;
 /* Used to read PCH temperature */
 static FILE *smfd_pch_temp_fp = NULL;
 
-/* Current CPU fan percentage */
-static uint8_t smfd_cpu_fan_percent = 100;
+/* Current fan percentage of each zone */
+static uint8_t smfd_fan_percent[SMFD_FAN_ZONE_COUNT] = { 100, 100 };
+
+/* Duty cycles taken over from smfd-boot (255 == none) */
+static uint8_t smfd_boot_percent[SMFD_FAN_ZONE_COUNT] = { 255, 255 };
+
+/* Fan zone actuators (set up by smfd_zone_init) */
+static struct smfd_zone smfd_zones[SMFD_FAN_ZONE_COUNT] = {
+	[SMFD_FAN_ZONE_CPU]	= { .ipmi_zone = SMFD_FAN_ZONE_CPU, .pwm_fd = -1, .enable_fd = -1 },
+	[SMFD_FAN_ZONE_SYS]	= { .ipmi_zone = SMFD_FAN_ZONE_SYS, .pwm_fd = -1, .enable_fd = -1 }
+};
+
+/* Time between temperature samples (milliseconds) */
+static unsigned int smfd_sample_interval = 30000;
+
+/* Zone names for logging */
+static const char *const smfd_zone_names[SMFD_FAN_ZONE_COUNT] = {
+	[SMFD_FAN_ZONE_CPU]	= "CPU",
+	[SMFD_FAN_ZONE_SYS]	= "system"
+};
+
+/* Sensor failure policies (per group) */
+static struct smfd_sensor_policy smfd_sensor_policies[SMFD_GROUP_COUNT] = {
+	[SMFD_GROUP_PCH]	= { SMFD_FAIL_HOLD, 120 },
+	[SMFD_GROUP_CPU]	= { SMFD_FAIL_HOLD, 120 },
+	[SMFD_GROUP_DISK]	= { SMFD_FAIL_HOLD, 120 }
+};
+
+/* Safety envelope -- hard limits (per group) & zones that a breach has forced to 100% (bit mask) */
+static struct smfd_safety_limit smfd_safety_limits[SMFD_GROUP_COUNT] = {
+	[SMFD_GROUP_PCH]	= { INT_MAX, 0 },
+	[SMFD_GROUP_CPU]	= { INT_MAX, 0 },
+	[SMFD_GROUP_DISK]	= { INT_MAX, 0 }
+};
+static uint8_t smfd_safety_active = 0;
+
+static const char *const smfd_sensor_state_names[] = {
+	[SMFD_SENSOR_OK]	= "ok",
+	[SMFD_SENSOR_STALE]	= "stale",
+	[SMFD_SENSOR_FAILED]	= "failed"
+};
+
+static const char *const smfd_fail_policy_names[] = {
+	[SMFD_FAIL_HOLD]	= "hold",
+	[SMFD_FAIL_IGNORE]	= "ignore",
+	[SMFD_FAIL_MAX]		= "max"
+};
+
+/* Sensor group names used in the configuration file and the coupling file */
+static const char *const smfd_group_keys[SMFD_GROUP_COUNT] = {
+	[SMFD_GROUP_PCH]	= "pch",
+	[SMFD_GROUP_CPU]	= "cpu",
+	[SMFD_GROUP_DISK]	= "disk"
+};
+
+/* Model-predictive optimizer settings (optional) */
+static _Bool smfd_opt_enabled = 0;
+static unsigned int smfd_opt_horizon = 120;		/* prediction horizon (seconds) */
+static unsigned int smfd_opt_time_constant = 300;	/* thermal time constant (seconds) */
+static unsigned int smfd_opt_step = 5;			/* duty cycle search granularity */
+static uint8_t smfd_opt_fan_min[SMFD_FAN_ZONE_COUNT] = { 25, 25 };
+static struct smfd_opt_group smfd_opt_groups[SMFD_GROUP_COUNT];
+
+/* Time at which the current cycle's temperature samples were taken (monotonic milliseconds) */
+static int64_t smfd_sample_time;
+
+/* Fan response tracking & latency histograms */
+static struct smfd_zone_response smfd_responses[SMFD_FAN_ZONE_COUNT];
+static struct smfd_histogram smfd_set_latency;		/* sample ==> duty cycle set */
+static struct smfd_histogram smfd_rpm_latency;		/* sample ==> RPM at 90% of change */
+static struct smfd_histogram smfd_turn_latency;		/* sample ==> temperature falling */
+
+/* Fleet mode -- remote hosts, UDP address for pushed readings & hosts allowed to push them */
+static struct smfd_fleet_host *smfd_fleet_hosts = NULL;
+static unsigned int smfd_fleet_host_count = 0;
+static char *smfd_fleet_listen = NULL;
+static struct in6_addr *smfd_fleet_peers = NULL;	/* IPv4 addresses are mapped */
+static unsigned int smfd_fleet_peer_count = 0;
+
+/* Control socket path (NULL if disabled) */
+static char *smfd_ctl_path = NULL;
+
+/* Duty cycle overrides set through the control socket */
+static struct smfd_override smfd_overrides[SMFD_FAN_ZONE_COUNT];
+
+/* Time at which the daemon started (for status) */
+static time_t smfd_start_time;
+
+/* Run zone-to-sensor coupling identification & exit? */
+static _Bool smfd_commission = 0;
+
+/* Shadow mode -- make decisions, but leave the fans to the BMC; compare & report */
+static _Bool smfd_shadow = 0;
+static struct smfd_shadow_stats smfd_shadow_stats;
+
+/* A/B experiment -- arms alternate in blocks (seconds); the start of each block isn't measured */
+static struct smfd_exp_arm smfd_exp_arms[2];
+static _Bool smfd_exp_enabled = 0;
+static unsigned int smfd_exp_block = 3600;
+static unsigned int smfd_exp_settle = 300;
+static unsigned int smfd_exp_current;		/* index of active arm */
+static int64_t smfd_exp_block_start;		/* monotonic time (ms) */
+static _Bool smfd_exp_second;			/* 2nd block of a randomized pair? */
+static _Bool smfd_exp_saved_opt;		/* configured policy, restored by each arm */
+static uint8_t smfd_exp_saved_base[SMFD_FAN_ZONE_COUNT];
+
+static const char *const smfd_exp_policy_names[] = {
+	[SMFD_EXP_TRIGGERS]	= "triggers",
+	[SMFD_EXP_OPTIMIZER]	= "optimizer",
+	[SMFD_EXP_BMC]		= "bmc"
+};
+
+/* Coupling identification settings */
+static char smfd_coupling_file_default[] = "/var/lib/smfd/coupling";
+static char *smfd_coupling_file = smfd_coupling_file_default;
+static unsigned int smfd_coupling_settle = 600;		/* seconds at each duty cycle setting */
+static uint8_t smfd_coupling_step = 25;			/* duty cycle perturbation (percent) */
 
-/* Current system fan percentage */
-static uint8_t smfd_sys_fan_percent = 100;
+/*
+ * Coupling zone assignment (optional) -- each group's triggers only drive the zone that cools it
+ * most cheaply, as measured by smfd -k (SMFD_FAN_ZONE_COUNT == both zones)
+ */
+static _Bool smfd_coupling_assign = 0;
+static uint8_t smfd_coupling_zones[SMFD_GROUP_COUNT] = {
+	[SMFD_GROUP_PCH]	= SMFD_FAN_ZONE_COUNT,
+	[SMFD_GROUP_CPU]	= SMFD_FAN_ZONE_COUNT,
+	[SMFD_GROUP_DISK]	= SMFD_FAN_ZONE_COUNT
+};
 
 /* Signal flags */
 static volatile sig_atomic_t smfd_debug_signal = 0;	/* SIGUSR1 */
@@ -205,6 +792,30 @@ static time_t smfd_next_log;
 /* Time at which data collection started */
 static time_t smfd_log_start;
 
+/* BMC fan mode, read once at startup (0xff if no zone uses IPMI) */
+static uint8_t smfd_fan_mode = 0xff;
+
+/* Reporting thread, the report (if any) that it has not yet logged & any flight recorder dump */
+static pthread_t smfd_report_thread;
+static pthread_mutex_t smfd_report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smfd_report_cond = PTHREAD_COND_INITIALIZER;
+static struct smfd_report *smfd_report_pending = NULL;
+static _Bool smfd_report_dump = 0;	/* flight recorder snapshot not yet written */
+static _Bool smfd_report_running = 0;
+static _Bool smfd_report_quit = 0;
+
+/* IPMI writer thread (with its own in-band context) & its write queue (1 slot per zone) */
+static pthread_t smfd_ipmiq_thread;
+static pthread_mutex_t smfd_ipmiq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smfd_ipmiq_cond;		/* CLOCK_MONOTONIC; see smfd_ipmiq_init */
+static ipmi_ctx_t smfd_ipmiq_ipmi = NULL;
+static struct smfd_ipmiq_slot smfd_ipmiq_slots[SMFD_FAN_ZONE_COUNT];
+static struct smfd_ipmiq_stats smfd_ipmiq_stats;
+static uint8_t smfd_ipmiq_mode = SMFD_SUPERMICRO_FAN_MODE_FULL;	/* mode the BMC should be in */
+static _Bool smfd_ipmiq_mode_pending = 0;
+static _Bool smfd_ipmiq_running = 0;
+static _Bool smfd_ipmiq_quit = 0;
+
 
 /***************************************************************************************************
  ***************************************************************************************************
@@ -330,23 +941,30 @@ static void smfd_update_temp(struct smfd_temperature *const temp, const int curr
 	temp->samples += 1;
 }
 
-/* Log and reset information about 1 temperature */
-static void smfd_log_temp(const char *const name, struct smfd_temperature *const temp)
+/* Log information about 1 temperature */
+static void smfd_log_temp(const char *const name, const struct smfd_temperature *const temp)
 {
+	if (temp->state != SMFD_SENSOR_OK)
+		SMFD_INFO("%s: sensor is %s\n", name, smfd_sensor_state_names[temp->state]);
+
+	if (temp->samples == 0) {
+		SMFD_INFO("%s: no samples\n", name);
+		return;
+	}
+
 	SMFD_INFO("%s: current: %d°C, high: %d°C, low: %d°C, mean: %d°C\n", name,
 		  temp->current, temp->high, temp->low,
 		  (temp->accumulator + temp->samples / 2) / temp->samples);
-
-	smfd_temp_reset(temp);
 }
 
-/* Forward declarations needed by smfd_log_info */
-static uint8_t smfd_get_fan_mode(void);
-static uint8_t smfd_get_fan_percent(uint8_t zone);
-static void smfd_ipmi_fan_read(void);
+/* Forward declarations needed by smfd_report_log */
+static void smfd_hist_log(const char *name, const struct smfd_histogram *hist);
+static void smfd_shadow_log(const struct smfd_shadow_stats *st);
+static void smfd_exp_log(const char *name, const struct smfd_exp_stats *st);
+static void smfd_cpu_log_threads(void);
 
-/* Log the current system state and some periodic statistics */
-static void smfd_log_info(void)
+/* Log a periodic report; runs in the reporting thread */
+static void smfd_report_log(const struct smfd_report *const report)
 {
 	static const char *const fan_modes[] = {
 		[SMFD_SUPERMICRO_FAN_MODE_STD]	= "Standard",			/* 0x00 */
@@ -356,271 +974,325 @@ static void smfd_log_info(void)
 		[SMFD_SUPERMICRO_FAN_MODE_IO]	= "Heavy I/O"			/* 0x04 */
 	};
 
-	uint8_t fan_mode, cpu_fan_speed, sys_fan_speed;
+	const struct smfd_report_fan *fan;
+	char start[32];
 	unsigned int i;
 
-	/* This is the only time that IPMI information is read */
-	fan_mode = smfd_get_fan_mode();
-	cpu_fan_speed = smfd_get_fan_percent(SMFD_FAN_ZONE_CPU);
-	sys_fan_speed = smfd_get_fan_percent(SMFD_FAN_ZONE_SYS);
-	smfd_ipmi_fan_read();
+	ctime_r(&report->start, start);
+	SMFD_INFO("Data collection began at %s", start);
 
-	SMFD_INFO("Data collection began at %s", ctime(&smfd_log_start));
+	if (report->fan_mode != 0xff) {
+		SMFD_INFO("BMC fan mode: %s\n", (report->fan_mode <= SMFD_SUPERMICRO_FAN_MODE_IO) ?
+						fan_modes[report->fan_mode] : "UNKNOWN");
+	}
 
-	SMFD_INFO("BMC fan mode: %s\n",
-		  (fan_mode <= SMFD_SUPERMICRO_FAN_MODE_IO) ? fan_modes[fan_mode] : "UNKNOWN");
-	SMFD_INFO("CPU fan duty cycle: %" PRIu8 "%%\n", cpu_fan_speed);
-	SMFD_INFO("System fan duty cycle: %" PRIu8 "%%\n", sys_fan_speed);
+	SMFD_INFO("CPU fan duty cycle%s: %" PRIu8 "%%\n", report->shadow ? " (shadow)" : "",
+		  report->fan_percent[SMFD_FAN_ZONE_CPU]);
+	SMFD_INFO("System fan duty cycle%s: %" PRIu8 "%%\n", report->shadow ? " (shadow)" : "",
+		  report->fan_percent[SMFD_FAN_ZONE_SYS]);
 
-	for (i = 0; i < smfd_ipmi_fan_count; ++i)
-		SMFD_INFO("%s: %u RPM\n", smfd_ipmi_fans[i].name, smfd_ipmi_fans[i].rpm);
+	for (i = 0; i < report->fan_count; ++i) {
 
-	smfd_log_temp("PCH", &smfd_pch_temp);
+		fan = &report->fans[i];
 
-	for (i = 0; i < smfd_coretemp_count; ++i)
-		smfd_log_temp(smfd_coretemps[i].name, &smfd_coretemps[i].temp);
+		if (fan->rpm_time == 0) {
+			SMFD_INFO("%s: not sampled\n", fan->name);
+		}
+		else {
+			SMFD_INFO("%s: %u RPM (sampled %" PRId64 " seconds earlier)\n", fan->name,
+				  fan->rpm, (report->taken - fan->rpm_time) / 1000);
+		}
+	}
 
-	for (i = 0; i < smfd_disk_count; ++i)
-		smfd_log_temp(smfd_disks[i].name, &smfd_disks[i].temp);
+	for (i = 0; i < report->temp_count; ++i)
+		smfd_log_temp(report->temps[i].name, &report->temps[i].temp);
+
+	if (report->peers) {
+		SMFD_INFO("Disk peer anomalies: %u active, %u raised in period\n",
+			  report->peer_active, report->peer_events);
+	}
+
+	smfd_hist_log("Fan response latency (sample ==> duty cycle set)", &report->set_latency);
+	smfd_hist_log("Fan response latency (sample ==> 90% of RPM change)", &report->rpm_latency);
+	smfd_hist_log("Fan response latency (sample ==> temperature falling)",
+		      &report->turn_latency);
+
+	if (report->ipmiq) {
+		smfd_hist_log("IPMI write queue (queued ==> written)", &report->ipmiq_stats.wait);
+		SMFD_INFO("IPMI write queue: %u written (%u safety), %u coalesced, %u unchanged; "
+			  "fan mode verified %u times, restored %u times\n",
+			  report->ipmiq_stats.written, report->ipmiq_stats.urgent,
+			  report->ipmiq_stats.coalesced, report->ipmiq_stats.unchanged,
+			  report->ipmiq_stats.mode_checks, report->ipmiq_stats.mode_restores);
+	}
+
+	if (report->shadow)
+		smfd_shadow_log(&report->shadow_stats);
+
+	if (report->exp_arm != NULL) {
+		SMFD_INFO("Experiment: active arm: %s\n", report->exp_arm);
+		smfd_exp_log(report->exp_names[0], &report->exp_stats[0]);
+		smfd_exp_log(report->exp_names[1], &report->exp_stats[1]);
+	}
+
+	smfd_cpu_log_threads();
 }
 
+/* strdup() or abort */
+static char *smfd_strdup(const char *const s)
+{
+	char *copy;
 
-/***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- **
- **
- **	Command line parsing
- **
- **
- ***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- **************************************************************************************************/
+	if ((copy = strdup(s)) == NULL)
+		SMFD_ABORT("strdup: %m\n");
 
-static void smfd_parse_args(const int argc, char **const argv)
+	return copy;
+}
+
+/* Free a periodic report */
+static void smfd_report_free(struct smfd_report *const report)
 {
-	static const char help_msg[] =
-			"Usage: %s [-h|--help]\n"
-			"       %s [-d] [-s] [-c CONFIG_FILE ]\n"
-			"\n"
-			"  -h, --help        show this message and exit\n"
-			"  -d                print/log debugging messages\n"
-			"  -s                log to syslog (when running in a terminal)\n"
-			"  -p                print/log configuration & exit (implies -d)\n"
-			"  -c CONFIG_FILE    configuration file [/etc/smfd/config.yaml]\n";
+	unsigned int i;
 
-	int i;
+	for (i = 0; i < report->temp_count; ++i)
+		free(report->temps[i].name);
 
-	for (i = 1; i < argc; ++i) {
-		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-			printf(help_msg, argv[0], argv[0]);
-			exit(EXIT_SUCCESS);
-		}
+	free(report->temps);
+	free(report->fans);
+	free(report);
+}
+
+/* Forward declarations needed by smfd_report_take */
+static int64_t smfd_mono_ms(void);
+static unsigned int smfd_peer_active(void);
+static void smfd_ipmiq_get_stats(struct smfd_ipmiq_stats *st, _Bool reset);
+
+/*
+ * Snapshot the current state & periodic statistics, and reset the statistics.  Only cached values
+ * are used -- the duty cycles that were last set and the fan speeds that were last read -- so this
+ * never waits for the BMC.
+ */
+static struct smfd_report *smfd_report_take(void)
+{
+	struct smfd_report *report;
+	unsigned int i, j;
+
+	if ((report = calloc(1, sizeof *report)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	report->temp_count = 1 + smfd_coretemp_count + smfd_ctrl_temp_count + smfd_disk_count
+				+ smfd_plugin_temp_count;
+	report->fan_count = smfd_ipmi_fan_count;
+
+	report->temps = malloc(report->temp_count * sizeof *report->temps);
+	report->fans = malloc((report->fan_count + 1) * sizeof *report->fans);
+	if (report->temps == NULL || report->fans == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	report->start = smfd_log_start;
+	report->taken = smfd_mono_ms();
+	report->fan_mode = smfd_fan_mode;
+	memcpy(report->fan_percent, smfd_fan_percent, sizeof report->fan_percent);
+
+	for (i = 0; i < smfd_ipmi_fan_count; ++i) {
+		report->fans[i].name = smfd_ipmi_fans[i].name;
+		report->fans[i].rpm = smfd_ipmi_fans[i].rpm;
+		report->fans[i].rpm_time = smfd_ipmi_fans[i].rpm_time;
 	}
 
-	smfd_use_syslog = !isatty(STDERR_FILENO);
+	report->temps[0].name = smfd_strdup("PCH");
+	report->temps[0].temp = smfd_pch_temp;
+	smfd_temp_reset(&smfd_pch_temp);
 
-	for (i = 1; i < argc; ++i) {
+	for (j = 1, i = 0; i < smfd_coretemp_count; ++i, ++j) {
+		report->temps[j].name = smfd_strdup(smfd_coretemps[i].name);
+		report->temps[j].temp = smfd_coretemps[i].temp;
+		smfd_temp_reset(&smfd_coretemps[i].temp);
+	}
 
-		if (strcmp(argv[i], "-d") == 0) {
-			smfd_debug = 1;
-			continue;
-		}
+	for (i = 0; i < smfd_ctrl_temp_count; ++i, ++j) {
+		report->temps[j].name = smfd_strdup(smfd_ctrl_temps[i].name);
+		report->temps[j].temp = smfd_ctrl_temps[i].temp;
+		smfd_temp_reset(&smfd_ctrl_temps[i].temp);
+	}
 
-		if (strcmp(argv[i], "-s") == 0) {
-			smfd_use_syslog = 1;
-			continue;
-		}
+	for (i = 0; i < smfd_disk_count; ++i, ++j) {
+		report->temps[j].name = smfd_strdup(smfd_disks[i].name);
+		report->temps[j].temp = smfd_disks[i].temp;
+		smfd_temp_reset(&smfd_disks[i].temp);
+	}
 
-		if (strcmp(argv[i], "-p") == 0) {
-			smfd_config_test = 1;
-			smfd_debug = 1;
-			continue;
-		}
+	for (i = 0; i < smfd_plugin_temp_count; ++i, ++j) {
+		report->temps[j].name = smfd_strdup(smfd_plugin_temps[i].name);
+		report->temps[j].temp = smfd_plugin_temps[i].temp;
+		smfd_temp_reset(&smfd_plugin_temps[i].temp);
+	}
 
-		if (strcmp(argv[i], "-c") == 0) {
-			if ((smfd_config_file = argv[++i]) == NULL)
-				SMFD_FATAL("-c option requires configuration file\n");
-			continue;
+	report->set_latency = smfd_set_latency;
+	report->rpm_latency = smfd_rpm_latency;
+	report->turn_latency = smfd_turn_latency;
+	memset(&smfd_set_latency, 0, sizeof smfd_set_latency);
+	memset(&smfd_rpm_latency, 0, sizeof smfd_rpm_latency);
+	memset(&smfd_turn_latency, 0, sizeof smfd_turn_latency);
+
+	report->ipmiq = smfd_ipmiq_running;
+	if (smfd_ipmiq_running)
+		smfd_ipmiq_get_stats(&report->ipmiq_stats, 1);
+
+	report->peers = (smfd_peer_threshold != 0);
+	report->peer_events = smfd_peer_events;
+	report->peer_active = smfd_peer_active();
+	smfd_peer_events = 0;
+
+	report->shadow = smfd_shadow;
+	report->shadow_stats = smfd_shadow_stats;
+	memset(&smfd_shadow_stats, 0, sizeof smfd_shadow_stats);
+
+	/* Experiment statistics are cumulative, so they aren't reset */
+	if (smfd_exp_enabled) {
+		for (i = 0; i < 2; ++i) {
+			report->exp_names[i] = smfd_exp_arms[i].name;
+			report->exp_stats[i] = smfd_exp_arms[i].stats;
 		}
+		report->exp_arm = smfd_exp_arms[smfd_exp_current].name;
 	}
-}
 
+	return report;
+}
 
-/***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- **
- **
- **	coretemp & PCH temperatures
- **
- **
- ***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- **************************************************************************************************/
+/* Forward declaration needed by the reporting thread */
+static void smfd_rec_write(void);
 
-/* Initialize smfd_coretemps with the name of each coretemp input and an open stream to each */
-static void smfd_coretemp_init(void)
+/* Reporting thread -- logs reports & writes flight recorder dumps handed off by the control loop */
+static void *smfd_report_main(void *const arg __attribute__((unused)))
 {
-	static const char hwmon_dir[] = "/sys/devices/platform/coretemp.0/hwmon/hwmon2";
+	struct smfd_report *report;
+	_Bool dump;
+	int rc;
 
-	char buf[sizeof "tempXX_input"];
-	int dirfd, rc, fd;
-	size_t label_size;
-	char *labels[99];
-	unsigned i;
-	FILE *fp;
+	while (1) {
 
-	if ((dirfd = open(hwmon_dir, O_DIRECTORY | O_PATH)) < 0)
-		SMFD_FATAL("%s: %m\n", hwmon_dir);
+		if ((rc = pthread_mutex_lock(&smfd_report_mutex)) != 0)
+			SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
 
-	for (i = 0; i < 99; ++i) {
+		while (smfd_report_pending == NULL && !smfd_report_dump && !smfd_report_quit) {
+			if ((rc = pthread_cond_wait(&smfd_report_cond, &smfd_report_mutex)) != 0)
+				SMFD_ABORT("pthread_cond_wait: %s\n", strerror(rc));
+		}
 
-		if ((rc = snprintf(buf, sizeof buf, "temp%u_label", i + 1)) < 0)
-			SMFD_ABORT("snprintf: %m\n");
+		report = smfd_report_pending;
+		smfd_report_pending = NULL;
+		dump = smfd_report_dump;
 
-		if (rc >= (int)sizeof buf)
-			SMFD_FATAL("File name truncated: temp%u_label", i + 1);
+		if ((rc = pthread_mutex_unlock(&smfd_report_mutex)) != 0)
+			SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
 
-		if ((fd = openat(dirfd, buf, O_RDONLY)) < 0) {
-			if (errno == ENOENT)
-				break;
-			SMFD_FATAL("%s/%s: %m\n", hwmon_dir, buf);
-		}
+		if (report == NULL && !dump)
+			return NULL;	/* smfd_report_quit set & nothing left to do */
 
-		if ((fp = fdopen(fd, "r")) == NULL)
-			SMFD_ABORT("fdopen: %m\n");
+		if (dump) {
 
-		labels[i] = NULL;
-		label_size = 0;
+			smfd_rec_write();
 
-		if ((rc = getline(&labels[i], &label_size, fp)) < 0)
-			SMFD_FATAL("getline: %m\n");
+			/* The control loop can fill the snapshot buffer again */
+			if ((rc = pthread_mutex_lock(&smfd_report_mutex)) != 0)
+				SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
 
-		assert(rc >= (int)sizeof "Core 0");
+			smfd_report_dump = 0;
 
-		if (labels[i][rc - 1] == '\n')
-			labels[i][rc - 1] = 0;
+			if ((rc = pthread_mutex_unlock(&smfd_report_mutex)) != 0)
+				SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
+		}
 
-		if (fclose(fp) != 0)
-			SMFD_FATAL("fclose: %m\n");
+		if (report != NULL) {
+			smfd_report_log(report);
+			smfd_report_free(report);
+		}
 	}
+}
 
-	if (i == 0)
-		SMFD_FATAL("No temperature inputs found in %s\n", hwmon_dir);
-
-	smfd_coretemp_count = i;
-	SMFD_DEBUG("Found %u coretemp inputs\n", i);
-
-	if ((smfd_coretemps = malloc(smfd_coretemp_count * sizeof *smfd_coretemps)) == NULL)
-		SMFD_ABORT("malloc: %m\n");
+/* Log the current system state and some periodic statistics (in the reporting thread) */
+static void smfd_log_info(void)
+{
+	struct smfd_report *report, *dropped;
+	int rc;
 
-	for (i = 0; i < smfd_coretemp_count; ++i) {
+	report = smfd_report_take();
 
-		smfd_coretemps[i].name = labels[i];
-		smfd_temp_reset(&smfd_coretemps[i].temp);
+	if (!smfd_report_running) {
+		smfd_report_log(report);
+		smfd_report_free(report);
+		return;
+	}
 
-		if ((rc = snprintf(buf, sizeof buf, "temp%u_input", i + 1)) < 0)
-			SMFD_ABORT("snprintf: %m\n");
+	if ((rc = pthread_mutex_lock(&smfd_report_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
 
-		if (rc >= (int) sizeof buf)
-			SMFD_FATAL("File name truncated: temp%u_input\n", i + 1);
+	dropped = smfd_report_pending;
+	smfd_report_pending = report;
 
-		if ((fd = openat(dirfd, buf, O_RDONLY)) < 0)
-			SMFD_FATAL("%s/%s: %m\n", hwmon_dir, buf);
+	if ((rc = pthread_cond_signal(&smfd_report_cond)) != 0)
+		SMFD_ABORT("pthread_cond_signal: %s\n", strerror(rc));
 
-		if ((smfd_coretemps[i].fp = fdopen(fd, "r")) == NULL)
-			SMFD_ABORT("fdopen: %m\n");
+	if ((rc = pthread_mutex_unlock(&smfd_report_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
 
-		if (setvbuf(smfd_coretemps[i].fp, NULL, _IONBF, 0) != 0)
-			SMFD_ABORT("setvbuf: %m\n");
+	if (dropped != NULL) {
+		SMFD_WARNING("Reporting thread is behind; discarding report from %s",
+			     ctime(&dropped->start));
+		smfd_report_free(dropped);
 	}
-
-	if (close(dirfd) != 0)
-		SMFD_FATAL("close: %m\n");
-
-	SMFD_DEBUG("smfd_coretemp_init finished\n");
 }
 
-/* Initialize smfd_pch_temp_fp with an open stream to the PCH temperature input */
-static void smfd_pch_temp_init(void)
+/* Start the reporting thread (with all signals blocked, so they are handled by the main thread) */
+static void smfd_report_init(void)
 {
-	static const char input[] = "/sys/devices/virtual/thermal/thermal_zone0/hwmon0/temp1_input";
-
-	smfd_temp_reset(&smfd_pch_temp);
-
-	if ((smfd_pch_temp_fp = fopen(input, "r")) == NULL)
-		SMFD_FATAL("%s: %m\n", input);
-
-	if (setvbuf(smfd_pch_temp_fp, NULL, _IONBF, 0) != 0)
-		SMFD_ABORT("setvbuf: %m\n");
+	sigset_t all, old;
+	int rc;
 
-	SMFD_DEBUG("smfd_pch_temp_init finished\n");
-}
+	if (sigfillset(&all) != 0)
+		SMFD_ABORT("sigfillset: %m\n");
 
-/* Clean up smfd_coretemps - close streams & free memory */
-static void smfd_coretemp_fini(void)
-{
-	unsigned i;
+	if ((rc = pthread_sigmask(SIG_SETMASK, &all, &old)) != 0)
+		SMFD_ABORT("pthread_sigmask: %s\n", strerror(rc));
 
-	for (i = 0; i < smfd_coretemp_count; ++i) {
+	if ((rc = pthread_create(&smfd_report_thread, NULL, smfd_report_main, NULL)) != 0)
+		SMFD_FATAL("pthread_create: %s\n", strerror(rc));
 
-		free(smfd_coretemps[i].name);
+	if ((rc = pthread_setname_np(smfd_report_thread, "smfd-report")) != 0)
+		SMFD_WARNING("pthread_setname_np: %s\n", strerror(rc));
 
-		if (fclose(smfd_coretemps[i].fp) != 0)
-			SMFD_ERR("fclose: %m\n");
-	}
+	if ((rc = pthread_sigmask(SIG_SETMASK, &old, NULL)) != 0)
+		SMFD_ABORT("pthread_sigmask: %s\n", strerror(rc));
 
-	free(smfd_coretemps);
-}
+	smfd_report_running = 1;
 
-/* Close smfd_pch_temp_fp */
-static void smfd_pch_temp_fini(void)
-{
-	if (fclose(smfd_pch_temp_fp) != 0)
-		SMFD_ERR("fclose: %m\n");
+	SMFD_DEBUG("smfd_report_init finished\n");
 }
 
-/* Read & parse a coretemp or PCH temperature */
-static void smfd_temp_read(FILE *const fp, const char *const name,
-			   struct smfd_temperature *const temp)
+/* Stop the reporting thread, after it logs any pending report & writes any pending dump */
+static void smfd_report_fini(void)
 {
-	int rc, reading;
-
-	rewind(fp);
-
-	if ((rc = fscanf(fp, "%d", &reading)) == EOF)
-		SMFD_FATAL("%s: %m\n", name);
+	int rc;
 
-	if (rc != 1)
-		SMFD_FATAL("Failed to parse %s temperature\n", name);
+	if (!smfd_report_running)
+		return;
 
-	smfd_update_temp(temp, (reading + 500) / 1000);
+	if ((rc = pthread_mutex_lock(&smfd_report_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
 
-	if (temp->current < 0 || temp->current > 120)
-		SMFD_WARNING("%s reading (%d°C) is probably garbage\n", name, temp->current);
-}
+	smfd_report_quit = 1;
 
-/* Read & parse the temperature from every coretemp input */
-static void smfd_coretemp_read(void)
-{
-	unsigned i;
+	if ((rc = pthread_cond_signal(&smfd_report_cond)) != 0)
+		SMFD_ABORT("pthread_cond_signal: %s\n", strerror(rc));
 
-	for (i = 0; i < smfd_coretemp_count; ++i) {
+	if ((rc = pthread_mutex_unlock(&smfd_report_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
 
-		smfd_temp_read(smfd_coretemps[i].fp, smfd_coretemps[i].name,
-			       &smfd_coretemps[i].temp);
-	}
-}
+	if ((rc = pthread_join(smfd_report_thread, NULL)) != 0)
+		SMFD_ERR("pthread_join: %s\n", strerror(rc));
 
-/* Read & parse the PCH temperature */
-static void smfd_pch_temp_read(void)
-{
-	smfd_temp_read(smfd_pch_temp_fp, "PCH", &smfd_pch_temp);
+	smfd_report_running = 0;
 }
 
 
@@ -630,7 +1302,7 @@ static void smfd_pch_temp_read(void)
  ***************************************************************************************************
  **
  **
- **	S.M.A.R.T. disk temperatures
+ **	Command line parsing
  **
  **
  ***************************************************************************************************
@@ -638,56 +1310,87 @@ static void smfd_pch_temp_read(void)
  ***************************************************************************************************
  **************************************************************************************************/
 
-/* Initialize smfd_disks with a libatasmart "handle" for each disk */
-static void smfd_disk_init(void)
+static void smfd_parse_args(const int argc, char **const argv)
 {
-	unsigned i;
-
-	for (i = 0; i < smfd_disk_count; ++i) {
+	static const char help_msg[] =
+			"Usage: %s [-h|--help]\n"
+			"       %s [-d] [-s] [-k] [--shadow] [-c CONFIG_FILE ] [--sysfs-root DIR]\n"
+			"       %s [-c CONFIG_FILE] --boot-config SNAPSHOT\n"
+			"       %s [-s] [-c CONFIG_FILE] --check-config\n"
+			"\n"
+			"  -h, --help        show this message and exit\n"
+			"  -d                print/log debugging messages\n"
+			"  -s                log to syslog (when running in a terminal)\n"
+			"  -p                print/log configuration & exit (implies -d)\n"
+			"  -k                identify zone-to-sensor coupling & exit\n"
+			"  --shadow          don't control the fans; compare with the BMC\n"
+			"  -c CONFIG_FILE    configuration file [/etc/smfd/config.yaml]\n"
+			"  --sysfs-root DIR  read sysfs files below DIR (testing)\n"
+			"  --boot-config SNAPSHOT\n"
+			"                    write a configuration snapshot for smfd-boot & exit\n"
+			"  --check-config    validate the configuration file & exit\n";
 
-		smfd_temp_reset(&smfd_disks[i].temp);
+	int i;
 
-		if (sk_disk_open(smfd_disks[i].name, &smfd_disks[i].disk) < 0)
-			SMFD_FATAL("%s: %m\n", smfd_disks[i].name);
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			printf(help_msg, argv[0], argv[0], argv[0], argv[0]);
+			exit(EXIT_SUCCESS);
+		}
 	}
 
-	SMFD_DEBUG("smfd_disk_init finished\n");
-}
+	smfd_use_syslog = !isatty(STDERR_FILENO);
 
-/* Close the libatasmart handle for each disk in smfd_disks and free memory */
-static void smfd_disk_fini(void)
-{
-	unsigned i;
+	for (i = 1; i < argc; ++i) {
 
-	for (i = 0; i < smfd_disk_count; ++i) {
-		sk_disk_free(smfd_disks[i].disk);
-		free(smfd_disks[i].name);
-	}
+		if (strcmp(argv[i], "-d") == 0) {
+			smfd_debug = 1;
+			continue;
+		}
 
-	free(smfd_disks);
-}
+		if (strcmp(argv[i], "-s") == 0) {
+			smfd_use_syslog = 1;
+			continue;
+		}
 
-/* Read the temperature of each disk in smfd_disks */
-static void smfd_disk_read(void)
-{
-	uint64_t mkelvin;
-	unsigned i;
+		if (strcmp(argv[i], "-p") == 0) {
+			smfd_config_test = 1;
+			smfd_debug = 1;
+			continue;
+		}
 
-	for (i = 0; i < smfd_disk_count; ++i) {
+		if (strcmp(argv[i], "-k") == 0) {
+			smfd_commission = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--shadow") == 0) {
+			smfd_shadow = 1;
+			continue;
+		}
 
-		if (sk_disk_smart_read_data(smfd_disks[i].disk) < 0)
-			SMFD_FATAL("%s: %m\n", smfd_disks[i].name);
+		if (strcmp(argv[i], "-c") == 0) {
+			if ((smfd_config_file = argv[++i]) == NULL)
+				SMFD_FATAL("-c option requires configuration file\n");
+			continue;
+		}
 
-		if (sk_disk_smart_get_temperature(smfd_disks[i].disk, &mkelvin) < 0)
-			SMFD_FATAL("%s: %m\n", smfd_disks[i].name);
+		if (strcmp(argv[i], "--sysfs-root") == 0) {
+			if ((smfd_sysfs_root = argv[++i]) == NULL)
+				SMFD_FATAL("--sysfs-root option requires directory\n");
+			continue;
+		}
 
-		if (mkelvin > (uint64_t)INT_MAX) {
-			SMFD_FATAL("%s: temperature (%" PRIu64 ") out of range\n",
-				   smfd_disks[i].name, mkelvin);
+		if (strcmp(argv[i], "--boot-config") == 0) {
+			if ((smfd_boot_config_file = argv[++i]) == NULL)
+				SMFD_FATAL("--boot-config option requires snapshot file\n");
+			continue;
 		}
 
-		/* Absolute zero == -273.15°C */
-		smfd_update_temp(&smfd_disks[i].temp ,(mkelvin - 273150 + 500) / 1000);
+		if (strcmp(argv[i], "--check-config") == 0) {
+			smfd_config_check = 1;
+			continue;
+		}
 	}
 }
 
@@ -698,7 +1401,7 @@ static void smfd_disk_read(void)
  ***************************************************************************************************
  **
  **
- **	Raw IPMI commands to query/set BMC fan mode & fan zone speeds (percentages)
+ **	CPU affinity -- keep smfd off of isolated (latency-critical) CPUs
  **
  **
  ***************************************************************************************************
@@ -706,239 +1409,309 @@ static void smfd_disk_read(void)
  ***************************************************************************************************
  **************************************************************************************************/
 
-/* Send a raw command to the BMC; check for success and a response of the expected length */
-static void smfd_ipmi_raw_cmd(const uint8_t *const cmd, const unsigned int cmd_len,
-			      uint8_t *const restrict response, const unsigned int response_len)
+/*
+ * The housekeeping CPUs are the online CPUs in smfd's cgroup (cpuset.cpus.effective) and its
+ * inherited affinity, minus any CPUs isolated with isolcpus= or nohz_full=.  The main thread is
+ * pinned to them before any other thread is created, so every thread inherits the same affinity;
+ * smfd_cpu_verify() checks that after startup.
+ */
+
+/* Parse a kernel CPU list ("0-3,8,10-11"); returns 0 if it isn't valid */
+static _Bool smfd_cpu_parse_list(const char *p, cpu_set_t *const set)
 {
-	static const uint8_t net_fn = IPMI_NET_FN_OEM_SUPERMICRO_GENERIC_RQ;	/* 0x30 */
+	unsigned long first, last;
+	char *end;
 
-	char msg[IPMI_ERR_STR_MAX_LEN];
-	uint8_t resp[256];
-	int rc;
+	CPU_ZERO(set);
 
-	memset(resp, 0, sizeof resp);
+	for (p += strspn(p, " \t\n"); *p != 0 && *p != '\n'; ) {
 
-	if ((rc = ipmi_cmd_raw(smfd_ipmi, 0, net_fn, cmd, cmd_len, resp, sizeof resp)) < 0)
-		SMFD_FATAL("ipmi_cmd_raw: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+		if (!isdigit((unsigned char)*p))
+			return 0;
 
-	if (rc < 2)
-		SMFD_FATAL("Truncated(?) IPMI response (%d bytes)\n", rc);
+		first = last = strtoul(p, &end, 10);
 
-	if (resp[1] != IPMI_COMP_CODE_COMMAND_SUCCESS) {
-		if (ipmi_completion_code_strerror_r(resp[0], net_fn, resp[1], msg, sizeof msg) < 0)
-			snprintf(msg, sizeof msg, "[completion code %0x" PRIx8 "]", resp[1]);
-		SMFD_FATAL("IPMI command failed: %s\n", msg);
-	}
+		if (*end == '-') {
+			if (!isdigit((unsigned char)end[1]))
+				return 0;
+			last = strtoul(end + 1, &end, 10);
+		}
 
-	if (resp[0] != cmd[0]) {
-		SMFD_FATAL("IPMI response (0x%" PRIx8 ") did not match command (0x%" PRIx8 ")\n",
-			   resp[0], cmd[0]);
-	}
+		if (last < first || last >= CPU_SETSIZE)
+			return 0;
 
-	if ((unsigned int)rc != response_len + 2) {
-		SMFD_FATAL("Unexpected response data size (got %d bytes, expected %u)\n",
-			   rc - 2, response_len);
+		for (; first <= last; ++first)
+			CPU_SET(first, set);
+
+		if (*end == ',')
+			++end;
+		else if (*end != 0 && *end != '\n')
+			return 0;
+
+		p = end;
 	}
 
-	if (response_len > 0)
-		memcpy(response, resp + 2, response_len);
+	return 1;
 }
 
-/* Query the current BMC fan management mode */
-static uint8_t smfd_get_fan_mode(void)
+/* Read a CPU list from a sysfs or cgroup file; returns 0 if it can't be read */
+static _Bool smfd_cpu_read_list(const char *const path, cpu_set_t *const set)
 {
-	static const uint8_t cmd[] = {
-		SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE,
-		0x00
-	};
+	size_t size;
+	char *line;
+	_Bool ok;
+	FILE *fp;
 
-	uint8_t mode;
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
 
-	smfd_ipmi_raw_cmd(cmd, sizeof cmd, &mode, sizeof mode);
+	line = NULL;
+	size = 0;
 
-	return mode;
+	/* An empty file (e.g. no isolated CPUs) is an empty set */
+	if (getline(&line, &size, fp) < 0) {
+		CPU_ZERO(set);
+		ok = !ferror(fp);
+	}
+	else if (!(ok = smfd_cpu_parse_list(line, set))) {
+		SMFD_WARNING("%s: invalid CPU list: %s", path, line);
+	}
+
+	free(line);
+
+	if (fclose(fp) != 0)
+		SMFD_ERR("fclose: %m\n");
+
+	return ok;
 }
 
-/* Set the BMC fan management mode */
-static void smfd_set_fan_mode(const uint8_t mode)
+/* Read the effective cpuset of smfd's (v2) cgroup; returns 0 if it isn't available */
+static _Bool smfd_cpu_read_cgroup(cpu_set_t *const set)
 {
-	static uint8_t cmd[] = {
-		SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE,
-		0x01,
-		0x00	/* mode goes here */
-	};
+	size_t size;
+	char *line, *path;
+	_Bool ok;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+		return 0;
+
+	for (ok = 0, line = NULL, size = 0; getline(&line, &size, fp) > 0; ) {
+
+		if (strncmp(line, "0::", 3) != 0)
+			continue;
+
+		line[strcspn(line, "\n")] = 0;
+
+		if (asprintf(&path, "/sys/fs/cgroup%s/cpuset.cpus.effective", line + 3) < 0)
+			SMFD_ABORT("asprintf: %m\n");
+
+		ok = smfd_cpu_read_list(path, set);
+		free(path);
+		break;
+	}
+
+	free(line);
+
+	if (fclose(fp) != 0)
+		SMFD_ERR("fclose: %m\n");
 
-	cmd[2] = mode;
-	smfd_ipmi_raw_cmd(cmd, sizeof cmd, NULL, 0);
+	return ok;
 }
 
-/* Query the current fan duty cycle (percentage) of a zone */
-static uint8_t smfd_get_fan_percent(const uint8_t zone)
+/* Format a CPU set as a CPU list */
+static void smfd_cpu_format(const cpu_set_t *const set, char *const buf, const size_t size)
 {
-	uint8_t cmd[] = {
-		IPMI_CMD_OEM_SUPERMICRO_GENERIC_EXTENSION,
-		SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT,
-		0x00,
-		0x00	/* zone goes here */
-	};
+	unsigned int first, last;
+	size_t len;
 
-	uint8_t percent;
+	buf[0] = 0;
 
-	cmd[3] = zone;
-	smfd_ipmi_raw_cmd(cmd, sizeof cmd, &percent, sizeof percent);
+	for (len = 0, first = 0; first < CPU_SETSIZE && len < size; first = last + 1) {
 
-	return percent;
+		if (!CPU_ISSET(first, set)) {
+			last = first;
+			continue;
+		}
+
+		for (last = first; last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set); ++last);
+
+		if (last == first) {
+			len += snprintf(buf + len, size - len, "%s%u", (len == 0) ? "" : ",",
+					first);
+		}
+		else {
+			len += snprintf(buf + len, size - len, "%s%u-%u", (len == 0) ? "" : ",",
+					first, last);
+		}
+	}
 }
 
-/* Set the fan duty cycle (percentage) of a zone */
-static void smfd_set_fan_percent(const uint8_t zone, const uint8_t percent)
+/* Determine the housekeeping CPUs & pin the (main) thread to them; call before creating threads */
+static void smfd_cpu_init(void)
 {
-	uint8_t cmd[] = {
-		IPMI_CMD_OEM_SUPERMICRO_GENERIC_EXTENSION,
-		SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT,
-		0x01,
-		0x00,	/* zone goes here */
-		0x00	/* percent goes here */
-	};
+	cpu_set_t set, excl;
+	char buf[256];
 
-	cmd[3] = zone;
-	cmd[4] = percent;
-	smfd_ipmi_raw_cmd(cmd, sizeof cmd, NULL, 0);
-}
+	if (smfd_cpu_affinity != NULL && strcmp(smfd_cpu_affinity, "none") == 0)
+		return;
 
+	if (smfd_cpu_affinity != NULL && strcmp(smfd_cpu_affinity, "auto") != 0) {
+		if (!smfd_cpu_parse_list(smfd_cpu_affinity, &smfd_cpus))
+			SMFD_ABORT("Invalid CPU list: %s\n", smfd_cpu_affinity);
+	}
+	else {
+		if (sched_getaffinity(0, sizeof smfd_cpus, &smfd_cpus) != 0)
+			SMFD_FATAL("sched_getaffinity: %m\n");
 
-/***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- **
- **
- **	IPMI initialization & fan sensor reading
- **
- **
- ***************************************************************************************************
- ***************************************************************************************************
- ***************************************************************************************************
- **************************************************************************************************/
-
-/* Initialize a smfd_ipmi_fan by reading its record from the IPMI SDR cache */
-static void smfd_ipmi_fan_init(const ipmi_sdr_ctx_t sdr, struct smfd_ipmi_fan *const fan)
-{
-	uint8_t record_type, sensor_type;
-	uint16_t record_id;
-	int rc;
+		if (smfd_cpu_read_list("/sys/devices/system/cpu/online", &set))
+			CPU_AND(&smfd_cpus, &smfd_cpus, &set);
 
-	if (ipmi_sdr_cache_search_record_id(sdr, fan->record_id) < 0)
-		SMFD_FATAL("ipmi_sdr_cache_search_record_id: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+		if (smfd_cpu_read_cgroup(&set))
+			CPU_AND(&smfd_cpus, &smfd_cpus, &set);
 
-	if (ipmi_sdr_parse_record_id_and_type(sdr, NULL, 0, &record_id, &record_type) < 0)
-		SMFD_FATAL("ipmi_sdr_parse_record_id_and_type: %s\n", ipmi_sdr_ctx_errormsg(sdr));
-
-	assert(record_id == fan->record_id);
+		if (smfd_cpu_read_list("/sys/devices/system/cpu/isolated", &excl)) {
+			CPU_AND(&set, &smfd_cpus, &excl);
+			CPU_XOR(&smfd_cpus, &smfd_cpus, &set);
+		}
 
-	if (record_type != IPMI_SDR_FORMAT_FULL_SENSOR_RECORD)
-		SMFD_FATAL("%s [%" PRIu16 "] is not a full sensor record\n", fan->name, record_id);
+		if (smfd_cpu_read_list("/sys/devices/system/cpu/nohz_full", &excl)) {
+			CPU_AND(&set, &smfd_cpus, &excl);
+			CPU_XOR(&smfd_cpus, &smfd_cpus, &set);
+		}
 
-	if (ipmi_sdr_parse_sensor_type(sdr, NULL, 0, &sensor_type) < 0)
-		SMFD_FATAL("ipmi_sdr_parse_sensor_type: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+		if (CPU_COUNT(&smfd_cpus) == 0) {
+			SMFD_WARNING("No housekeeping CPUs found; CPU affinity not changed\n");
+			return;
+		}
+	}
 
-	if (sensor_type != IPMI_SENSOR_TYPE_FAN)
-		SMFD_FATAL("%s [%" PRIu16 "] is not a fan sensor\n", fan->name, record_id);
+	if (sched_setaffinity(0, sizeof smfd_cpus, &smfd_cpus) != 0) {
+		smfd_cpu_format(&smfd_cpus, buf, sizeof buf);
+		SMFD_FATAL("sched_setaffinity (%s): %m\n", buf);
+	}
 
-	if ((rc = ipmi_sdr_cache_record_read(sdr, fan->record, sizeof fan->record)) < 0)
-		SMFD_FATAL("ipmi_sdr_cache_record_read: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+	smfd_cpu_pinned = 1;
 
-	fan->record_len = rc;
+	smfd_cpu_format(&smfd_cpus, buf, sizeof buf);
+	SMFD_INFO("Running on housekeeping CPUs %s\n", buf);
 }
 
-/* Initialize smfd_ipmi, smfd_ipmi_fans & smfd_read; set fan mode to full & set all fans to 100% */
-static void smfd_ipmi_init(void)
+/* Get a thread's name & the CPU on which it last ran; returns 0 if it has exited */
+static _Bool smfd_cpu_thread_info(const pid_t tid, char *const name, const size_t size,
+				  int *const cpu)
 {
-	ipmi_sdr_ctx_t sdr;
-	unsigned i;
-	int rc;
+	char path[sizeof "/proc/self/task/4294967295/stat"], buf[1024];
+	const char *p;
+	unsigned int i;
+	ssize_t len;
+	int fd;
 
-	if ((smfd_ipmi = ipmi_ctx_create()) == NULL)
-		SMFD_ABORT("ipmi_ctx_create: %m\n");
+	snprintf(path, sizeof path, "/proc/self/task/%d/stat", (int)tid);
 
-	if ((rc = ipmi_ctx_find_inband(smfd_ipmi, NULL, 0, 0, 0, NULL, 0, 0)) < 0)
-		SMFD_FATAL("ipmi_ctx_find_inband: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
 
-	if (rc == 0)
-		SMFD_FATAL("Could not find in-band IPMI device\n");
+	len = read(fd, buf, sizeof buf - 1);
 
-	if ((sdr = ipmi_sdr_ctx_create()) == NULL)
-		SMFD_ABORT("ipmi_sdr_ctx_create: %m\n");
+	if (close(fd) != 0)
+		SMFD_ERR("close: %m\n");
 
-	if (ipmi_sdr_cache_open(sdr, smfd_ipmi, smfd_sdr_cache) < 0)
-		SMFD_FATAL("ipmi_sdr_cache_open: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+	if (len <= 0)
+		return 0;
 
-	for (i = 0; i < smfd_ipmi_fan_count; ++i)
-		smfd_ipmi_fan_init(sdr, &smfd_ipmi_fans[i]);
+	buf[len] = 0;
 
-	if (ipmi_sdr_cache_close(sdr) < 0)
-		SMFD_ERR("ipmi_sdr_cache_close: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+	/* Fields: pid (comm) state ... -- processor is field 39 */
+	if ((p = strchr(buf, '(')) == NULL)
+		return 0;
 
-	ipmi_sdr_ctx_destroy(sdr);
+	snprintf(name, size, "%.*s", (int)strcspn(p + 1, ")"), p + 1);
 
-	if ((smfd_read = ipmi_sensor_read_ctx_create(smfd_ipmi)) == NULL)
-		SMFD_FATAL("ipmi_sensor_read_ctx_create: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+	if ((p = strrchr(buf, ')')) == NULL)
+		return 0;
 
-	SMFD_NOTICE("Setting BMC fan management mode to full (manual)\n");
-	smfd_set_fan_mode(SMFD_SUPERMICRO_FAN_MODE_FULL);
+	for (i = 2; i < 39 && p != NULL; ++i)
+		p = strchr(p + 1, ' ');
 
-	SMFD_NOTICE("Setting CPU fan to 100%%\n");
-	smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, 100);
+	*cpu = (p == NULL) ? -1 : atoi(p + 1);
 
-	SMFD_NOTICE("Setting system fan to 100%%\n");
-	smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, 100);
+	return 1;
+}
 
-	SMFD_DEBUG("smfd_ipmi_init finished\n");
+/*
+ * Call a function for each of smfd's threads; threads can exit while they are being examined, so
+ * the callback must tolerate errors
+ */
+static void smfd_cpu_for_each_thread(void (*const fn)(pid_t tid))
+{
+	struct dirent *d;
+	DIR *dir;
+
+	if ((dir = opendir("/proc/self/task")) == NULL)
+		SMFD_FATAL("/proc/self/task: %m\n");
+
+	while ((d = readdir(dir)) != NULL) {
+		if (isdigit((unsigned char)d->d_name[0]))
+			fn(atoi(d->d_name));
+	}
+
+	if (closedir(dir) != 0)
+		SMFD_ERR("closedir: %m\n");
 }
 
-/* Close/destroy FreeIPMI contexts (smfd_ipmi and smfd_read) & free smfd_ipmi_fans */
-static void smfd_ipmi_fini(void)
+/* Fatal error if a thread can run outside the housekeeping CPUs */
+static void smfd_cpu_verify_thread(const pid_t tid)
 {
-	unsigned i;
+	char name[32], buf[256];
+	cpu_set_t set, outside;
+	int cpu;
 
-	ipmi_sensor_read_ctx_destroy(smfd_read);
+	if (sched_getaffinity(tid, sizeof set, &set) != 0)
+		return;		/* thread has exited */
 
-	if (ipmi_ctx_close(smfd_ipmi) < 0)
-		SMFD_ERR("ipmi_ctx_close: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+	CPU_AND(&outside, &set, &smfd_cpus);
+	CPU_XOR(&outside, &outside, &set);
 
-	ipmi_ctx_destroy(smfd_ipmi);
+	if (CPU_COUNT(&outside) == 0)
+		return;
 
-	for (i = 0; i < smfd_ipmi_fan_count; ++i)
-		free(smfd_ipmi_fans[i].name);
+	if (!smfd_cpu_thread_info(tid, name, sizeof name, &cpu))
+		return;
 
-	free(smfd_ipmi_fans);
+	smfd_cpu_format(&set, buf, sizeof buf);
+	SMFD_FATAL("Thread %s (%d) can run on non-housekeeping CPUs (%s)\n", name, (int)tid, buf);
 }
 
-/* Read the current RPM of all IPMI fans */
-static void smfd_ipmi_fan_read(void)
+/* Check that no thread can run outside the housekeeping CPUs; call after all threads start */
+static void smfd_cpu_verify(void)
 {
-	uint16_t bitmask;
-	double *reading;
-	unsigned i;
-	int rc;
+	if (smfd_cpu_pinned)
+		smfd_cpu_for_each_thread(smfd_cpu_verify_thread);
+}
 
-	for (i = 0; i < smfd_ipmi_fan_count; ++i) {
+/* Log the CPU placement of 1 thread */
+static void smfd_cpu_log_thread(const pid_t tid)
+{
+	char name[32], buf[256];
+	cpu_set_t set;
+	int cpu;
 
-		rc = ipmi_sensor_read(smfd_read, smfd_ipmi_fans[i].record,
-				      smfd_ipmi_fans[i].record_len, 0, NULL, &reading, &bitmask);
-		if (rc <= 0) {
-			SMFD_FATAL("ipmi_sensor_read: %s\n",
-				   ipmi_sensor_read_ctx_errormsg(smfd_read));
-		}
+	if (!smfd_cpu_thread_info(tid, name, sizeof name, &cpu))
+		return;
 
-		if (*reading < 0 || *reading > UINT_MAX) {
-			SMFD_FATAL("%s fan (%g RPM) out of range\n",
-				   smfd_ipmi_fans[i].name, *reading);
-		}
+	if (sched_getaffinity(tid, sizeof set, &set) != 0)
+		return;
 
-		smfd_ipmi_fans[i].rpm = *reading;
-		free(reading);
-	}
+	smfd_cpu_format(&set, buf, sizeof buf);
+	SMFD_INFO("Thread %s (%d): last ran on CPU %d; allowed CPUs: %s\n",
+		  name, (int)tid, cpu, buf);
+}
+
+/* Log the CPU placement of every thread */
+static void smfd_cpu_log_threads(void)
+{
+	smfd_cpu_for_each_thread(smfd_cpu_log_thread);
 }
 
 
@@ -948,7 +1721,7 @@ static void smfd_ipmi_fan_read(void)
  ***************************************************************************************************
  **
  **
- **	Process temperatures/thresholds to determine fan percentages
+ **	Sensor failure handling
  **
  **
  ***************************************************************************************************
@@ -956,149 +1729,75 @@ static void smfd_ipmi_fan_read(void)
  ***************************************************************************************************
  **************************************************************************************************/
 
-/* Process 1 temperature against a set of thresholds */
-static void smfd_process_temp(const int temp, struct smfd_temp_threshold *const cfg,
-			      const char *const name, struct smfd_process_temp_result *const result)
-{
-	struct smfd_temp_threshold *t, *max;
-
-	for (max = NULL, t = cfg; t->name != NULL; ++t) {
-
-		if (t->active) {
-			if (temp >= t->hysteresis) {
-				SMFD_DEBUG("%s temperature (%d) still exceeds %s hysteresis (%d)\n",
-					   name, temp, t->name, t->hysteresis);
-				/* no need to set t-> active; it already is */
-				max = t;
-			}
-			else {
-				SMFD_INFO("%s temperature (%d) "
-					  "no longer exceeds %s hysteresis (%d)\n",
-					  name, temp, t->name, t->hysteresis);
-				t->active = 0;
-			}
-		}
-		else {
-			if (temp >= t->threshold) {
-				SMFD_INFO("%s temperature (%d) exceeds %s threshold (%d)\n",
-					  name, temp, t->name, t->hysteresis);
-				t->active = 1;
-				max = t;
-			}
-		}
-	}
-
-	if (max != NULL) {
-		SMFD_DEBUG("%s temperature (%d) ==> "
-			   "%s fan settings (CPU: %" PRIu8 "%%, SYS: %" PRIu8 "%%)\n",
-			   name, temp, max->name, max->cpu_fan_percent, max->sys_fan_percent);
-		result->cpu_fan_percent = max->cpu_fan_percent;
-		result->cpu_threshold = max;
-		result->sys_fan_percent = max->sys_fan_percent;
-		result->sys_threshold = max;
-	}
-	else {
-		SMFD_DEBUG("%s temperature (%d) ==> "
-			   "base fan settings (CPU: %" PRIu8 "%%, SYS: %" PRIu8 "%%)\n",
-			   name, temp, smfd_cpu_fan_base, smfd_sys_fan_base);
-		result->cpu_fan_percent = smfd_cpu_fan_base;
-		result->cpu_threshold = NULL;
-		result->sys_fan_percent = smfd_sys_fan_base;
-		result->sys_threshold = NULL;
-	}
-}
+/* Longest interval between retries of a failed sensor (ms) */
+#define SMFD_SENSOR_RETRY_MAX	(600 * 1000)
 
-/* Process the PCH temperature/thresholds */
-static void smfd_process_pch_temp(struct smfd_process_temp_result *const result)
+/* Should a sensor be read during this cycle?  (Failed sensors are only retried after backoff.) */
+static _Bool smfd_sensor_due(const struct smfd_temperature *const temp)
 {
-	smfd_process_temp(smfd_pch_temp.current, smfd_cfg_pch_temp, "PCH", result);
+	return temp->state != SMFD_SENSOR_FAILED || smfd_sample_time >= temp->retry_at;
 }
 
-/* Process the highest CPU (coretemp) temperature/thresholds */
-static void smfd_process_cpu_temps(struct smfd_process_temp_result *const result)
-{
-	struct smfd_coretemp *max;
-	unsigned i;
-
-	for (max = &smfd_coretemps[0], i = 1; i < smfd_coretemp_count; ++i) {
-		if (smfd_coretemps[i].temp.current > max->temp.current)
-			max = &smfd_coretemps[i];
-	}
-
-	SMFD_DEBUG("Highest CPU temperature is %d (%s)\n", max->temp.current, max->name);
+static void smfd_safety_check(const char *name, enum smfd_group group, int temp);
 
-	smfd_process_temp(max->temp.current, smfd_cfg_cpu_temp, "CPU", result);
-}
-
-/* Process the highest disk temperature/thresholds */
-static void smfd_process_disk_temps(struct smfd_process_temp_result *const result)
+/* Record a good reading (re-admits a stale or failed sensor) & check its group's safety limit */
+static void smfd_sensor_ok(const char *const name, const enum smfd_group group,
+			   struct smfd_temperature *const temp, const int current)
 {
-	struct smfd_disk *max;
-	unsigned i;
-
-	for (max = &smfd_disks[0], i = 1; i < smfd_disk_count; ++i) {
-		if (smfd_disks[i].temp.current > max->temp.current)
-			max = &smfd_disks[i];
-	}
+	if (temp->state != SMFD_SENSOR_OK)
+		SMFD_NOTICE("%s sensor is readable again (%d°C)\n", name, current);
 
-	SMFD_DEBUG("Highest disk temperature is %d (%s)\n", max->temp.current, max->name);
+	temp->state = SMFD_SENSOR_OK;
+	temp->last_ok = smfd_sample_time;
+	temp->retry_delay = 0;
 
-	smfd_process_temp(max->temp.current, smfd_cfg_disk_temp, "disk",result);
+	smfd_update_temp(temp, current);
+	smfd_safety_check(name, group, current);
 }
 
-/* Process all temperature readings and set the fan speeds */
-static void smfd_process_all_temps(void)
+/* Record a failed read and advance the sensor's state according to its group's policy */
+static void smfd_sensor_fail(const char *const name, const enum smfd_group group,
+			     struct smfd_temperature *const temp)
 {
-	struct smfd_process_temp_result results[3] = {
-		{ .name = "PCH" },
-		{ .name = "CPU" },
-		{ .name = "disk" }
-	};
-
-	const struct smfd_process_temp_result *cpu, *sys;
-	unsigned i;
-
-	smfd_process_pch_temp(&results[0]);
-	smfd_process_cpu_temps(&results[1]);
-	smfd_process_disk_temps(&results[2]);
-
-	for (cpu = sys= &results[0], i = 1; i < 3; ++i) {
-		if (results[i].cpu_fan_percent > cpu->cpu_fan_percent)
-			cpu = &results[i];
-		if (results[i].sys_fan_percent > sys->sys_fan_percent)
-			sys = &results[i];
+	const struct smfd_sensor_policy *const policy = &smfd_sensor_policies[group];
+
+	if (temp->state == SMFD_SENSOR_FAILED) {
+		temp->retry_delay = (temp->retry_delay > SMFD_SENSOR_RETRY_MAX / 2) ?
+						SMFD_SENSOR_RETRY_MAX : temp->retry_delay * 2;
+		temp->retry_at = smfd_sample_time + temp->retry_delay;
+		SMFD_DEBUG("%s sensor still failed; next retry in %u seconds\n",
+			   name, temp->retry_delay / 1000);
+		return;
 	}
 
-	SMFD_DEBUG("%s temperature ==> CPU fan @ %" PRIu8 "%%\n", cpu->name, cpu->cpu_fan_percent);
-	SMFD_DEBUG("%s temperature ==> SYS fan @ %" PRIu8 "%%\n", sys->name, sys->sys_fan_percent);
-
-	if (cpu->cpu_fan_percent != smfd_cpu_fan_percent) {
+	if (policy->policy == SMFD_FAIL_HOLD && temp->last_ok != 0
+			&& smfd_sample_time - temp->last_ok < (int64_t)policy->hold_time * 1000) {
 
-		if (cpu->cpu_threshold == NULL) {
-			SMFD_NOTICE("Setting CPU fan to %" PRIu8 "%%\n", cpu->cpu_fan_percent);
-		}
-		else {
-			SMFD_NOTICE("Setting CPU fan to %" PRIu8 "%% (%s %s threshold)\n",
-				    cpu->cpu_fan_percent, cpu->name, cpu->cpu_threshold->name);
+		if (temp->state == SMFD_SENSOR_OK) {
+			SMFD_WARNING("%s sensor is stale; using last reading (%d°C) "
+				     "for up to %u seconds\n", name, temp->current,
+				     policy->hold_time);
+			temp->state = SMFD_SENSOR_STALE;
 		}
 
-		smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, cpu->cpu_fan_percent);
-		smfd_cpu_fan_percent = cpu->cpu_fan_percent;
+		return;
 	}
 
-	if (sys->sys_fan_percent != smfd_sys_fan_percent) {
+	SMFD_ERR("%s sensor has failed; %s\n", name,
+		 (policy->policy == SMFD_FAIL_IGNORE) ?
+				"ignoring it" : "demanding maximum cooling");
 
-		if (sys->sys_threshold == NULL) {
-			SMFD_NOTICE("Setting system fan to %" PRIu8 "%%\n", sys->sys_fan_percent);
-		}
-		else {
-			SMFD_NOTICE("Setting system fan to %" PRIu8 "%% (%s %s threshold)\n",
-				    sys->sys_fan_percent, sys->name, sys->sys_threshold->name);
-		}
+	temp->state = SMFD_SENSOR_FAILED;
+	temp->retry_delay = (smfd_sample_interval < 1000) ? 1000 : smfd_sample_interval;
+	temp->retry_at = smfd_sample_time + temp->retry_delay;
+}
 
-		smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, sys->sys_fan_percent);
-		smfd_sys_fan_percent = sys->sys_fan_percent;
-	}
+/* Does a (failed) sensor demand maximum cooling? */
+static _Bool smfd_sensor_demands_max(const struct smfd_temperature *const temp,
+				     const enum smfd_group group)
+{
+	return temp->state == SMFD_SENSOR_FAILED
+			&& smfd_sensor_policies[group].policy != SMFD_FAIL_IGNORE;
 }
 
 
@@ -1108,7 +1807,7 @@ static void smfd_process_all_temps(void)
  ***************************************************************************************************
  **
  **
- **	Configuration file
+ **	coretemp & PCH temperatures
  **
  **
  ***************************************************************************************************
@@ -1116,484 +1815,9074 @@ static void smfd_process_all_temps(void)
  ***************************************************************************************************
  **************************************************************************************************/
 
-/* Print/log config settings in smfd_cfg_cpu_temp, smfd_cfg_pch_temp or smfd_cfg_disk_temp */
-static void smfd_dump_threshold_config(const char *const restrict name,
-				       const struct smfd_temp_threshold *thresh)
+/* Initialize smfd_coretemps with the name of each coretemp input and an open stream to each */
+static void smfd_coretemp_init(void)
 {
-	unsigned int i;
-
-	SMFD_DEBUG("  %s:\n", name);
+	char buf[sizeof "temp4294967295_input"];
+	char *hwmon_dir, **labels;
+	int dirfd, rc, fd;
+	size_t label_size;
+	unsigned i;
+	FILE *fp;
 
-	for (i = 0; thresh->name != NULL; ++i, ++thresh) {
-		SMFD_DEBUG("    [%u]:\n", i);
-		SMFD_DEBUG("      .name: %s\n", thresh->name);
-		SMFD_DEBUG("      .threshold: %d\n", thresh->threshold);
-		SMFD_DEBUG("      .hysteresis: %d\n", thresh->hysteresis);
-		SMFD_DEBUG("      .cpu_fan_percent: %" PRIu8 "\n", thresh->cpu_fan_percent);
-		SMFD_DEBUG("      .sys_fan_percent: %" PRIu8 "\n", thresh->sys_fan_percent);
+	if (asprintf(&hwmon_dir, "%s/sys/devices/platform/coretemp.0/hwmon/hwmon2",
+		     smfd_sysfs_root) < 0) {
+		SMFD_ABORT("asprintf: %m\n");
 	}
-}
 
-/* Print/log all configuration settings */
-static void smfd_dump_config(void)
-{
-	unsigned int i;
+	if ((dirfd = open(hwmon_dir, O_DIRECTORY | O_PATH)) < 0)
+		SMFD_FATAL("%s: %m\n", hwmon_dir);
 
-	if (!smfd_debug)
-		return;
+	for (labels = NULL, i = 0; ; ++i) {
 
-	SMFD_DEBUG("  smfd_sdr_cache: %s\n", smfd_sdr_cache);
-	SMFD_DEBUG("  smfd_log_interval: %u\n", smfd_log_interval);
-	SMFD_DEBUG("  smfd_cpu_fan_base: %" PRIu8 "\n", smfd_cpu_fan_base);
-	SMFD_DEBUG("  smfd_sys_fan_base: %" PRIu8 "\n", smfd_sys_fan_base);
+		if ((rc = snprintf(buf, sizeof buf, "temp%u_label", i + 1)) < 0)
+			SMFD_ABORT("snprintf: %m\n");
 
-	smfd_dump_threshold_config("smfd_cfg_cpu_temp", smfd_cfg_cpu_temp);
-	smfd_dump_threshold_config("smfd_cfg_pch_temp", smfd_cfg_pch_temp);
-	smfd_dump_threshold_config("smfd_cfg_disk_temp", smfd_cfg_disk_temp);
+		if (rc >= (int)sizeof buf)
+			SMFD_FATAL("File name truncated: temp%u_label", i + 1);
 
-	SMFD_DEBUG("  smfd_ipmi_fans:\n");
+		if ((fd = openat(dirfd, buf, O_RDONLY)) < 0) {
+			if (errno == ENOENT)
+				break;
+			SMFD_FATAL("%s/%s: %m\n", hwmon_dir, buf);
+		}
 
-	for (i = 0; i < smfd_ipmi_fan_count; ++i) {
-		SMFD_DEBUG("    [%u]:\n", i);
-		SMFD_DEBUG("      .record_id: %" PRIu16 "\n", smfd_ipmi_fans[i].record_id);
-		SMFD_DEBUG("      .name: %s\n", smfd_ipmi_fans[i].name);
-	}
+		if ((fp = fdopen(fd, "r")) == NULL)
+			SMFD_ABORT("fdopen: %m\n");
 
-	SMFD_DEBUG("  smfd_disks:\n");
+		if ((labels = realloc(labels, (i + 1) * sizeof *labels)) == NULL)
+			SMFD_ABORT("realloc: %m\n");
 
-	for (i = 0; i < smfd_disk_count; ++i) {
-		SMFD_DEBUG("    [%u]:\n", i);
-		SMFD_DEBUG("      .name: %s\n", smfd_disks[i].name);
-	}
+		labels[i] = NULL;
+		label_size = 0;
 
-	if (smfd_config_test)
-		exit(EXIT_SUCCESS);
-}
+		if ((rc = getline(&labels[i], &label_size, fp)) < 0)
+			SMFD_FATAL("getline: %m\n");
 
-/* Fatal error if the node is not of the expected type */
-static void smfd_check_node_type(const yaml_node_t *const node, const char *const restrict name,
-				 const yaml_node_type_t type, const char *const restrict type_name)
-{
-	if (node->type != type)
-		SMFD_CFG_FATAL("value of %s is not a %s\n", node, name, type_name);
-}
+		assert(rc >= (int)sizeof "Core 0");
 
-/* Fatal error if the node is not a YAML_SCALAR_NODE */
-static void smfd_check_scalar(const yaml_node_t *const node, const char *const restrict name)
-{
-	smfd_check_node_type(node, name, YAML_SCALAR_NODE, "scalar");
-}
+		if (labels[i][rc - 1] == '\n')
+			labels[i][rc - 1] = 0;
 
-/* Fatal error if the node is not a YAML_SEQUENCE_NODE */
-static void smfd_check_sequence(const yaml_node_t *const node, const char *const restrict name)
+		if (fclose(fp) != 0)
+			SMFD_FATAL("fclose: %m\n");
+	}
+
+	if (i == 0)
+		SMFD_FATAL("No temperature inputs found in %s\n", hwmon_dir);
+
+	smfd_coretemp_count = i;
+	SMFD_DEBUG("Found %u coretemp inputs\n", i);
+
+	if ((smfd_coretemps = malloc(smfd_coretemp_count * sizeof *smfd_coretemps)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	for (i = 0; i < smfd_coretemp_count; ++i) {
+
+		smfd_coretemps[i].name = labels[i];
+		smfd_temp_reset(&smfd_coretemps[i].temp);
+
+		if ((rc = snprintf(buf, sizeof buf, "temp%u_input", i + 1)) < 0)
+			SMFD_ABORT("snprintf: %m\n");
+
+		if (rc >= (int) sizeof buf)
+			SMFD_FATAL("File name truncated: temp%u_input\n", i + 1);
+
+		if ((fd = openat(dirfd, buf, O_RDONLY)) < 0)
+			SMFD_FATAL("%s/%s: %m\n", hwmon_dir, buf);
+
+		if ((smfd_coretemps[i].fp = fdopen(fd, "r")) == NULL)
+			SMFD_ABORT("fdopen: %m\n");
+
+		if (setvbuf(smfd_coretemps[i].fp, NULL, _IONBF, 0) != 0)
+			SMFD_ABORT("setvbuf: %m\n");
+	}
+
+	if (close(dirfd) != 0)
+		SMFD_FATAL("close: %m\n");
+
+	free(labels);
+	free(hwmon_dir);
+
+	SMFD_DEBUG("smfd_coretemp_init finished\n");
+}
+
+/* Initialize smfd_pch_temp_fp with an open stream to the PCH temperature input */
+static void smfd_pch_temp_init(void)
+{
+	char *input;
+
+	smfd_temp_reset(&smfd_pch_temp);
+
+	if (asprintf(&input, "%s/sys/devices/virtual/thermal/thermal_zone0/hwmon0/temp1_input",
+		     smfd_sysfs_root) < 0) {
+		SMFD_ABORT("asprintf: %m\n");
+	}
+
+	if ((smfd_pch_temp_fp = fopen(input, "r")) == NULL)
+		SMFD_FATAL("%s: %m\n", input);
+
+	free(input);
+
+	if (setvbuf(smfd_pch_temp_fp, NULL, _IONBF, 0) != 0)
+		SMFD_ABORT("setvbuf: %m\n");
+
+	SMFD_DEBUG("smfd_pch_temp_init finished\n");
+}
+
+/* Clean up smfd_coretemps - close streams & free memory */
+static void smfd_coretemp_fini(void)
+{
+	unsigned i;
+
+	for (i = 0; i < smfd_coretemp_count; ++i) {
+
+		free(smfd_coretemps[i].name);
+
+		if (fclose(smfd_coretemps[i].fp) != 0)
+			SMFD_ERR("fclose: %m\n");
+	}
+
+	free(smfd_coretemps);
+}
+
+/* Close smfd_pch_temp_fp */
+static void smfd_pch_temp_fini(void)
+{
+	if (fclose(smfd_pch_temp_fp) != 0)
+		SMFD_ERR("fclose: %m\n");
+}
+
+/* Read & parse a coretemp or PCH temperature */
+static void smfd_temp_read(FILE *const fp, const char *const name, const enum smfd_group group,
+			   struct smfd_temperature *const temp)
+{
+	int rc, reading;
+
+	if (!smfd_sensor_due(temp))
+		return;
+
+	rewind(fp);
+
+	if ((rc = fscanf(fp, "%d", &reading)) == EOF) {
+		if (temp->state == SMFD_SENSOR_OK)
+			SMFD_WARNING("%s: %m\n", name);
+		smfd_sensor_fail(name, group, temp);
+		return;
+	}
+
+	if (rc != 1) {
+		if (temp->state == SMFD_SENSOR_OK)
+			SMFD_WARNING("Failed to parse %s temperature\n", name);
+		smfd_sensor_fail(name, group, temp);
+		return;
+	}
+
+	smfd_sensor_ok(name, group, temp, (reading + 500) / 1000);
+
+	if (temp->current < 0 || temp->current > 120)
+		SMFD_WARNING("%s reading (%d°C) is probably garbage\n", name, temp->current);
+}
+
+/* Read & parse the temperature from every coretemp input */
+static void smfd_coretemp_read(void)
+{
+	unsigned i;
+
+	for (i = 0; i < smfd_coretemp_count; ++i) {
+
+		smfd_temp_read(smfd_coretemps[i].fp, smfd_coretemps[i].name, SMFD_GROUP_CPU,
+			       &smfd_coretemps[i].temp);
+	}
+}
+
+/* Read & parse the PCH temperature */
+static void smfd_pch_temp_read(void)
+{
+	smfd_temp_read(smfd_pch_temp_fp, "PCH", SMFD_GROUP_PCH, &smfd_pch_temp);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	RAID/HBA controller temperatures
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Storage controllers are often the hottest components in a storage server.  Their temperatures
+ * are read from sysfs (no vendor CLI tools), either from inputs matched by a glob, or from every
+ * temperature input of the hwmon devices bound to a driver.  Each source's inputs join a sensor
+ * group, and are read every cycle, like the coretemp inputs.  (Controllers that only report their
+ * temperature through management ioctls need a plugin.)
+ */
+
+/* Open 1 controller temperature input */
+static void smfd_ctrl_add(const struct smfd_ctrl_source *const src, const char *const path,
+			  const unsigned int index, const unsigned int count)
+{
+	struct smfd_ctrl_temp *const ctrl = &smfd_ctrl_temps[smfd_ctrl_temp_count++];
+
+	memset(ctrl, 0, sizeof *ctrl);
+
+	if (count == 1)
+		ctrl->name = smfd_strdup(src->name);
+	else if (asprintf(&ctrl->name, "%s %u", src->name, index + 1) < 0)
+		SMFD_ABORT("asprintf: %m\n");
+
+	if ((ctrl->fp = fopen(path, "re")) == NULL)
+		SMFD_FATAL("%s: %m\n", path);
+
+	if (setvbuf(ctrl->fp, NULL, _IONBF, 0) != 0)
+		SMFD_ABORT("setvbuf: %m\n");
+
+	ctrl->group = src->group;
+	smfd_temp_reset(&ctrl->temp);
+
+	SMFD_DEBUG("%s controller temperature: %s\n", ctrl->name, path);
+}
+
+/* Find the temperature inputs of the hwmon devices bound to a driver; returns glob's result */
+static int smfd_ctrl_glob_driver(const char *const driver, glob_t *const inputs)
+{
+	char path[PATH_MAX], link[PATH_MAX];
+	const char *name;
+	int flags, rc;
+	unsigned int i;
+	ssize_t len;
+	glob_t g;
+
+	snprintf(path, sizeof path, "%s/sys/class/hwmon/hwmon*", smfd_sysfs_root);
+
+	if ((rc = glob(path, 0, NULL, &g)) != 0)
+		return rc;
+
+	for (rc = GLOB_NOMATCH, flags = 0, i = 0; i < g.gl_pathc; ++i) {
+
+		snprintf(path, sizeof path, "%s/device/driver", g.gl_pathv[i]);
+
+		if ((len = readlink(path, link, sizeof link - 1)) < 0)
+			continue;	/* not a device (or no driver) */
+
+		link[len] = 0;
+		name = strrchr(link, '/');
+
+		if (strcmp((name == NULL) ? link : name + 1, driver) != 0)
+			continue;
+
+		snprintf(path, sizeof path, "%s/temp*_input", g.gl_pathv[i]);
+
+		if (glob(path, flags, NULL, inputs) == 0) {
+			flags = GLOB_APPEND;
+			rc = 0;
+		}
+	}
+
+	globfree(&g);
+
+	return rc;
+}
+
+/* Open the temperature inputs matched by each controller temperature source */
+static void smfd_ctrl_init(void)
+{
+	const struct smfd_ctrl_source *src;
+	char path[PATH_MAX];
+	unsigned int i, j;
+	size_t n;
+	glob_t g;
+	int rc;
+
+	for (i = 0; i < smfd_ctrl_source_count; ++i) {
+
+		src = &smfd_ctrl_sources[i];
+
+		if (src->path != NULL) {
+			snprintf(path, sizeof path, "%s%s", smfd_sysfs_root, src->path);
+			rc = glob(path, 0, NULL, &g);
+		}
+		else {
+			rc = smfd_ctrl_glob_driver(src->driver, &g);
+		}
+
+		if (rc == GLOB_NOMATCH) {
+			SMFD_FATAL("No temperature inputs found for %s controller (%s)\n",
+				   src->name, (src->path != NULL) ? src->path : src->driver);
+		}
+
+		if (rc != 0)
+			SMFD_FATAL("Failed to find %s controller temperature inputs\n", src->name);
+
+		n = smfd_ctrl_temp_count + g.gl_pathc;
+		smfd_ctrl_temps = realloc(smfd_ctrl_temps, n * sizeof *smfd_ctrl_temps);
+		if (smfd_ctrl_temps == NULL)
+			SMFD_ABORT("realloc: %m\n");
+
+		for (j = 0; j < g.gl_pathc; ++j)
+			smfd_ctrl_add(src, g.gl_pathv[j], j, g.gl_pathc);
+
+		globfree(&g);
+	}
+
+	SMFD_DEBUG("smfd_ctrl_init finished (%u inputs)\n", smfd_ctrl_temp_count);
+}
+
+/* Close the controller temperature inputs & free the sources */
+static void smfd_ctrl_fini(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < smfd_ctrl_temp_count; ++i) {
+
+		free(smfd_ctrl_temps[i].name);
+
+		if (fclose(smfd_ctrl_temps[i].fp) != 0)
+			SMFD_ERR("fclose: %m\n");
+	}
+
+	free(smfd_ctrl_temps);
+
+	for (i = 0; i < smfd_ctrl_source_count; ++i) {
+		free(smfd_ctrl_sources[i].name);
+		free(smfd_ctrl_sources[i].path);
+		free(smfd_ctrl_sources[i].driver);
+	}
+
+	free(smfd_ctrl_sources);
+}
+
+/* Read & parse every controller temperature */
+static void smfd_ctrl_read(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < smfd_ctrl_temp_count; ++i) {
+		smfd_temp_read(smfd_ctrl_temps[i].fp, smfd_ctrl_temps[i].name,
+			       smfd_ctrl_temps[i].group, &smfd_ctrl_temps[i].temp);
+	}
+}
+
+/*
+ * Raise *max to the highest readable controller temperature in a group (and set *name, if not
+ * NULL).  Returns whether a failed controller sensor in the group demands maximum cooling.
+ */
+static _Bool smfd_ctrl_group_max(const enum smfd_group group, int *const max,
+				 const char **const name)
+{
+	const struct smfd_ctrl_temp *c;
+	_Bool failed;
+	unsigned int i;
+
+	for (failed = 0, i = 0; i < smfd_ctrl_temp_count; ++i) {
+
+		c = &smfd_ctrl_temps[i];
+
+		if (c->group != group)
+			continue;
+
+		if (c->temp.state == SMFD_SENSOR_FAILED) {
+			failed |= smfd_sensor_demands_max(&c->temp, group);
+			continue;
+		}
+
+		if (c->temp.current > *max) {
+			*max = c->temp.current;
+			if (name != NULL)
+				*name = c->name;
+		}
+	}
+
+	return failed;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Sensor & actuator plugins
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Plugins are shared objects (see smfd-plugin.h) loaded from the plugin directory.  Their sensors
+ * join the groups in the configuration file, alongside the coretemp, PCH & disk temperatures, and
+ * their fan zones can be used as actuators.  A plugin reads each temperature directly into its
+ * slot in smfd_plugin_temps, and is called from the control loop, so there is no per-read IPC.
+ */
+
+/* Log a message on behalf of a plugin */
+__attribute__((format(printf, 3, 4)))
+static void smfd_plugin_log(const struct smfd_plugin_instance *const inst, const int priority,
+			    const char *const format, ...)
+{
+	static const char *const levels[] = {
+		[LOG_EMERG]	= "EMERG",
+		[LOG_ALERT]	= "ALERT",
+		[LOG_CRIT]	= "CRIT",
+		[LOG_ERR]	= "ERR",
+		[LOG_WARNING]	= "WARNING",
+		[LOG_NOTICE]	= "NOTICE",
+		[LOG_INFO]	= "INFO"
+	};
+
+	char buf[512];
+	va_list ap;
+
+	if (priority == LOG_DEBUG && !smfd_debug)
+		return;
+
+	va_start(ap, format);
+	vsnprintf(buf, sizeof buf, format, ap);
+	va_end(ap);
+
+	/* Like SMFD_DEBUG, debug messages are logged at INFO priority */
+	if (priority == LOG_DEBUG)
+		smfd_log(LOG_INFO, "DEBUG: %s plugin: %s", inst->name, buf);
+	else if (priority >= LOG_EMERG && priority < LOG_DEBUG)
+		smfd_log(priority, "%s: %s plugin: %s", levels[priority], inst->name, buf);
+	else
+		smfd_log(LOG_ERR, "ERR: %s plugin: %s", inst->name, buf);
+}
+
+static const struct smfd_plugin_host smfd_plugin_services = {
+	.abi	= SMFD_PLUGIN_ABI,
+	.log	= smfd_plugin_log
+};
+
+/* Find a plugin by name (NULL if it isn't in the configuration file) */
+static struct smfd_plugin_lib *smfd_plugin_find(const char *const name)
+{
+	unsigned int i;
+
+	for (i = 0; i < smfd_plugin_lib_count; ++i) {
+		if (strcmp(smfd_plugin_libs[i].name, name) == 0)
+			return &smfd_plugin_libs[i];
+	}
+
+	return NULL;
+}
+
+/* Load a plugin, check its ABI version & initialize it */
+static void smfd_plugin_load(struct smfd_plugin_lib *const lib)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof path, "%s/%s.so",
+		     (smfd_plugin_dir == NULL) ? "/usr/local/lib64/smfd" : smfd_plugin_dir,
+		     lib->name) >= (int)sizeof path) {
+		SMFD_FATAL("File name truncated: %s.so\n", lib->name);
+	}
+
+	if ((lib->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+		SMFD_FATAL("%s\n", dlerror());
+
+	if ((lib->ops = dlsym(lib->handle, SMFD_PLUGIN_SYMBOL)) == NULL)
+		SMFD_FATAL("%s: no %s symbol\n", path, SMFD_PLUGIN_SYMBOL);
+
+	if (lib->ops->abi != SMFD_PLUGIN_ABI) {
+		SMFD_FATAL("%s: plugin ABI version %" PRIu32 " (smfd supports version %d)\n",
+			   path, lib->ops->abi, SMFD_PLUGIN_ABI);
+	}
+
+	lib->inst.host = &smfd_plugin_services;
+	lib->inst.name = lib->name;
+	lib->inst.argument = lib->argument;
+
+	if (lib->ops->init != NULL && lib->ops->init(&lib->inst) != 0)
+		SMFD_FATAL("%s plugin failed to initialize\n", lib->name);
+
+	lib->initialized = 1;
+
+	if (lib->inst.sensor_count > 0) {
+		if (lib->ops->read == NULL || lib->inst.sensor_names == NULL)
+			SMFD_FATAL("%s plugin has sensors, but no read function\n", lib->name);
+		if (!lib->have_group)
+			SMFD_FATAL("%s plugin has sensors, but no group is set\n", lib->name);
+	}
+
+	if (lib->inst.zone_count > 0 && (lib->ops->set == NULL || lib->ops->get == NULL))
+		SMFD_FATAL("%s plugin has fan zones, but no set & get functions\n", lib->name);
+
+	SMFD_INFO("Loaded %s plugin (%s): %u sensors, %u fan zones\n", lib->name, path,
+		  lib->inst.sensor_count, lib->inst.zone_count);
+}
+
+/* Load & initialize every plugin, and give each of their sensors a slot in smfd_plugin_temps */
+static void smfd_plugin_init(void)
+{
+	struct smfd_plugin_temp *t;
+	unsigned int i, j;
+
+	for (i = 0; i < smfd_plugin_lib_count; ++i) {
+		smfd_plugin_load(&smfd_plugin_libs[i]);
+		smfd_plugin_temp_count += smfd_plugin_libs[i].inst.sensor_count;
+	}
+
+	if (smfd_plugin_temp_count == 0)
+		return;
+
+	if ((smfd_plugin_temps = calloc(smfd_plugin_temp_count, sizeof *smfd_plugin_temps)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (t = smfd_plugin_temps, i = 0; i < smfd_plugin_lib_count; ++i) {
+		for (j = 0; j < smfd_plugin_libs[i].inst.sensor_count; ++j, ++t) {
+			t->name = smfd_plugin_libs[i].inst.sensor_names[j];
+			t->lib = &smfd_plugin_libs[i];
+			t->sensor = j;
+			smfd_temp_reset(&t->temp);
+		}
+	}
+
+	SMFD_DEBUG("smfd_plugin_init finished (%u temperatures)\n", smfd_plugin_temp_count);
+}
+
+/* Close every plugin & free the plugin settings */
+static void smfd_plugin_fini(void)
+{
+	struct smfd_plugin_lib *lib;
+	unsigned int i;
+
+	for (i = 0; i < smfd_plugin_lib_count; ++i) {
+
+		lib = &smfd_plugin_libs[i];
+
+		if (lib->initialized && lib->ops->close != NULL)
+			lib->ops->close(&lib->inst);
+
+		if (lib->handle != NULL && dlclose(lib->handle) != 0)
+			SMFD_ERR("dlclose: %s\n", dlerror());
+
+		free(lib->name);
+		free(lib->argument);
+	}
+
+	free(smfd_plugin_libs);
+	free(smfd_plugin_temps);
+	free(smfd_plugin_dir);
+}
+
+/* Read each plugin temperature that is due (the plugin's schedule permitting) */
+static void smfd_plugin_read(void)
+{
+	struct smfd_plugin_temp *t;
+	unsigned int i;
+
+	for (i = 0; i < smfd_plugin_temp_count; ++i) {
+
+		t = &smfd_plugin_temps[i];
+
+		if (!smfd_sensor_due(&t->temp))
+			continue;
+
+		if (t->temp.state == SMFD_SENSOR_OK && smfd_sample_time < t->next_read)
+			continue;
+
+		if (t->lib->ops->read(&t->lib->inst, t->sensor, &t->temp.current) != 0) {
+			if (t->temp.state == SMFD_SENSOR_OK)
+				SMFD_WARNING("Failed to read %s temperature\n", t->name);
+			smfd_sensor_fail(t->name, t->lib->group, &t->temp);
+			continue;
+		}
+
+		smfd_sensor_ok(t->name, t->lib->group, &t->temp, t->temp.current);
+
+		if (t->temp.current < 0 || t->temp.current > 120)
+			SMFD_WARNING("%s reading (%d°C) is probably garbage\n", t->name,
+				     t->temp.current);
+
+		t->next_read = (t->lib->ops->schedule == NULL) ? 0 :
+			smfd_sample_time + t->lib->ops->schedule(&t->lib->inst, t->sensor);
+	}
+}
+
+/*
+ * Raise *max to the highest readable plugin temperature in a group (and set *name, if not NULL).
+ * Returns whether a failed plugin sensor in the group demands maximum cooling.
+ */
+static _Bool smfd_plugin_group_max(const enum smfd_group group, int *const max,
+				   const char **const name)
+{
+	const struct smfd_plugin_temp *t;
+	_Bool failed;
+	unsigned int i;
+
+	for (failed = 0, i = 0; i < smfd_plugin_temp_count; ++i) {
+
+		t = &smfd_plugin_temps[i];
+
+		if (t->lib->group != group)
+			continue;
+
+		if (t->temp.state == SMFD_SENSOR_FAILED) {
+			failed |= smfd_sensor_demands_max(&t->temp, group);
+			continue;
+		}
+
+		if (t->temp.current > *max) {
+			*max = t->temp.current;
+			if (name != NULL)
+				*name = t->name;
+		}
+	}
+
+	return failed;
+}
+
+/* Plugin actuator -- find the zone's plugin; the plugin took control when it was initialized */
+static void smfd_plugin_zone_init(struct smfd_zone *const zone)
+{
+	/* smfd_load_config has checked that the plugin is in the configuration file */
+	zone->plugin = smfd_plugin_find(zone->plugin_name);
+
+	if (zone->plugin_zone >= zone->plugin->inst.zone_count)
+		SMFD_FATAL("%s plugin has no fan zone %u\n", zone->plugin_name, zone->plugin_zone);
+}
+
+/* Plugin actuator -- set the duty cycle */
+static void smfd_plugin_zone_set(struct smfd_zone *const zone, const uint8_t percent)
+{
+	if (zone->plugin->ops->set(&zone->plugin->inst, zone->plugin_zone, percent) != 0) {
+		SMFD_FATAL("%s plugin failed to set fan zone %u to %" PRIu8 "%%\n",
+			   zone->plugin_name, zone->plugin_zone, percent);
+	}
+}
+
+/* Plugin actuator -- query the duty cycle */
+static uint8_t smfd_plugin_zone_get(struct smfd_zone *const zone)
+{
+	int percent;
+
+	percent = zone->plugin->ops->get(&zone->plugin->inst, zone->plugin_zone);
+
+	if (percent < 0 || percent > 100) {
+		SMFD_FATAL("%s plugin failed to query fan zone %u\n",
+			   zone->plugin_name, zone->plugin_zone);
+	}
+
+	return percent;
+}
+
+/* Plugin actuator -- the plugin is closed (releasing its zones) by smfd_plugin_fini */
+static void smfd_plugin_zone_fini(struct smfd_zone *const zone)
+{
+	free(zone->plugin_name);
+}
+
+static const struct smfd_actuator_ops smfd_plugin_actuator = {
+	.name	= "plugin",
+	.init	= smfd_plugin_zone_init,
+	.set	= smfd_plugin_zone_set,
+	.get	= smfd_plugin_zone_get,
+	.fini	= smfd_plugin_zone_fini
+};
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Disk thermal aging
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Boltzmann constant (eV/K) */
+#define SMFD_BOLTZMANN		8.617333e-5
+
+/*
+ * Longest interval (ms) credited to 1 sample, unless disks are paced (see smfd_aging_gap); longer
+ * gaps (sensor failures, etc.) aren't counted
+ */
+#define SMFD_AGING_GAP		(600 * 1000)
+
+/* Aging records of every disk seen (loaded from & saved to the state file) */
+static struct smfd_aging *smfd_agings = NULL;
+static unsigned int smfd_aging_count = 0;
+
+/* Monotonic time (ms) of the last save */
+static int64_t smfd_aging_saved;
+
+/* State file location */
+static const char *smfd_aging_path(void)
+{
+	return (smfd_aging_file == NULL) ? "/var/lib/smfd/disk-aging" : smfd_aging_file;
+}
+
+/*
+ * Relative aging rate at a temperature -- the Arrhenius acceleration factor, exp(Ea/k x (1/Tref -
+ * 1/T)), with respect to the reference temperature
+ */
+static double smfd_aging_factor(const int temp)
+{
+	return exp(smfd_aging_energy / SMFD_BOLTZMANN
+			* (1.0 / (smfd_aging_reference + 273.15) - 1.0 / (temp + 273.15)));
+}
+
+/* Return the index of a disk's aging record, creating the record if it doesn't exist */
+static unsigned int smfd_aging_find(const char *const id)
+{
+	struct smfd_aging *aging;
+	unsigned int i;
+
+	for (i = 0; i < smfd_aging_count; ++i) {
+		if (strcmp(smfd_agings[i].id, id) == 0)
+			return i;
+	}
+
+	if ((aging = realloc(smfd_agings, (smfd_aging_count + 1) * sizeof *aging)) == NULL)
+		SMFD_ABORT("realloc: %m\n");
+
+	smfd_agings = aging;
+	aging = &smfd_agings[smfd_aging_count];
+	memset(aging, 0, sizeof *aging);
+	aging->id = smfd_strdup(id);
+
+	return smfd_aging_count++;
+}
+
+/* Associate a newly attached disk with its aging record (by serial number) */
+static void smfd_aging_attach(struct smfd_disk *const disk, struct udev_device *const dev)
+{
+	const char *id;
+
+	if (!smfd_aging_enabled)
+		return;
+
+	if ((id = udev_device_get_property_value(dev, "ID_SERIAL")) == NULL) {
+		SMFD_WARNING("%s: no serial number; aging is tracked by device node\n", disk->name);
+		id = disk->devnode;
+	}
+
+	disk->aging = smfd_aging_find(id);
+	disk->aging_time = 0;
+}
+
+/* Longest interval (ms) credited to 1 sample -- paced disks can go max_staleness between reads */
+static int64_t smfd_aging_gap(void)
+{
+	const int64_t paced = 2 * (int64_t)smfd_disk_max_staleness;
+
+	return (paced > SMFD_AGING_GAP) ? paced : SMFD_AGING_GAP;
+}
+
+/* Credit the time since a disk's last sample (at its last temperature) & record a new sample */
+static void smfd_aging_sample(struct smfd_disk *const disk, const int current)
+{
+	struct smfd_aging *aging;
+	double hours;
+	int64_t now;
+
+	if (!smfd_aging_enabled)
+		return;
+
+	now = smfd_mono_ms();
+
+	if (disk->aging_time != 0 && now - disk->aging_time <= smfd_aging_gap()) {
+
+		aging = &smfd_agings[disk->aging];
+		hours = (now - disk->aging_time) / 3600e3;
+
+		aging->hours += hours;
+		aging->aged_hours += hours * smfd_aging_factor(disk->aging_temp);
+
+		if (disk->aging_temp > smfd_aging_reference)
+			aging->degree_hours += hours * (disk->aging_temp - smfd_aging_reference);
+	}
+
+	disk->aging_time = now;
+	disk->aging_temp = current;
+}
+
+/* Mean current aging factor of the readable disks (-1 if none) */
+static double smfd_aging_mean_factor(void)
+{
+	unsigned int i, n;
+	double sum;
+
+	for (sum = 0, n = 0, i = 0; i < smfd_disk_count; ++i) {
+		if (smfd_disks[i].temp.state != SMFD_SENSOR_FAILED
+				&& smfd_disks[i].temp.samples > 0) {
+			sum += smfd_aging_factor(smfd_disks[i].temp.current);
+			++n;
+		}
+	}
+
+	return (n == 0) ? -1 : sum / n;
+}
+
+/* Load the aging records saved by a previous run (if any) */
+static void smfd_aging_load(void)
+{
+	const char *const path = smfd_aging_path();
+	double hours, degree_hours, aged_hours;
+	struct smfd_aging *aging;
+	char line[512], *nl;
+	unsigned int i;
+	int id;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		if (errno != ENOENT)
+			SMFD_FATAL("%s: %m\n", path);
+		SMFD_NOTICE("%s doesn't exist; starting disk aging accounting from 0\n", path);
+		return;
+	}
+
+	while (fgets(line, sizeof line, fp) != NULL) {
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if ((nl = strchr(line, '\n')) != NULL)
+			*nl = 0;
+
+		if (sscanf(line, "%lf %lf %lf %n", &hours, &degree_hours, &aged_hours, &id) != 3
+				|| line[id] == 0 || hours < 0 || degree_hours < 0
+				|| aged_hours < 0) {
+			SMFD_FATAL("%s: invalid line: %s\n", path, line);
+		}
+
+		i = smfd_aging_find(line + id);		/* may move smfd_agings */
+		aging = &smfd_agings[i];
+		aging->hours = hours;
+		aging->degree_hours = degree_hours;
+		aging->aged_hours = aged_hours;
+	}
+
+	if (ferror(fp) || fclose(fp) != 0)
+		SMFD_FATAL("%s: %m\n", path);
+
+	SMFD_DEBUG("Loaded aging records of %u disks from %s\n", smfd_aging_count, path);
+}
+
+/* Write the aging records to the state file; errors are logged, but not fatal */
+static void smfd_aging_save(void)
+{
+	const char *const path = smfd_aging_path();
+	char tmp[PATH_MAX + sizeof ".tmp"];
+	unsigned int i;
+	FILE *fp;
+
+	smfd_aging_saved = smfd_mono_ms();
+
+	if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int)sizeof tmp) {
+		SMFD_ERR("File name truncated: %s.tmp\n", path);
+		return;
+	}
+
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		SMFD_ERR("%s: %m\n", tmp);
+		return;
+	}
+
+	fprintf(fp, "# smfd disk thermal aging; reference %d°C, activation energy %g eV\n"
+		    "# hours degree_hours aged_hours disk\n",
+		smfd_aging_reference, smfd_aging_energy);
+
+	for (i = 0; i < smfd_aging_count; ++i) {
+		fprintf(fp, "%.4f %.4f %.4f %s\n", smfd_agings[i].hours,
+			smfd_agings[i].degree_hours, smfd_agings[i].aged_hours, smfd_agings[i].id);
+	}
+
+	if (fflush(fp) != 0 || fdatasync(fileno(fp)) != 0) {
+		SMFD_ERR("%s: %m\n", tmp);
+		fclose(fp);
+		if (unlink(tmp) != 0)
+			SMFD_ERR("%s: %m\n", tmp);
+		return;
+	}
+
+	if (fclose(fp) != 0) {
+		SMFD_ERR("%s: %m\n", tmp);
+		return;
+	}
+
+	if (rename(tmp, path) != 0)
+		SMFD_ERR("%s: %m\n", path);
+}
+
+/* Save the aging records if smfd_aging_save_interval has passed */
+static void smfd_aging_check(void)
+{
+	if (smfd_aging_enabled && smfd_mono_ms() - smfd_aging_saved
+					>= (int64_t)smfd_aging_save_interval * 1000) {
+		smfd_aging_save();
+	}
+}
+
+/* Load the saved aging records; must be called before disks are attached */
+static void smfd_aging_init(void)
+{
+	if (!smfd_aging_enabled)
+		return;
+
+	smfd_aging_load();
+	smfd_aging_saved = smfd_mono_ms();
+
+	SMFD_DEBUG("smfd_aging_init finished\n");
+}
+
+/* Save the aging records one last time & free them */
+static void smfd_aging_fini(void)
+{
+	unsigned int i;
+
+	if (!smfd_aging_enabled)
+		return;
+
+	smfd_aging_save();
+
+	for (i = 0; i < smfd_aging_count; ++i)
+		free(smfd_agings[i].id);
+
+	free(smfd_agings);
+	smfd_agings = NULL;
+	smfd_aging_count = 0;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	S.M.A.R.T. disk temperatures
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Open the libatasmart "handle" for a disk; a disk that can't be opened is marked failed */
+static _Bool smfd_disk_open(struct smfd_disk *const disk)
+{
+	if (sk_disk_open(disk->devnode, &disk->disk) < 0) {
+		if (disk->temp.state == SMFD_SENSOR_OK)
+			SMFD_WARNING("%s: %m\n", disk->name);
+		disk->disk = NULL;
+		smfd_sensor_fail(disk->name, SMFD_GROUP_DISK, &disk->temp);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Return the name (device node or /dev/disk symlink) by which a disk matches one of a set of
+ * patterns (smart_disks or a cage), or NULL if it doesn't match
+ */
+static const char *smfd_disk_match(struct udev_device *const dev, char **const patterns,
+				   const unsigned int pattern_count)
+{
+	struct udev_list_entry *link;
+	const char *devnode, *path;
+	unsigned int i;
+
+	if ((devnode = udev_device_get_devnode(dev)) == NULL)
+		return NULL;
+
+	for (i = 0; i < pattern_count; ++i) {
+
+		if (fnmatch(patterns[i], devnode, FNM_PATHNAME) == 0)
+			return devnode;
+
+		udev_list_entry_foreach(link, udev_device_get_devlinks_list_entry(dev)) {
+			path = udev_list_entry_get_name(link);
+			if (fnmatch(patterns[i], path, FNM_PATHNAME) == 0)
+				return path;
+		}
+	}
+
+	return NULL;
+}
+
+/* Return the index of the first cage that contains a disk (smfd_disk_cage_count if none) */
+static unsigned int smfd_disk_cage(struct udev_device *const dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < smfd_disk_cage_count; ++i) {
+		if (smfd_disk_match(dev, smfd_disk_cages[i].patterns,
+				    smfd_disk_cages[i].pattern_count) != NULL) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+/* Open a disk's block device statistics (for I/O utilization); not fatal if it can't be opened */
+static void smfd_disk_stat_open(struct smfd_disk *const disk)
+{
+	const char *dev;
+	char *path;
+
+	disk->stat_fd = -1;
+	disk->util = -1;
+
+	if ((dev = strrchr(disk->devnode, '/')) == NULL)
+		return;
+
+	if (asprintf(&path, "%s/sys/block/%s/stat", smfd_sysfs_root, dev + 1) < 0)
+		SMFD_ABORT("asprintf: %m\n");
+
+	if ((disk->stat_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		SMFD_DEBUG("%s: %m\n", path);
+
+	free(path);
+}
+
+/*
+ * Update a disk's I/O utilization -- the fraction of the time since the last update during which
+ * the disk had I/O in flight (io_ticks, the 10th field of the stat file)
+ */
+static void smfd_disk_util(struct smfd_disk *const disk)
+{
+	unsigned long long ticks;
+	char buf[256];
+	ssize_t len;
+	int64_t now;
+
+	if (disk->stat_fd < 0)
+		return;
+
+	if ((len = pread(disk->stat_fd, buf, sizeof buf - 1, 0)) < 0) {
+		SMFD_WARNING("%s: stat: %m\n", disk->name);
+		disk->util = -1;
+		return;
+	}
+
+	buf[len] = 0;
+
+	if (sscanf(buf, "%*u %*u %*u %*u %*u %*u %*u %*u %*u %llu", &ticks) != 1) {
+		disk->util = -1;
+		return;
+	}
+
+	now = smfd_mono_ms();
+
+	if (disk->io_time != 0 && now > disk->io_time && ticks >= disk->io_ticks) {
+		disk->util = (ticks - disk->io_ticks) * 100 / (now - disk->io_time);
+		if (disk->util > 100)
+			disk->util = 100;
+	}
+
+	disk->io_ticks = ticks;
+	disk->io_time = now;
+}
+
+/* Start monitoring a disk, if it matches a smart_disks pattern and isn't already monitored */
+static void smfd_disk_attach(struct udev_device *const dev)
+{
+	struct smfd_disk *disk;
+	const char *name;
+	unsigned int i;
+
+	if ((name = smfd_disk_match(dev, smfd_disk_patterns, smfd_disk_pattern_count)) == NULL)
+		return;
+
+	for (i = 0; i < smfd_disk_count; ++i) {
+		if (strcmp(smfd_disks[i].devnode, udev_device_get_devnode(dev)) == 0)
+			return;
+	}
+
+	disk = realloc(smfd_disks, (smfd_disk_count + 1) * sizeof *smfd_disks);
+	if (disk == NULL)
+		SMFD_ABORT("realloc: %m\n");
+
+	smfd_disks = disk;
+	disk = &smfd_disks[smfd_disk_count++];
+	memset(disk, 0, sizeof *disk);
+
+	disk->name = smfd_strdup(name);
+	disk->devnode = smfd_strdup(udev_device_get_devnode(dev));
+
+	disk->cage = smfd_disk_cage(dev);
+
+	smfd_temp_reset(&disk->temp);
+	smfd_disk_stat_open(disk);
+	smfd_aging_attach(disk, dev);
+
+	if (disk->cage < smfd_disk_cage_count) {
+		SMFD_NOTICE("Monitoring disk %s (%s) in cage %s\n", disk->name, disk->devnode,
+			    smfd_disk_cages[disk->cage].name);
+	}
+	else {
+		SMFD_NOTICE("Monitoring disk %s (%s)\n", disk->name, disk->devnode);
+	}
+
+	smfd_disk_open(disk);
+}
+
+/* Stop monitoring a disk that has been removed */
+static void smfd_disk_detach(const char *const devnode)
+{
+	struct smfd_disk *disk;
+	unsigned int i;
+
+	for (i = 0; i < smfd_disk_count; ++i) {
+		if (strcmp(smfd_disks[i].devnode, devnode) == 0)
+			break;
+	}
+
+	if (i == smfd_disk_count)
+		return;
+
+	disk = &smfd_disks[i];
+
+	SMFD_NOTICE("Disk %s (%s) removed\n", disk->name, disk->devnode);
+
+	if (disk->disk != NULL)
+		sk_disk_free(disk->disk);
+
+	if (disk->stat_fd >= 0 && close(disk->stat_fd) != 0)
+		SMFD_WARNING("close: %m\n");
+
+	free(disk->name);
+	free(disk->devnode);
+
+	memmove(disk, disk + 1, (--smfd_disk_count - i) * sizeof *disk);
+}
+
+/* Handle any pending udev events (disks added or removed) */
+static void smfd_disk_monitor(void)
+{
+	struct udev_device *dev;
+	const char *action, *devnode;
+
+	while ((dev = udev_monitor_receive_device(smfd_udev_mon)) != NULL) {
+
+		action = udev_device_get_action(dev);
+		devnode = udev_device_get_devnode(dev);
+
+		SMFD_DEBUG("udev event: %s %s\n", (action == NULL) ? "(none)" : action,
+			   (devnode == NULL) ? "(none)" : devnode);
+
+		if (action != NULL && devnode != NULL) {
+			if (strcmp(action, "add") == 0)
+				smfd_disk_attach(dev);
+			else if (strcmp(action, "remove") == 0)
+				smfd_disk_detach(devnode);
+		}
+
+		udev_device_unref(dev);
+	}
+}
+
+/* File descriptor of the udev monitor (-1 if not running) */
+static int smfd_disk_monitor_fd(void)
+{
+	return (smfd_udev_mon == NULL) ? -1 : udev_monitor_get_fd(smfd_udev_mon);
+}
+
+/* Start the udev monitor, then attach every existing disk that matches a smart_disks pattern */
+static void smfd_disk_init(void)
+{
+	struct udev_enumerate *enumerate;
+	struct udev_list_entry *entry;
+	struct udev_device *dev;
+
+	if ((smfd_udev = udev_new()) == NULL)
+		SMFD_FATAL("udev_new: %m\n");
+
+	/* Start receiving events before enumerating, so no disk is missed */
+	if ((smfd_udev_mon = udev_monitor_new_from_netlink(smfd_udev, "udev")) == NULL)
+		SMFD_FATAL("udev_monitor_new_from_netlink: %m\n");
+
+	if (udev_monitor_filter_add_match_subsystem_devtype(smfd_udev_mon, "block", "disk") < 0)
+		SMFD_FATAL("udev_monitor_filter_add_match_subsystem_devtype: %m\n");
+
+	if (udev_monitor_enable_receiving(smfd_udev_mon) < 0)
+		SMFD_FATAL("udev_monitor_enable_receiving: %m\n");
+
+	if ((enumerate = udev_enumerate_new(smfd_udev)) == NULL)
+		SMFD_FATAL("udev_enumerate_new: %m\n");
+
+	if (udev_enumerate_add_match_subsystem(enumerate, "block") < 0
+			|| udev_enumerate_add_match_property(enumerate, "DEVTYPE", "disk") < 0
+			|| udev_enumerate_scan_devices(enumerate) < 0) {
+		SMFD_FATAL("udev_enumerate: %m\n");
+	}
+
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+
+		dev = udev_device_new_from_syspath(smfd_udev, udev_list_entry_get_name(entry));
+		if (dev == NULL)
+			continue;	/* removed since scan */
+
+		smfd_disk_attach(dev);
+		udev_device_unref(dev);
+	}
+
+	udev_enumerate_unref(enumerate);
+
+	if (smfd_disk_count == 0)
+		SMFD_WARNING("No disks match smart_disks (yet)\n");
+
+	SMFD_DEBUG("smfd_disk_init finished\n");
+}
+
+/* Close the libatasmart handle for each disk in smfd_disks, stop the udev monitor & free memory */
+static void smfd_disk_fini(void)
+{
+	unsigned i, j;
+
+	for (i = 0; i < smfd_disk_count; ++i) {
+		if (smfd_disks[i].disk != NULL)
+			sk_disk_free(smfd_disks[i].disk);
+		if (smfd_disks[i].stat_fd >= 0)
+			close(smfd_disks[i].stat_fd);
+		free(smfd_disks[i].name);
+		free(smfd_disks[i].devnode);
+	}
+
+	free(smfd_disks);
+	free(smfd_disk_due);
+
+	for (i = 0; i < smfd_disk_pattern_count; ++i)
+		free(smfd_disk_patterns[i]);
+
+	free(smfd_disk_patterns);
+
+	for (i = 0; i < smfd_disk_cage_count; ++i) {
+		for (j = 0; j < smfd_disk_cages[i].pattern_count; ++j)
+			free(smfd_disk_cages[i].patterns[j]);
+		free(smfd_disk_cages[i].patterns);
+		free(smfd_disk_cages[i].name);
+	}
+
+	free(smfd_disk_cages);
+
+	if (smfd_udev_mon != NULL)
+		udev_monitor_unref(smfd_udev_mon);
+
+	if (smfd_udev != NULL)
+		udev_unref(smfd_udev);
+}
+
+/* Read the temperature of 1 disk; returns 0 on failure */
+static _Bool smfd_disk_read_one(struct smfd_disk *const disk)
+{
+	uint64_t mkelvin;
+
+	if (sk_disk_smart_read_data(disk->disk) < 0
+			|| sk_disk_smart_get_temperature(disk->disk, &mkelvin) < 0) {
+		if (disk->temp.state == SMFD_SENSOR_OK)
+			SMFD_WARNING("%s: %m\n", disk->name);
+		return 0;
+	}
+
+	if (mkelvin > (uint64_t)INT_MAX) {
+		if (disk->temp.state == SMFD_SENSOR_OK) {
+			SMFD_WARNING("%s: temperature (%" PRIu64 ") out of range\n",
+				     disk->name, mkelvin);
+		}
+		return 0;
+	}
+
+	/* Absolute zero == -273.15°C */
+	smfd_sensor_ok(disk->name, SMFD_GROUP_DISK, &disk->temp,
+		       (mkelvin - 273150 + 500) / 1000);
+	smfd_aging_sample(disk, disk->temp.current);
+
+	return 1;
+}
+
+/*
+ * Margin (°C) below which a disk's allowed staleness starts to shrink.  A disk at its next trigger
+ * threshold is polled 10 times as often as a cool one.
+ */
+#define SMFD_DISK_MARGIN	10
+
+/* Distance (°C) from a disk's temperature to the next disk trigger threshold above it */
+static int smfd_disk_margin(const int temp)
+{
+	const struct smfd_temp_threshold *t;
+	int margin;
+
+	t = smfd_policy->triggers[SMFD_GROUP_DISK];
+
+	for (margin = SMFD_DISK_MARGIN; t->name != NULL; ++t) {
+		if (t->threshold > temp && t->threshold - temp < margin)
+			margin = t->threshold - temp;
+	}
+
+	return margin;
+}
+
+/* Set a disk's polling deadline -- its staleness limit, shortened as it nears a threshold */
+static void smfd_disk_schedule(struct smfd_disk *const disk)
+{
+	int margin;
+
+	if (disk->last_read == 0 || disk->temp.state != SMFD_SENSOR_OK) {
+		disk->deadline = 0;	/* never read, or stale -- as soon as possible */
+		return;
+	}
+
+	margin = smfd_disk_margin(disk->temp.current);
+	if (margin < 1)
+		margin = 1;
+
+	disk->deadline = disk->last_read
+				+ (int64_t)smfd_disk_max_staleness * margin / SMFD_DISK_MARGIN;
+}
+
+/* qsort() comparison function -- earliest deadline first */
+static int smfd_disk_cmp(const void *const a, const void *const b)
+{
+	const struct smfd_disk *const x = *(struct smfd_disk *const *)a;
+	const struct smfd_disk *const y = *(struct smfd_disk *const *)b;
+
+	return (x->deadline > y->deadline) - (x->deadline < y->deadline);
+}
+
+/* Read the temperature of 1 disk, handling any failure */
+static void smfd_disk_poll(struct smfd_disk *const disk)
+{
+	disk->last_read = smfd_sample_time;
+
+	/* A failed disk's handle is closed; reopen it to retry */
+	if (disk->disk == NULL && !smfd_disk_open(disk))
+		return;
+
+	if (smfd_disk_read_one(disk))
+		return;
+
+	smfd_sensor_fail(disk->name, SMFD_GROUP_DISK, &disk->temp);
+
+	if (disk->temp.state == SMFD_SENSOR_FAILED) {
+		sk_disk_free(disk->disk);
+		disk->disk = NULL;
+	}
+}
+
+/*
+ * Read the temperatures of the disks that are due, earliest deadline first, until the per-cycle
+ * time budget or disk limit is reached.  A disk is due if its deadline falls before the next
+ * cycle.  With no staleness limit, every disk is due in every cycle.
+ */
+static void smfd_disk_read(void)
+{
+	unsigned int i, count, polled;
+	int64_t start, horizon;
+	struct smfd_disk *disk;
+
+	if (smfd_disk_due_size < smfd_disk_count) {
+		smfd_disk_due = realloc(smfd_disk_due, smfd_disk_count * sizeof *smfd_disk_due);
+		if (smfd_disk_due == NULL)
+			SMFD_ABORT("realloc: %m\n");
+		smfd_disk_due_size = smfd_disk_count;
+	}
+
+	horizon = smfd_sample_time + smfd_sample_interval;
+
+	for (count = 0, i = 0; i < smfd_disk_count; ++i) {
+
+		disk = &smfd_disks[i];
+
+		if (!smfd_sensor_due(&disk->temp))
+			continue;
+
+		smfd_disk_schedule(disk);
+
+		if (disk->deadline < horizon || smfd_disk_max_staleness == 0)
+			smfd_disk_due[count++] = disk;
+	}
+
+	qsort(smfd_disk_due, count, sizeof *smfd_disk_due, smfd_disk_cmp);
+
+	start = smfd_mono_ms();
+
+	for (polled = 0; polled < count; ++polled) {
+
+		if (smfd_disk_max_per_cycle != 0 && polled == smfd_disk_max_per_cycle)
+			break;
+
+		if (smfd_disk_budget != 0 && smfd_mono_ms() - start >= smfd_disk_budget)
+			break;
+
+		smfd_disk_poll(smfd_disk_due[polled]);
+	}
+
+	SMFD_DEBUG("Polled %u of %u due disks in %" PRId64 " ms\n",
+		   polled, count, smfd_mono_ms() - start);
+
+	for (i = polled; i < count; ++i) {
+
+		disk = smfd_disk_due[i];
+
+		if (disk->last_read != 0 && disk->deadline < smfd_sample_time) {
+			SMFD_DEBUG("%s is overdue by %" PRId64 " ms\n",
+				   disk->name, smfd_sample_time - disk->deadline);
+		}
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Disk peer comparison -- disks running hotter than others in the same cage
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Disks in the same cage, under similar load, should read within a few degrees of each other.  A
+ * disk that runs well above the median of its peers usually has a blocked airflow path (or a
+ * missing blank next to it), which can be fixed before the whole zone has to run at 100%.
+ *
+ * Each cycle, every disk's deviation from its cage's median temperature is adjusted for the
+ * difference between its I/O utilization and the cage's median utilization, then smoothed.  A
+ * disk whose smoothed deviation stays at or above the threshold for the persistence period is
+ * reported as an anomaly.
+ */
+
+/* Time constant (ms) of the smoothed deviation */
+#define SMFD_PEER_TAU		60000
+
+/* An anomaly is cleared when the smoothed deviation falls this far (°C) below the threshold */
+#define SMFD_PEER_HYSTERESIS	2
+
+/* Minimum number of readable disks in a cage for a meaningful median */
+#define SMFD_PEER_MIN		3
+
+/* Time of the previous update (0 if none) */
+static int64_t smfd_peer_last = 0;
+
+/* Name of a disk's peer group, for messages */
+static const char *smfd_peer_cage_name(const unsigned int cage)
+{
+	if (cage < smfd_disk_cage_count)
+		return smfd_disk_cages[cage].name;
+
+	return (smfd_disk_cage_count == 0) ? "all disks" : "disks in no cage";
+}
+
+/* Return the median of the n (> 0) values in a histogram */
+static double smfd_peer_median(const unsigned int *const hist, const unsigned int n)
+{
+	unsigned int i, lo, seen;
+
+	/* Values at (zero-based) positions (n - 1) / 2 and n / 2 */
+	for (seen = 0, i = 0; seen + hist[i] <= (n - 1) / 2; seen += hist[i++]);
+	lo = i;
+	for (; seen + hist[i] <= n / 2; seen += hist[i++]);
+
+	return (lo + i) / 2.0;
+}
+
+/* Can a disk be compared with its peers? */
+static _Bool smfd_peer_readable(const struct smfd_disk *const disk)
+{
+	return disk->temp.state == SMFD_SENSOR_OK && disk->temp.last_ok != 0;
+}
+
+/* Raise or clear a disk's anomaly, based on its smoothed deviation */
+static void smfd_peer_check(struct smfd_disk *const disk, const double median)
+{
+	if (disk->score >= smfd_peer_threshold) {
+
+		if (disk->outlier_since == 0)
+			disk->outlier_since = smfd_sample_time;
+
+		if (!disk->anomaly && smfd_sample_time - disk->outlier_since
+						>= smfd_peer_persistence * 1000LL) {
+			disk->anomaly = 1;
+			++smfd_peer_events;
+			SMFD_WARNING("%s is running %.1f°C hotter than its peers (%s; median "
+				     "%.1f°C); check for blocked airflow\n", disk->name,
+				     disk->score, smfd_peer_cage_name(disk->cage), median);
+		}
+	}
+	else if (disk->score < (double)smfd_peer_threshold - SMFD_PEER_HYSTERESIS) {
+
+		disk->outlier_since = 0;
+
+		if (disk->anomaly) {
+			disk->anomaly = 0;
+			SMFD_NOTICE("%s is back within %u°C of its peers (%s)\n", disk->name,
+				    smfd_peer_threshold - SMFD_PEER_HYSTERESIS,
+				    smfd_peer_cage_name(disk->cage));
+		}
+	}
+}
+
+/* Update the deviations of the disks in 1 cage */
+static void smfd_peer_cage(const unsigned int cage, const double alpha)
+{
+	unsigned int temps[128] = { 0 }, utils[101] = { 0 }, count, util_count, i;
+	double median, util_median, raw;
+	struct smfd_disk *disk;
+
+	for (count = 0, util_count = 0, i = 0; i < smfd_disk_count; ++i) {
+
+		disk = &smfd_disks[i];
+
+		if (disk->cage != cage || !smfd_peer_readable(disk))
+			continue;
+
+		++temps[(disk->temp.current < 0) ? 0 : (disk->temp.current > 127) ? 127 :
+							disk->temp.current];
+		++count;
+
+		if (disk->util >= 0) {
+			++utils[disk->util];
+			++util_count;
+		}
+	}
+
+	if (count < SMFD_PEER_MIN) {
+		for (i = 0; i < smfd_disk_count; ++i) {
+			if (smfd_disks[i].cage == cage)
+				smfd_disks[i].outlier_since = 0;
+		}
+		return;
+	}
+
+	median = smfd_peer_median(temps, count);
+	util_median = (util_count == 0) ? 0.0 : smfd_peer_median(utils, util_count);
+
+	for (i = 0; i < smfd_disk_count; ++i) {
+
+		disk = &smfd_disks[i];
+
+		if (disk->cage != cage)
+			continue;
+
+		if (!smfd_peer_readable(disk)) {
+			disk->outlier_since = 0;
+			continue;
+		}
+
+		raw = disk->temp.current - median;
+
+		if (disk->util >= 0 && util_count > 0)
+			raw -= smfd_peer_load_coeff * (disk->util - util_median) / 100.0;
+
+		disk->score += (raw - disk->score) * alpha;
+		smfd_peer_check(disk, median);
+	}
+}
+
+/* Update I/O utilization & deviations from peers; called after the disk temperatures are read */
+static void smfd_peer_cycle(void)
+{
+	unsigned int i;
+	int64_t elapsed;
+	double alpha;
+
+	if (smfd_peer_threshold == 0)
+		return;
+
+	for (i = 0; i < smfd_disk_count; ++i)
+		smfd_disk_util(&smfd_disks[i]);
+
+	elapsed = (smfd_peer_last == 0) ? SMFD_PEER_TAU : smfd_sample_time - smfd_peer_last;
+	smfd_peer_last = smfd_sample_time;
+	alpha = (elapsed >= SMFD_PEER_TAU) ? 1.0 : (double)elapsed / SMFD_PEER_TAU;
+
+	for (i = 0; i <= smfd_disk_cage_count; ++i)
+		smfd_peer_cage(i, alpha);
+}
+
+/* Number of disks currently reported as anomalies */
+static unsigned int smfd_peer_active(void)
+{
+	unsigned int i, active;
+
+	for (active = 0, i = 0; i < smfd_disk_count; ++i)
+		active += smfd_disks[i].anomaly;
+
+	return active;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Raw IPMI commands to query/set BMC fan mode & fan zone speeds (percentages)
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Send a raw command to a BMC; check for success and a response of the expected length.  Returns
+ * -1 (with an error message in err) on failure.
+ */
+static int smfd_ipmi_cmd(const ipmi_ctx_t ipmi, const uint8_t *const cmd,
+			 const unsigned int cmd_len, uint8_t *const restrict response,
+			 const unsigned int response_len, char *const restrict err,
+			 const size_t err_size)
+{
+	static const uint8_t net_fn = IPMI_NET_FN_OEM_SUPERMICRO_GENERIC_RQ;	/* 0x30 */
+
+	char msg[IPMI_ERR_STR_MAX_LEN];
+	uint8_t resp[256];
+	int rc;
+
+	memset(resp, 0, sizeof resp);
+
+	if ((rc = ipmi_cmd_raw(ipmi, 0, net_fn, cmd, cmd_len, resp, sizeof resp)) < 0) {
+		snprintf(err, err_size, "ipmi_cmd_raw: %s", ipmi_ctx_errormsg(ipmi));
+		return -1;
+	}
+
+	if (rc < 2) {
+		snprintf(err, err_size, "Truncated(?) IPMI response (%d bytes)", rc);
+		return -1;
+	}
+
+	if (resp[1] != IPMI_COMP_CODE_COMMAND_SUCCESS) {
+		if (ipmi_completion_code_strerror_r(resp[0], net_fn, resp[1], msg, sizeof msg) < 0)
+			snprintf(msg, sizeof msg, "[completion code %0x" PRIx8 "]", resp[1]);
+		snprintf(err, err_size, "IPMI command failed: %s", msg);
+		return -1;
+	}
+
+	if (resp[0] != cmd[0]) {
+		snprintf(err, err_size,
+			 "IPMI response (0x%" PRIx8 ") did not match command (0x%" PRIx8 ")",
+			 resp[0], cmd[0]);
+		return -1;
+	}
+
+	if ((unsigned int)rc != response_len + 2) {
+		snprintf(err, err_size, "Unexpected response data size (got %d bytes, expected %u)",
+			 rc - 2, response_len);
+		return -1;
+	}
+
+	if (response_len > 0)
+		memcpy(response, resp + 2, response_len);
+
+	return 0;
+}
+
+/* Send a raw command to the local BMC; any failure is fatal */
+static void smfd_ipmi_raw_cmd(const uint8_t *const cmd, const unsigned int cmd_len,
+			      uint8_t *const restrict response, const unsigned int response_len)
+{
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+
+	if (smfd_ipmi_cmd(smfd_ipmi, cmd, cmd_len, response, response_len, err, sizeof err) < 0)
+		SMFD_FATAL("%s\n", err);
+}
+
+/* Set the fan management mode of a BMC */
+static int smfd_ipmi_set_fan_mode(const ipmi_ctx_t ipmi, const uint8_t mode,
+				  char *const err, const size_t err_size)
+{
+	const uint8_t cmd[] = {
+		SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE,
+		0x01,
+		mode
+	};
+
+	return smfd_ipmi_cmd(ipmi, cmd, sizeof cmd, NULL, 0, err, err_size);
+}
+
+/* Set the fan duty cycle (percentage) of a zone on a BMC */
+static int smfd_ipmi_set_fan_percent(const ipmi_ctx_t ipmi, const uint8_t zone,
+				     const uint8_t percent, char *const err, const size_t err_size)
+{
+	const uint8_t cmd[] = {
+		IPMI_CMD_OEM_SUPERMICRO_GENERIC_EXTENSION,
+		SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT,
+		0x01,
+		zone,
+		percent
+	};
+
+	return smfd_ipmi_cmd(ipmi, cmd, sizeof cmd, NULL, 0, err, err_size);
+}
+
+/* Query the current BMC fan management mode */
+static uint8_t smfd_get_fan_mode(void)
+{
+	static const uint8_t cmd[] = {
+		SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE,
+		0x00
+	};
+
+	uint8_t mode;
+
+	smfd_ipmi_raw_cmd(cmd, sizeof cmd, &mode, sizeof mode);
+
+	return mode;
+}
+
+/* Set the BMC fan management mode */
+static void smfd_set_fan_mode(const uint8_t mode)
+{
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+
+	if (smfd_ipmi_set_fan_mode(smfd_ipmi, mode, err, sizeof err) < 0)
+		SMFD_FATAL("%s\n", err);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	IPMI write queue & actuator -- duty cycles are written by a separate thread
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * The control loop never waits for the BMC to accept a duty cycle.  Each zone has 1 slot in the
+ * queue; a write to a zone whose previous write hasn't been sent yet replaces it, so the writer
+ * thread only ever sends the newest duty cycle, and the BMC is never more than 1 transaction behind
+ * the controller.  Safety writes (zones forced to 100% by a safety limit) are sent before any
+ * other zone's write.  The BMC fan mode is verified whenever the queue is empty (at most every
+ * SMFD_IPMIQ_VERIFY_INTERVAL), rather than with each write; a timed wait keeps verifying it while
+ * the duty cycles aren't changing.
+ */
+
+/* Minimum time between BMC fan mode verifications (milliseconds) */
+#define SMFD_IPMIQ_VERIFY_INTERVAL	30000
+
+/* Forward declarations needed by the writer thread */
+static int64_t smfd_mono_ms(void);
+static void smfd_hist_add(struct smfd_histogram *hist, int64_t ms);
+
+/* Lock the IPMI write queue */
+static void smfd_ipmiq_lock(void)
+{
+	int rc;
+
+	if ((rc = pthread_mutex_lock(&smfd_ipmiq_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
+}
+
+/* Unlock the IPMI write queue */
+static void smfd_ipmiq_unlock(void)
+{
+	int rc;
+
+	if ((rc = pthread_mutex_unlock(&smfd_ipmiq_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
+}
+
+/* Wake the writer thread (queue locked) */
+static void smfd_ipmiq_signal(void)
+{
+	int rc;
+
+	if ((rc = pthread_cond_signal(&smfd_ipmiq_cond)) != 0)
+		SMFD_ABORT("pthread_cond_signal: %s\n", strerror(rc));
+}
+
+/*
+ * Choose the next zone to write (queue locked) -- a safety write, if any, otherwise the zone that
+ * has waited longest.  Returns SMFD_FAN_ZONE_COUNT if nothing is pending.
+ */
+static unsigned int smfd_ipmiq_next(void)
+{
+	const struct smfd_ipmiq_slot *slot;
+	unsigned int zone, next;
+
+	next = SMFD_FAN_ZONE_COUNT;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		slot = &smfd_ipmiq_slots[zone];
+
+		if (!slot->pending)
+			continue;
+
+		if (next == SMFD_FAN_ZONE_COUNT)
+			next = zone;
+		else if (slot->urgent && !smfd_ipmiq_slots[next].urgent)
+			next = zone;
+		else if (slot->urgent == smfd_ipmiq_slots[next].urgent
+				&& slot->queued < smfd_ipmiq_slots[next].queued)
+			next = zone;
+	}
+
+	return next;
+}
+
+/*
+ * Verify the BMC fan mode at the end of a batch of writes (queue locked; unlocked while waiting for
+ * the BMC).  If something (a BMC reset, another management tool) has taken the BMC out of full
+ * (manual) mode, put it back, and queue each zone's last duty cycle to be written again.
+ */
+static void smfd_ipmiq_verify(void)
+{
+	static const uint8_t cmd[] = {
+		SMFD_SUPERMICRO_IPMI_CMD_FAN_MODE,
+		0x00
+	};
+
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+	struct smfd_ipmiq_slot *slot;
+	unsigned int zone;
+	uint8_t mode;
+	int64_t now;
+
+	smfd_ipmiq_unlock();
+
+	if (smfd_ipmi_cmd(smfd_ipmiq_ipmi, cmd, sizeof cmd, &mode, sizeof mode,
+			  err, sizeof err) < 0) {
+		SMFD_FATAL("%s\n", err);
+	}
+
+	smfd_ipmiq_lock();
+
+	smfd_ipmiq_stats.mode_checks += 1;
+
+	/* Mode may have been changed (for an experiment arm) while the BMC was queried */
+	if (mode == smfd_ipmiq_mode || smfd_ipmiq_mode_pending
+			|| smfd_ipmiq_mode != SMFD_SUPERMICRO_FAN_MODE_FULL) {
+		return;
+	}
+
+	SMFD_WARNING("BMC fan management mode changed (%#" PRIx8 "); "
+		     "setting it to full (manual) again\n", mode);
+
+	smfd_ipmiq_stats.mode_restores += 1;
+	smfd_ipmiq_mode_pending = 1;
+	now = smfd_mono_ms();
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		slot = &smfd_ipmiq_slots[zone];
+
+		if (slot->written == 255)
+			continue;
+
+		if (!slot->pending) {
+			slot->percent = slot->written;
+			slot->queued = now;
+			slot->pending = 1;
+		}
+
+		slot->written = 255;
+	}
+}
+
+/* Writer thread -- sends queued fan mode changes & duty cycles to the BMC */
+static void *smfd_ipmiq_main(void *const arg __attribute__((unused)))
+{
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+	struct smfd_ipmiq_slot *slot;
+	int64_t now, verified, sample;
+	uint8_t mode, percent;
+	struct timespec until;
+	unsigned int zone;
+	_Bool urgent;
+	int rc;
+
+	verified = smfd_mono_ms();	/* smfd_ipmi_init has just set (& read back) the mode */
+
+	smfd_ipmiq_lock();
+
+	while (1) {
+
+		while (!smfd_ipmiq_mode_pending && !smfd_ipmiq_quit
+				&& smfd_ipmiq_next() == SMFD_FAN_ZONE_COUNT) {
+
+			/* The BMC can take the fans back while the duty cycles aren't changing */
+			if (smfd_ipmiq_mode != SMFD_SUPERMICRO_FAN_MODE_FULL) {
+				rc = pthread_cond_wait(&smfd_ipmiq_cond, &smfd_ipmiq_mutex);
+				if (rc != 0)
+					SMFD_ABORT("pthread_cond_wait: %s\n", strerror(rc));
+				continue;
+			}
+
+			if ((now = smfd_mono_ms()) - verified >= SMFD_IPMIQ_VERIFY_INTERVAL) {
+				smfd_ipmiq_verify();
+				verified = now;
+				continue;
+			}
+
+			until.tv_sec = (verified + SMFD_IPMIQ_VERIFY_INTERVAL) / 1000;
+			until.tv_nsec = (verified + SMFD_IPMIQ_VERIFY_INTERVAL) % 1000 * 1000000;
+
+			rc = pthread_cond_timedwait(&smfd_ipmiq_cond, &smfd_ipmiq_mutex, &until);
+			if (rc != 0 && rc != ETIMEDOUT)
+				SMFD_ABORT("pthread_cond_timedwait: %s\n", strerror(rc));
+		}
+
+		if (smfd_ipmiq_mode_pending) {
+
+			mode = smfd_ipmiq_mode;
+			smfd_ipmiq_mode_pending = 0;
+			smfd_ipmiq_unlock();
+
+			if (smfd_ipmi_set_fan_mode(smfd_ipmiq_ipmi, mode, err, sizeof err) < 0)
+				SMFD_FATAL("%s\n", err);
+
+			verified = smfd_mono_ms();
+			smfd_ipmiq_lock();
+			continue;
+		}
+
+		if ((zone = smfd_ipmiq_next()) == SMFD_FAN_ZONE_COUNT)
+			break;	/* smfd_ipmiq_quit set & nothing left to write */
+
+		slot = &smfd_ipmiq_slots[zone];
+		percent = slot->percent;
+		sample = slot->sample;
+		urgent = slot->urgent;
+		slot->pending = 0;
+		slot->urgent = 0;
+
+		if (percent == slot->written) {
+			smfd_ipmiq_stats.unchanged += 1;
+			continue;
+		}
+
+		smfd_ipmiq_unlock();
+
+		if (smfd_ipmi_set_fan_percent(smfd_ipmiq_ipmi, slot->ipmi_zone, percent,
+					      err, sizeof err) < 0) {
+			SMFD_FATAL("%s\n", err);
+		}
+
+		now = smfd_mono_ms();
+		smfd_ipmiq_lock();
+
+		slot->written = percent;
+		slot->done_ms = now - sample;
+		smfd_ipmiq_stats.written += 1;
+		smfd_ipmiq_stats.urgent += urgent;
+		smfd_hist_add(&smfd_ipmiq_stats.wait, now - slot->queued);
+	}
+
+	smfd_ipmiq_unlock();
+
+	return NULL;
+}
+
+/* Queue a duty cycle for a zone, replacing any write to that zone that hasn't been sent yet */
+static void smfd_ipmiq_post(const unsigned int zone, const uint8_t percent, const _Bool urgent)
+{
+	struct smfd_ipmiq_slot *const slot = &smfd_ipmiq_slots[zone];
+
+	smfd_ipmiq_lock();
+
+	if (slot->pending)
+		smfd_ipmiq_stats.coalesced += 1;
+	else
+		slot->queued = smfd_mono_ms();
+
+	slot->percent = percent;
+	slot->sample = smfd_sample_time;
+	slot->pending = 1;
+	slot->urgent |= urgent;
+
+	smfd_ipmiq_signal();
+	smfd_ipmiq_unlock();
+}
+
+/*
+ * Queue a BMC fan mode change; it is sent before any queued duty cycle.  Duty cycles that haven't
+ * been sent are discarded if the BMC is taking over (they would be obsolete).
+ */
+static void smfd_ipmiq_set_mode(const uint8_t mode)
+{
+	unsigned int zone;
+
+	if (!smfd_ipmiq_running) {
+		smfd_set_fan_mode(mode);
+		return;
+	}
+
+	smfd_ipmiq_lock();
+
+	smfd_ipmiq_mode = mode;
+	smfd_ipmiq_mode_pending = 1;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+		if (mode != SMFD_SUPERMICRO_FAN_MODE_FULL)
+			smfd_ipmiq_slots[zone].pending = 0;
+		/* The BMC may change the duty cycles while it is in control */
+		smfd_ipmiq_slots[zone].written = 255;
+	}
+
+	smfd_ipmiq_signal();
+	smfd_ipmiq_unlock();
+}
+
+/* Latency (sample ==> written) of a zone's last completed write, if it hasn't been collected yet */
+static int64_t smfd_ipmiq_take_done(const unsigned int zone)
+{
+	int64_t ms;
+
+	smfd_ipmiq_lock();
+	ms = smfd_ipmiq_slots[zone].done_ms;
+	smfd_ipmiq_slots[zone].done_ms = -1;
+	smfd_ipmiq_unlock();
+
+	return ms;
+}
+
+/* Copy (and optionally reset) the write queue statistics */
+static void smfd_ipmiq_get_stats(struct smfd_ipmiq_stats *const st, const _Bool reset)
+{
+	smfd_ipmiq_lock();
+
+	*st = smfd_ipmiq_stats;
+	if (reset)
+		memset(&smfd_ipmiq_stats, 0, sizeof smfd_ipmiq_stats);
+
+	smfd_ipmiq_unlock();
+}
+
+/* Open the writer's IPMI context & start the writer thread (with all signals blocked) */
+static void smfd_ipmiq_init(void)
+{
+	pthread_condattr_t attr;
+	sigset_t all, old;
+	unsigned int zone;
+	int rc;
+
+	if ((smfd_ipmiq_ipmi = ipmi_ctx_create()) == NULL)
+		SMFD_ABORT("ipmi_ctx_create: %m\n");
+
+	/* FreeIPMI contexts aren't thread-safe, so the writer can't share smfd_ipmi */
+	if ((rc = ipmi_ctx_find_inband(smfd_ipmiq_ipmi, NULL, 0, 0, 0, NULL, 0, 0)) < 0)
+		SMFD_FATAL("ipmi_ctx_find_inband: %s\n", ipmi_ctx_errormsg(smfd_ipmiq_ipmi));
+
+	if (rc == 0)
+		SMFD_FATAL("Could not find in-band IPMI device\n");
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+		smfd_ipmiq_slots[zone].ipmi_zone = smfd_zones[zone].ipmi_zone;
+		smfd_ipmiq_slots[zone].written = 255;
+		smfd_ipmiq_slots[zone].done_ms = -1;
+	}
+
+	/* The writer's timed waits (BMC fan mode verification) use smfd_mono_ms() time */
+	if ((rc = pthread_condattr_init(&attr)) != 0)
+		SMFD_ABORT("pthread_condattr_init: %s\n", strerror(rc));
+
+	if ((rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)) != 0)
+		SMFD_ABORT("pthread_condattr_setclock: %s\n", strerror(rc));
+
+	if ((rc = pthread_cond_init(&smfd_ipmiq_cond, &attr)) != 0)
+		SMFD_ABORT("pthread_cond_init: %s\n", strerror(rc));
+
+	if ((rc = pthread_condattr_destroy(&attr)) != 0)
+		SMFD_ABORT("pthread_condattr_destroy: %s\n", strerror(rc));
+
+	if (sigfillset(&all) != 0)
+		SMFD_ABORT("sigfillset: %m\n");
+
+	if ((rc = pthread_sigmask(SIG_SETMASK, &all, &old)) != 0)
+		SMFD_ABORT("pthread_sigmask: %s\n", strerror(rc));
+
+	if ((rc = pthread_create(&smfd_ipmiq_thread, NULL, smfd_ipmiq_main, NULL)) != 0)
+		SMFD_FATAL("pthread_create: %s\n", strerror(rc));
+
+	if ((rc = pthread_setname_np(smfd_ipmiq_thread, "smfd-ipmi")) != 0)
+		SMFD_WARNING("pthread_setname_np: %s\n", strerror(rc));
+
+	if ((rc = pthread_sigmask(SIG_SETMASK, &old, NULL)) != 0)
+		SMFD_ABORT("pthread_sigmask: %s\n", strerror(rc));
+
+	smfd_ipmiq_running = 1;
+
+	SMFD_DEBUG("smfd_ipmiq_init finished\n");
+}
+
+/* Stop the writer thread, after it sends any queued writes, & close its IPMI context */
+static void smfd_ipmiq_fini(void)
+{
+	int rc;
+
+	if (!smfd_ipmiq_running)
+		return;
+
+	smfd_ipmiq_lock();
+	smfd_ipmiq_quit = 1;
+	smfd_ipmiq_signal();
+	smfd_ipmiq_unlock();
+
+	if ((rc = pthread_join(smfd_ipmiq_thread, NULL)) != 0)
+		SMFD_ERR("pthread_join: %s\n", strerror(rc));
+
+	smfd_ipmiq_running = 0;
+
+	if ((rc = pthread_cond_destroy(&smfd_ipmiq_cond)) != 0)
+		SMFD_ERR("pthread_cond_destroy: %s\n", strerror(rc));
+
+	if (ipmi_ctx_close(smfd_ipmiq_ipmi) < 0)
+		SMFD_ERR("ipmi_ctx_close: %s\n", ipmi_ctx_errormsg(smfd_ipmiq_ipmi));
+
+	ipmi_ctx_destroy(smfd_ipmiq_ipmi);
+}
+
+/* IPMI actuator -- query the current fan duty cycle (percentage) of a zone */
+static uint8_t smfd_ipmi_zone_get(struct smfd_zone *const zone)
+{
+	uint8_t cmd[] = {
+		IPMI_CMD_OEM_SUPERMICRO_GENERIC_EXTENSION,
+		SMFD_SUPERMICRO_IPMI_EXT_FAN_PERCENT,
+		0x00,
+		0x00	/* zone goes here */
+	};
+
+	uint8_t percent;
+
+	cmd[3] = zone->ipmi_zone;
+	smfd_ipmi_raw_cmd(cmd, sizeof cmd, &percent, sizeof percent);
+
+	return percent;
+}
+
+/* IPMI actuator -- queue the fan duty cycle (percentage) of a zone for the writer thread */
+static void smfd_ipmi_zone_set(struct smfd_zone *const zone, const uint8_t percent)
+{
+	const unsigned int index = zone - smfd_zones;
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+
+	if (smfd_ipmiq_running) {
+		smfd_ipmiq_post(index, percent, (smfd_safety_active & (1 << index)) != 0);
+		return;
+	}
+
+	if (smfd_ipmi_set_fan_percent(smfd_ipmi, zone->ipmi_zone, percent, err, sizeof err) < 0)
+		SMFD_FATAL("%s\n", err);
+}
+
+/* IPMI actuator -- nothing to do; smfd_ipmi_init sets the BMC fan mode for all IPMI zones */
+static void smfd_ipmi_zone_nop(struct smfd_zone *const zone __attribute__((unused)))
+{
+}
+
+static const struct smfd_actuator_ops smfd_ipmi_actuator = {
+	.name	= "ipmi",
+	.init	= smfd_ipmi_zone_nop,
+	.set	= smfd_ipmi_zone_set,
+	.get	= smfd_ipmi_zone_get,
+	.fini	= smfd_ipmi_zone_nop
+};
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	hwmon PWM fan control (Super I/O chips -- nct6775, it87, etc.)
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Read an integer from a sysfs attribute */
+static int smfd_sysfs_read_int(const int fd, const char *const name)
+{
+	char buf[16];
+	ssize_t len;
+
+	if ((len = pread(fd, buf, sizeof buf - 1, 0)) < 0)
+		SMFD_FATAL("%s: %m\n", name);
+
+	buf[len] = 0;
+
+	return atoi(buf);
+}
+
+/* Write an integer to a sysfs attribute */
+static void smfd_sysfs_write_int(const int fd, const char *const name, const int value)
+{
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof buf, "%d\n", value);
+
+	if (pwrite(fd, buf, len, 0) != len)
+		SMFD_FATAL("%s: %m\n", name);
+}
+
+/* hwmon actuator -- open pwmN & pwmN_enable, and switch the channel to manual control */
+static void smfd_hwmon_zone_init(struct smfd_zone *const zone)
+{
+	char enable[PATH_MAX];
+
+	if (snprintf(enable, sizeof enable, "%s_enable", zone->pwm) >= (int)sizeof enable)
+		SMFD_FATAL("File name truncated: %s_enable\n", zone->pwm);
+
+	if ((zone->pwm_fd = open(zone->pwm, (smfd_shadow ? O_RDONLY : O_RDWR) | O_CLOEXEC)) < 0)
+		SMFD_FATAL("%s: %m\n", zone->pwm);
+
+	if (smfd_shadow) {
+		zone->enable_fd = -1;	/* leave the control mode alone */
+		return;
+	}
+
+	if ((zone->enable_fd = open(enable, O_RDWR | O_CLOEXEC)) < 0)
+		SMFD_FATAL("%s: %m\n", enable);
+
+	zone->saved_enable = smfd_sysfs_read_int(zone->enable_fd, enable);
+	smfd_sysfs_write_int(zone->enable_fd, enable, 1);	/* 1 == manual */
+
+	SMFD_DEBUG("%s: switched from mode %d to manual\n", zone->pwm, zone->saved_enable);
+}
+
+/* hwmon actuator -- set the duty cycle (0-255 in sysfs) */
+static void smfd_hwmon_zone_set(struct smfd_zone *const zone, const uint8_t percent)
+{
+	smfd_sysfs_write_int(zone->pwm_fd, zone->pwm, (percent * 255 + 50) / 100);
+}
+
+/* hwmon actuator -- query the duty cycle */
+static uint8_t smfd_hwmon_zone_get(struct smfd_zone *const zone)
+{
+	return (smfd_sysfs_read_int(zone->pwm_fd, zone->pwm) * 100 + 127) / 255;
+}
+
+/* hwmon actuator -- restore the original control mode and close the attributes */
+static void smfd_hwmon_zone_fini(struct smfd_zone *const zone)
+{
+	char enable[PATH_MAX];
+
+	if (zone->enable_fd >= 0) {
+		/* smfd_hwmon_zone_init has checked that this fits */
+		snprintf(enable, sizeof enable, "%s_enable", zone->pwm);
+		smfd_sysfs_write_int(zone->enable_fd, enable, zone->saved_enable);
+		if (close(zone->enable_fd) != 0)
+			SMFD_ERR("close: %m\n");
+	}
+
+	if (close(zone->pwm_fd) != 0)
+		SMFD_ERR("close: %m\n");
+
+	free(zone->pwm);
+}
+
+static const struct smfd_actuator_ops smfd_hwmon_actuator = {
+	.name	= "hwmon",
+	.init	= smfd_hwmon_zone_init,
+	.set	= smfd_hwmon_zone_set,
+	.get	= smfd_hwmon_zone_get,
+	.fini	= smfd_hwmon_zone_fini
+};
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Fan zones
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Does any zone use the IPMI actuator? */
+static _Bool smfd_zones_use_ipmi(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		if (smfd_zones[i].ops == &smfd_ipmi_actuator)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Query the current fan duty cycle (percentage) of a zone */
+static uint8_t smfd_get_fan_percent(const uint8_t zone)
+{
+	return smfd_zones[zone].ops->get(&smfd_zones[zone]);
+}
+
+/* Set the fan duty cycle (percentage) of a zone */
+static void smfd_set_fan_percent(const uint8_t zone, const uint8_t percent)
+{
+	smfd_zones[zone].ops->set(&smfd_zones[zone], percent);
+}
+
+/* Take control of each zone's fans & set them to 100% */
+static void smfd_zone_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		smfd_zones[i].ops->init(&smfd_zones[i]);
+		if (smfd_shadow)
+			continue;
+		if (smfd_boot_percent[i] <= 100) {
+			/* Continue from smfd-boot, rather than spinning the fans up */
+			SMFD_NOTICE("Continuing %s fan at %" PRIu8 "%% from smfd-boot (%s)\n",
+				    smfd_zone_names[i], smfd_boot_percent[i],
+				    smfd_zones[i].ops->name);
+			smfd_fan_percent[i] = smfd_boot_percent[i];
+			smfd_set_fan_percent(i, smfd_boot_percent[i]);
+			continue;
+		}
+		SMFD_NOTICE("Setting %s fan to 100%% (%s)\n",
+			    smfd_zone_names[i], smfd_zones[i].ops->name);
+		smfd_set_fan_percent(i, 100);
+	}
+
+	SMFD_DEBUG("smfd_zone_init finished\n");
+}
+
+/* Release control of each zone's fans */
+static void smfd_zone_fini(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i)
+		smfd_zones[i].ops->fini(&smfd_zones[i]);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	IPMI initialization & fan sensor reading
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Read a full sensor record of the expected sensor type from an IPMI SDR cache.  Returns the
+ * record length, or -1 (with an error message in err) on failure.
+ */
+static int smfd_sdr_read_record(const ipmi_sdr_ctx_t sdr, const uint16_t id, const uint8_t type,
+				const char *const restrict name, uint8_t *const restrict record,
+				const size_t size, char *const restrict err, const size_t err_size)
+{
+	uint8_t record_type, sensor_type;
+	uint16_t record_id;
+	int rc;
+
+	if (ipmi_sdr_cache_search_record_id(sdr, id) < 0) {
+		snprintf(err, err_size, "ipmi_sdr_cache_search_record_id: %s",
+			 ipmi_sdr_ctx_errormsg(sdr));
+		return -1;
+	}
+
+	if (ipmi_sdr_parse_record_id_and_type(sdr, NULL, 0, &record_id, &record_type) < 0) {
+		snprintf(err, err_size, "ipmi_sdr_parse_record_id_and_type: %s",
+			 ipmi_sdr_ctx_errormsg(sdr));
+		return -1;
+	}
+
+	assert(record_id == id);
+
+	if (record_type != IPMI_SDR_FORMAT_FULL_SENSOR_RECORD) {
+		snprintf(err, err_size, "%s [%" PRIu16 "] is not a full sensor record",
+			 name, record_id);
+		return -1;
+	}
+
+	if (ipmi_sdr_parse_sensor_type(sdr, NULL, 0, &sensor_type) < 0) {
+		snprintf(err, err_size, "ipmi_sdr_parse_sensor_type: %s",
+			 ipmi_sdr_ctx_errormsg(sdr));
+		return -1;
+	}
+
+	if (sensor_type != type) {
+		snprintf(err, err_size, "%s [%" PRIu16 "] is not a %s sensor", name, record_id,
+			 (type == IPMI_SENSOR_TYPE_FAN) ? "fan" : "temperature");
+		return -1;
+	}
+
+	if ((rc = ipmi_sdr_cache_record_read(sdr, record, size)) < 0) {
+		snprintf(err, err_size, "ipmi_sdr_cache_record_read: %s",
+			 ipmi_sdr_ctx_errormsg(sdr));
+		return -1;
+	}
+
+	return rc;
+}
+
+/* Initialize a smfd_ipmi_fan by reading its record from the IPMI SDR cache */
+static void smfd_ipmi_fan_init(const ipmi_sdr_ctx_t sdr, struct smfd_ipmi_fan *const fan)
+{
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+	int rc;
+
+	rc = smfd_sdr_read_record(sdr, fan->record_id, IPMI_SENSOR_TYPE_FAN, fan->name,
+				  fan->record, sizeof fan->record, err, sizeof err);
+	if (rc < 0)
+		SMFD_FATAL("%s\n", err);
+
+	fan->record_len = rc;
+}
+
+/*
+ * Initialize smfd_ipmi, smfd_ipmi_fans & smfd_read; set fan mode to full & start the writer thread
+ * if any zone uses IPMI
+ */
+static void smfd_ipmi_init(void)
+{
+	ipmi_sdr_ctx_t sdr;
+	unsigned i;
+	int rc;
+
+	if (!smfd_zones_use_ipmi() && smfd_ipmi_fan_count == 0) {
+		SMFD_DEBUG("IPMI not used\n");
+		return;
+	}
+
+	if ((smfd_ipmi = ipmi_ctx_create()) == NULL)
+		SMFD_ABORT("ipmi_ctx_create: %m\n");
+
+	if ((rc = ipmi_ctx_find_inband(smfd_ipmi, NULL, 0, 0, 0, NULL, 0, 0)) < 0)
+		SMFD_FATAL("ipmi_ctx_find_inband: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+
+	if (rc == 0)
+		SMFD_FATAL("Could not find in-band IPMI device\n");
+
+	if ((sdr = ipmi_sdr_ctx_create()) == NULL)
+		SMFD_ABORT("ipmi_sdr_ctx_create: %m\n");
+
+	if (ipmi_sdr_cache_open(sdr, smfd_ipmi, smfd_sdr_cache) < 0)
+		SMFD_FATAL("ipmi_sdr_cache_open: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+
+	for (i = 0; i < smfd_ipmi_fan_count; ++i)
+		smfd_ipmi_fan_init(sdr, &smfd_ipmi_fans[i]);
+
+	if (ipmi_sdr_cache_close(sdr) < 0)
+		SMFD_ERR("ipmi_sdr_cache_close: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+
+	ipmi_sdr_ctx_destroy(sdr);
+
+	if ((smfd_read = ipmi_sensor_read_ctx_create(smfd_ipmi)) == NULL)
+		SMFD_FATAL("ipmi_sensor_read_ctx_create: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+
+	if (smfd_zones_use_ipmi() && smfd_shadow) {
+		smfd_fan_mode = smfd_get_fan_mode();
+		SMFD_NOTICE("Shadow mode; leaving BMC fan management mode (%#" PRIx8 ") alone\n",
+			    smfd_fan_mode);
+	}
+	else if (smfd_zones_use_ipmi()) {
+		SMFD_NOTICE("Setting BMC fan management mode to full (manual)\n");
+		smfd_set_fan_mode(SMFD_SUPERMICRO_FAN_MODE_FULL);
+		/* Periodic reports use this cached value, rather than querying the BMC */
+		smfd_fan_mode = smfd_get_fan_mode();
+		smfd_ipmiq_init();
+	}
+
+	SMFD_DEBUG("smfd_ipmi_init finished\n");
+}
+
+/* Close/destroy FreeIPMI contexts (smfd_ipmi and smfd_read) & free smfd_ipmi_fans */
+static void smfd_ipmi_fini(void)
+{
+	unsigned i;
+
+	if (smfd_ipmi == NULL)
+		return;
+
+	smfd_ipmiq_fini();
+	ipmi_sensor_read_ctx_destroy(smfd_read);
+
+	if (ipmi_ctx_close(smfd_ipmi) < 0)
+		SMFD_ERR("ipmi_ctx_close: %s\n", ipmi_ctx_errormsg(smfd_ipmi));
+
+	ipmi_ctx_destroy(smfd_ipmi);
+
+	for (i = 0; i < smfd_ipmi_fan_count; ++i)
+		free(smfd_ipmi_fans[i].name);
+
+	free(smfd_ipmi_fans);
+}
+
+/* Read the current RPM of 1 IPMI fan; returns 0 on failure */
+static _Bool smfd_ipmi_fan_read_one(struct smfd_ipmi_fan *const fan)
+{
+	uint16_t bitmask;
+	double *reading;
+	int rc;
+
+	rc = ipmi_sensor_read(smfd_read, fan->record, fan->record_len, 0, NULL, &reading, &bitmask);
+	if (rc <= 0) {
+		SMFD_WARNING("%s: ipmi_sensor_read: %s\n",
+			     fan->name, ipmi_sensor_read_ctx_errormsg(smfd_read));
+		return 0;
+	}
+
+	if (*reading < 0 || *reading > UINT_MAX) {
+		SMFD_WARNING("%s fan (%g RPM) out of range\n", fan->name, *reading);
+		free(reading);
+		return 0;
+	}
+
+	fan->rpm = *reading;
+	fan->rpm_time = smfd_mono_ms();
+	free(reading);
+
+	return 1;
+}
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Flight recorder -- high-resolution data from before thermal incidents
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Each control cycle is recorded as 1 CSV line in a preallocated ring buffer: the raw sensor
+ * readings, each zone's duty cycle & the reason for it, the latency of any duty cycle write, and
+ * any RPM readings.  When the highest trigger of any sensor group activates, or a group's
+ * temperature is still rising with its fans at 100% (both zones, or the zone it is assigned to),
+ * the ring is copied to a preallocated snapshot buffer, which the reporting thread writes (with a
+ * single write()) to a new file & renames into place once it is complete, so the control loop
+ * never waits for the disk.
+ *
+ * The ring holds at least smfd_rec_window seconds of cycles (at the sample interval when smfd
+ * started).  Disks are recorded as NAME=TEMP pairs, because they can come and go.  A write latency
+ * is measured from the triggering sample until the write completed; writes queued for the IPMI
+ * writer thread are recorded in the first cycle after the BMC accepts them.
+ */
+
+/* Longest possible line, other than coretemp & disk readings */
+#define SMFD_REC_LINE_BASE	256
+
+/* Per-zone data for the current cycle */
+struct smfd_rec_zone {
+	const char *reason;
+	int64_t set_ms;		/* sample ==> duty cycle written latency (-1 if none written) */
+	unsigned int rpm;
+	_Bool rpm_valid;
+};
+
+static char *smfd_rec_ring = NULL;
+static size_t smfd_rec_size;
+static size_t smfd_rec_head;		/* where the next line will be written */
+static _Bool smfd_rec_wrapped;
+static char *smfd_rec_line;		/* line being formatted */
+static size_t smfd_rec_line_size;
+static char *smfd_rec_snap;		/* header lines & ring contents being dumped */
+static size_t smfd_rec_snap_len;
+static size_t smfd_rec_hdr_size;
+static time_t smfd_rec_snap_time;
+static char smfd_rec_snap_event[64];
+static struct smfd_rec_zone smfd_rec_zones[SMFD_FAN_ZONE_COUNT];
+static int smfd_rec_last_temp[SMFD_GROUP_COUNT];
+static _Bool smfd_rec_max_active[SMFD_GROUP_COUNT];
+static _Bool smfd_rec_saturated;
+static int64_t smfd_rec_last_dump;
+
+/* Allocate the ring, line & snapshot buffers; call after the coretemps & disks have been found */
+static void smfd_rec_init(void)
+{
+	unsigned int i, cycles;
+
+	if (smfd_rec_window == 0)
+		return;
+
+	/* Up to 8 characters per coretemp reading & 24 per disk (with room for hotplug) */
+	smfd_rec_line_size = SMFD_REC_LINE_BASE + 8 * smfd_coretemp_count
+				+ 24 * (smfd_disk_count + 32);
+
+	cycles = (uint64_t)smfd_rec_window * 1000 / smfd_sample_interval + 2;
+	smfd_rec_size = (size_t)cycles * smfd_rec_line_size;
+
+	smfd_rec_hdr_size = SMFD_REC_LINE_BASE * 2;
+	for (i = 0; i < smfd_coretemp_count; ++i)
+		smfd_rec_hdr_size += strlen(smfd_coretemps[i].name) + 1;
+
+	if ((smfd_rec_ring = malloc(smfd_rec_size)) == NULL
+			|| (smfd_rec_line = malloc(smfd_rec_line_size)) == NULL
+			|| (smfd_rec_snap = malloc(smfd_rec_hdr_size + smfd_rec_size)) == NULL) {
+		SMFD_ABORT("malloc: %m\n");
+	}
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i)
+		smfd_rec_zones[i].set_ms = -1;
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i)
+		smfd_rec_last_temp[i] = INT_MIN;
+
+	SMFD_DEBUG("smfd_rec_init finished (%zu byte ring)\n", smfd_rec_size);
+}
+
+/* Free the ring, line & snapshot buffers; call after the reporting thread has stopped */
+static void smfd_rec_fini(void)
+{
+	free(smfd_rec_ring);
+	free(smfd_rec_line);
+	free(smfd_rec_snap);
+}
+
+/* Record the latency of a duty cycle write */
+static void smfd_rec_set(const uint8_t zone, const int64_t latency)
+{
+	smfd_rec_zones[zone].set_ms = latency;
+}
+
+/* Record the RPM of a zone's fans */
+static void smfd_rec_rpm(const uint8_t zone, const unsigned int rpm)
+{
+	smfd_rec_zones[zone].rpm = rpm;
+	smfd_rec_zones[zone].rpm_valid = 1;
+}
+
+/* Append a formatted value to the line buffer (silently truncating) */
+__attribute__((format(printf, 2, 3)))
+static void smfd_rec_add(size_t *const len, const char *const format, ...)
+{
+	va_list ap;
+	int rc;
+
+	if (*len >= smfd_rec_line_size - 1)
+		return;
+
+	va_start(ap, format);
+	rc = vsnprintf(smfd_rec_line + *len, smfd_rec_line_size - 1 - *len, format, ap);
+	va_end(ap);
+
+	if (rc < 0)
+		SMFD_ABORT("vsnprintf: %m\n");
+
+	*len += rc;
+	if (*len > smfd_rec_line_size - 2)
+		*len = smfd_rec_line_size - 2;	/* leave room for the newline */
+}
+
+/* Append a sensor reading (empty if the sensor has failed) */
+static void smfd_rec_add_temp(size_t *const len, const struct smfd_temperature *const temp)
+{
+	if (temp->state == SMFD_SENSOR_FAILED)
+		smfd_rec_add(len, ",");
+	else
+		smfd_rec_add(len, ",%d", temp->current);
+}
+
+/* Copy a complete line into the ring */
+static void smfd_rec_append(const size_t len)
+{
+	size_t first;
+
+	first = smfd_rec_size - smfd_rec_head;
+	if (first > len)
+		first = len;
+
+	memcpy(smfd_rec_ring + smfd_rec_head, smfd_rec_line, first);
+	memcpy(smfd_rec_ring, smfd_rec_line + first, len - first);
+
+	smfd_rec_head += len;
+	if (smfd_rec_head >= smfd_rec_size) {
+		smfd_rec_head -= smfd_rec_size;
+		smfd_rec_wrapped = 1;
+	}
+}
+
+/* Write the snapshot to a new incident file; runs in the reporting thread (if it is running) */
+static void smfd_rec_write(void)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + sizeof ".tmp"], stamp[sizeof "YYYYmmdd-HHMMSS"];
+	struct tm tm;
+	int fd;
+
+	strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", localtime_r(&smfd_rec_snap_time, &tm));
+
+	snprintf(path, sizeof path, "%s/incident-%s.csv",
+		 (smfd_rec_dir == NULL) ? "/var/lib/smfd" : smfd_rec_dir, stamp);
+	snprintf(tmp, sizeof tmp, "%s.tmp", path);
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640)) < 0) {
+		SMFD_ERR("%s: %m\n", tmp);
+		return;
+	}
+
+	if (write(fd, smfd_rec_snap, smfd_rec_snap_len) != (ssize_t)smfd_rec_snap_len
+			|| fdatasync(fd) != 0) {
+		SMFD_ERR("%s: %m\n", tmp);
+		if (close(fd) != 0)
+			SMFD_ERR("close: %m\n");
+		if (unlink(tmp) != 0)
+			SMFD_ERR("%s: %m\n", tmp);
+		return;
+	}
+
+	if (close(fd) != 0)
+		SMFD_ERR("close: %m\n");
+
+	if (rename(tmp, path) != 0) {
+		SMFD_ERR("%s: %m\n", path);
+		return;
+	}
+
+	SMFD_NOTICE("Thermal incident (%s); flight recorder data written to %s\n",
+		    smfd_rec_snap_event, path);
+}
+
+/* Copy the ring to the snapshot buffer & hand it to the reporting thread to be written */
+static void smfd_rec_dump(const char *const event)
+{
+	size_t len, start;
+	const char *nl;
+	unsigned i;
+	_Bool busy;
+	int rc;
+
+	if (smfd_report_running) {
+
+		if ((rc = pthread_mutex_lock(&smfd_report_mutex)) != 0)
+			SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
+
+		busy = smfd_report_dump;
+
+		if ((rc = pthread_mutex_unlock(&smfd_report_mutex)) != 0)
+			SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
+
+		if (busy) {
+			SMFD_WARNING("Previous flight recorder dump not yet written; "
+				     "not recording incident (%s)\n", event);
+			return;
+		}
+	}
+
+	smfd_rec_snap_time = time(NULL);
+	snprintf(smfd_rec_snap_event, sizeof smfd_rec_snap_event, "%s", event);
+
+	/* Header -- formatted in the preallocated buffer */
+	len = snprintf(smfd_rec_snap, smfd_rec_hdr_size,
+		       "# smfd flight recorder: %s; sample interval %u ms\ntime,PCH", event,
+		       smfd_sample_interval);
+	for (i = 0; i < smfd_coretemp_count && len < smfd_rec_hdr_size; ++i) {
+		len += snprintf(smfd_rec_snap + len, smfd_rec_hdr_size - len, ",%s",
+				smfd_coretemps[i].name);
+	}
+	if (len < smfd_rec_hdr_size) {
+		len += snprintf(smfd_rec_snap + len, smfd_rec_hdr_size - len,
+				",disks,cpu_duty,cpu_reason,cpu_set_ms,cpu_rpm,"
+				"sys_duty,sys_reason,sys_set_ms,sys_rpm,event\n");
+	}
+	if (len >= smfd_rec_hdr_size)
+		len = smfd_rec_hdr_size - 1;
+
+	if (!smfd_rec_wrapped) {
+		memcpy(smfd_rec_snap + len, smfd_rec_ring, smfd_rec_head);
+		len += smfd_rec_head;
+	}
+	else {
+		/* The oldest line was partly overwritten; start after it */
+		nl = memchr(smfd_rec_ring + smfd_rec_head, '\n', smfd_rec_size - smfd_rec_head);
+
+		if (nl != NULL) {
+			start = nl + 1 - smfd_rec_ring;
+			memcpy(smfd_rec_snap + len, smfd_rec_ring + start, smfd_rec_size - start);
+			len += smfd_rec_size - start;
+			memcpy(smfd_rec_snap + len, smfd_rec_ring, smfd_rec_head);
+			len += smfd_rec_head;
+		}
+		else {
+			nl = memchr(smfd_rec_ring, '\n', smfd_rec_head);
+			start = (nl == NULL) ? smfd_rec_head : (size_t)(nl + 1 - smfd_rec_ring);
+			memcpy(smfd_rec_snap + len, smfd_rec_ring + start, smfd_rec_head - start);
+			len += smfd_rec_head - start;
+		}
+	}
+
+	smfd_rec_snap_len = len;
+
+	if (!smfd_report_running) {
+		smfd_rec_write();
+		return;
+	}
+
+	if ((rc = pthread_mutex_lock(&smfd_report_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
+
+	smfd_report_dump = 1;
+
+	if ((rc = pthread_cond_signal(&smfd_report_cond)) != 0)
+		SMFD_ABORT("pthread_cond_signal: %s\n", strerror(rc));
+
+	if ((rc = pthread_mutex_unlock(&smfd_report_mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
+}
+
+/* Detect an incident -- a group's highest trigger activating, or saturated fans & rising temps */
+static const char *smfd_rec_incident(const struct smfd_process_temp_result *const results)
+{
+	static char event[64];
+
+	const struct smfd_temp_threshold *t, *top;
+	_Bool saturated, group_saturated;
+	const char *incident;
+	unsigned int i;
+	uint8_t zone;
+
+	incident = NULL;
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		for (top = t = smfd_policy->triggers[i]; t->name != NULL; ++t) {
+			if (t->threshold > top->threshold)
+				top = t;
+		}
+
+		if (top->name != NULL && top->active && !smfd_rec_max_active[i]) {
+			snprintf(event, sizeof event, "%s %s trigger", results[i].name, top->name);
+			incident = event;
+		}
+
+		smfd_rec_max_active[i] = (top->name != NULL && top->active);
+	}
+
+	for (saturated = 0, i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		/* A group assigned to 1 zone (coupling assign_zones) is only cooled by that zone */
+		zone = smfd_coupling_zones[i];
+		if (zone == SMFD_FAN_ZONE_COUNT) {
+			group_saturated = smfd_fan_percent[SMFD_FAN_ZONE_CPU] == 100
+					&& smfd_fan_percent[SMFD_FAN_ZONE_SYS] == 100;
+		}
+		else {
+			group_saturated = smfd_fan_percent[zone] == 100;
+		}
+
+		saturated |= group_saturated;
+
+		if (group_saturated && !smfd_rec_saturated && incident == NULL
+				&& results[i].temp != INT_MIN && smfd_rec_last_temp[i] != INT_MIN
+				&& results[i].temp > smfd_rec_last_temp[i]) {
+			snprintf(event, sizeof event, "fans saturated while %s temperature rising",
+				 results[i].name);
+			incident = event;
+			smfd_rec_saturated = 1;
+		}
+
+		smfd_rec_last_temp[i] = results[i].temp;
+	}
+
+	if (!saturated)
+		smfd_rec_saturated = 0;
+
+	return incident;
+}
+
+/* Record a control cycle & check for an incident */
+static void smfd_rec_cycle(const struct smfd_process_temp_result *const results,
+			   const char *const *const reason)
+{
+	struct smfd_rec_zone *zone;
+	const char *incident, *name;
+	struct timespec now;
+	size_t len;
+	unsigned i;
+
+	if (smfd_rec_ring == NULL)
+		return;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) != 0)
+		SMFD_FATAL("clock_gettime: %m\n");
+
+	incident = smfd_rec_incident(results);
+
+	len = 0;
+	smfd_rec_add(&len, "%ld.%03ld", (long)now.tv_sec, now.tv_nsec / 1000000);
+	smfd_rec_add_temp(&len, &smfd_pch_temp);
+
+	for (i = 0; i < smfd_coretemp_count; ++i)
+		smfd_rec_add_temp(&len, &smfd_coretemps[i].temp);
+
+	smfd_rec_add(&len, ",");
+
+	for (i = 0; i < smfd_disk_count; ++i) {
+
+		if ((name = strrchr(smfd_disks[i].devnode, '/')) == NULL)
+			name = smfd_disks[i].devnode;
+		else
+			++name;
+
+		if (smfd_disks[i].temp.state == SMFD_SENSOR_FAILED)
+			smfd_rec_add(&len, "%s%s=", (i == 0) ? "" : " ", name);
+		else
+			smfd_rec_add(&len, "%s%s=%d", (i == 0) ? "" : " ", name,
+				     smfd_disks[i].temp.current);
+	}
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+
+		zone = &smfd_rec_zones[i];
+
+		if (smfd_ipmiq_running && smfd_zones[i].ops == &smfd_ipmi_actuator)
+			zone->set_ms = smfd_ipmiq_take_done(i);
+
+		smfd_rec_add(&len, ",%" PRIu8 ",%s,", smfd_fan_percent[i],
+			     (reason[i] == NULL) ? "base" : reason[i]);
+
+		if (zone->set_ms >= 0)
+			smfd_rec_add(&len, "%" PRId64, zone->set_ms);
+
+		smfd_rec_add(&len, ",");
+
+		if (zone->rpm_valid)
+			smfd_rec_add(&len, "%u", zone->rpm);
+
+		zone->set_ms = -1;
+		zone->rpm_valid = 0;
+	}
+
+	smfd_rec_add(&len, ",%s", (incident == NULL) ? "" : incident);
+	smfd_rec_line[len++] = '\n';
+
+	smfd_rec_append(len);
+
+	/* Incidents within 1 window of the last dump would mostly repeat it */
+	if (incident != NULL && (smfd_rec_last_dump == 0
+			|| smfd_sample_time - smfd_rec_last_dump >= smfd_rec_window * 1000LL)) {
+		smfd_rec_dump(incident);
+		smfd_rec_last_dump = smfd_sample_time;
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Fan response latency measurement
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Current monotonic time in milliseconds */
+static int64_t smfd_mono_ms(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		SMFD_ABORT("clock_gettime: %m\n");
+
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Add a latency to a histogram */
+static void smfd_hist_add(struct smfd_histogram *const hist, const int64_t ms)
+{
+	unsigned int bucket;
+
+	for (bucket = 0; bucket < 23 && ms >= (INT64_C(1) << bucket); ++bucket);
+
+	hist->buckets[bucket] += 1;
+	hist->count += 1;
+	hist->total += ms;
+
+	if (ms > hist->max)
+		hist->max = ms;
+}
+
+/* Upper bound (ms) of the bucket that contains the given percentile */
+static int64_t smfd_hist_percentile(const struct smfd_histogram *const hist,
+				    const unsigned int percentile)
+{
+	unsigned int bucket, seen;
+
+	for (bucket = 0, seen = 0; bucket < 23; ++bucket) {
+		seen += hist->buckets[bucket];
+		if (seen * 100 >= hist->count * percentile)
+			break;
+	}
+
+	return INT64_C(1) << bucket;
+}
+
+/* Log a latency histogram */
+static void smfd_hist_log(const char *const name, const struct smfd_histogram *const hist)
+{
+	if (hist->count == 0) {
+		SMFD_INFO("%s: no samples\n", name);
+		return;
+	}
+
+	SMFD_INFO("%s: samples: %u, mean: %" PRId64 " ms, p50: <%" PRId64 " ms, "
+		  "p90: <%" PRId64 " ms, max: %" PRId64 " ms\n", name, hist->count,
+		  hist->total / hist->count, smfd_hist_percentile(hist, 50),
+		  smfd_hist_percentile(hist, 90), hist->max);
+}
+
+/* Read the total RPM of the IPMI fans in a zone; returns 0 if the zone has no (readable) fans */
+static _Bool smfd_zone_rpm(const uint8_t zone, unsigned int *const rpm)
+{
+	_Bool found;
+	unsigned i;
+
+	for (*rpm = 0, found = 0, i = 0; i < smfd_ipmi_fan_count; ++i) {
+
+		if (smfd_ipmi_fans[i].zone != zone)
+			continue;
+
+		if (!smfd_ipmi_fan_read_one(&smfd_ipmi_fans[i]))
+			return 0;
+
+		*rpm += smfd_ipmi_fans[i].rpm;
+		found = 1;
+	}
+
+	if (found)
+		smfd_rec_rpm(zone, *rpm);
+
+	return found;
+}
+
+/* Start tracking a zone's response to a duty cycle change that has just been made */
+static void smfd_response_start(const uint8_t zone, const _Bool increase,
+				const struct smfd_process_temp_result *const result)
+{
+	struct smfd_zone_response *const resp = &smfd_responses[zone];
+	int64_t now;
+
+	now = smfd_mono_ms();
+	smfd_hist_add(&smfd_set_latency, now - smfd_sample_time);
+
+	/* Queued IPMI writes are recorded when the writer thread completes them */
+	if (!smfd_ipmiq_running || smfd_zones[zone].ops != &smfd_ipmi_actuator)
+		smfd_rec_set(zone, now - smfd_sample_time);
+
+	resp->sample = smfd_sample_time;
+
+	/* RPM immediately after the change approximates the old steady state */
+	resp->rpm_pending = smfd_zone_rpm(zone, &resp->rpm[0]);
+	resp->rpm_time[0] = now;
+	resp->rpm_count = 1;
+
+	resp->temp_pending = increase && result != NULL;
+	if (resp->temp_pending) {
+		resp->group = result->group;
+		resp->last_temp = result->temp;
+	}
+}
+
+/* Sample the RPM of zones whose fans are still responding to a duty cycle change */
+static void smfd_response_poll(void)
+{
+	struct smfd_zone_response *resp;
+	unsigned int i, n, old, new, change, target;
+	uint8_t zone;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		resp = &smfd_responses[zone];
+		if (!resp->rpm_pending)
+			continue;
+
+		n = resp->rpm_count;
+		smfd_zone_rpm(zone, &resp->rpm[n]);
+		resp->rpm_time[n] = smfd_mono_ms();
+		resp->rpm_count = ++n;
+
+		/* Settled when the last 3 samples are within 2% of each other */
+		if (n < SMFD_RPM_SAMPLES && (n < 4
+				|| abs((int)resp->rpm[n - 1] - (int)resp->rpm[n - 2])
+						> (int)resp->rpm[n - 1] / 50
+				|| abs((int)resp->rpm[n - 1] - (int)resp->rpm[n - 3])
+						> (int)resp->rpm[n - 1] / 50)) {
+			continue;
+		}
+
+		resp->rpm_pending = 0;
+
+		old = resp->rpm[0];
+		new = resp->rpm[n - 1];
+		change = (new > old) ? new - old : old - new;
+
+		if (change < 50 || change < old / 20) {
+			SMFD_DEBUG("%s fan RPM change (%u ==> %u) too small to measure\n",
+				   smfd_zone_names[zone], old, new);
+			continue;
+		}
+
+		target = change * 9 / 10;
+
+		for (i = 1; i < n; ++i) {
+			if ((unsigned int)abs((int)resp->rpm[i] - (int)old) >= target)
+				break;
+		}
+
+		SMFD_DEBUG("%s fan reached 90%% of %u ==> %u RPM after %" PRId64 " ms\n",
+			   smfd_zone_names[zone], old, new, resp->rpm_time[i] - resp->sample);
+
+		smfd_hist_add(&smfd_rpm_latency, resp->rpm_time[i] - resp->sample);
+	}
+}
+
+/* Check whether the group that caused a duty cycle increase has started to cool */
+static void smfd_response_temps(const struct smfd_process_temp_result *const results)
+{
+	struct smfd_zone_response *resp;
+	int64_t elapsed;
+	uint8_t zone;
+	int temp;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		resp = &smfd_responses[zone];
+		if (!resp->temp_pending)
+			continue;
+
+		temp = results[resp->group].temp;
+		elapsed = smfd_sample_time - resp->sample;
+
+		if (temp == INT_MIN)
+			continue;	/* no readable sensors in group */
+
+		if (temp < resp->last_temp) {
+			SMFD_DEBUG("%s temperature turned around %" PRId64 " ms after %s fan "
+				   "change\n", results[resp->group].name, elapsed,
+				   smfd_zone_names[zone]);
+			smfd_hist_add(&smfd_turn_latency, elapsed);
+			resp->temp_pending = 0;
+		}
+		else if (elapsed > 3600 * 1000) {
+			resp->temp_pending = 0;		/* give up */
+		}
+		else {
+			resp->last_temp = temp;
+		}
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Shadow mode -- compare smfd's decisions with the BMC's
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Compare the duty cycles that smfd has decided on (smfd_fan_percent) with the zones' actual duty
+ * cycles and fan speeds.  Fan power is estimated as the cube of the duty cycle.  Where a group's
+ * coupling gains are known, the temperature change that smfd's decisions would cause (at steady
+ * state) is projected from the difference in duty cycles.
+ */
+static void smfd_shadow_sample(void)
+{
+	struct smfd_shadow_stats *const st = &smfd_shadow_stats;
+	double diff[SMFD_FAN_ZONE_COUNT], delta;
+	uint8_t actual, zone;
+	unsigned int rpm, i;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		actual = smfd_get_fan_percent(zone);
+
+		st->shadow_power[zone] += pow(smfd_fan_percent[zone] / 100.0, 3);
+		st->actual_power[zone] += pow(actual / 100.0, 3);
+		diff[zone] = (double)smfd_fan_percent[zone] - actual;
+		st->duty_diff[zone] += diff[zone];
+
+		if (smfd_zone_rpm(zone, &rpm)) {
+			st->rpm[zone] += rpm;
+			st->rpm_samples[zone] += 1;
+		}
+
+		SMFD_DEBUG("Shadow: %s fan: smfd %" PRIu8 "%%, actual %" PRIu8 "%%\n",
+			   smfd_zone_names[zone], smfd_fan_percent[zone], actual);
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		if (!smfd_opt_groups[i].have_gain)
+			continue;
+
+		delta = smfd_opt_groups[i].gain[SMFD_FAN_ZONE_CPU] * diff[SMFD_FAN_ZONE_CPU]
+			+ smfd_opt_groups[i].gain[SMFD_FAN_ZONE_SYS] * diff[SMFD_FAN_ZONE_SYS];
+
+		if (!st->have_model[i] || delta > st->temp_delta_max[i])
+			st->temp_delta_max[i] = delta;
+
+		st->temp_delta[i] += delta;
+		st->have_model[i] = 1;
+	}
+
+	st->samples += 1;
+}
+
+/* Log a shadow mode summary */
+static void smfd_shadow_log(const struct smfd_shadow_stats *const st)
+{
+	unsigned int zone, i;
+
+	if (st->samples == 0) {
+		SMFD_INFO("Shadow mode: no samples\n");
+		return;
+	}
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		SMFD_INFO("Shadow mode: %s fan: mean duty cycle difference %+.1f%%, "
+			  "projected fan energy savings %.1f%%\n", smfd_zone_names[zone],
+			  st->duty_diff[zone] / st->samples,
+			  (st->actual_power[zone] > 0) ?
+				100.0 * (1.0 - st->shadow_power[zone] / st->actual_power[zone])
+				: 0.0);
+
+		if (st->rpm_samples[zone] > 0) {
+			SMFD_INFO("Shadow mode: %s fan: mean measured speed %.0f RPM\n",
+				  smfd_zone_names[zone], st->rpm[zone] / st->rpm_samples[zone]);
+		}
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (!st->have_model[i])
+			continue;
+		SMFD_INFO("Shadow mode: %s temperature: projected change mean %+.2f°C, "
+			  "max %+.2f°C\n", smfd_group_keys[i], st->temp_delta[i] / st->samples,
+			  st->temp_delta_max[i]);
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Background I/O throttling -- slow RAID resync & scrubs when the disks are too hot
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * When disks are hot, background work (md resync/check, a ZFS scrub or btrfs balance) is often a
+ * bigger heat source than the foreground workload.  If the disk group's highest trigger stays
+ * active with the system fans at 100% for hold_time seconds, the rate limits of the configured md
+ * arrays (sync_speed_max) and cgroups (io.max of each monitored disk) are halved -- and halved
+ * again after every further hold_time seconds, up to steps times.  Once the trigger deactivates
+ * (below its hysteresis), the limits are raised a step at a time, at the same pace, and finally
+ * restored to their original values.
+ */
+
+/* Current throttling level (0 == not throttled) */
+static unsigned int smfd_throttle_level = 0;
+
+/* Direction of the pending step (1 == throttle, -1 == relax, 0 == none) & when it became pending */
+static int smfd_throttle_dir = 0;
+static int64_t smfd_throttle_since;
+
+/* Read a (small) sysfs or cgroup file into a new string; returns NULL on failure */
+static char *smfd_throttle_read(const char *const path)
+{
+	char buf[4096];
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		SMFD_WARNING("%s: %m\n", path);
+		return NULL;
+	}
+
+	if ((len = read(fd, buf, sizeof buf - 1)) < 0)
+		SMFD_WARNING("%s: %m\n", path);
+
+	if (close(fd) != 0)
+		SMFD_WARNING("%s: %m\n", path);
+
+	if (len < 0)
+		return NULL;
+
+	buf[len] = 0;
+
+	return smfd_strdup(buf);
+}
+
+/* Write a value to a sysfs or cgroup file */
+static void smfd_throttle_write(const char *const restrict path, const char *const restrict value)
+{
+	int fd;
+
+	SMFD_DEBUG("Writing %s to %s\n", value, path);
+
+	if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+		SMFD_WARNING("%s: %m\n", path);
+		return;
+	}
+
+	if (write(fd, value, strlen(value)) != (ssize_t)strlen(value))
+		SMFD_WARNING("%s: %s: %m\n", path, value);
+
+	if (close(fd) != 0)
+		SMFD_WARNING("%s: %m\n", path);
+}
+
+/* Rate limit (KiB/s) at a throttling level -- base halved at each step, but not below min_rate */
+static unsigned long smfd_throttle_rate(const unsigned long base, const unsigned int level)
+{
+	unsigned long rate, floor;
+
+	floor = smfd_throttle_min_rate * 1024UL;
+	rate = base >> level;
+
+	return (rate < floor) ? floor : rate;
+}
+
+/* Set an md array's resync/check speed limit for a throttling level */
+static void smfd_throttle_md(struct smfd_throttle_target *const target, const unsigned int level)
+{
+	char value[32];
+
+	if (level == 0) {
+		/* sync_speed_max reads as "200000 (system)" or "50000 (local)" */
+		if (strstr(target->saved, "(system)") != NULL)
+			snprintf(value, sizeof value, "system");
+		else
+			snprintf(value, sizeof value, "%lu", target->base);
+	}
+	else {
+		snprintf(value, sizeof value, "%lu", smfd_throttle_rate(target->base, level));
+	}
+
+	smfd_throttle_write(target->path, value);
+}
+
+/* Find the line of an io.max file that sets a device's limits ("MAJ:MIN ..."); NULL if none */
+static const char *smfd_throttle_find(const char *line, const char *const prefix)
+{
+	while (strncmp(line, prefix, strlen(prefix)) != 0) {
+		if ((line = strchr(line, '\n')) == NULL)
+			return NULL;
+		++line;
+	}
+
+	return line;
+}
+
+/* Set a cgroup's bandwidth limits on the monitored disks for a throttling level */
+static void smfd_throttle_cgroup(struct smfd_throttle_target *const target,
+				 const unsigned int level)
+{
+	char value[128], prefix[32];
+	unsigned long rate;
+	const char *line;
+	unsigned int i, j;
+	struct stat st;
+	dev_t *devs;
+
+	if (level == 0) {
+
+		/* Put back each limit that smfd changed (or remove it) */
+		for (i = 0; i < target->dev_count; ++i) {
+
+			snprintf(prefix, sizeof prefix, "%u:%u ",
+				 major(target->devs[i]), minor(target->devs[i]));
+
+			if ((line = smfd_throttle_find(target->saved, prefix)) != NULL)
+				snprintf(value, sizeof value, "%.*s",
+					 (int)strcspn(line, "\n"), line);
+			else
+				snprintf(value, sizeof value, "%srbps=max wbps=max", prefix);
+
+			smfd_throttle_write(target->path, value);
+		}
+
+		target->dev_count = 0;
+		return;
+	}
+
+	rate = smfd_throttle_rate(smfd_throttle_cgroup_rate * 1024UL, level) * 1024;
+
+	/* Disks may have been hot plugged since the last step */
+	for (i = 0; i < smfd_disk_count; ++i) {
+
+		if (stat(smfd_disks[i].devnode, &st) != 0) {
+			SMFD_WARNING("%s: %m\n", smfd_disks[i].devnode);
+			continue;
+		}
+
+		for (j = 0; j < target->dev_count && target->devs[j] != st.st_rdev; ++j);
+
+		if (j == target->dev_count) {
+			devs = realloc(target->devs, (j + 1) * sizeof *devs);
+			if (devs == NULL)
+				SMFD_ABORT("realloc: %m\n");
+			target->devs = devs;
+			target->devs[target->dev_count++] = st.st_rdev;
+		}
+
+		snprintf(value, sizeof value, "%u:%u rbps=%lu wbps=%lu",
+			 major(st.st_rdev), minor(st.st_rdev), rate, rate);
+		smfd_throttle_write(target->path, value);
+	}
+}
+
+/* Apply a throttling level to all targets, saving their original limits first */
+static void smfd_throttle_set(const unsigned int level)
+{
+	struct smfd_throttle_target *target;
+	unsigned int i;
+
+	smfd_throttle_level = level;
+
+	/* In shadow mode, the decision is only logged */
+	if (smfd_shadow)
+		return;
+
+	for (i = 0; i < smfd_throttle_count; ++i) {
+
+		target = &smfd_throttle_targets[i];
+
+		if (target->saved == NULL) {
+
+			if (level == 0)
+				continue;
+
+			if ((target->saved = smfd_throttle_read(target->path)) == NULL)
+				continue;
+
+			target->base = strtoul(target->saved, NULL, 10);
+		}
+
+		if (target->cgroup)
+			smfd_throttle_cgroup(target, level);
+		else
+			smfd_throttle_md(target, level);
+
+		if (level == 0) {
+			free(target->saved);
+			target->saved = NULL;
+		}
+	}
+}
+
+/* Throttle or relax background I/O, based on the disk group's highest trigger & its fans */
+static void smfd_throttle_cycle(void)
+{
+	const struct smfd_temp_threshold *t, *top;
+	uint8_t zone;
+	int dir;
+
+	if (smfd_throttle_count == 0)
+		return;
+
+	/* The system fans cool the disks, unless coupling has assigned them to the CPU zone */
+	zone = smfd_coupling_zones[SMFD_GROUP_DISK];
+	if (zone == SMFD_FAN_ZONE_COUNT)
+		zone = SMFD_FAN_ZONE_SYS;
+
+	for (top = t = smfd_policy->triggers[SMFD_GROUP_DISK]; t->name != NULL; ++t) {
+		if (t->threshold > top->threshold)
+			top = t;
+	}
+
+	if (top->name == NULL)
+		return;
+
+	if (top->active && smfd_fan_percent[zone] == 100
+			&& smfd_throttle_level < smfd_throttle_steps) {
+		dir = 1;
+	}
+	else if (!top->active && smfd_throttle_level > 0) {
+		dir = -1;
+	}
+	else {
+		dir = 0;
+	}
+
+	if (dir != smfd_throttle_dir) {
+		smfd_throttle_dir = dir;
+		smfd_throttle_since = smfd_sample_time;
+	}
+
+	if (dir == 0 || smfd_sample_time - smfd_throttle_since < smfd_throttle_hold * 1000LL)
+		return;
+
+	smfd_throttle_since = smfd_sample_time;
+
+	if (dir > 0) {
+		SMFD_WARNING("Disks over %s trigger with %s fans at 100%%; throttling "
+			     "background I/O (step %u of %u)%s\n", top->name, smfd_zone_names[zone],
+			     smfd_throttle_level + 1, smfd_throttle_steps,
+			     smfd_shadow ? " (shadow)" : "");
+	}
+	else if (smfd_throttle_level > 1) {
+		SMFD_NOTICE("Disks below %s trigger; relaxing background I/O throttling"
+			    " (step %u of %u)%s\n", top->name, smfd_throttle_level - 1,
+			    smfd_throttle_steps, smfd_shadow ? " (shadow)" : "");
+	}
+	else {
+		SMFD_NOTICE("Disks below %s trigger; background I/O limits restored%s\n", top->name,
+			    smfd_shadow ? " (shadow)" : "");
+	}
+
+	smfd_throttle_set(smfd_throttle_level + dir);
+}
+
+/* Locate the rate limit of each md array & cgroup */
+static void smfd_throttle_init(void)
+{
+	struct smfd_throttle_target *target;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < smfd_throttle_count; ++i) {
+
+		target = &smfd_throttle_targets[i];
+
+		if (target->cgroup) {
+			rc = asprintf(&target->path, "%s/sys/fs/cgroup/%s/io.max",
+				      smfd_sysfs_root, target->name);
+		}
+		else {
+			rc = asprintf(&target->path, "%s/sys/block/%s/md/sync_speed_max",
+				      smfd_sysfs_root, target->name);
+		}
+
+		if (rc < 0)
+			SMFD_ABORT("asprintf: %m\n");
+
+		/* An md array may be assembled (or a cgroup created) later */
+		if (access(target->path, W_OK) != 0)
+			SMFD_WARNING("%s: %m\n", target->path);
+	}
+
+	SMFD_DEBUG("smfd_throttle_init finished\n");
+}
+
+/* Restore the original rate limits & free the targets */
+static void smfd_throttle_fini(void)
+{
+	unsigned int i;
+
+	if (smfd_throttle_level > 0 && !smfd_shadow) {
+		SMFD_NOTICE("Restoring background I/O limits\n");
+		smfd_throttle_set(0);
+	}
+
+	for (i = 0; i < smfd_throttle_count; ++i) {
+		free(smfd_throttle_targets[i].name);
+		free(smfd_throttle_targets[i].path);
+		free(smfd_throttle_targets[i].saved);
+		free(smfd_throttle_targets[i].devs);
+	}
+
+	free(smfd_throttle_targets);
+	smfd_throttle_targets = NULL;
+	smfd_throttle_count = 0;
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Process temperatures/thresholds to determine fan percentages
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Temperature of each group in the last sample (INT_MIN if none was readable) */
+static int smfd_last_temps[SMFD_GROUP_COUNT] = { INT_MIN, INT_MIN, INT_MIN };
+
+/* Process 1 temperature against a set of thresholds */
+static void smfd_process_temp(const int temp, struct smfd_temp_threshold *const cfg,
+			      const char *const name, struct smfd_process_temp_result *const result)
+{
+	struct smfd_temp_threshold *t, *max;
+
+	result->temp = temp;
+
+	for (max = NULL, t = cfg; t->name != NULL; ++t) {
+
+		if (t->active) {
+			if (temp >= t->hysteresis) {
+				SMFD_DEBUG("%s temperature (%d) still exceeds %s hysteresis (%d)\n",
+					   name, temp, t->name, t->hysteresis);
+				/* no need to set t-> active; it already is */
+				max = t;
+			}
+			else {
+				SMFD_INFO("%s temperature (%d) "
+					  "no longer exceeds %s hysteresis (%d)\n",
+					  name, temp, t->name, t->hysteresis);
+				t->active = 0;
+			}
+		}
+		else {
+			if (temp >= t->threshold) {
+				SMFD_INFO("%s temperature (%d) exceeds %s threshold (%d)\n",
+					  name, temp, t->name, t->hysteresis);
+				t->active = 1;
+				max = t;
+			}
+		}
+	}
+
+	if (max != NULL) {
+		SMFD_DEBUG("%s temperature (%d) ==> "
+			   "%s fan settings (CPU: %" PRIu8 "%%, SYS: %" PRIu8 "%%)\n",
+			   name, temp, max->name, max->cpu_fan_percent, max->sys_fan_percent);
+		result->cpu_fan_percent = max->cpu_fan_percent;
+		result->cpu_threshold = max;
+		result->sys_fan_percent = max->sys_fan_percent;
+		result->sys_threshold = max;
+	}
+	else {
+		SMFD_DEBUG("%s temperature (%d) ==> "
+			   "base fan settings (CPU: %" PRIu8 "%%, SYS: %" PRIu8 "%%)\n",
+			   name, temp, smfd_policy->fan_base[SMFD_FAN_ZONE_CPU],
+			   smfd_policy->fan_base[SMFD_FAN_ZONE_SYS]);
+		result->cpu_fan_percent = smfd_policy->fan_base[SMFD_FAN_ZONE_CPU];
+		result->cpu_threshold = NULL;
+		result->sys_fan_percent = smfd_policy->fan_base[SMFD_FAN_ZONE_SYS];
+		result->sys_threshold = NULL;
+	}
+}
+
+/*
+ * Process the highest readable temperature in a group (INT_MIN if none), then apply any sensor
+ * failure that demands maximum cooling
+ */
+static void smfd_process_group(const int temp, const _Bool failed,
+			       struct smfd_temp_threshold *const cfg, const char *const name,
+			       struct smfd_process_temp_result *const result)
+{
+	if (temp != INT_MIN) {
+		smfd_process_temp(temp, cfg, name, result);
+	}
+	else {
+		SMFD_DEBUG("No readable %s temperature ==> base fan settings\n", name);
+		result->temp = INT_MIN;
+		result->cpu_fan_percent = smfd_policy->fan_base[SMFD_FAN_ZONE_CPU];
+		result->cpu_threshold = NULL;
+		result->sys_fan_percent = smfd_policy->fan_base[SMFD_FAN_ZONE_SYS];
+		result->sys_threshold = NULL;
+	}
+
+	if (failed) {
+		SMFD_DEBUG("Failed %s sensor ==> maximum fan settings\n", name);
+		result->failed = 1;
+		result->cpu_fan_percent = 100;
+		result->cpu_threshold = NULL;
+		result->sys_fan_percent = 100;
+		result->sys_threshold = NULL;
+	}
+}
+
+/* Process the PCH temperature/thresholds */
+static void smfd_process_pch_temp(struct smfd_process_temp_result *const result)
+{
+	_Bool failed;
+	int temp;
+
+	temp = (smfd_pch_temp.state == SMFD_SENSOR_FAILED) ? INT_MIN : smfd_pch_temp.current;
+	failed = smfd_sensor_demands_max(&smfd_pch_temp, SMFD_GROUP_PCH);
+	failed |= smfd_ctrl_group_max(SMFD_GROUP_PCH, &temp, NULL);
+	failed |= smfd_plugin_group_max(SMFD_GROUP_PCH, &temp, NULL);
+
+	smfd_process_group(temp, failed, smfd_policy->triggers[SMFD_GROUP_PCH], "PCH", result);
+}
+
+/* Process the highest CPU (coretemp) temperature/thresholds */
+static void smfd_process_cpu_temps(struct smfd_process_temp_result *const result)
+{
+	struct smfd_coretemp *max;
+	const char *name;
+	_Bool failed;
+	unsigned i;
+	int temp;
+
+	for (max = NULL, failed = 0, i = 0; i < smfd_coretemp_count; ++i) {
+
+		if (smfd_coretemps[i].temp.state == SMFD_SENSOR_FAILED) {
+			failed |= smfd_sensor_demands_max(&smfd_coretemps[i].temp, SMFD_GROUP_CPU);
+			continue;
+		}
+
+		if (max == NULL || smfd_coretemps[i].temp.current > max->temp.current)
+			max = &smfd_coretemps[i];
+	}
+
+	temp = (max == NULL) ? INT_MIN : max->temp.current;
+	name = (max == NULL) ? NULL : max->name;
+	failed |= smfd_ctrl_group_max(SMFD_GROUP_CPU, &temp, &name);
+	failed |= smfd_plugin_group_max(SMFD_GROUP_CPU, &temp, &name);
+
+	if (name != NULL)
+		SMFD_DEBUG("Highest CPU temperature is %d (%s)\n", temp, name);
+
+	smfd_process_group(temp, failed, smfd_policy->triggers[SMFD_GROUP_CPU], "CPU", result);
+}
+
+/* Process the highest disk temperature/thresholds */
+static void smfd_process_disk_temps(struct smfd_process_temp_result *const result)
+{
+	struct smfd_disk *max;
+	const char *name;
+	_Bool failed;
+	unsigned i;
+	int temp;
+
+	for (max = NULL, failed = 0, i = 0; i < smfd_disk_count; ++i) {
+
+		if (smfd_disks[i].temp.state == SMFD_SENSOR_FAILED) {
+			failed |= smfd_sensor_demands_max(&smfd_disks[i].temp, SMFD_GROUP_DISK);
+			continue;
+		}
+
+		if (max == NULL || smfd_disks[i].temp.current > max->temp.current)
+			max = &smfd_disks[i];
+	}
+
+	temp = (max == NULL) ? INT_MIN : max->temp.current;
+	name = (max == NULL) ? NULL : max->name;
+	failed |= smfd_ctrl_group_max(SMFD_GROUP_DISK, &temp, &name);
+	failed |= smfd_plugin_group_max(SMFD_GROUP_DISK, &temp, &name);
+
+	if (name != NULL)
+		SMFD_DEBUG("Highest disk temperature is %d (%s)\n", temp, name);
+
+	smfd_process_group(temp, failed, smfd_policy->triggers[SMFD_GROUP_DISK], "disk", result);
+}
+
+/* Update the smoothed temperature trend of each modeled group */
+static void smfd_opt_update_trend(const struct smfd_process_temp_result *const results)
+{
+	static struct timespec last;
+
+	struct smfd_opt_group *group;
+	struct timespec now;
+	double elapsed;
+	unsigned int i;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		SMFD_ABORT("clock_gettime: %m\n");
+
+	elapsed = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		group = &smfd_opt_groups[i];
+		if (!group->configured)
+			continue;
+
+		/* INT_MIN == no readable temperature; the difference would overflow */
+		if (last.tv_sec != 0 && elapsed > 0 && results[i].temp != INT_MIN
+				&& group->last_temp != INT_MIN) {
+			group->slope = 0.5 * group->slope
+					+ 0.5 * (results[i].temp - group->last_temp) / elapsed;
+		}
+
+		group->last_temp = results[i].temp;
+	}
+
+	last = now;
+}
+
+/* Next candidate duty cycle for the optimizer search; 100% is always the last candidate */
+static unsigned int smfd_opt_next(const unsigned int percent)
+{
+	return (percent + smfd_opt_step > 100) ? 100 : percent + smfd_opt_step;
+}
+
+/*
+ * Choose the duty cycles that minimize estimated fan power (sum of the cubes of the duty cycles)
+ * while keeping the predicted temperature of every modeled group at or below its limit.
+ *
+ * Each group is modeled as a first-order system.  Its current trend is extrapolated over the
+ * prediction horizon, and a change in duty cycle moves the temperature by the group's gain for
+ * each zone, scaled by the fraction of the step response that completes within the horizon.
+ *
+ * The search is an exhaustive walk of a fixed grid (at most 101 x 101 candidates), so it runs in
+ * bounded time.  Returns 0 if no candidate is feasible, in which case the caller falls back to the
+ * trigger tables.
+ */
+static _Bool smfd_opt_solve(const struct smfd_process_temp_result *const results,
+			    uint8_t *const percent)
+{
+	double base[SMFD_GROUP_COUNT], alpha, trend, pred, cost, best_cost;
+	const struct smfd_opt_group *group;
+	unsigned int cpu, sys, i;
+	_Bool feasible;
+
+	alpha = 1.0 - exp(-(double)smfd_opt_horizon / smfd_opt_time_constant);
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		group = &smfd_opt_groups[i];
+		if (!group->configured)
+			continue;
+
+		trend = (group->slope > 0) ? group->slope * smfd_opt_time_constant * alpha : 0;
+
+		/* Prediction = base[i] + alpha * (sum of gain * candidate duty cycle) */
+		base[i] = results[i].temp + trend
+				- alpha * group->gain[SMFD_FAN_ZONE_CPU]
+					* smfd_fan_percent[SMFD_FAN_ZONE_CPU]
+				- alpha * group->gain[SMFD_FAN_ZONE_SYS]
+					* smfd_fan_percent[SMFD_FAN_ZONE_SYS];
+	}
+
+	/* Written on every path, even if nothing is feasible (the caller then ignores it) */
+	percent[SMFD_FAN_ZONE_CPU] = 100;
+	percent[SMFD_FAN_ZONE_SYS] = 100;
+	best_cost = HUGE_VAL;
+
+	for (cpu = smfd_opt_fan_min[SMFD_FAN_ZONE_CPU]; ; cpu = smfd_opt_next(cpu)) {
+
+		for (sys = smfd_opt_fan_min[SMFD_FAN_ZONE_SYS]; ; sys = smfd_opt_next(sys)) {
+
+			cost = (double)cpu * cpu * cpu + (double)sys * sys * sys;
+			if (cost >= best_cost)
+				break;	/* cost only increases with sys */
+
+			for (feasible = 1, i = 0; feasible && i < SMFD_GROUP_COUNT; ++i) {
+
+				group = &smfd_opt_groups[i];
+				if (!group->configured)
+					continue;
+
+				pred = base[i] + alpha * (group->gain[SMFD_FAN_ZONE_CPU] * cpu
+							  + group->gain[SMFD_FAN_ZONE_SYS] * sys);
+				if (pred > group->limit)
+					feasible = 0;
+			}
+
+			if (feasible) {
+				best_cost = cost;
+				percent[SMFD_FAN_ZONE_CPU] = cpu;
+				percent[SMFD_FAN_ZONE_SYS] = sys;
+				break;	/* higher sys values cost more */
+			}
+
+			if (sys == 100)
+				break;
+		}
+
+		if (cpu == 100)
+			break;
+	}
+
+	if (best_cost == HUGE_VAL) {
+		SMFD_WARNING("Optimizer found no feasible fan settings; using triggers\n");
+		return 0;
+	}
+
+	SMFD_DEBUG("Optimizer ==> CPU fan @ %" PRIu8 "%%, SYS fan @ %" PRIu8 "%%\n",
+		   percent[SMFD_FAN_ZONE_CPU], percent[SMFD_FAN_ZONE_SYS]);
+
+	return 1;
+}
+
+/*
+ * The optimizer only sees the groups that it models, so the trigger tables of the other groups
+ * still apply -- a zone runs at least as fast as any threshold that an unmodeled group has reached.
+ */
+static void smfd_opt_apply_triggers(const struct smfd_process_temp_result *const results,
+				    uint8_t *const percent,
+				    const struct smfd_process_temp_result **const cause,
+				    const char **const reason)
+{
+	const struct smfd_process_temp_result *r;
+	unsigned int i;
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		if (smfd_opt_groups[i].configured)
+			continue;
+
+		r = &results[i];
+
+		if (r->cpu_threshold != NULL && r->cpu_fan_percent > percent[SMFD_FAN_ZONE_CPU]) {
+			percent[SMFD_FAN_ZONE_CPU] = r->cpu_fan_percent;
+			cause[SMFD_FAN_ZONE_CPU] = r;
+			reason[SMFD_FAN_ZONE_CPU] = r->cpu_threshold->name;
+		}
+
+		if (r->sys_threshold != NULL && r->sys_fan_percent > percent[SMFD_FAN_ZONE_SYS]) {
+			percent[SMFD_FAN_ZONE_SYS] = r->sys_fan_percent;
+			cause[SMFD_FAN_ZONE_SYS] = r;
+			reason[SMFD_FAN_ZONE_SYS] = r->sys_threshold->name;
+		}
+	}
+}
+
+/* Set the duty cycle of a zone, if it has changed; result is the group that requires it (if any) */
+static void smfd_update_fan(const uint8_t zone, const uint8_t percent,
+			    const struct smfd_process_temp_result *const restrict result,
+			    const char *const restrict reason)
+{
+	const _Bool bmc = smfd_exp_enabled && smfd_exp_block_start != 0
+				&& smfd_exp_arms[smfd_exp_current].policy == SMFD_EXP_BMC;
+	const char *const verb = smfd_shadow ? "Shadow: would set" :
+					bmc ? "BMC arm: would set" : "Setting";
+	const uint8_t old = smfd_fan_percent[zone];
+
+	if (percent == old)
+		return;
+
+	if (reason == NULL) {
+		SMFD_NOTICE("%s %s fan to %" PRIu8 "%%\n", verb, smfd_zone_names[zone], percent);
+	}
+	else if (result == NULL) {
+		SMFD_NOTICE("%s %s fan to %" PRIu8 "%% (%s)\n",
+			    verb, smfd_zone_names[zone], percent, reason);
+	}
+	else {
+		SMFD_NOTICE("%s %s fan to %" PRIu8 "%% (%s %s threshold)\n",
+			    verb, smfd_zone_names[zone], percent, result->name, reason);
+	}
+
+	smfd_fan_percent[zone] = percent;
+
+	if (smfd_shadow || bmc)
+		return;
+
+	smfd_set_fan_percent(zone, percent);
+	smfd_response_start(zone, percent > old, result);
+}
+
+/* Forward declaration needed by smfd_safety_check */
+static void smfd_exp_safety_end(void);
+
+/*
+ * Safety fast path -- called as soon as a sensor is read, before any filtering or policy.  If the
+ * reading breaches its group's hard limit, the mapped zones are set to 100% immediately, rather
+ * than after the rest of the sensors have been read, so the response time is bounded by the read
+ * interval plus 1 actuator write (2 for IPMI zones, if the writer thread is already sending another
+ * zone's write).  smfd_process_all_temps keeps them there until the limit is no longer exceeded.
+ */
+static void smfd_safety_check(const char *const name, const enum smfd_group group,
+			      const int temp)
+{
+	const struct smfd_safety_limit *const safety = &smfd_safety_limits[group];
+	uint8_t zone;
+
+	if (temp < safety->limit)
+		return;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		if (!(safety->zones & (1 << zone)) || (smfd_safety_active & (1 << zone)))
+			continue;
+
+		SMFD_CRIT("%s temperature (%d°C) exceeds %s safety limit (%d°C); "
+			  "forcing %s fan to 100%%\n", name, temp, smfd_group_keys[group],
+			  safety->limit, smfd_zone_names[zone]);
+
+		smfd_safety_active |= 1 << zone;
+		smfd_exp_safety_end();
+		smfd_update_fan(zone, 100, NULL, "safety limit");
+	}
+}
+
+/*
+ * Coupling zone assignment -- a group that has been assigned to 1 zone leaves the other zone at its
+ * base duty cycle (unless a sensor failure demands maximum cooling)
+ */
+static void smfd_process_assign(struct smfd_process_temp_result *const results)
+{
+	struct smfd_process_temp_result *r;
+	unsigned int i;
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		r = &results[i];
+
+		if (r->failed)
+			continue;
+
+		if (smfd_coupling_zones[i] == SMFD_FAN_ZONE_CPU) {
+			r->sys_fan_percent = smfd_policy->fan_base[SMFD_FAN_ZONE_SYS];
+			r->sys_threshold = NULL;
+		}
+		else if (smfd_coupling_zones[i] == SMFD_FAN_ZONE_SYS) {
+			r->cpu_fan_percent = smfd_policy->fan_base[SMFD_FAN_ZONE_CPU];
+			r->cpu_threshold = NULL;
+		}
+	}
+}
+
+/* Process all temperature readings and set the fan speeds */
+static void smfd_process_all_temps(void)
+{
+	struct smfd_process_temp_result results[SMFD_GROUP_COUNT] = {
+		[SMFD_GROUP_PCH]	= { .group = SMFD_GROUP_PCH, .name = "PCH" },
+		[SMFD_GROUP_CPU]	= { .group = SMFD_GROUP_CPU, .name = "CPU" },
+		[SMFD_GROUP_DISK]	= { .group = SMFD_GROUP_DISK, .name = "disk" }
+	};
+
+	const struct smfd_process_temp_result *cpu, *sys, *cause[SMFD_FAN_ZONE_COUNT];
+	uint8_t opt[SMFD_FAN_ZONE_COUNT], percent[SMFD_FAN_ZONE_COUNT], zone;
+	const char *reason[SMFD_FAN_ZONE_COUNT];
+	uint8_t safety;
+	_Bool degraded;
+	unsigned i;
+
+	smfd_process_pch_temp(&results[SMFD_GROUP_PCH]);
+	smfd_process_cpu_temps(&results[SMFD_GROUP_CPU]);
+	smfd_process_disk_temps(&results[SMFD_GROUP_DISK]);
+
+	if (smfd_coupling_assign)
+		smfd_process_assign(results);
+
+	for (cpu = sys= &results[0], i = 1; i < SMFD_GROUP_COUNT; ++i) {
+		if (results[i].cpu_fan_percent > cpu->cpu_fan_percent)
+			cpu = &results[i];
+		if (results[i].sys_fan_percent > sys->sys_fan_percent)
+			sys = &results[i];
+	}
+
+	SMFD_DEBUG("%s temperature ==> CPU fan @ %" PRIu8 "%%\n", cpu->name, cpu->cpu_fan_percent);
+	SMFD_DEBUG("%s temperature ==> SYS fan @ %" PRIu8 "%%\n", sys->name, sys->sys_fan_percent);
+
+	smfd_response_temps(results);
+
+	percent[SMFD_FAN_ZONE_CPU] = cpu->cpu_fan_percent;
+	cause[SMFD_FAN_ZONE_CPU] = (cpu->cpu_threshold == NULL) ? NULL : cpu;
+	reason[SMFD_FAN_ZONE_CPU] = (cpu->cpu_threshold == NULL) ? NULL : cpu->cpu_threshold->name;
+
+	percent[SMFD_FAN_ZONE_SYS] = sys->sys_fan_percent;
+	cause[SMFD_FAN_ZONE_SYS] = (sys->sys_threshold == NULL) ? NULL : sys;
+	reason[SMFD_FAN_ZONE_SYS] = (sys->sys_threshold == NULL) ? NULL : sys->sys_threshold->name;
+
+	/* The optimizer's model needs a temperature from every modeled group */
+	for (degraded = 0, i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (results[i].failed
+				|| (results[i].temp == INT_MIN && smfd_opt_groups[i].configured)) {
+			degraded = 1;
+		}
+	}
+
+	if (cpu->failed)
+		reason[SMFD_FAN_ZONE_CPU] = "sensor failure";
+
+	if (sys->failed)
+		reason[SMFD_FAN_ZONE_SYS] = "sensor failure";
+
+	if (smfd_opt_enabled && !degraded) {
+
+		smfd_opt_update_trend(results);
+
+		if (smfd_opt_solve(results, opt)) {
+			for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+				percent[zone] = opt[zone];
+				cause[zone] = NULL;
+				reason[zone] = "optimizer";
+			}
+			smfd_opt_apply_triggers(results, percent, cause, reason);
+		}
+	}
+
+	/* Let duty cycles fall no faster than the ramp limit */
+	for (zone = 0; smfd_policy->ramp_down != 0 && zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+		if (percent[zone] + smfd_policy->ramp_down < smfd_fan_percent[zone]) {
+			percent[zone] = smfd_fan_percent[zone] - smfd_policy->ramp_down;
+			cause[zone] = NULL;
+			reason[zone] = "ramp limit";
+		}
+	}
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		if (!smfd_overrides[zone].active)
+			continue;
+
+		if (smfd_sample_time >= smfd_overrides[zone].expires) {
+			SMFD_NOTICE("%s fan override expired\n", smfd_zone_names[zone]);
+			smfd_overrides[zone].active = 0;
+			continue;
+		}
+
+		percent[zone] = smfd_overrides[zone].percent;
+		cause[zone] = NULL;
+		reason[zone] = "override";
+	}
+
+	/* Safety limits come last, so nothing can lower a zone that a breach has forced to 100% */
+	for (safety = 0, i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (results[i].temp != INT_MIN && results[i].temp >= smfd_safety_limits[i].limit)
+			safety |= smfd_safety_limits[i].zones;
+	}
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+		if (safety & (1 << zone)) {
+			percent[zone] = 100;
+			cause[zone] = NULL;
+			reason[zone] = "safety limit";
+		}
+		else if (smfd_safety_active & (1 << zone)) {
+			SMFD_NOTICE("%s fan safety limit no longer exceeded\n",
+				    smfd_zone_names[zone]);
+		}
+	}
+
+	/* A breach that the fast path didn't see (a sensor read elsewhere) also ends a bmc block */
+	if (safety & ~smfd_safety_active)
+		smfd_exp_safety_end();
+
+	smfd_safety_active = safety;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone)
+		smfd_update_fan(zone, percent[zone], cause[zone], reason[zone]);
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i)
+		smfd_last_temps[i] = results[i].temp;
+
+	smfd_throttle_cycle();
+	smfd_rec_cycle(results, reason);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Control profiles -- named policies (quiet, performance, etc.) switched at runtime
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Every profile is fully built (its own copy of each trigger table) when the configuration file is
+ * loaded, so switching profiles only changes smfd_policy -- nothing is parsed or reinitialized.
+ *
+ * Trigger activation state is carried over.  A trigger in the new profile whose threshold has been
+ * reached is activated when the new profile is first processed, as usual.  A trigger whose
+ * temperature is between its hysteresis and its threshold is only active if the old profile had
+ * an active trigger in the same group with the same or a higher threshold -- i.e. if the
+ * temperature has reached the new trigger's threshold and hasn't fallen below its hysteresis
+ * since.
+ */
+
+/* Carry a group's trigger activation state over to another profile's trigger table */
+static void smfd_profile_carry(const struct smfd_temp_threshold *const from,
+			       struct smfd_temp_threshold *const to, const int temp)
+{
+	const struct smfd_temp_threshold *f;
+	struct smfd_temp_threshold *t;
+
+	for (t = to; t->name != NULL; ++t) {
+
+		t->active = 0;
+
+		if (temp == INT_MIN || temp < t->hysteresis || temp >= t->threshold)
+			continue;
+
+		for (f = from; f->name != NULL; ++f) {
+			if (f->active && f->threshold >= t->threshold)
+				t->active = 1;
+		}
+	}
+}
+
+/* Find a profile by name (NULL if there is no such profile) */
+static struct smfd_profile *smfd_profile_find(const char *const name)
+{
+	unsigned int i;
+
+	if (strcmp(name, smfd_default_profile.name) == 0)
+		return &smfd_default_profile;
+
+	for (i = 0; i < smfd_profile_count; ++i) {
+		if (strcmp(name, smfd_profiles[i].name) == 0)
+			return &smfd_profiles[i];
+	}
+
+	return NULL;
+}
+
+/* Make a profile active; returns an error message or NULL */
+static const char *smfd_profile_select(const char *const name)
+{
+	struct smfd_profile *profile;
+	unsigned int i;
+
+	if ((profile = smfd_profile_find(name)) == NULL)
+		return "unknown profile";
+
+	if (profile == smfd_policy)
+		return NULL;
+
+	/* Experiment arms change the active profile's base duty cycles */
+	if (smfd_exp_enabled)
+		return "profiles can't be switched during an experiment";
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i)
+		smfd_profile_carry(smfd_policy->triggers[i], profile->triggers[i],
+				   smfd_last_temps[i]);
+
+	SMFD_NOTICE("Switching from profile %s to %s\n", smfd_policy->name, profile->name);
+
+	smfd_policy = profile;
+
+	return NULL;
+}
+
+/* Copy a trigger table of the default profile (names too), so each profile has its own state */
+static struct smfd_temp_threshold *smfd_profile_copy_triggers(const enum smfd_group group)
+{
+	const struct smfd_temp_threshold *const cfg = smfd_default_profile.triggers[group];
+	struct smfd_temp_threshold *copy;
+	size_t len, i;
+
+	for (len = 0; cfg[len].name != NULL; ++len);
+
+	if ((copy = malloc((len + 1) * sizeof *copy)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	memcpy(copy, cfg, (len + 1) * sizeof *copy);
+
+	for (i = 0; i < len; ++i)
+		copy[i].name = smfd_strdup(cfg[i].name);
+
+	return copy;
+}
+
+/* Named profiles inherit any settings that they don't set from the default profile */
+static void smfd_profiles_inherit(void)
+{
+	struct smfd_profile *profile;
+	unsigned int i, j;
+
+	for (i = 0; i < smfd_profile_count; ++i) {
+
+		profile = &smfd_profiles[i];
+
+		for (j = 0; j < SMFD_FAN_ZONE_COUNT; ++j) {
+			if (profile->fan_base[j] == 255)
+				profile->fan_base[j] = smfd_default_profile.fan_base[j];
+		}
+
+		for (j = 0; j < SMFD_GROUP_COUNT; ++j) {
+			if (profile->triggers[j] == NULL)
+				profile->triggers[j] = smfd_profile_copy_triggers(j);
+		}
+
+		if (profile->ramp_down == 255)
+			profile->ramp_down = smfd_default_profile.ramp_down;
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Early boot -- configuration snapshots for smfd-boot & taking over from it
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Longest wait (ms) for smfd-boot to exit */
+#define SMFD_BOOT_EXIT_WAIT	2000
+
+/*
+ * Write the base duty cycles, CPU triggers & sample interval of the default profile to a binary
+ * snapshot that smfd-boot can read without LibYAML
+ */
+static void smfd_boot_write(void)
+{
+	const struct smfd_temp_threshold *t;
+	struct smfd_boot_config cfg;
+	unsigned int i;
+	int fd;
+
+	if (smfd_fleet_host_count > 0)
+		SMFD_FATAL("smfd-boot doesn't support fleet mode\n");
+
+	memset(&cfg, 0, sizeof cfg);
+	memcpy(cfg.magic, SMFD_BOOT_MAGIC, sizeof cfg.magic);
+	cfg.version = SMFD_BOOT_VERSION;
+	cfg.sample_interval = smfd_sample_interval;
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		cfg.fan_base[i] = smfd_default_profile.fan_base[i];
+		cfg.ipmi_zone[i] = (smfd_zones[i].ops == &smfd_ipmi_actuator) ?
+					smfd_zones[i].ipmi_zone : SMFD_BOOT_NO_ZONE;
+		if (cfg.ipmi_zone[i] == SMFD_BOOT_NO_ZONE) {
+			SMFD_WARNING("%s fan zone doesn't use IPMI; smfd-boot won't control it\n",
+				     smfd_zone_names[i]);
+		}
+	}
+
+	for (t = smfd_default_profile.triggers[SMFD_GROUP_CPU]; t->name != NULL; ++t) {
+
+		if (cfg.trigger_count == SMFD_BOOT_MAX_TRIGGERS) {
+			SMFD_FATAL("smfd-boot supports no more than %d CPU triggers\n",
+				   SMFD_BOOT_MAX_TRIGGERS);
+		}
+
+		cfg.triggers[cfg.trigger_count].threshold = t->threshold;
+		cfg.triggers[cfg.trigger_count].hysteresis = t->hysteresis;
+		cfg.triggers[cfg.trigger_count].cpu_fan_percent = t->cpu_fan_percent;
+		cfg.triggers[cfg.trigger_count].sys_fan_percent = t->sys_fan_percent;
+		cfg.trigger_count += 1;
+	}
+
+	fd = open(smfd_boot_config_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		SMFD_FATAL("%s: %m\n", smfd_boot_config_file);
+
+	if (write(fd, &cfg, sizeof cfg) != (ssize_t)sizeof cfg)
+		SMFD_FATAL("%s: %m\n", smfd_boot_config_file);
+
+	if (close(fd) != 0)
+		SMFD_FATAL("%s: %m\n", smfd_boot_config_file);
+
+	SMFD_NOTICE("Wrote smfd-boot configuration snapshot (%u CPU triggers) to %s\n",
+		    cfg.trigger_count, smfd_boot_config_file);
+}
+
+/* Read smfd-boot's state file; returns 0 if there is no (valid) state file */
+static _Bool smfd_boot_read_state(struct smfd_boot_state *const state)
+{
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(SMFD_BOOT_STATE, O_RDONLY | O_CLOEXEC)) < 0) {
+		if (errno != ENOENT)
+			SMFD_WARNING("%s: %m\n", SMFD_BOOT_STATE);
+		return 0;
+	}
+
+	if ((len = read(fd, state, sizeof *state)) < 0)
+		SMFD_WARNING("%s: %m\n", SMFD_BOOT_STATE);
+
+	if (close(fd) != 0)
+		SMFD_WARNING("close: %m\n");
+
+	if (len != (ssize_t)sizeof *state
+			|| memcmp(state->magic, SMFD_BOOT_MAGIC, sizeof state->magic) != 0
+			|| state->version != SMFD_BOOT_VERSION) {
+		SMFD_WARNING("Ignoring invalid %s\n", SMFD_BOOT_STATE);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Is a process smfd-boot?  (Its PID could have been reused.) */
+static _Bool smfd_boot_is_running(const pid_t pid)
+{
+	char path[sizeof "/proc/4294967295/comm"], comm[32];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof path, "/proc/%d/comm", (int)pid);
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+
+	len = read(fd, comm, sizeof comm - 1);
+	close(fd);
+
+	return len > 0 && strncmp(comm, "smfd-boot\n", len) == 0;
+}
+
+/*
+ * If smfd-boot is controlling the fans, stop it, then continue from its duty cycles & CPU trigger
+ * state.  A trigger whose hysteresis band contains smfd-boot's last CPU temperature stays active
+ * if smfd-boot's highest active trigger is at least as high (as when switching profiles).
+ */
+static void smfd_boot_takeover(void)
+{
+	struct smfd_temp_threshold boot[2] = { { .name = "smfd-boot", .active = 1 }, { NULL } };
+	struct smfd_boot_state state;
+	unsigned int i;
+
+	if (!smfd_boot_read_state(&state))
+		return;
+
+	if (state.pid > 0 && smfd_boot_is_running(state.pid)) {
+
+		SMFD_NOTICE("Stopping smfd-boot (PID %" PRId32 ")\n", state.pid);
+
+		if (kill(state.pid, SIGTERM) != 0)
+			SMFD_FATAL("kill: %m\n");
+
+		for (i = 0; smfd_boot_is_running(state.pid); i += 10) {
+			if (i >= SMFD_BOOT_EXIT_WAIT)
+				SMFD_FATAL("smfd-boot (PID %" PRId32 ") didn't exit\n", state.pid);
+			usleep(10 * 1000);
+		}
+
+		/* smfd-boot writes its final state when it exits */
+		if (!smfd_boot_read_state(&state))
+			return;
+	}
+
+	if (unlink(SMFD_BOOT_STATE) != 0)
+		SMFD_WARNING("%s: %m\n", SMFD_BOOT_STATE);
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		if (smfd_zones[i].ops == &smfd_ipmi_actuator)
+			smfd_boot_percent[i] = state.fan_percent[i];
+	}
+
+	if (state.active_threshold != INT32_MIN && state.cpu_temp != INT32_MIN) {
+		boot[0].threshold = state.active_threshold;
+		smfd_profile_carry(boot, smfd_policy->triggers[SMFD_GROUP_CPU], state.cpu_temp);
+	}
+
+	SMFD_DEBUG("smfd_boot_takeover finished\n");
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	A/B experiments -- alternate control policies & measure outcomes
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Blocks are run in pairs, in random order within each pair, so that neither arm is favored by a
+ * periodic workload (or time of day).  Each block starts with a settling period that isn't
+ * measured, so that one arm's thermal state doesn't count against the other.
+ *
+ * Fan energy is estimated from the cube of each zone's duty cycle.  It is normalized by workload
+ * power (RAPL package energy), when that is readable.
+ */
+
+/* RAPL package energy counters & CPU thermal throttling counters */
+static FILE **smfd_exp_rapl = NULL;
+static uint64_t *smfd_exp_rapl_max;	/* counter range (wraparound) */
+static uint64_t *smfd_exp_rapl_last;
+static unsigned int smfd_exp_rapl_count = 0;
+static FILE **smfd_exp_throttle = NULL;
+static unsigned int smfd_exp_throttle_count = 0;
+static uint64_t smfd_exp_throttle_last;
+static int64_t smfd_exp_last_sample;
+
+/* Read a counter from an (open) sysfs file; returns 0 on failure */
+static _Bool smfd_exp_read_counter(FILE *const fp, uint64_t *const value)
+{
+	rewind(fp);
+	return fscanf(fp, "%" SCNu64, value) == 1;
+}
+
+/* Read a counter from a sysfs file by name; returns 0 on failure */
+static _Bool smfd_exp_read_file(const char *const path, uint64_t *const value)
+{
+	_Bool ok;
+	FILE *fp;
+
+	if ((fp = fopen(path, "re")) == NULL)
+		return 0;
+
+	ok = smfd_exp_read_counter(fp, value);
+	fclose(fp);
+
+	return ok;
+}
+
+/* Open the RAPL package energy counters */
+static void smfd_exp_rapl_init(void)
+{
+	char path[PATH_MAX];
+	unsigned int i, n;
+	glob_t g;
+
+	if (glob("/sys/class/powercap/intel-rapl:*", 0, NULL, &g) != 0)
+		return;
+
+	smfd_exp_rapl = calloc(g.gl_pathc, sizeof *smfd_exp_rapl);
+	smfd_exp_rapl_max = calloc(g.gl_pathc, sizeof *smfd_exp_rapl_max);
+	smfd_exp_rapl_last = calloc(g.gl_pathc, sizeof *smfd_exp_rapl_last);
+	if (smfd_exp_rapl == NULL || smfd_exp_rapl_max == NULL || smfd_exp_rapl_last == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (n = 0, i = 0; i < g.gl_pathc; ++i) {
+
+		/* Packages only -- intel-rapl:N, not subdomains (intel-rapl:N:M) */
+		if (strchr(strchr(g.gl_pathv[i], ':') + 1, ':') != NULL)
+			continue;
+
+		snprintf(path, sizeof path, "%s/max_energy_range_uj", g.gl_pathv[i]);
+		if (!smfd_exp_read_file(path, &smfd_exp_rapl_max[n]))
+			continue;
+
+		snprintf(path, sizeof path, "%s/energy_uj", g.gl_pathv[i]);
+		if ((smfd_exp_rapl[n] = fopen(path, "re")) == NULL)
+			continue;
+
+		if (!smfd_exp_read_counter(smfd_exp_rapl[n], &smfd_exp_rapl_last[n])) {
+			fclose(smfd_exp_rapl[n]);
+			continue;
+		}
+
+		++n;
+	}
+
+	globfree(&g);
+	smfd_exp_rapl_count = n;
+
+	if (n == 0)
+		SMFD_WARNING("RAPL energy counters not readable; fan energy won't be normalized\n");
+}
+
+/* Open the CPU thermal throttling counters */
+static void smfd_exp_throttle_init(void)
+{
+	unsigned int i, n;
+	uint64_t count;
+	glob_t g;
+
+	if (glob("/sys/devices/system/cpu/cpu[0-9]*/thermal_throttle/core_throttle_count",
+		 0, NULL, &g) != 0) {
+		SMFD_WARNING("CPU thermal throttling counters not found\n");
+		return;
+	}
+
+	if ((smfd_exp_throttle = calloc(g.gl_pathc, sizeof *smfd_exp_throttle)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (n = 0, smfd_exp_throttle_last = 0, i = 0; i < g.gl_pathc; ++i) {
+
+		if ((smfd_exp_throttle[n] = fopen(g.gl_pathv[i], "re")) == NULL)
+			continue;
+
+		if (!smfd_exp_read_counter(smfd_exp_throttle[n], &count)) {
+			fclose(smfd_exp_throttle[n]);
+			continue;
+		}
+
+		smfd_exp_throttle_last += count;
+		++n;
+	}
+
+	globfree(&g);
+	smfd_exp_throttle_count = n;
+}
+
+/* Energy (J) used by all CPU packages since the last call */
+static double smfd_exp_rapl_delta(void)
+{
+	uint64_t value;
+	double total;
+	unsigned int i;
+
+	for (total = 0, i = 0; i < smfd_exp_rapl_count; ++i) {
+
+		if (!smfd_exp_read_counter(smfd_exp_rapl[i], &value))
+			continue;
+
+		if (value >= smfd_exp_rapl_last[i])
+			total += value - smfd_exp_rapl_last[i];
+		else
+			total += smfd_exp_rapl_max[i] - smfd_exp_rapl_last[i] + value;
+
+		smfd_exp_rapl_last[i] = value;
+	}
+
+	return total / 1e6;
+}
+
+/* CPU thermal throttling events since the last call */
+static unsigned long smfd_exp_throttle_delta(void)
+{
+	uint64_t value, total;
+	unsigned long delta;
+	unsigned int i;
+
+	for (total = 0, i = 0; i < smfd_exp_throttle_count; ++i) {
+		if (smfd_exp_read_counter(smfd_exp_throttle[i], &value))
+			total += value;
+	}
+
+	delta = (total >= smfd_exp_throttle_last) ? total - smfd_exp_throttle_last : 0;
+	smfd_exp_throttle_last = total;
+
+	return delta;
+}
+
+/* Put an arm's control policy into effect */
+static void smfd_exp_apply(const unsigned int arm, const _Bool was_bmc)
+{
+	const struct smfd_exp_arm *const a = &smfd_exp_arms[arm];
+	uint8_t zone;
+
+	smfd_opt_enabled = smfd_exp_saved_opt && a->policy == SMFD_EXP_OPTIMIZER;
+	smfd_policy->fan_base[SMFD_FAN_ZONE_CPU] = (a->cpu_fan_base == 255) ?
+				smfd_exp_saved_base[SMFD_FAN_ZONE_CPU] : a->cpu_fan_base;
+	smfd_policy->fan_base[SMFD_FAN_ZONE_SYS] = (a->sys_fan_base == 255) ?
+				smfd_exp_saved_base[SMFD_FAN_ZONE_SYS] : a->sys_fan_base;
+
+	if (a->policy == SMFD_EXP_BMC && !was_bmc) {
+		SMFD_NOTICE("Setting BMC fan management mode to optimal\n");
+		smfd_ipmiq_set_mode(SMFD_SUPERMICRO_FAN_MODE_OPT);
+		smfd_fan_mode = SMFD_SUPERMICRO_FAN_MODE_OPT;
+	}
+	else if (a->policy != SMFD_EXP_BMC && was_bmc) {
+		SMFD_NOTICE("Setting BMC fan management mode to full (manual)\n");
+		smfd_ipmiq_set_mode(SMFD_SUPERMICRO_FAN_MODE_FULL);
+		smfd_fan_mode = SMFD_SUPERMICRO_FAN_MODE_FULL;
+		for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone)
+			smfd_set_fan_percent(zone, smfd_fan_percent[zone]);
+	}
+}
+
+/* Start the next block */
+static void smfd_exp_next_block(void)
+{
+	const _Bool was_bmc = smfd_exp_block_start != 0
+				&& smfd_exp_arms[smfd_exp_current].policy == SMFD_EXP_BMC;
+
+	smfd_exp_current = smfd_exp_second ? !smfd_exp_current : (unsigned int)(random() & 1);
+	smfd_exp_second = !smfd_exp_second;
+	smfd_exp_block_start = smfd_sample_time;
+	smfd_exp_arms[smfd_exp_current].stats.blocks += 1;
+
+	SMFD_NOTICE("Experiment: starting block %u of arm %s (%s)\n",
+		    smfd_exp_arms[smfd_exp_current].stats.blocks,
+		    smfd_exp_arms[smfd_exp_current].name,
+		    smfd_exp_policy_names[smfd_exp_arms[smfd_exp_current].policy]);
+
+	smfd_exp_apply(smfd_exp_current, was_bmc);
+}
+
+/* End a block of the bmc arm early, so that smfd can force the fans to 100% (a safety breach) */
+static void smfd_exp_safety_end(void)
+{
+	if (!smfd_exp_enabled || smfd_exp_block_start == 0
+			|| smfd_exp_arms[smfd_exp_current].policy != SMFD_EXP_BMC) {
+		return;
+	}
+
+	SMFD_WARNING("Experiment: safety limit exceeded; ending block %u of arm %s early\n",
+		     smfd_exp_arms[smfd_exp_current].stats.blocks,
+		     smfd_exp_arms[smfd_exp_current].name);
+
+	smfd_exp_arms[smfd_exp_current].stats.safety_ends += 1;
+
+	/* The other arm's block completes the pair (and it doesn't use the BMC's mode) */
+	smfd_exp_second = 1;
+	smfd_exp_next_block();
+}
+
+/* Save the configured policy settings (that arms change) and start the first block */
+static void smfd_exp_init(void)
+{
+	if (!smfd_exp_enabled)
+		return;
+
+	srandom(time(NULL) ^ getpid());
+
+	smfd_exp_saved_opt = smfd_opt_enabled;
+	smfd_exp_saved_base[SMFD_FAN_ZONE_CPU] = smfd_policy->fan_base[SMFD_FAN_ZONE_CPU];
+	smfd_exp_saved_base[SMFD_FAN_ZONE_SYS] = smfd_policy->fan_base[SMFD_FAN_ZONE_SYS];
+
+	smfd_exp_rapl_init();
+	smfd_exp_throttle_init();
+
+	/* The first block starts with the first sample */
+	smfd_exp_block_start = 0;
+	smfd_exp_second = 0;
+
+	SMFD_DEBUG("smfd_exp_init finished\n");
+}
+
+/* Re-save the configured policy after a reload, and put the active arm back into effect */
+static void smfd_exp_reloaded(void)
+{
+	const _Bool bmc = smfd_exp_block_start != 0
+				&& smfd_exp_arms[smfd_exp_current].policy == SMFD_EXP_BMC;
+
+	if (!smfd_exp_enabled)
+		return;
+
+	smfd_exp_saved_opt = smfd_opt_enabled;
+	smfd_exp_saved_base[SMFD_FAN_ZONE_CPU] = smfd_policy->fan_base[SMFD_FAN_ZONE_CPU];
+	smfd_exp_saved_base[SMFD_FAN_ZONE_SYS] = smfd_policy->fan_base[SMFD_FAN_ZONE_SYS];
+
+	smfd_exp_apply(smfd_exp_current, bmc);
+}
+
+/* Highest (non-failed) temperature in a sensor group; INT_MIN if none */
+static int smfd_exp_group_temp(const enum smfd_group group)
+{
+	unsigned int i;
+	int max;
+
+	max = INT_MIN;
+
+	switch (group) {
+
+		case SMFD_GROUP_PCH:
+			if (smfd_pch_temp.state != SMFD_SENSOR_FAILED)
+				max = smfd_pch_temp.current;
+			break;
+
+		case SMFD_GROUP_CPU:
+			for (i = 0; i < smfd_coretemp_count; ++i) {
+				if (smfd_coretemps[i].temp.state != SMFD_SENSOR_FAILED
+						&& smfd_coretemps[i].temp.current > max)
+					max = smfd_coretemps[i].temp.current;
+			}
+			break;
+
+		default:
+			for (i = 0; i < smfd_disk_count; ++i) {
+				if (smfd_disks[i].temp.state != SMFD_SENSOR_FAILED
+						&& smfd_disks[i].temp.current > max)
+					max = smfd_disks[i].temp.current;
+			}
+	}
+
+	smfd_ctrl_group_max(group, &max, NULL);
+	smfd_plugin_group_max(group, &max, NULL);
+
+	return max;
+}
+
+/* Record the outcome of the latest cycle for the active arm, and switch arms at block end */
+static void smfd_exp_sample(void)
+{
+	struct smfd_exp_stats *const st = &smfd_exp_arms[smfd_exp_current].stats;
+	unsigned long throttles;
+	double energy, seconds, aging;
+	uint8_t zone, percent;
+	unsigned int i;
+	int temp;
+
+	energy = smfd_exp_rapl_delta();
+	throttles = smfd_exp_throttle_delta();
+	seconds = (smfd_exp_last_sample == 0) ? 0 : (smfd_sample_time - smfd_exp_last_sample) / 1e3;
+	smfd_exp_last_sample = smfd_sample_time;
+
+	if (smfd_exp_block_start == 0
+			|| smfd_sample_time - smfd_exp_block_start
+				>= (int64_t)smfd_exp_block * 1000) {
+		smfd_exp_next_block();
+		/* The BMC can't have the fans while a safety limit holds zones at 100% */
+		if (smfd_safety_active)
+			smfd_exp_safety_end();
+		return;
+	}
+
+	if (smfd_sample_time - smfd_exp_block_start < (int64_t)smfd_exp_settle * 1000)
+		return;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+		percent = (smfd_exp_arms[smfd_exp_current].policy == SMFD_EXP_BMC) ?
+				smfd_get_fan_percent(zone) : smfd_fan_percent[zone];
+		st->fan_power[zone] += pow(percent / 100.0, 3);
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if ((temp = smfd_exp_group_temp(i)) == INT_MIN)
+			continue;
+		st->temps[i][(temp < 0) ? 0 : (temp > 127) ? 127 : temp] += 1;
+	}
+
+	if (smfd_exp_rapl_count > 0) {
+		st->cpu_energy += energy;
+		st->cpu_seconds += seconds;
+	}
+
+	if (smfd_aging_enabled && (aging = smfd_aging_mean_factor()) >= 0) {
+		st->disk_aging += aging;
+		st->aging_samples += 1;
+	}
+
+	st->throttles += throttles;
+	st->samples += 1;
+}
+
+/* Temperature (°C) at the given percentile of a histogram; -1 if empty */
+static int smfd_exp_percentile(const unsigned int *const hist, const unsigned int percentile)
+{
+	unsigned int i, total, seen;
+
+	for (total = 0, i = 0; i < 128; ++i)
+		total += hist[i];
+
+	if (total == 0)
+		return -1;
+
+	for (seen = 0, i = 0; i < 127; ++i) {
+		seen += hist[i];
+		if (seen * 100 >= total * percentile)
+			break;
+	}
+
+	return i;
+}
+
+/* Mean fan power of both zones (sum of (duty / 100)^3) */
+static double smfd_exp_fan_power(const struct smfd_exp_stats *const st)
+{
+	return (st->fan_power[SMFD_FAN_ZONE_CPU] + st->fan_power[SMFD_FAN_ZONE_SYS]) / st->samples;
+}
+
+/* Log the outcome of an experiment arm */
+static void smfd_exp_log(const char *const name, const struct smfd_exp_stats *const st)
+{
+	unsigned int i;
+
+	if (st->samples == 0) {
+		SMFD_INFO("Experiment arm %s: no samples\n", name);
+		return;
+	}
+
+	SMFD_INFO("Experiment arm %s: blocks: %u, samples: %u, mean fan power: %.4f, "
+		  "throttling events: %lu\n",
+		  name, st->blocks, st->samples, smfd_exp_fan_power(st), st->throttles);
+
+	if (st->safety_ends > 0) {
+		SMFD_INFO("Experiment arm %s: blocks ended by safety limits: %u\n",
+			  name, st->safety_ends);
+	}
+
+	if (st->cpu_seconds > 0) {
+		SMFD_INFO("Experiment arm %s: mean CPU power: %.1f W, fan power per 100 W: %.4f\n",
+			  name, st->cpu_energy / st->cpu_seconds,
+			  smfd_exp_fan_power(st) * 100 / (st->cpu_energy / st->cpu_seconds));
+	}
+
+	if (st->aging_samples > 0) {
+		SMFD_INFO("Experiment arm %s: mean disk aging factor: %.3f\n",
+			  name, st->disk_aging / st->aging_samples);
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (smfd_exp_percentile(st->temps[i], 50) < 0)
+			continue;
+		SMFD_INFO("Experiment arm %s: %s temperature p50: %d°C, p95: %d°C, p99: %d°C\n",
+			  name, smfd_group_keys[i], smfd_exp_percentile(st->temps[i], 50),
+			  smfd_exp_percentile(st->temps[i], 95),
+			  smfd_exp_percentile(st->temps[i], 99));
+	}
+}
+
+/* Close counters & free arm names */
+static void smfd_exp_fini(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < smfd_exp_rapl_count; ++i)
+		fclose(smfd_exp_rapl[i]);
+
+	for (i = 0; i < smfd_exp_throttle_count; ++i)
+		fclose(smfd_exp_throttle[i]);
+
+	free(smfd_exp_rapl);
+	free(smfd_exp_rapl_max);
+	free(smfd_exp_rapl_last);
+	free(smfd_exp_throttle);
+
+	for (i = 0; i < 2; ++i)
+		free(smfd_exp_arms[i].name);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Zone-to-sensor coupling identification (commissioning)
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Read all temperatures and get the (highest) temperature of each sensor group */
+static void smfd_group_temps(int *const temps)
+{
+	unsigned int i;
+
+	smfd_coretemp_read();
+	smfd_pch_temp_read();
+	smfd_ctrl_read();
+	smfd_plugin_read();
+	smfd_disk_read();
+
+	temps[SMFD_GROUP_PCH] = smfd_pch_temp.current;
+
+	for (temps[SMFD_GROUP_CPU] = INT_MIN, i = 0; i < smfd_coretemp_count; ++i) {
+		if (smfd_coretemps[i].temp.current > temps[SMFD_GROUP_CPU])
+			temps[SMFD_GROUP_CPU] = smfd_coretemps[i].temp.current;
+	}
+
+	for (temps[SMFD_GROUP_DISK] = INT_MIN, i = 0; i < smfd_disk_count; ++i) {
+		if (smfd_disks[i].temp.current > temps[SMFD_GROUP_DISK])
+			temps[SMFD_GROUP_DISK] = smfd_disks[i].temp.current;
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		smfd_ctrl_group_max(i, &temps[i], NULL);
+		smfd_plugin_group_max(i, &temps[i], NULL);
+	}
+}
+
+/* Highest threshold in a set of triggers (INT_MIN if the set is empty) */
+static int smfd_trigger_max(const struct smfd_temp_threshold *t)
+{
+	int max;
+
+	for (max = INT_MIN; t->name != NULL; ++t) {
+		if (t->threshold > max)
+			max = t->threshold;
+	}
+
+	return max;
+}
+
+/* Restore full cooling and exit if commissioning must stop */
+__attribute__((noreturn))
+static void smfd_coupling_abort(const char *const reason)
+{
+	smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, 100);
+	smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, 100);
+	SMFD_FATAL("Coupling identification aborted: %s; fans set to 100%%\n", reason);
+}
+
+/*
+ * Hold the given duty cycles for the settle time, and average each group's temperature over the
+ * last third of that period.  Aborts if any group reaches its highest trigger threshold.
+ */
+static void smfd_coupling_measure(const uint8_t *const percent, double *const temps)
+{
+	const int max[SMFD_GROUP_COUNT] = {
+		[SMFD_GROUP_PCH]	= smfd_trigger_max(smfd_policy->triggers[SMFD_GROUP_PCH]),
+		[SMFD_GROUP_CPU]	= smfd_trigger_max(smfd_policy->triggers[SMFD_GROUP_CPU]),
+		[SMFD_GROUP_DISK]	= smfd_trigger_max(smfd_policy->triggers[SMFD_GROUP_DISK])
+	};
+
+	unsigned int elapsed, interval, samples[SMFD_GROUP_COUNT], i;
+	int current[SMFD_GROUP_COUNT];
+
+	SMFD_NOTICE("Holding CPU fan at %" PRIu8 "%%, system fan at %" PRIu8 "%% for %u seconds\n",
+		    percent[SMFD_FAN_ZONE_CPU], percent[SMFD_FAN_ZONE_SYS], smfd_coupling_settle);
+
+	smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, percent[SMFD_FAN_ZONE_CPU]);
+	smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, percent[SMFD_FAN_ZONE_SYS]);
+
+	memset(temps, 0, SMFD_GROUP_COUNT * sizeof *temps);
+	memset(samples, 0, sizeof samples);
+	interval = (smfd_coupling_settle < 90) ? smfd_coupling_settle / 3 + 1 : 30;
+
+	for (elapsed = 0; elapsed < smfd_coupling_settle; elapsed += interval) {
+
+		sleep(interval);
+
+		if (smfd_quit_signal)
+			smfd_coupling_abort("got shutdown signal");
+
+		smfd_group_temps(current);
+
+		/* A group with no triggers (or no readable sensors) has nothing to check */
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+			if (max[i] != INT_MIN && current[i] != INT_MIN && current[i] >= max[i])
+				smfd_coupling_abort("temperature reached highest trigger");
+		}
+
+		if (elapsed + interval < smfd_coupling_settle * 2 / 3)
+			continue;
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+			if (current[i] != INT_MIN) {
+				temps[i] += current[i];
+				++samples[i];
+			}
+		}
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (samples[i] == 0) {
+			temps[i] = NAN;		/* written as nan; loaded as no gain */
+			SMFD_INFO("  %s: no readable sensors\n", smfd_group_keys[i]);
+			continue;
+		}
+		temps[i] /= samples[i];
+		SMFD_INFO("  %s: %.2f°C\n", smfd_group_keys[i], temps[i]);
+	}
+}
+
+/*
+ * Perturb each zone's duty cycle in turn, starting from the base duty cycles, and record how much
+ * each sensor group's steady-state temperature changes per percent.  Each group is assigned to the
+ * zone that cools it most cheaply -- the lowest marginal fan power (3 x duty^2) per °C.  Results
+ * are written to smfd_coupling_file.
+ */
+static void smfd_coupling_run(void)
+{
+	const uint8_t base[SMFD_FAN_ZONE_COUNT] = {
+		[SMFD_FAN_ZONE_CPU]	= smfd_policy->fan_base[SMFD_FAN_ZONE_CPU],
+		[SMFD_FAN_ZONE_SYS]	= smfd_policy->fan_base[SMFD_FAN_ZONE_SYS]
+	};
+
+	double base_temps[SMFD_GROUP_COUNT], temps[SMFD_GROUP_COUNT];
+	double gain[SMFD_GROUP_COUNT][SMFD_FAN_ZONE_COUNT], cost, best_cost;
+	uint8_t percent[SMFD_FAN_ZONE_COUNT];
+	unsigned int zone, best, i;
+	char tmp[PATH_MAX];
+	int delta;
+	FILE *fp;
+
+	SMFD_NOTICE("Measuring baseline temperatures\n");
+	smfd_coupling_measure(base, base_temps);
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		memcpy(percent, base, sizeof percent);
+		delta = (base[zone] + smfd_coupling_step <= 100) ?
+				smfd_coupling_step : -(int)smfd_coupling_step;
+		percent[zone] = base[zone] + delta;
+
+		SMFD_NOTICE("Perturbing %s fan zone by %+d%%\n", smfd_zone_names[zone], delta);
+		smfd_coupling_measure(percent, temps);
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i)
+			gain[i][zone] = (temps[i] - base_temps[i]) / delta;
+	}
+
+	if (snprintf(tmp, sizeof tmp, "%s.tmp", smfd_coupling_file) >= (int)sizeof tmp)
+		SMFD_FATAL("File name truncated: %s.tmp\n", smfd_coupling_file);
+
+	if ((fp = fopen(tmp, "w")) == NULL)
+		SMFD_FATAL("%s: %m\n", tmp);
+
+	fprintf(fp, "# smfd zone-to-sensor coupling (°C per duty cycle percent)\n"
+		    "# base duty cycles: CPU %" PRIu8 "%%, system %" PRIu8 "%%\n"
+		    "# group cpu_fan_gain sys_fan_gain zone\n",
+		base[SMFD_FAN_ZONE_CPU], base[SMFD_FAN_ZONE_SYS]);
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+
+		for (best = 0, best_cost = HUGE_VAL, zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+			if (gain[i][zone] >= 0)
+				continue;	/* this zone doesn't cool the group */
+
+			cost = 3.0 * base[zone] * base[zone] / -gain[i][zone];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best = zone;
+			}
+		}
+
+		fprintf(fp, "%s %.4f %.4f %s\n", smfd_group_keys[i],
+			gain[i][SMFD_FAN_ZONE_CPU], gain[i][SMFD_FAN_ZONE_SYS],
+			(best_cost == HUGE_VAL) ? "none" : smfd_zone_names[best]);
+
+		SMFD_NOTICE("%s temperatures: CPU zone %.4f°C/%%, system zone %.4f°C/%% ==> %s\n",
+			    smfd_group_keys[i], gain[i][SMFD_FAN_ZONE_CPU],
+			    gain[i][SMFD_FAN_ZONE_SYS],
+			    (best_cost == HUGE_VAL) ? "no cooling zone" : smfd_zone_names[best]);
+	}
+
+	if (fclose(fp) != 0)
+		SMFD_FATAL("%s: %m\n", tmp);
+
+	if (rename(tmp, smfd_coupling_file) != 0)
+		SMFD_FATAL("%s: %m\n", smfd_coupling_file);
+
+	SMFD_NOTICE("Wrote coupling matrix to %s\n", smfd_coupling_file);
+
+	smfd_set_fan_percent(SMFD_FAN_ZONE_CPU, 100);
+	smfd_set_fan_percent(SMFD_FAN_ZONE_SYS, 100);
+}
+
+/*
+ * Load measured gains for optimizer groups that don't have gains in the configuration file, and
+ * the zone assigned to each group (if assign_zones is set)
+ */
+static void smfd_coupling_load(void)
+{
+	char group[sizeof "disk"], zone[sizeof "system"];
+	double cpu_gain, sys_gain;
+	struct smfd_opt_group *g;
+	char *line = NULL;
+	size_t size = 0;
+	unsigned int i, z;
+	FILE *fp;
+
+	for (i = 0; smfd_opt_enabled && i < SMFD_GROUP_COUNT; ++i) {
+		if (smfd_opt_groups[i].configured && !smfd_opt_groups[i].have_gain)
+			break;
+	}
+
+	if ((!smfd_opt_enabled || i == SMFD_GROUP_COUNT) && !smfd_coupling_assign)
+		return;
+
+	if ((fp = fopen(smfd_coupling_file, "r")) == NULL) {
+		if (smfd_coupling_assign) {
+			SMFD_FATAL("%s: %m (coupling assign_zones is set; run smfd -k)\n",
+				   smfd_coupling_file);
+		}
+		SMFD_FATAL("%s: %m (optimizer %s group has no gains; run smfd -k)\n",
+			   smfd_coupling_file, smfd_group_keys[i]);
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i)
+		smfd_coupling_zones[i] = SMFD_FAN_ZONE_COUNT;
+
+	while (getline(&line, &size, fp) > 0) {
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%4s %lf %lf %6s", group, &cpu_gain, &sys_gain, zone) != 4)
+			SMFD_FATAL("%s: invalid line: %s", smfd_coupling_file, line);
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+			if (strcmp(group, smfd_group_keys[i]) == 0)
+				break;
+		}
+
+		if (i == SMFD_GROUP_COUNT)
+			SMFD_FATAL("%s: unknown sensor group (%s)\n", smfd_coupling_file, group);
+
+		for (z = 0; z < SMFD_FAN_ZONE_COUNT; ++z) {
+			if (strcmp(zone, smfd_zone_names[z]) == 0)
+				break;
+		}
+
+		if (z == SMFD_FAN_ZONE_COUNT && strcmp(zone, "none") != 0)
+			SMFD_FATAL("%s: unknown fan zone (%s)\n", smfd_coupling_file, zone);
+
+		if (smfd_coupling_assign) {
+			smfd_coupling_zones[i] = z;
+			SMFD_DEBUG("Assigned %s group to %s fan zone\n", group,
+				   (z == SMFD_FAN_ZONE_COUNT) ? "both" : smfd_zone_names[z]);
+		}
+
+		g = &smfd_opt_groups[i];
+		if (!smfd_opt_enabled || !g->configured || g->have_gain)
+			continue;
+
+		/* nan == the group had no readable sensors while it was measured */
+		if (isnan(cpu_gain) || isnan(sys_gain))
+			continue;
+
+		/* A measured warming effect is noise; the model requires non-positive gains */
+		g->gain[SMFD_FAN_ZONE_CPU] = (cpu_gain < 0) ? cpu_gain : 0;
+		g->gain[SMFD_FAN_ZONE_SYS] = (sys_gain < 0) ? sys_gain : 0;
+		g->have_gain = 1;
+
+		SMFD_DEBUG("Loaded %s gains from %s\n", group, smfd_coupling_file);
+	}
+
+	free(line);
+
+	if (ferror(fp))
+		SMFD_FATAL("%s: %m\n", smfd_coupling_file);
+
+	if (fclose(fp) != 0)
+		SMFD_FATAL("fclose: %m\n");
+
+	for (i = 0; smfd_opt_enabled && i < SMFD_GROUP_COUNT; ++i) {
+		if (smfd_opt_groups[i].configured && !smfd_opt_groups[i].have_gain) {
+			SMFD_FATAL("%s: no gains for %s sensor group\n",
+				   smfd_coupling_file, smfd_group_keys[i]);
+		}
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Fleet mode -- remote BMCs over IPMI LAN
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Lock a remote host's shared state */
+static void smfd_fleet_lock(struct smfd_fleet_host *const host)
+{
+	int rc;
+
+	if ((rc = pthread_mutex_lock(&host->mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_lock: %s\n", strerror(rc));
+}
+
+/* Unlock a remote host's shared state */
+static void smfd_fleet_unlock(struct smfd_fleet_host *const host)
+{
+	int rc;
+
+	if ((rc = pthread_mutex_unlock(&host->mutex)) != 0)
+		SMFD_ABORT("pthread_mutex_unlock: %s\n", strerror(rc));
+}
+
+/* Close a remote host's IPMI session (if open) */
+static void smfd_fleet_close(struct smfd_fleet_host *const host)
+{
+	if (host->ipmi == NULL)
+		return;
+
+	if (host->read != NULL) {
+		ipmi_sensor_read_ctx_destroy(host->read);
+		host->read = NULL;
+	}
+
+	if (ipmi_ctx_close(host->ipmi) < 0)
+		SMFD_DEBUG("%s: ipmi_ctx_close: %s\n", host->name, ipmi_ctx_errormsg(host->ipmi));
+
+	ipmi_ctx_destroy(host->ipmi);
+	host->ipmi = NULL;
+}
+
+/* Drop a failed session; reconnect attempts back off exponentially, up to 10 minutes apart */
+static void smfd_fleet_fail(struct smfd_fleet_host *const host, const char *const err)
+{
+	unsigned int backoff;
+
+	smfd_fleet_close(host);
+
+	backoff = host->interval << (host->failures < 5 ? host->failures : 5);
+	if (backoff > 600)
+		backoff = 600;
+
+	smfd_fleet_lock(host);
+	host->failures += 1;
+	host->connected = 0;
+	smfd_fleet_unlock(host);
+
+	host->retry = smfd_mono_ms() + (int64_t)backoff * 1000;
+
+	SMFD_WARNING("%s: %s; retrying in %u seconds\n", host->name, err, backoff);
+}
+
+/*
+ * Open an IPMI 2.0 (lanplus) session to a remote BMC, load its temperature sensor records, and take
+ * control of its fans (full mode, all zones at 100%).
+ */
+static int smfd_fleet_open(struct smfd_fleet_host *const host, char *const err,
+			   const size_t err_size)
+{
+	struct smfd_fleet_sensor *sensor;
+	ipmi_sdr_ctx_t sdr;
+	unsigned int i;
+	uint8_t zone;
+	int rc;
+
+	if ((host->ipmi = ipmi_ctx_create()) == NULL)
+		SMFD_ABORT("ipmi_ctx_create: %m\n");
+
+	rc = ipmi_ctx_open_outofband_2_0(host->ipmi, host->address, host->username, host->password,
+					 NULL, 0, IPMI_PRIVILEGE_LEVEL_ADMIN, host->cipher_suite,
+					 host->timeout * 1000,
+					 (host->timeout < 2) ? host->timeout * 500 : 1000, 0, 0);
+	if (rc < 0) {
+		snprintf(err, err_size, "ipmi_ctx_open_outofband_2_0: %s",
+			 ipmi_ctx_errormsg(host->ipmi));
+		return -1;
+	}
+
+	if ((sdr = ipmi_sdr_ctx_create()) == NULL)
+		SMFD_ABORT("ipmi_sdr_ctx_create: %m\n");
+
+	if (ipmi_sdr_cache_open(sdr, host->ipmi, host->sdr_cache) < 0) {
+		snprintf(err, err_size, "ipmi_sdr_cache_open: %s", ipmi_sdr_ctx_errormsg(sdr));
+		ipmi_sdr_ctx_destroy(sdr);
+		return -1;
+	}
+
+	for (rc = 0, i = 0; rc >= 0 && i < host->sensor_count; ++i) {
+
+		sensor = &host->sensors[i];
+		if (sensor->record_id == 0xffff)
+			continue;	/* external */
+
+		rc = smfd_sdr_read_record(sdr, sensor->record_id, IPMI_SENSOR_TYPE_TEMPERATURE,
+					  sensor->name, sensor->record, sizeof sensor->record,
+					  err, err_size);
+		sensor->record_len = (rc < 0) ? 0 : rc;
+	}
+
+	if (ipmi_sdr_cache_close(sdr) < 0)
+		SMFD_ERR("ipmi_sdr_cache_close: %s\n", ipmi_sdr_ctx_errormsg(sdr));
+
+	ipmi_sdr_ctx_destroy(sdr);
+
+	if (rc < 0)
+		return -1;
+
+	if ((host->read = ipmi_sensor_read_ctx_create(host->ipmi)) == NULL) {
+		snprintf(err, err_size, "ipmi_sensor_read_ctx_create: %s",
+			 ipmi_ctx_errormsg(host->ipmi));
+		return -1;
+	}
+
+	SMFD_NOTICE("%s: Setting BMC fan management mode to full (manual)\n", host->name);
+
+	if (smfd_ipmi_set_fan_mode(host->ipmi, SMFD_SUPERMICRO_FAN_MODE_FULL, err, err_size) < 0)
+		return -1;
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+		if (smfd_ipmi_set_fan_percent(host->ipmi, zone, 100, err, err_size) < 0)
+			return -1;
+	}
+
+	smfd_fleet_lock(host);
+	memset(host->fan_percent, 100, sizeof host->fan_percent);
+	host->connected = 1;
+	smfd_fleet_unlock(host);
+
+	SMFD_NOTICE("%s: IPMI session established; all fans at 100%%\n", host->name);
+
+	return 0;
+}
+
+/* Read a remote host's BMC temperature sensors */
+static int smfd_fleet_read(struct smfd_fleet_host *const host, char *const err,
+			   const size_t err_size)
+{
+	struct smfd_fleet_sensor *sensor;
+	uint16_t bitmask;
+	double *reading;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < host->sensor_count; ++i) {
+
+		sensor = &host->sensors[i];
+		if (sensor->record_len == 0)
+			continue;	/* external */
+
+		rc = ipmi_sensor_read(host->read, sensor->record, sensor->record_len, 0, NULL,
+				      &reading, &bitmask);
+		if (rc < 0) {
+			snprintf(err, err_size, "ipmi_sensor_read: %s",
+				 ipmi_sensor_read_ctx_errormsg(host->read));
+			return -1;
+		}
+
+		if (rc == 0 || reading == NULL) {
+			SMFD_DEBUG("%s: %s: no reading\n", host->name, sensor->name);
+			continue;
+		}
+
+		smfd_fleet_lock(host);
+		sensor->value = lround(*reading);
+		sensor->updated = smfd_mono_ms();
+		smfd_fleet_unlock(host);
+		free(reading);
+	}
+
+	return 0;
+}
+
+/*
+ * Process a remote host's temperatures against its triggers and set its fan zones.  A group whose
+ * sensors are all stale (no reading within 3 intervals) requires 100% in both zones.
+ */
+static int smfd_fleet_process(struct smfd_fleet_host *const host, char *const err,
+			      const size_t err_size)
+{
+	static const char *const group_names[SMFD_GROUP_COUNT] = {
+		[SMFD_GROUP_PCH]	= "PCH",
+		[SMFD_GROUP_CPU]	= "CPU",
+		[SMFD_GROUP_DISK]	= "disk"
+	};
+
+	struct smfd_process_temp_result result;
+	uint8_t percent[SMFD_FAN_ZONE_COUNT];
+	const struct smfd_fleet_sensor *sensor;
+	_Bool present, stale;
+	int64_t now, limit;
+	char name[128];
+	unsigned int i;
+	uint8_t zone;
+	int g, temp;
+
+	now = smfd_mono_ms();
+	limit = (int64_t)host->interval * 3000;
+	percent[SMFD_FAN_ZONE_CPU] = smfd_policy->fan_base[SMFD_FAN_ZONE_CPU];
+	percent[SMFD_FAN_ZONE_SYS] = smfd_policy->fan_base[SMFD_FAN_ZONE_SYS];
+
+	for (g = 0; g < SMFD_GROUP_COUNT; ++g) {
+
+		smfd_fleet_lock(host);
+
+		for (temp = INT_MIN, present = 0, stale = 1, i = 0; i < host->sensor_count; ++i) {
+
+			sensor = &host->sensors[i];
+			if (sensor->group != (enum smfd_group)g)
+				continue;
+
+			present = 1;
+
+			if (sensor->updated == 0 || now - sensor->updated > limit)
+				continue;
+
+			stale = 0;
+			if (sensor->value > temp)
+				temp = sensor->value;
+		}
+
+		smfd_fleet_unlock(host);
+
+		if (!present)
+			continue;
+
+		if (stale) {
+			SMFD_WARNING("%s: no current %s temperature; requiring 100%% fans\n",
+				     host->name, group_names[g]);
+			percent[SMFD_FAN_ZONE_CPU] = 100;
+			percent[SMFD_FAN_ZONE_SYS] = 100;
+			continue;
+		}
+
+		snprintf(name, sizeof name, "%s %s", host->name, group_names[g]);
+		smfd_process_temp(temp, host->triggers[g], name, &result);
+
+		if (result.cpu_fan_percent > percent[SMFD_FAN_ZONE_CPU])
+			percent[SMFD_FAN_ZONE_CPU] = result.cpu_fan_percent;
+		if (result.sys_fan_percent > percent[SMFD_FAN_ZONE_SYS])
+			percent[SMFD_FAN_ZONE_SYS] = result.sys_fan_percent;
+	}
+
+	for (zone = 0; zone < SMFD_FAN_ZONE_COUNT; ++zone) {
+
+		if (percent[zone] == host->fan_percent[zone])
+			continue;
+
+		SMFD_NOTICE("%s: Setting %s fan to %" PRIu8 "%%\n",
+			    host->name, smfd_zone_names[zone], percent[zone]);
+
+		if (smfd_ipmi_set_fan_percent(host->ipmi, zone, percent[zone], err, err_size) < 0)
+			return -1;
+
+		smfd_fleet_lock(host);
+		host->fan_percent[zone] = percent[zone];
+		smfd_fleet_unlock(host);
+	}
+
+	return 0;
+}
+
+/* Sample a remote host -- (re)connect if needed, read sensors & set fans */
+static void smfd_fleet_sample(struct smfd_fleet_host *const host)
+{
+	char err[IPMI_ERR_STR_MAX_LEN + 64];
+
+	if (host->ipmi == NULL) {
+
+		if (smfd_mono_ms() < host->retry)
+			return;
+
+		if (smfd_fleet_open(host, err, sizeof err) < 0) {
+			smfd_fleet_fail(host, err);
+			return;
+		}
+	}
+
+	if (smfd_fleet_read(host, err, sizeof err) < 0
+			|| smfd_fleet_process(host, err, sizeof err) < 0) {
+		smfd_fleet_fail(host, err);
+		return;
+	}
+
+	smfd_fleet_lock(host);
+	host->failures = 0;
+	smfd_fleet_unlock(host);
+}
+
+/*
+ * Worker thread -- samples 1 remote host each time its timer fires.  Each host has its own thread
+ * (and FreeIPMI context), so a host whose BMC stops responding can't delay any other host.
+ */
+static void *smfd_fleet_main(void *const arg)
+{
+	struct smfd_fleet_host *const host = arg;
+	int rc;
+
+	smfd_fleet_lock(host);
+
+	while (1) {
+
+		while (!host->tick && !host->quit) {
+			if ((rc = pthread_cond_wait(&host->cond, &host->mutex)) != 0)
+				SMFD_ABORT("pthread_cond_wait: %s\n", strerror(rc));
+		}
+
+		if (host->quit)
+			break;
+
+		host->tick = 0;
+		host->busy = 1;
+		smfd_fleet_unlock(host);
+
+		smfd_fleet_sample(host);
+
+		smfd_fleet_lock(host);
+		host->busy = 0;
+	}
+
+	smfd_fleet_unlock(host);
+	smfd_fleet_close(host);
+
+	return NULL;
+}
+
+/* Handle a host's sampling timer -- wake its worker, unless the previous sample is still running */
+static void smfd_fleet_tick(struct smfd_fleet_host *const host)
+{
+	uint64_t expirations;
+	int rc;
+
+	if (read(host->timer_fd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+		SMFD_FATAL("read: %m\n");
+
+	smfd_fleet_lock(host);
+
+	if (host->busy) {
+		SMFD_DEBUG("%s: previous sample still in progress; skipping\n", host->name);
+	}
+	else {
+		host->tick = 1;
+		if ((rc = pthread_cond_signal(&host->cond)) != 0)
+			SMFD_ABORT("pthread_cond_signal: %s\n", strerror(rc));
+	}
+
+	smfd_fleet_unlock(host);
+}
+
+/* Check whether a pushed reading came from an allowed sender */
+static _Bool smfd_fleet_peer_ok(const struct sockaddr_storage *const addr)
+{
+	struct in6_addr peer;
+	unsigned int i;
+
+	if (smfd_fleet_peer_count == 0)
+		return 1;	/* listening on loopback (checked by smfd_fleet_listen_init) */
+
+	if (addr->ss_family == AF_INET) {
+		memset(&peer, 0, sizeof peer);
+		peer.s6_addr[10] = 0xff;
+		peer.s6_addr[11] = 0xff;
+		memcpy(&peer.s6_addr[12], &((const struct sockaddr_in *)addr)->sin_addr, 4);
+	}
+	else if (addr->ss_family == AF_INET6) {
+		peer = ((const struct sockaddr_in6 *)addr)->sin6_addr;
+	}
+	else {
+		return 0;
+	}
+
+	for (i = 0; i < smfd_fleet_peer_count; ++i) {
+		if (memcmp(&peer, &smfd_fleet_peers[i], sizeof peer) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Receive a pushed external reading -- "HOST SENSOR TEMPERATURE" (sensor names may have spaces) */
+static void smfd_fleet_push(const int fd)
+{
+	char buf[256], *sensor_name, *temp, *end, sender[INET6_ADDRSTRLEN];
+	struct smfd_fleet_sensor *sensor;
+	struct smfd_fleet_host *host;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	unsigned int i;
+	ssize_t len;
+	long value;
+
+	while (1) {
+
+		addr_len = sizeof addr;
+		len = recvfrom(fd, buf, sizeof buf - 1, MSG_DONTWAIT, (struct sockaddr *)&addr,
+			       &addr_len);
+		if (len < 0)
+			break;
+
+		if (!smfd_fleet_peer_ok(&addr)) {
+			if (getnameinfo((struct sockaddr *)&addr, addr_len, sender, sizeof sender,
+					NULL, 0, NI_NUMERICHOST) != 0) {
+				strcpy(sender, "(unknown)");
+			}
+			SMFD_WARNING("Ignoring pushed reading from %s\n", sender);
+			continue;
+		}
+
+		buf[len] = 0;
+		buf[strcspn(buf, "\r\n")] = 0;
+
+		if ((sensor_name = strchr(buf, ' ')) == NULL
+				|| (temp = strrchr(buf, ' ')) == sensor_name) {
+			SMFD_WARNING("Ignoring malformed pushed reading: %s\n", buf);
+			continue;
+		}
+
+		*sensor_name++ = 0;
+		*temp++ = 0;
+
+		errno = 0;
+		value = strtol(temp, &end, 10);
+		if (errno != 0 || *end != 0 || end == temp || value < -273 || value > 999) {
+			SMFD_WARNING("Ignoring invalid pushed temperature: %s\n", temp);
+			continue;
+		}
+
+		for (host = NULL, i = 0; i < smfd_fleet_host_count; ++i) {
+			if (strcmp(smfd_fleet_hosts[i].name, buf) == 0) {
+				host = &smfd_fleet_hosts[i];
+				break;
+			}
+		}
+
+		if (host == NULL) {
+			SMFD_WARNING("Ignoring pushed reading for unknown host: %s\n", buf);
+			continue;
+		}
+
+		for (sensor = NULL, i = 0; i < host->sensor_count; ++i) {
+			if (host->sensors[i].record_id == 0xffff
+					&& strcmp(host->sensors[i].name, sensor_name) == 0) {
+				sensor = &host->sensors[i];
+				break;
+			}
+		}
+
+		if (sensor == NULL) {
+			SMFD_WARNING("%s: Ignoring pushed reading for unknown sensor: %s\n",
+				     host->name, sensor_name);
+			continue;
+		}
+
+		smfd_fleet_lock(host);
+		sensor->value = (int)value;
+		sensor->updated = smfd_mono_ms();
+		smfd_fleet_unlock(host);
+
+		SMFD_DEBUG("%s: %s: pushed reading %d\n", host->name, sensor->name, sensor->value);
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		SMFD_ERR("recv: %m\n");
+}
+
+/* Check whether a socket address is a loopback address */
+static _Bool smfd_fleet_loopback(const struct sockaddr *const addr)
+{
+	if (addr->sa_family == AF_INET)
+		return ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr) >> 24 == 127;
+
+	if (addr->sa_family == AF_INET6)
+		return IN6_IS_ADDR_LOOPBACK(&((const struct sockaddr_in6 *)addr)->sin6_addr);
+
+	return 0;
+}
+
+/*
+ * Open the UDP socket on which external readings are pushed (ADDRESS:PORT).  Anyone who can reach
+ * the socket can set a host's temperatures, so a non-loopback address requires push_peers.
+ */
+static int smfd_fleet_listen_init(void)
+{
+	struct addrinfo hints = {
+		.ai_family	= AF_UNSPEC,
+		.ai_socktype	= SOCK_DGRAM,
+		.ai_flags	= AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV
+	};
+
+	struct addrinfo *ai;
+	char *addr, *port;
+	int fd, rc;
+
+	if ((addr = strdup(smfd_fleet_listen)) == NULL)
+		SMFD_ABORT("strdup: %m\n");
+
+	if ((port = strrchr(addr, ':')) == NULL)
+		SMFD_FATAL("Invalid fleet listen address (%s)\n", smfd_fleet_listen);
+
+	*port++ = 0;
+
+	/* Allow [::1]:port */
+	if (addr[0] == '[' && port[-2] == ']') {
+		port[-2] = 0;
+		memmove(addr, addr + 1, strlen(addr));
+	}
+
+	if ((rc = getaddrinfo(addr, port, &hints, &ai)) != 0)
+		SMFD_FATAL("%s: %s\n", smfd_fleet_listen, gai_strerror(rc));
+
+	if (smfd_fleet_peer_count == 0 && !smfd_fleet_loopback(ai->ai_addr)) {
+		SMFD_FATAL("Fleet listen address (%s) is not a loopback address; "
+			   "push_peers must be set\n", smfd_fleet_listen);
+	}
+
+	fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		SMFD_FATAL("socket: %m\n");
+
+	if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+		SMFD_FATAL("%s: bind: %m\n", smfd_fleet_listen);
+
+	freeaddrinfo(ai);
+	free(addr);
+
+	SMFD_DEBUG("Listening for pushed readings on %s\n", smfd_fleet_listen);
+
+	return fd;
+}
+
+/* Log the state of all remote hosts */
+static void smfd_fleet_log_info(void)
+{
+	struct smfd_fleet_host *host;
+	const struct smfd_fleet_sensor *sensor;
+	unsigned int i, j;
+	int64_t now;
+
+	now = smfd_mono_ms();
+
+	for (i = 0; i < smfd_fleet_host_count; ++i) {
+
+		host = &smfd_fleet_hosts[i];
+		smfd_fleet_lock(host);
+
+		if (!host->connected) {
+			SMFD_INFO("%s: no session (%u consecutive failures)\n",
+				  host->name, host->failures);
+			smfd_fleet_unlock(host);
+			continue;
+		}
+
+		SMFD_INFO("%s: CPU fan: %" PRIu8 "%%, system fan: %" PRIu8 "%%\n", host->name,
+			  host->fan_percent[SMFD_FAN_ZONE_CPU],
+			  host->fan_percent[SMFD_FAN_ZONE_SYS]);
+
+		for (j = 0; j < host->sensor_count; ++j) {
+
+			sensor = &host->sensors[j];
+
+			if (sensor->updated == 0) {
+				SMFD_INFO("%s: %s: no reading\n", host->name, sensor->name);
+				continue;
+			}
+
+			SMFD_INFO("%s: %s: %d°C (%" PRId64 " seconds ago)\n", host->name,
+				  sensor->name, sensor->value, (now - sensor->updated) / 1000);
+		}
+
+		smfd_fleet_unlock(host);
+	}
+}
+
+/* Copy the global trigger tables, so that each host has its own trigger state */
+static struct smfd_temp_threshold *smfd_fleet_copy_triggers(const struct smfd_temp_threshold *cfg)
+{
+	struct smfd_temp_threshold *copy;
+	size_t len;
+
+	for (len = 0; cfg[len].name != NULL; ++len);
+
+	if ((copy = malloc((len + 1) * sizeof *copy)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	memcpy(copy, cfg, (len + 1) * sizeof *copy);
+
+	return copy;
+}
+
+/* Forward declaration needed by smfd_fleet_run */
+static void smfd_check_signals(void);
+
+/* Start a remote host's worker thread */
+static void smfd_fleet_start(struct smfd_fleet_host *const host)
+{
+	sigset_t all, old;
+	int rc;
+
+	if ((rc = pthread_mutex_init(&host->mutex, NULL)) != 0)
+		SMFD_ABORT("pthread_mutex_init: %s\n", strerror(rc));
+
+	if ((rc = pthread_cond_init(&host->cond, NULL)) != 0)
+		SMFD_ABORT("pthread_cond_init: %s\n", strerror(rc));
+
+	if (sigfillset(&all) != 0)
+		SMFD_ABORT("sigfillset: %m\n");
+
+	if ((rc = pthread_sigmask(SIG_SETMASK, &all, &old)) != 0)
+		SMFD_ABORT("pthread_sigmask: %s\n", strerror(rc));
+
+	if ((rc = pthread_create(&host->thread, NULL, smfd_fleet_main, host)) != 0)
+		SMFD_FATAL("pthread_create: %s\n", strerror(rc));
+
+	if ((rc = pthread_setname_np(host->thread, "smfd-fleet")) != 0)
+		SMFD_WARNING("pthread_setname_np: %s\n", strerror(rc));
+
+	if ((rc = pthread_sigmask(SIG_SETMASK, &old, NULL)) != 0)
+		SMFD_ABORT("pthread_sigmask: %s\n", strerror(rc));
+}
+
+/* Stop a remote host's worker thread (which closes its IPMI session) */
+static void smfd_fleet_stop(struct smfd_fleet_host *const host)
+{
+	int rc;
+
+	smfd_fleet_lock(host);
+	host->quit = 1;
+
+	if ((rc = pthread_cond_signal(&host->cond)) != 0)
+		SMFD_ABORT("pthread_cond_signal: %s\n", strerror(rc));
+
+	smfd_fleet_unlock(host);
+
+	if ((rc = pthread_join(host->thread, NULL)) != 0)
+		SMFD_ERR("pthread_join: %s\n", strerror(rc));
+
+	if ((rc = pthread_cond_destroy(&host->cond)) != 0)
+		SMFD_ERR("pthread_cond_destroy: %s\n", strerror(rc));
+
+	if ((rc = pthread_mutex_destroy(&host->mutex)) != 0)
+		SMFD_ERR("pthread_mutex_destroy: %s\n", strerror(rc));
+}
+
+/*
+ * Fleet mode main loop.  Each host has a timer; all timers and the pushed reading socket are
+ * multiplexed on 1 epoll instance.  FreeIPMI transactions are synchronous, so each host's sessions
+ * run in its own worker thread; a timer that fires while the host's worker is still busy (e.g.
+ * waiting for an unresponsive BMC) is skipped, and a host that fails is retried with exponential
+ * backoff.
+ */
+static void smfd_fleet_run(void)
+{
+	struct epoll_event events[16], ev;
+	struct smfd_fleet_host *host;
+	struct itimerspec its;
+	int epfd, listen_fd, n, i;
+	unsigned int h;
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		SMFD_FATAL("epoll_create1: %m\n");
+
+	listen_fd = -1;
+
+	if (smfd_fleet_listen != NULL) {
+
+		listen_fd = smfd_fleet_listen_init();
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) != 0)
+			SMFD_FATAL("epoll_ctl: %m\n");
+	}
+
+	for (h = 0; h < smfd_fleet_host_count; ++h) {
+
+		host = &smfd_fleet_hosts[h];
+
+		host->triggers[SMFD_GROUP_PCH] =
+			smfd_fleet_copy_triggers(smfd_default_profile.triggers[SMFD_GROUP_PCH]);
+		host->triggers[SMFD_GROUP_CPU] =
+			smfd_fleet_copy_triggers(smfd_default_profile.triggers[SMFD_GROUP_CPU]);
+		host->triggers[SMFD_GROUP_DISK] =
+			smfd_fleet_copy_triggers(smfd_default_profile.triggers[SMFD_GROUP_DISK]);
+
+		smfd_fleet_start(host);
+
+		host->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (host->timer_fd < 0)
+			SMFD_FATAL("timerfd_create: %m\n");
+
+		/* Stagger the first sample of each host by 100 ms */
+		its.it_value.tv_sec = h / 10;
+		its.it_value.tv_nsec = (h % 10) * 100000000 + 1;
+		its.it_interval.tv_sec = host->interval;
+		its.it_interval.tv_nsec = 0;
+
+		if (timerfd_settime(host->timer_fd, 0, &its, NULL) != 0)
+			SMFD_FATAL("timerfd_settime: %m\n");
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = host;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, host->timer_fd, &ev) != 0)
+			SMFD_FATAL("epoll_ctl: %m\n");
+	}
+
+	SMFD_NOTICE("Managing %u remote hosts\n", smfd_fleet_host_count);
+
+	while (!smfd_quit_signal) {
+
+		smfd_check_signals();
+
+		if ((n = epoll_wait(epfd, events, sizeof events / sizeof events[0], -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			SMFD_FATAL("epoll_wait: %m\n");
+		}
+
+		for (i = 0; i < n; ++i) {
+			if (events[i].data.ptr == NULL)
+				smfd_fleet_push(listen_fd);
+			else
+				smfd_fleet_tick(events[i].data.ptr);
+		}
+	}
+
+	for (h = 0; h < smfd_fleet_host_count; ++h) {
+		host = &smfd_fleet_hosts[h];
+		smfd_fleet_stop(host);
+		if (close(host->timer_fd) != 0)
+			SMFD_ERR("close: %m\n");
+	}
+
+	if (listen_fd >= 0 && close(listen_fd) != 0)
+		SMFD_ERR("close: %m\n");
+
+	if (close(epfd) != 0)
+		SMFD_ERR("close: %m\n");
+}
+
+/* Free the remote host configuration */
+static void smfd_fleet_fini(void)
+{
+	struct smfd_fleet_host *host;
+	unsigned int h, i;
+
+	for (h = 0; h < smfd_fleet_host_count; ++h) {
+
+		host = &smfd_fleet_hosts[h];
+
+		for (i = 0; i < host->sensor_count; ++i)
+			free(host->sensors[i].name);
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i)
+			free(host->triggers[i]);
+
+		free(host->sensors);
+		free(host->name);
+		free(host->address);
+		free(host->username);
+		free(host->password);
+		free(host->sdr_cache);
+	}
+
+	free(smfd_fleet_hosts);
+	free(smfd_fleet_listen);
+	free(smfd_fleet_peers);
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Configuration file
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/* Print/log the settings of a trigger table */
+static void smfd_dump_threshold_config(const char *const restrict name,
+				       const struct smfd_temp_threshold *thresh)
+{
+	unsigned int i;
+
+	SMFD_DEBUG("  %s:\n", name);
+
+	for (i = 0; thresh->name != NULL; ++i, ++thresh) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .name: %s\n", thresh->name);
+		SMFD_DEBUG("      .threshold: %d\n", thresh->threshold);
+		SMFD_DEBUG("      .hysteresis: %d\n", thresh->hysteresis);
+		SMFD_DEBUG("      .cpu_fan_percent: %" PRIu8 "\n", thresh->cpu_fan_percent);
+		SMFD_DEBUG("      .sys_fan_percent: %" PRIu8 "\n", thresh->sys_fan_percent);
+	}
+}
+
+/* Print/log the settings of a profile */
+static void smfd_dump_profile(const struct smfd_profile *const profile)
+{
+	SMFD_DEBUG("  profile %s:\n", profile->name);
+	SMFD_DEBUG("  .fan_base[SMFD_FAN_ZONE_CPU]: %" PRIu8 "\n",
+		   profile->fan_base[SMFD_FAN_ZONE_CPU]);
+	SMFD_DEBUG("  .fan_base[SMFD_FAN_ZONE_SYS]: %" PRIu8 "\n",
+		   profile->fan_base[SMFD_FAN_ZONE_SYS]);
+	SMFD_DEBUG("  .ramp_down: %" PRIu8 "\n", profile->ramp_down);
+
+	smfd_dump_threshold_config(".triggers[SMFD_GROUP_CPU]", profile->triggers[SMFD_GROUP_CPU]);
+	smfd_dump_threshold_config(".triggers[SMFD_GROUP_PCH]", profile->triggers[SMFD_GROUP_PCH]);
+	smfd_dump_threshold_config(".triggers[SMFD_GROUP_DISK]",
+				   profile->triggers[SMFD_GROUP_DISK]);
+}
+
+/* Print/log all configuration settings */
+static void smfd_dump_config(void)
+{
+	char peer[INET6_ADDRSTRLEN];
+	unsigned int i, j;
+
+	if (!smfd_debug)
+		return;
+
+	SMFD_DEBUG("  smfd_sdr_cache: %s\n", smfd_sdr_cache);
+	SMFD_DEBUG("  smfd_log_interval: %u\n", smfd_log_interval);
+	SMFD_DEBUG("  smfd_sample_interval: %u ms\n", smfd_sample_interval);
+	SMFD_DEBUG("  smfd_policy: %s\n", smfd_policy->name);
+
+	smfd_dump_profile(&smfd_default_profile);
+
+	for (i = 0; i < smfd_profile_count; ++i)
+		smfd_dump_profile(&smfd_profiles[i]);
+
+	SMFD_DEBUG("  smfd_ipmi_fans:\n");
+
+	for (i = 0; i < smfd_ipmi_fan_count; ++i) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .record_id: %" PRIu16 "\n", smfd_ipmi_fans[i].record_id);
+		SMFD_DEBUG("      .name: %s\n", smfd_ipmi_fans[i].name);
+		SMFD_DEBUG("      .zone: %" PRIu8 "\n", smfd_ipmi_fans[i].zone);
+	}
+
+	SMFD_DEBUG("  smfd_zones:\n");
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .backend: %s\n", smfd_zones[i].ops->name);
+		if (smfd_zones[i].ops == &smfd_hwmon_actuator) {
+			SMFD_DEBUG("      .pwm: %s\n", smfd_zones[i].pwm);
+		}
+		else if (smfd_zones[i].ops == &smfd_plugin_actuator) {
+			SMFD_DEBUG("      .plugin: %s\n", smfd_zones[i].plugin_name);
+			SMFD_DEBUG("      .plugin_zone: %u\n", smfd_zones[i].plugin_zone);
+		}
+		else {
+			SMFD_DEBUG("      .ipmi_zone: %" PRIu8 "\n", smfd_zones[i].ipmi_zone);
+		}
+	}
+
+	SMFD_DEBUG("  smfd_ctrl_sources:\n");
+
+	for (i = 0; i < smfd_ctrl_source_count; ++i) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .name: %s\n", smfd_ctrl_sources[i].name);
+		if (smfd_ctrl_sources[i].path != NULL)
+			SMFD_DEBUG("      .path: %s\n", smfd_ctrl_sources[i].path);
+		else
+			SMFD_DEBUG("      .driver: %s\n", smfd_ctrl_sources[i].driver);
+		SMFD_DEBUG("      .group: %s\n", smfd_group_keys[smfd_ctrl_sources[i].group]);
+	}
+
+	SMFD_DEBUG("  smfd_plugin_dir: %s\n",
+		   (smfd_plugin_dir == NULL) ? "/usr/local/lib64/smfd" : smfd_plugin_dir);
+	SMFD_DEBUG("  smfd_plugin_libs:\n");
+
+	for (i = 0; i < smfd_plugin_lib_count; ++i) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .name: %s\n", smfd_plugin_libs[i].name);
+		SMFD_DEBUG("      .group: %s\n", smfd_plugin_libs[i].have_group ?
+					smfd_group_keys[smfd_plugin_libs[i].group] : "(none)");
+		SMFD_DEBUG("      .argument: %s\n", (smfd_plugin_libs[i].argument == NULL) ?
+					"(none)" : smfd_plugin_libs[i].argument);
+	}
+
+	SMFD_DEBUG("  smfd_sensor_policies:\n");
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .policy: %s\n",
+			   smfd_fail_policy_names[smfd_sensor_policies[i].policy]);
+		SMFD_DEBUG("      .hold_time: %u\n", smfd_sensor_policies[i].hold_time);
+	}
+
+	SMFD_DEBUG("  smfd_safety_limits:\n");
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (smfd_safety_limits[i].limit == INT_MAX)
+			continue;
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .limit: %d\n", smfd_safety_limits[i].limit);
+		SMFD_DEBUG("      .zones: %#" PRIx8 "\n", smfd_safety_limits[i].zones);
+	}
+
+	SMFD_DEBUG("  smfd_coupling_file: %s\n", smfd_coupling_file);
+	SMFD_DEBUG("  smfd_coupling_settle: %u\n", smfd_coupling_settle);
+	SMFD_DEBUG("  smfd_coupling_step: %" PRIu8 "\n", smfd_coupling_step);
+	SMFD_DEBUG("  smfd_coupling_assign: %s\n", smfd_coupling_assign ? "true" : "false");
+
+	if (smfd_opt_enabled) {
+
+		SMFD_DEBUG("  smfd_opt_horizon: %u\n", smfd_opt_horizon);
+		SMFD_DEBUG("  smfd_opt_time_constant: %u\n", smfd_opt_time_constant);
+		SMFD_DEBUG("  smfd_opt_step: %u\n", smfd_opt_step);
+		SMFD_DEBUG("  smfd_opt_fan_min: { %" PRIu8 ", %" PRIu8 " }\n",
+			   smfd_opt_fan_min[SMFD_FAN_ZONE_CPU],
+			   smfd_opt_fan_min[SMFD_FAN_ZONE_SYS]);
+		SMFD_DEBUG("  smfd_opt_groups:\n");
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+			if (!smfd_opt_groups[i].configured)
+				continue;
+			SMFD_DEBUG("    [%u]:\n", i);
+			SMFD_DEBUG("      .limit: %d\n", smfd_opt_groups[i].limit);
+			SMFD_DEBUG("      .gain: { %g, %g }\n",
+				   smfd_opt_groups[i].gain[SMFD_FAN_ZONE_CPU],
+				   smfd_opt_groups[i].gain[SMFD_FAN_ZONE_SYS]);
+		}
+	}
+
+	if (smfd_fleet_host_count > 0) {
+
+		SMFD_DEBUG("  smfd_fleet_listen: %s\n",
+			   (smfd_fleet_listen == NULL) ? "(none)" : smfd_fleet_listen);
+		SMFD_DEBUG("  smfd_fleet_peers:%s\n",
+			   (smfd_fleet_peer_count == 0) ? " (none)" : "");
+
+		for (i = 0; i < smfd_fleet_peer_count; ++i) {
+			SMFD_DEBUG("    [%u]: %s\n", i,
+				   inet_ntop(AF_INET6, &smfd_fleet_peers[i], peer, sizeof peer));
+		}
+
+		SMFD_DEBUG("  smfd_fleet_hosts:\n");
+
+		for (i = 0; i < smfd_fleet_host_count; ++i) {
+			SMFD_DEBUG("    [%u]:\n", i);
+			SMFD_DEBUG("      .name: %s\n", smfd_fleet_hosts[i].name);
+			SMFD_DEBUG("      .address: %s\n", smfd_fleet_hosts[i].address);
+			SMFD_DEBUG("      .username: %s\n", smfd_fleet_hosts[i].username);
+			SMFD_DEBUG("      .sdr_cache: %s\n", smfd_fleet_hosts[i].sdr_cache);
+			SMFD_DEBUG("      .interval: %u\n", smfd_fleet_hosts[i].interval);
+			SMFD_DEBUG("      .timeout: %u\n", smfd_fleet_hosts[i].timeout);
+			SMFD_DEBUG("      .cipher_suite: %u\n", smfd_fleet_hosts[i].cipher_suite);
+			SMFD_DEBUG("      .sensor_count: %u\n", smfd_fleet_hosts[i].sensor_count);
+		}
+	}
+
+	SMFD_DEBUG("  smfd_rec_window: %u\n", smfd_rec_window);
+	SMFD_DEBUG("  smfd_rec_dir: %s\n", (smfd_rec_dir == NULL) ? "/var/lib/smfd" : smfd_rec_dir);
+	SMFD_DEBUG("  smfd_cpu_affinity: %s\n",
+		   (smfd_cpu_affinity == NULL) ? "auto" : smfd_cpu_affinity);
+	SMFD_DEBUG("  smfd_disk_max_staleness: %u\n", smfd_disk_max_staleness);
+	SMFD_DEBUG("  smfd_disk_budget: %u\n", smfd_disk_budget);
+	SMFD_DEBUG("  smfd_disk_max_per_cycle: %u\n", smfd_disk_max_per_cycle);
+	SMFD_DEBUG("  smfd_disk_patterns:\n");
+
+	for (i = 0; i < smfd_disk_pattern_count; ++i)
+		SMFD_DEBUG("    [%u]: %s\n", i, smfd_disk_patterns[i]);
+
+	SMFD_DEBUG("  smfd_peer_threshold: %u\n", smfd_peer_threshold);
+	SMFD_DEBUG("  smfd_peer_persistence: %u\n", smfd_peer_persistence);
+	SMFD_DEBUG("  smfd_peer_load_coeff: %g\n", smfd_peer_load_coeff);
+	SMFD_DEBUG("  smfd_throttle_steps: %u\n", smfd_throttle_steps);
+	SMFD_DEBUG("  smfd_throttle_hold: %u\n", smfd_throttle_hold);
+	SMFD_DEBUG("  smfd_throttle_min_rate: %u\n", smfd_throttle_min_rate);
+	SMFD_DEBUG("  smfd_throttle_cgroup_rate: %u\n", smfd_throttle_cgroup_rate);
+	SMFD_DEBUG("  smfd_throttle_targets:\n");
+
+	for (i = 0; i < smfd_throttle_count; ++i) {
+		SMFD_DEBUG("    [%u]: %s %s\n", i,
+			   smfd_throttle_targets[i].cgroup ? "cgroup" : "md",
+			   smfd_throttle_targets[i].name);
+	}
+
+	SMFD_DEBUG("  smfd_disk_cages:\n");
+
+	for (i = 0; i < smfd_disk_cage_count; ++i) {
+		SMFD_DEBUG("    [%u]:\n", i);
+		SMFD_DEBUG("      .name: %s\n", smfd_disk_cages[i].name);
+		for (j = 0; j < smfd_disk_cages[i].pattern_count; ++j)
+			SMFD_DEBUG("      .patterns[%u]: %s\n", j, smfd_disk_cages[i].patterns[j]);
+	}
+
+	if (smfd_aging_enabled) {
+		SMFD_DEBUG("  smfd_aging_file: %s\n", smfd_aging_path());
+		SMFD_DEBUG("  smfd_aging_reference: %d\n", smfd_aging_reference);
+		SMFD_DEBUG("  smfd_aging_energy: %g\n", smfd_aging_energy);
+		SMFD_DEBUG("  smfd_aging_save_interval: %u\n", smfd_aging_save_interval);
+	}
+
+	if (smfd_exp_enabled) {
+
+		SMFD_DEBUG("  smfd_exp_block: %u\n", smfd_exp_block);
+		SMFD_DEBUG("  smfd_exp_settle: %u\n", smfd_exp_settle);
+		SMFD_DEBUG("  smfd_exp_arms:\n");
+
+		for (i = 0; i < 2; ++i) {
+			SMFD_DEBUG("    [%u]:\n", i);
+			SMFD_DEBUG("      .name: %s\n", smfd_exp_arms[i].name);
+			SMFD_DEBUG("      .policy: %s\n",
+				   smfd_exp_policy_names[smfd_exp_arms[i].policy]);
+			SMFD_DEBUG("      .cpu_fan_base: %" PRIu8 "\n",
+				   smfd_exp_arms[i].cpu_fan_base);
+			SMFD_DEBUG("      .sys_fan_base: %" PRIu8 "\n",
+				   smfd_exp_arms[i].sys_fan_base);
+		}
+	}
+
+	if (smfd_config_test)
+		exit(EXIT_SUCCESS);
+}
+
+/* Fatal error if the node is not of the expected type */
+static void smfd_check_node_type(const yaml_node_t *const node, const char *const restrict name,
+				 const yaml_node_type_t type, const char *const restrict type_name)
+{
+	if (node->type != type)
+		SMFD_CFG_FATAL("value of %s is not a %s\n", node, name, type_name);
+}
+
+/* Fatal error if the node is not a YAML_SCALAR_NODE */
+static void smfd_check_scalar(const yaml_node_t *const node, const char *const restrict name)
+{
+	smfd_check_node_type(node, name, YAML_SCALAR_NODE, "scalar");
+}
+
+/* Fatal error if the node is not a YAML_SEQUENCE_NODE */
+static void smfd_check_sequence(const yaml_node_t *const node, const char *const restrict name)
+{
+	smfd_check_node_type(node, name, YAML_SEQUENCE_NODE, "sequence");
+}
+
+/* Fatal error if the node is not a YAML_MAPPING_NODE */
+static void smfd_check_mapping(const yaml_node_t *node, const char *const restrict name)
+{
+	smfd_check_node_type(node, name, YAML_MAPPING_NODE, "mapping");
+}
+
+/* Parse an integer from a scalar node */
+static int smfd_parse_int(const yaml_node_t *const node, const char *const restrict name)
+{
+	long value;
+	char *end;
+
+	smfd_check_scalar(node, name);
+
+	if (*node->data.scalar.value == 0 || isspace(*node->data.scalar.value)) {
+		SMFD_CFG_FATAL("value of %s (%s) is not a valid integer\n",
+			       node, name, node->data.scalar.value);
+	}
+
+	errno = 0;
+	value = strtol((char *)node->data.scalar.value, &end, 0);
+
+	if (errno != 0 || *end != 0 || value < INT_MIN || value > INT_MAX) {
+		SMFD_CFG_FATAL("value of %s (%s) is not a valid integer\n",
+			       node, name, node->data.scalar.value);
+	}
+
+	return (int)value;
+}
+
+/* Parse (allocate & copy) a string from a scalar node */
+static char *smfd_parse_string(const yaml_node_t *const node, const char *const restrict name)
+{
+	char *value;
+
+	smfd_check_scalar(node, name);
+
+	if ((value = malloc(node->data.scalar.length + 1)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	memcpy(value, node->data.scalar.value, node->data.scalar.length + 1);
+
+	return value;
+}
+
+static void smfd_parse_sdr_cache(const yaml_node_t *const node,
+				 yaml_document_t *const doc __attribute__((unused)),
+				 const char *const restrict name,
+				 void *const restrict data __attribute__((unused)))
+{
+	smfd_sdr_cache = smfd_parse_string(node, name);
+}
+
+/* Parse a fan speed (percentage) from a scalar node */
+static void smfd_parse_fan_speed(const yaml_node_t *const node,
+				 yaml_document_t *const doc __attribute__((unused)),
+				 const char *const restrict name, void *const restrict data)
+{
+	uint8_t *const speed = data;
+	int value;
+
+	value = smfd_parse_int(node, name);
+
+	if (value < 0 || value > 100)
+		SMFD_CFG_FATAL("%s (%d%%) is not a valid fan speed\n", node, name, value);
+
+	if (value < 25) {
+		SMFD_WARNING("Fan speeds below 25%% may cause problems (%s = %d%%)\n",
+			     name, value);
+	}
+
+	*speed = (uint8_t)value;
+}
+
+/* Parse a ramp limit (maximum duty cycle decrease per sample) from a scalar node */
+static void smfd_parse_ramp_down(const yaml_node_t *const node,
+				 yaml_document_t *const doc __attribute__((unused)),
+				 const char *const restrict name, void *const restrict data)
+{
+	uint8_t *const ramp = data;
+	int value;
+
+	value = smfd_parse_int(node, name);
+
+	if (value < 0 || value > 100)
+		SMFD_CFG_FATAL("%s (%d%%) must be 0 - 100\n", node, name, value);
+
+	*ramp = (uint8_t)value;
+}
+
+/* Parse a logging interval (seconds) from a scalar node */
+static void smfd_parse_log_interval(const yaml_node_t *const node,
+				    yaml_document_t *const doc __attribute__((unused)),
+				    const char *const restrict name, void *const restrict data)
+{
+	unsigned int *const interval = data;
+	int value;
+
+	value = smfd_parse_int(node, name);
+
+	if (value < 0)
+		SMFD_CFG_FATAL("%s (%d) is not a valid logging interval\n", node, name, value);
+
+	if (value != 0 && value < 30)
+		SMFD_WARNING("%s (%d) is less than 30 second sampling interval\n", name, value);
+
+	if (value != 0 && value < 600)
+		SMFD_WARNING("%s (%d seconds) may generate excessive log entries\n", name, value);
+
+	if (value > 30000000) /* about 1 year */ {
+		SMFD_WARNING("Set %s to 0 to disable periodic logging (%s = %d)\n",
+			     name, name, value);
+	}
+
+	*interval = (unsigned int)value;
+}
+
+/* Parse a temperature from a scalar node */
+static int smfd_parse_temp(const yaml_node_t *const node, const char *const restrict name)
+{
+	int value;
+
+	value = smfd_parse_int(node, name);
+
+	if (value < -273 || value > 999)
+		SMFD_CFG_FATAL("%s (%d) is not a valid temperature\n", node, name, value);
+
+	if (value < 25 || value > 80) {
+		SMFD_WARNING("Temperatures outside 25°C - 80°C are probably not useful (%s = %d)\n",
+			     name, value);
+	}
+
+	return value;
+}
+
+/* Parse an IPMI SDR record ID from a scalar node */
+static uint16_t smfd_parse_record_id(const yaml_node_t *const node)
+{
+	int value;
+
+	value = smfd_parse_int(node, "record_id");
+
+	if (value < 0 || value >= 0xffff)
+		SMFD_CFG_FATAL("record_id (%d) is not a valid IPMI SDR ID\n", node, value);
+
+	return (uint16_t)value;
+}
+
+/* Parse a fan zone name (cpu or system) from a scalar node */
+static uint8_t smfd_parse_zone(const yaml_node_t *const node)
+{
+	smfd_check_scalar(node, "zone");
+
+	if (strcmp((char *)node->data.scalar.value, "cpu") == 0)
+		return SMFD_FAN_ZONE_CPU;
+
+	if (strcmp((char *)node->data.scalar.value, "system") == 0)
+		return SMFD_FAN_ZONE_SYS;
+
+	SMFD_CFG_FATAL("zone (%s) is not cpu or system\n", node, node->data.scalar.value);
+}
+
+/* Fatal error due to missing field (key) in a mapping node */
+__attribute__((noreturn))
+static void smfd_missing_field(const yaml_node_t *const node, const char *const restrict seq_name,
+			       const char *const restrict field_name)
+{
+	SMFD_CFG_FATAL("%s not set in %s element\n", node, field_name, seq_name);
+}
+
+/* Parse smfd_ipmi_fans and smfd_ipmi_fan_count from a sequence node */
+static void smfd_parse_ipmi_fans(const yaml_node_t *const node, yaml_document_t *const doc,
+				 const char *const restrict name,
+				 void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *map, *key, *value;
+	const yaml_node_item_t *item;
+	const yaml_node_pair_t *kv;
+	struct smfd_ipmi_fan *fans;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, name);
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	if ((fans = malloc(len * sizeof *fans)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item) {
+
+		map = yaml_document_get_node(doc, *item);
+		smfd_check_mapping(map, name);
+		fans[i].name = NULL;
+		fans[i].record_id = 0xffff;
+		fans[i].zone = SMFD_FAN_ZONE_COUNT;
+
+		for (kv = map->data.mapping.pairs.start; kv < map->data.mapping.pairs.top; ++kv) {
+
+			key = yaml_document_get_node(doc, kv->key);
+			if (key->type != YAML_SCALAR_NODE)
+				SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+			value = yaml_document_get_node(doc, kv->value);
+
+			if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+				fans[i].name = smfd_parse_string(value, "name");
+			}
+			else if (strcmp((char *)key->data.scalar.value, "record_id") == 0) {
+				fans[i].record_id = smfd_parse_record_id(value);
+			}
+			else if (strcmp((char *)key->data.scalar.value, "zone") == 0) {
+				fans[i].zone = smfd_parse_zone(value);
+			}
+			else {
+				SMFD_CFG_FATAL("unknown key (%s) in ipmi_fans\n",
+					       key, key->data.scalar.value);
+			}
+		}
+
+		if (fans[i].name == NULL)
+			smfd_missing_field(map, "ipmi_fans", "name");
+		if (fans[i].record_id == 0xffff)
+			smfd_missing_field(map, "ipmi_fans", "record_id");
+	}
+
+	smfd_ipmi_fans = fans;
+	smfd_ipmi_fan_count = len;
+}
+
+/*
+ * Parse a trigger (in a CPU, PCH or disk trigger table) from a mapping node
+ */
+static void smfd_parse_trigger(const yaml_node_t *const node, yaml_document_t *const doc,
+			       const char *const restrict name,
+			       struct smfd_temp_threshold *const trigger)
+{
+	static const struct smfd_temp_threshold init = {
+		.name			= NULL,
+		.threshold		= INT_MIN,
+		.hysteresis		= INT_MIN,
+		.cpu_fan_percent	= 255,
+		.sys_fan_percent	= 255,
+		.active			= 1	/* not a flag value; all triggers start active */
+	};
+
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+
+	smfd_check_mapping(node, name);
+	memcpy(trigger, &init, sizeof *trigger);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+			trigger->name = smfd_parse_string(value, "name");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "threshold") == 0) {
+			trigger->threshold = smfd_parse_temp(value, "threshold");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "hysteresis") == 0) {
+			trigger->hysteresis = smfd_parse_temp(value, "hysteresis");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cpu_fan_speed") == 0) {
+			smfd_parse_fan_speed(value, doc, "cpu_fan_speed",
+					     &trigger->cpu_fan_percent);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "sys_fan_speed") == 0) {
+			smfd_parse_fan_speed(value, doc, "sys_fan_speed",
+					     &trigger->sys_fan_percent);
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (trigger->name == NULL)
+		smfd_missing_field(node, name, "name");
+	if (trigger->threshold == INT_MIN)
+		smfd_missing_field(node, name, "threshold");
+	if (trigger->hysteresis == INT_MIN)
+		smfd_missing_field(node, name, "hysteresis");
+
+	if (trigger->cpu_fan_percent == 255 && trigger->sys_fan_percent == 255)
+		SMFD_CFG_FATAL("no cpu_fan_speed or sys_fan_speed in %s element\n", node, name);
+
+	trigger->cpu_fan_percent = (trigger->cpu_fan_percent == 255) ? 0 : trigger->cpu_fan_percent;
+	trigger->sys_fan_percent = (trigger->sys_fan_percent == 255) ? 0 : trigger->sys_fan_percent;
+
+	if (trigger->hysteresis >= trigger->threshold) {
+		SMFD_CFG_FATAL("hysteresis (%d) >= threshold (%d) in %s element\n",
+			       node, trigger->hysteresis, trigger->threshold, name);
+	}
+}
+
+/* Parse a CPU, PCH or disk trigger table from a sequence node */
+static void smfd_parse_triggers(const yaml_node_t *const node, yaml_document_t *const doc,
+				const char *const restrict name, void *const restrict data)
+{
+	struct smfd_temp_threshold **const triggers = data;
+
+	const yaml_node_item_t *item;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, name);
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	if ((*triggers = malloc((len + 1) * sizeof **triggers)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	(*triggers)[len].name = NULL;
+
+	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item)
+		smfd_parse_trigger(yaml_document_get_node(doc, *item), doc, name, &(*triggers)[i]);
+}
+
+/* Parse a floating point number from a scalar node */
+static double smfd_parse_double(const yaml_node_t *const node, const char *const restrict name)
+{
+	double value;
+	char *end;
+
+	smfd_check_scalar(node, name);
+
+	if (*node->data.scalar.value == 0 || isspace(*node->data.scalar.value)) {
+		SMFD_CFG_FATAL("value of %s (%s) is not a valid number\n",
+			       node, name, node->data.scalar.value);
+	}
+
+	errno = 0;
+	value = strtod((char *)node->data.scalar.value, &end);
+
+	if (errno != 0 || *end != 0 || !isfinite(value)) {
+		SMFD_CFG_FATAL("value of %s (%s) is not a valid number\n",
+			       node, name, node->data.scalar.value);
+	}
+
+	return value;
+}
+
+/* Parse a positive number of seconds (or other unit) from a scalar node */
+static unsigned int smfd_parse_positive(const yaml_node_t *const node,
+					const char *const restrict name)
+{
+	int value;
+
+	value = smfd_parse_int(node, name);
+
+	if (value <= 0)
+		SMFD_CFG_FATAL("%s (%d) must be greater than 0\n", node, name, value);
+
+	return (unsigned int)value;
+}
+
+/* Parse a sensor group name (pch, cpu or disk) from a scalar node */
+static enum smfd_group smfd_parse_group(const yaml_node_t *const node)
+{
+	unsigned int i;
+
+	smfd_check_scalar(node, "group");
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		if (strcmp((char *)node->data.scalar.value, smfd_group_keys[i]) == 0)
+			return i;
+	}
+
+	SMFD_CFG_FATAL("unknown sensor group (%s)\n", node, node->data.scalar.value);
+}
+
+/* Parse the thermal model of 1 sensor group (in the optimizer groups mapping) */
+static void smfd_parse_opt_group(const yaml_node_t *const node, yaml_document_t *const doc,
+				 const char *const restrict name,
+				 struct smfd_opt_group *const group)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+
+	smfd_check_mapping(node, name);
+
+	group->limit = INT_MIN;
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "limit") == 0) {
+			group->limit = smfd_parse_temp(value, "limit");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cpu_fan_gain") == 0) {
+			group->gain[SMFD_FAN_ZONE_CPU] = smfd_parse_double(value, "cpu_fan_gain");
+			group->have_gain = 1;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "sys_fan_gain") == 0) {
+			group->gain[SMFD_FAN_ZONE_SYS] = smfd_parse_double(value, "sys_fan_gain");
+			group->have_gain = 1;
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (group->limit == INT_MIN)
+		smfd_missing_field(node, name, "limit");
+
+	if (group->gain[SMFD_FAN_ZONE_CPU] > 0 || group->gain[SMFD_FAN_ZONE_SYS] > 0)
+		SMFD_CFG_FATAL("fan gains in %s must not be positive\n", node, name);
+
+	group->configured = 1;
+}
+
+/* Parse the optimizer settings from a mapping node */
+static void smfd_parse_optimizer(const yaml_node_t *const node, yaml_document_t *const doc,
+				 const char *const restrict name,
+				 void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value, *gkey;
+	const yaml_node_pair_t *pair, *gpair;
+	unsigned int i;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "horizon") == 0) {
+			smfd_opt_horizon = smfd_parse_positive(value, "horizon");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "time_constant") == 0) {
+			smfd_opt_time_constant = smfd_parse_positive(value, "time_constant");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "step") == 0) {
+			smfd_opt_step = smfd_parse_positive(value, "step");
+			if (smfd_opt_step > 100) {
+				SMFD_CFG_FATAL("step (%u) is greater than 100\n",
+					       value, smfd_opt_step);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cpu_fan_min") == 0) {
+			smfd_parse_fan_speed(value, doc, "cpu_fan_min",
+					     &smfd_opt_fan_min[SMFD_FAN_ZONE_CPU]);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "sys_fan_min") == 0) {
+			smfd_parse_fan_speed(value, doc, "sys_fan_min",
+					     &smfd_opt_fan_min[SMFD_FAN_ZONE_SYS]);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "groups") == 0) {
+
+			smfd_check_mapping(value, "groups");
+
+			for (gpair = value->data.mapping.pairs.start;
+					gpair < value->data.mapping.pairs.top; ++gpair) {
+
+				gkey = yaml_document_get_node(doc, gpair->key);
+				if (gkey->type != YAML_SCALAR_NODE)
+					SMFD_CFG_FATAL("mapping key is not a scalar\n", gkey);
+
+				i = smfd_parse_group(gkey);
+
+				smfd_parse_opt_group(yaml_document_get_node(doc, gpair->value),
+						     doc, smfd_group_keys[i], &smfd_opt_groups[i]);
+			}
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	for (i = 0; i < SMFD_GROUP_COUNT && !smfd_opt_groups[i].configured; ++i);
+
+	if (i == SMFD_GROUP_COUNT)
+		SMFD_CFG_FATAL("no sensor groups in %s\n", node, name);
+
+	smfd_opt_enabled = 1;
+}
+
+/* Parse the failure policy of 1 sensor group (in the sensor_failure mapping) */
+static void smfd_parse_sensor_policy(const yaml_node_t *const node, yaml_document_t *const doc,
+				     const char *const restrict name,
+				     struct smfd_sensor_policy *const restrict policy)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	unsigned int i;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "policy") == 0) {
+
+			smfd_check_scalar(value, "policy");
+
+			for (i = 0;
+			     i < sizeof smfd_fail_policy_names / sizeof *smfd_fail_policy_names;
+			     ++i) {
+				if (strcmp((char *)value->data.scalar.value,
+					   smfd_fail_policy_names[i]) == 0) {
+					break;
+				}
+			}
+
+			if (i == sizeof smfd_fail_policy_names / sizeof *smfd_fail_policy_names) {
+				SMFD_CFG_FATAL("unknown policy (%s); must be hold, ignore or max\n",
+					       value, value->data.scalar.value);
+			}
+
+			policy->policy = i;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "hold_time") == 0) {
+			policy->hold_time = smfd_parse_positive(value, "hold_time");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+}
+
+/* Parse the sensor failure policies from a mapping node (keyed by sensor group) */
+static void smfd_parse_sensor_failure(const yaml_node_t *const node, yaml_document_t *const doc,
+				      const char *const restrict name,
+				      void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_pair_t *pair;
+	const yaml_node_t *key;
+	enum smfd_group group;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		group = smfd_parse_group(key);
+
+		smfd_parse_sensor_policy(yaml_document_get_node(doc, pair->value), doc,
+					 smfd_group_keys[group], &smfd_sensor_policies[group]);
+	}
+}
+
+/* Parse the coupling identification settings from a mapping node */
+static void smfd_parse_coupling(const yaml_node_t *const node, yaml_document_t *const doc,
+				const char *const restrict name,
+				void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "file") == 0) {
+			smfd_coupling_file = smfd_parse_string(value, "file");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "settle_time") == 0) {
+			smfd_coupling_settle = smfd_parse_positive(value, "settle_time");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "perturbation") == 0) {
+			smfd_parse_fan_speed(value, doc, "perturbation", &smfd_coupling_step);
+			if (smfd_coupling_step == 0)
+				SMFD_CFG_FATAL("perturbation must be greater than 0\n", value);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "assign_zones") == 0) {
+			smfd_check_scalar(value, "assign_zones");
+			smfd_coupling_assign =
+					strcmp((char *)value->data.scalar.value, "true") == 0;
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+}
+
+/* Read a password from the first line of a file */
+static char *smfd_parse_password_file(const yaml_node_t *const node,
+				      const char *const restrict name)
+{
+	char *path, *password = NULL;
+	size_t size = 0;
+	ssize_t len;
+	FILE *fp;
+
+	path = smfd_parse_string(node, name);
+
+	if ((fp = fopen(path, "r")) == NULL)
+		SMFD_CFG_FATAL("%s: %m\n", node, path);
+
+	if ((len = getline(&password, &size, fp)) < 0)
+		SMFD_CFG_FATAL("%s: no password\n", node, path);
+
+	if (len > 0 && password[len - 1] == '\n')
+		password[len - 1] = 0;
+
+	if (fclose(fp) != 0)
+		SMFD_FATAL("fclose: %m\n");
+
+	free(path);
+
+	return password;
+}
+
+/* Parse the temperature sensors of a remote host from a sequence node */
+static void smfd_parse_fleet_sensors(const yaml_node_t *const node, yaml_document_t *const doc,
+				     struct smfd_fleet_host *const host)
+{
+	const yaml_node_t *map, *key, *value;
+	struct smfd_fleet_sensor *sensors;
+	const yaml_node_item_t *item;
+	const yaml_node_pair_t *kv;
+	_Bool external, have_group;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, "sensors");
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	if ((sensors = calloc(len, sizeof *sensors)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item) {
+
+		map = yaml_document_get_node(doc, *item);
+		smfd_check_mapping(map, "sensors");
+		sensors[i].record_id = 0xffff;
+		external = have_group = 0;
+
+		for (kv = map->data.mapping.pairs.start; kv < map->data.mapping.pairs.top; ++kv) {
+
+			key = yaml_document_get_node(doc, kv->key);
+			if (key->type != YAML_SCALAR_NODE)
+				SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+			value = yaml_document_get_node(doc, kv->value);
+
+			if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+				sensors[i].name = smfd_parse_string(value, "name");
+			}
+			else if (strcmp((char *)key->data.scalar.value, "record_id") == 0) {
+				sensors[i].record_id = smfd_parse_record_id(value);
+			}
+			else if (strcmp((char *)key->data.scalar.value, "external") == 0) {
+				smfd_check_scalar(value, "external");
+				external = strcmp((char *)value->data.scalar.value, "true") == 0;
+			}
+			else if (strcmp((char *)key->data.scalar.value, "group") == 0) {
+				sensors[i].group = smfd_parse_group(value);
+				have_group = 1;
+			}
+			else {
+				SMFD_CFG_FATAL("unknown key (%s) in sensors\n",
+					       key, key->data.scalar.value);
+			}
+		}
+
+		if (sensors[i].name == NULL)
+			smfd_missing_field(map, "sensors", "name");
+		if (!have_group)
+			smfd_missing_field(map, "sensors", "group");
+		if (external == (sensors[i].record_id != 0xffff)) {
+			SMFD_CFG_FATAL("sensor must have exactly 1 of record_id or external\n",
+				       map);
+		}
+	}
+
+	host->sensors = sensors;
+	host->sensor_count = len;
+}
+
+/* Parse a remote host from a mapping node */
+static void smfd_parse_fleet_host(const yaml_node_t *const node, yaml_document_t *const doc,
+				  struct smfd_fleet_host *const host)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	int cipher_suite;
+
+	smfd_check_mapping(node, "hosts");
+
+	host->interval = 30;
+	host->timeout = 5;
+	host->cipher_suite = 3;
+	host->timer_fd = -1;
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+			host->name = smfd_parse_string(value, "name");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "address") == 0) {
+			host->address = smfd_parse_string(value, "address");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "username") == 0) {
+			host->username = smfd_parse_string(value, "username");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "password_file") == 0) {
+			host->password = smfd_parse_password_file(value, "password_file");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "sdr_cache_file") == 0) {
+			host->sdr_cache = smfd_parse_string(value, "sdr_cache_file");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "interval") == 0) {
+			host->interval = smfd_parse_positive(value, "interval");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "timeout") == 0) {
+			host->timeout = smfd_parse_positive(value, "timeout");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cipher_suite") == 0) {
+			cipher_suite = smfd_parse_int(value, "cipher_suite");
+			if (cipher_suite < 0 || cipher_suite > 17) {
+				SMFD_CFG_FATAL("invalid cipher_suite (%d)\n",
+					       value, cipher_suite);
+			}
+			host->cipher_suite = cipher_suite;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "sensors") == 0) {
+			smfd_parse_fleet_sensors(value, doc, host);
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in hosts\n", key, key->data.scalar.value);
+		}
+	}
+
+	if (host->name == NULL)
+		smfd_missing_field(node, "hosts", "name");
+	if (host->address == NULL)
+		smfd_missing_field(node, "hosts", "address");
+	if (host->username == NULL)
+		smfd_missing_field(node, "hosts", "username");
+	if (host->password == NULL)
+		smfd_missing_field(node, "hosts", "password_file");
+	if (host->sdr_cache == NULL)
+		smfd_missing_field(node, "hosts", "sdr_cache_file");
+	if (host->sensors == NULL)
+		smfd_missing_field(node, "hosts", "sensors");
+
+	if (host->timeout >= host->interval) {
+		SMFD_CFG_FATAL("timeout (%u) must be less than interval (%u)\n",
+			       node, host->timeout, host->interval);
+	}
+}
+
+/* Parse a host allowed to push readings (numeric IPv4 or IPv6 address) from a scalar node */
+static void smfd_parse_fleet_peer(const yaml_node_t *const node, struct in6_addr *const addr)
+{
+	struct in_addr addr4;
+
+	smfd_check_scalar(node, "push_peers");
+
+	if (inet_pton(AF_INET6, (char *)node->data.scalar.value, addr) == 1)
+		return;
+
+	if (inet_pton(AF_INET, (char *)node->data.scalar.value, &addr4) != 1) {
+		SMFD_CFG_FATAL("invalid address (%s) in push_peers\n",
+			       node, node->data.scalar.value);
+	}
+
+	/* IPv4-mapped, so that IPv4 & IPv6 senders can be compared the same way */
+	memset(addr, 0, sizeof *addr);
+	addr->s6_addr[10] = 0xff;
+	addr->s6_addr[11] = 0xff;
+	memcpy(&addr->s6_addr[12], &addr4, sizeof addr4);
+}
+
+/* Parse the fleet mode settings from a mapping node */
+static void smfd_parse_fleet(const yaml_node_t *const node, yaml_document_t *const doc,
+			     const char *const restrict name,
+			     void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	const yaml_node_item_t *item;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "listen") == 0) {
+			smfd_fleet_listen = smfd_parse_string(value, "listen");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "push_peers") == 0) {
+
+			smfd_check_sequence(value, "push_peers");
+
+			len = value->data.sequence.items.top - value->data.sequence.items.start;
+			assert(len > 0);
+
+			smfd_fleet_peers = calloc(len, sizeof *smfd_fleet_peers);
+			if (smfd_fleet_peers == NULL)
+				SMFD_ABORT("calloc: %m\n");
+
+			for (i = 0, item = value->data.sequence.items.start; i < len; ++i, ++item) {
+				smfd_parse_fleet_peer(yaml_document_get_node(doc, *item),
+						      &smfd_fleet_peers[i]);
+			}
+
+			smfd_fleet_peer_count = len;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "hosts") == 0) {
+
+			smfd_check_sequence(value, "hosts");
+
+			len = value->data.sequence.items.top - value->data.sequence.items.start;
+			assert(len > 0);
+
+			smfd_fleet_hosts = calloc(len, sizeof *smfd_fleet_hosts);
+			if (smfd_fleet_hosts == NULL)
+				SMFD_ABORT("calloc: %m\n");
+
+			for (i = 0, item = value->data.sequence.items.start; i < len; ++i, ++item) {
+				smfd_parse_fleet_host(yaml_document_get_node(doc, *item), doc,
+						      &smfd_fleet_hosts[i]);
+			}
+
+			smfd_fleet_host_count = len;
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (smfd_fleet_hosts == NULL)
+		smfd_missing_field(node, name, "hosts");
+}
+
+/* Parse the actuator settings of 1 fan zone from a mapping node */
+static void smfd_parse_zone_config(const yaml_node_t *const node, yaml_document_t *const doc,
+				   const char *const restrict name, struct smfd_zone *const zone)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	int ipmi_zone, plugin_zone;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "backend") == 0) {
+
+			smfd_check_scalar(value, "backend");
+
+			if (strcmp((char *)value->data.scalar.value, "ipmi") == 0) {
+				zone->ops = &smfd_ipmi_actuator;
+			}
+			else if (strcmp((char *)value->data.scalar.value, "hwmon") == 0) {
+				zone->ops = &smfd_hwmon_actuator;
+			}
+			else if (strcmp((char *)value->data.scalar.value, "plugin") == 0) {
+				zone->ops = &smfd_plugin_actuator;
+			}
+			else {
+				SMFD_CFG_FATAL("backend (%s) is not ipmi, hwmon or plugin\n",
+					       value, value->data.scalar.value);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "pwm") == 0) {
+			zone->pwm = smfd_parse_string(value, "pwm");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "plugin") == 0) {
+			zone->plugin_name = smfd_parse_string(value, "plugin");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "plugin_zone") == 0) {
+			plugin_zone = smfd_parse_int(value, "plugin_zone");
+			if (plugin_zone < 0) {
+				SMFD_CFG_FATAL("plugin_zone (%d) is not valid\n",
+					       value, plugin_zone);
+			}
+			zone->plugin_zone = plugin_zone;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "ipmi_zone") == 0) {
+			ipmi_zone = smfd_parse_int(value, "ipmi_zone");
+			if (ipmi_zone < 0 || ipmi_zone > 255)
+				SMFD_CFG_FATAL("ipmi_zone (%d) is not valid\n", value, ipmi_zone);
+			zone->ipmi_zone = ipmi_zone;
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (zone->ops == NULL)
+		smfd_missing_field(node, name, "backend");
+
+	if (zone->ops == &smfd_hwmon_actuator && zone->pwm == NULL)
+		SMFD_CFG_FATAL("hwmon backend requires pwm in %s\n", node, name);
+
+	if (zone->ops != &smfd_hwmon_actuator && zone->pwm != NULL)
+		SMFD_CFG_FATAL("pwm is only valid with hwmon backend in %s\n", node, name);
+
+	if (zone->ops == &smfd_plugin_actuator && zone->plugin_name == NULL)
+		SMFD_CFG_FATAL("plugin backend requires plugin in %s\n", node, name);
+
+	if (zone->ops != &smfd_plugin_actuator && zone->plugin_name != NULL)
+		SMFD_CFG_FATAL("plugin is only valid with plugin backend in %s\n", node, name);
+}
+
+/* Parse the fan zone actuator settings from a mapping node */
+static void smfd_parse_zones(const yaml_node_t *const node, yaml_document_t *const doc,
+			     const char *const restrict name,
+			     void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	uint8_t zone;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		value = yaml_document_get_node(doc, pair->value);
+
+		zone = smfd_parse_zone(key);
+		smfd_parse_zone_config(value, doc, (char *)key->data.scalar.value,
+				       &smfd_zones[zone]);
+	}
+}
+
+/* Parse the sampling interval (seconds; may be fractional) from a scalar node */
+static void smfd_parse_sample_interval(const yaml_node_t *const node,
+				       yaml_document_t *const doc __attribute__((unused)),
+				       const char *const restrict name, void *const restrict data)
+{
+	unsigned int *const interval = data;
+	double value;
+
+	value = smfd_parse_double(node, name);
+
+	if (value < 0.1 || value > 3600)
+		SMFD_CFG_FATAL("%s (%g) is not between 0.1 and 3600 seconds\n", node, name, value);
+
+	*interval = (unsigned int)lround(value * 1000);
+}
+
+/* Parse 1 experiment arm from a mapping node */
+static void smfd_parse_exp_arm(const yaml_node_t *const node, yaml_document_t *const doc,
+			       const char *const restrict name,
+			       struct smfd_exp_arm *const restrict arm)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	unsigned int i;
+	_Bool policy;
+
+	smfd_check_mapping(node, name);
+
+	arm->cpu_fan_base = 255;
+	arm->sys_fan_base = 255;
+	policy = 0;
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+			arm->name = smfd_parse_string(value, "name");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "policy") == 0) {
+
+			smfd_check_scalar(value, "policy");
+
+			for (i = 0;
+			     i < sizeof smfd_exp_policy_names / sizeof *smfd_exp_policy_names;
+			     ++i) {
+				if (strcmp((char *)value->data.scalar.value,
+					   smfd_exp_policy_names[i]) == 0) {
+					break;
+				}
+			}
+
+			if (i == sizeof smfd_exp_policy_names / sizeof *smfd_exp_policy_names) {
+				SMFD_CFG_FATAL("unknown policy (%s); must be triggers, optimizer "
+					       "or bmc\n", value, value->data.scalar.value);
+			}
+
+			arm->policy = i;
+			policy = 1;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cpu_fan_base") == 0) {
+			smfd_parse_fan_speed(value, doc, "cpu_fan_base", &arm->cpu_fan_base);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "sys_fan_base") == 0) {
+			smfd_parse_fan_speed(value, doc, "sys_fan_base", &arm->sys_fan_base);
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (arm->name == NULL)
+		smfd_missing_field(node, name, "name");
+
+	if (!policy)
+		smfd_missing_field(node, name, "policy");
+}
+
+/* Parse the A/B experiment settings from a mapping node */
+static void smfd_parse_experiment(const yaml_node_t *const node, yaml_document_t *const doc,
+				  const char *const restrict name,
+				  void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_item_t *item;
+	const yaml_node_pair_t *pair;
+	_Bool arms;
+	int settle;
+
+	smfd_check_mapping(node, name);
+
+	for (arms = 0, pair = node->data.mapping.pairs.start;
+			pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "block") == 0) {
+			smfd_exp_block = smfd_parse_positive(value, "block");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "settle_time") == 0) {
+			if ((settle = smfd_parse_int(value, "settle_time")) < 0)
+				SMFD_CFG_FATAL("settle_time (%d) is negative\n", value, settle);
+			smfd_exp_settle = settle;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "arms") == 0) {
+
+			smfd_check_sequence(value, "arms");
+
+			if (value->data.sequence.items.top - value->data.sequence.items.start != 2)
+				SMFD_CFG_FATAL("arms must contain exactly 2 arms\n", value);
+
+			item = value->data.sequence.items.start;
+			smfd_parse_exp_arm(yaml_document_get_node(doc, item[0]), doc, "arms",
+					   &smfd_exp_arms[0]);
+			smfd_parse_exp_arm(yaml_document_get_node(doc, item[1]), doc, "arms",
+					   &smfd_exp_arms[1]);
+			arms = 1;
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (!arms)
+		SMFD_CFG_FATAL("arms not set in %s\n", node, name);
+
+	if (smfd_exp_settle >= smfd_exp_block) {
+		SMFD_CFG_FATAL("settle_time (%u) must be less than block (%u)\n",
+			       node, smfd_exp_settle, smfd_exp_block);
+	}
+
+	smfd_exp_enabled = 1;
+}
+
+/* Parse the disk polling schedule from a mapping node */
+static void smfd_parse_disk_polling(const yaml_node_t *const node, yaml_document_t *const doc,
+				    const char *const restrict name,
+				    void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	double budget;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "max_staleness") == 0) {
+			smfd_disk_max_staleness =
+					smfd_parse_positive(value, "max_staleness") * 1000;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "budget") == 0) {
+			budget = smfd_parse_double(value, "budget");
+			if (budget < 0.001 || budget > 3600) {
+				SMFD_CFG_FATAL("budget (%g) is not between 0.001 and 3600 "
+					       "seconds\n", value, budget);
+			}
+			smfd_disk_budget = (unsigned int)lround(budget * 1000);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "max_disks") == 0) {
+			smfd_disk_max_per_cycle = smfd_parse_positive(value, "max_disks");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+}
+
+/* Parse smfd_disk_patterns and smfd_disk_pattern_count from a sequence node */
+static void smfd_parse_smart_disks(const yaml_node_t *const node, yaml_document_t *const doc,
+				   const char *const restrict name,
+				   void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_item_t *item;
+	char **patterns;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, name);
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	if ((patterns = malloc(len * sizeof *patterns)) == NULL)
+		SMFD_ABORT("malloc: %m\n");
+
+	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item)
+		patterns[i] = smfd_parse_string(yaml_document_get_node(doc, *item), name);
+
+	smfd_disk_patterns = patterns;
+	smfd_disk_pattern_count = len;
+}
+
+/* Add the md arrays or cgroups in a sequence node to smfd_throttle_targets */
+static void smfd_parse_throttle_targets(const yaml_node_t *const node, yaml_document_t *const doc,
+					const char *const restrict name, const _Bool cgroup)
+{
+	struct smfd_throttle_target *targets;
+	const yaml_node_item_t *item;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, name);
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	targets = realloc(smfd_throttle_targets, (smfd_throttle_count + len) * sizeof *targets);
+	if (targets == NULL)
+		SMFD_ABORT("realloc: %m\n");
+
+	smfd_throttle_targets = targets;
+	targets += smfd_throttle_count;
+	memset(targets, 0, len * sizeof *targets);
+
+	for (i = 0, item = node->data.sequence.items.start; i < len; ++i, ++item) {
+		targets[i].name = smfd_parse_string(yaml_document_get_node(doc, *item), name);
+		targets[i].cgroup = cgroup;
+	}
+
+	smfd_throttle_count += len;
+}
+
+/* Parse a named profile from a mapping node */
+static void smfd_parse_profile(const yaml_node_t *const node, yaml_document_t *const doc,
+			       const char *const restrict name, struct smfd_profile *const profile)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	const char *k;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+		k = (char *)key->data.scalar.value;
+
+		if (strcmp(k, "cpu_fan_base") == 0)
+			smfd_parse_fan_speed(value, doc, k, &profile->fan_base[SMFD_FAN_ZONE_CPU]);
+		else if (strcmp(k, "sys_fan_base") == 0)
+			smfd_parse_fan_speed(value, doc, k, &profile->fan_base[SMFD_FAN_ZONE_SYS]);
+		else if (strcmp(k, "cpu_temp_triggers") == 0)
+			smfd_parse_triggers(value, doc, k, &profile->triggers[SMFD_GROUP_CPU]);
+		else if (strcmp(k, "pch_temp_triggers") == 0)
+			smfd_parse_triggers(value, doc, k, &profile->triggers[SMFD_GROUP_PCH]);
+		else if (strcmp(k, "disk_temp_triggers") == 0)
+			smfd_parse_triggers(value, doc, k, &profile->triggers[SMFD_GROUP_DISK]);
+		else if (strcmp(k, "ramp_down") == 0)
+			smfd_parse_ramp_down(value, doc, k, &profile->ramp_down);
+		else
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n", key, k, name);
+	}
+}
+
+/* Parse the named profiles from a mapping of names to profiles */
+static void smfd_parse_profiles(const yaml_node_t *const node, yaml_document_t *const doc,
+				const char *const restrict name,
+				void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_pair_t *pair;
+	struct smfd_profile *profile;
+	const yaml_node_t *key;
+	ptrdiff_t len;
+
+	smfd_check_mapping(node, name);
+
+	len = node->data.mapping.pairs.top - node->data.mapping.pairs.start;
+	assert(len > 0);
+
+	if ((smfd_profiles = calloc(len, sizeof *smfd_profiles)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		if (smfd_profile_find((char *)key->data.scalar.value) != NULL)
+			SMFD_CFG_FATAL("duplicate profile name (%s)\n",
+				       key, key->data.scalar.value);
+
+		profile = &smfd_profiles[smfd_profile_count++];
+		profile->name = smfd_strdup((char *)key->data.scalar.value);
+		profile->fan_base[SMFD_FAN_ZONE_CPU] = 255;
+		profile->fan_base[SMFD_FAN_ZONE_SYS] = 255;
+		profile->ramp_down = 255;
+
+		smfd_parse_profile(yaml_document_get_node(doc, pair->value), doc, profile->name,
+				   profile);
+	}
+}
+
+/* Parse the background I/O throttling settings from a mapping node */
+static void smfd_parse_disk_throttle(const yaml_node_t *const node, yaml_document_t *const doc,
+				     const char *const restrict name,
+				     void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "md_arrays") == 0) {
+			smfd_parse_throttle_targets(value, doc, "md_arrays", 0);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cgroups") == 0) {
+			smfd_parse_throttle_targets(value, doc, "cgroups", 1);
+		}
+		else if (strcmp((char *)key->data.scalar.value, "steps") == 0) {
+			smfd_throttle_steps = smfd_parse_positive(value, "steps");
+			if (smfd_throttle_steps > 16) {
+				SMFD_CFG_FATAL("steps (%u) must be 16 or less\n",
+					       value, smfd_throttle_steps);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "hold_time") == 0) {
+			smfd_throttle_hold = smfd_parse_positive(value, "hold_time");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "min_rate") == 0) {
+			smfd_throttle_min_rate = smfd_parse_positive(value, "min_rate");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cgroup_rate") == 0) {
+			smfd_throttle_cgroup_rate = smfd_parse_positive(value, "cgroup_rate");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (smfd_throttle_count == 0)
+		SMFD_CFG_FATAL("%s requires md_arrays or cgroups\n", node, name);
+}
+
+/* Parse the disk cages (peer groups) from a mapping of names to sequences of patterns */
+static void smfd_parse_disk_cages(const yaml_node_t *const node, yaml_document_t *const doc,
+				  const char *const restrict name)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	const yaml_node_item_t *item;
+	struct smfd_disk_cage *cage;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_mapping(node, name);
+
+	len = node->data.mapping.pairs.top - node->data.mapping.pairs.start;
+	assert(len > 0);
+
+	if ((smfd_disk_cages = calloc(len, sizeof *smfd_disk_cages)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+		smfd_check_sequence(value, (char *)key->data.scalar.value);
+
+		cage = &smfd_disk_cages[smfd_disk_cage_count++];
+		cage->name = smfd_strdup((char *)key->data.scalar.value);
+
+		len = value->data.sequence.items.top - value->data.sequence.items.start;
+		assert(len > 0);
+
+		if ((cage->patterns = malloc(len * sizeof *cage->patterns)) == NULL)
+			SMFD_ABORT("malloc: %m\n");
+
+		for (i = 0, item = value->data.sequence.items.start; i < len; ++i, ++item) {
+			cage->patterns[i] = smfd_parse_string(yaml_document_get_node(doc, *item),
+							      cage->name);
+		}
+
+		cage->pattern_count = len;
+	}
+}
+
+/* Parse the disk peer anomaly detection settings from a mapping node */
+static void smfd_parse_disk_anomaly(const yaml_node_t *const node, yaml_document_t *const doc,
+				    const char *const restrict name,
+				    void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	int threshold;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "threshold") == 0) {
+			if ((threshold = smfd_parse_int(value, "threshold")) < 0)
+				SMFD_CFG_FATAL("threshold (%d) is negative\n", value, threshold);
+			smfd_peer_threshold = threshold;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "persistence") == 0) {
+			smfd_peer_persistence = smfd_parse_positive(value, "persistence");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "load_coefficient") == 0) {
+			smfd_peer_load_coeff = smfd_parse_double(value, "load_coefficient");
+			if (smfd_peer_load_coeff < 0) {
+				SMFD_CFG_FATAL("load_coefficient (%g) is negative\n",
+					       value, smfd_peer_load_coeff);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "cages") == 0) {
+			smfd_parse_disk_cages(value, doc, "cages");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+}
+
+/* Parse the disk thermal aging settings from a mapping node */
+static void smfd_parse_disk_aging(const yaml_node_t *const node, yaml_document_t *const doc,
+				  const char *const restrict name,
+				  void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "file") == 0) {
+			smfd_aging_file = smfd_parse_string(value, "file");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "reference") == 0) {
+			smfd_aging_reference = smfd_parse_int(value, "reference");
+			if (smfd_aging_reference < 0 || smfd_aging_reference > 100) {
+				SMFD_CFG_FATAL("reference (%d) must be between 0 and 100\n",
+					       value, smfd_aging_reference);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "activation_energy") == 0) {
+			smfd_aging_energy = smfd_parse_double(value, "activation_energy");
+			if (smfd_aging_energy <= 0 || smfd_aging_energy > 5) {
+				SMFD_CFG_FATAL("activation_energy (%g) must be greater than 0 "
+					       "and no more than 5 eV\n", value, smfd_aging_energy);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "save_interval") == 0) {
+			smfd_aging_save_interval = smfd_parse_positive(value, "save_interval");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	smfd_aging_enabled = 1;
+}
+
+/* Parse 1 group's safety limit (in the safety_limits mapping) */
+static void smfd_parse_safety_limit(const yaml_node_t *const node, yaml_document_t *const doc,
+				    const char *const restrict name,
+				    struct smfd_safety_limit *const safety)
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_item_t *item;
+	const yaml_node_pair_t *pair;
+	uint8_t zone;
+
+	smfd_check_mapping(node, name);
+
+	safety->zones = (1 << SMFD_FAN_ZONE_CPU) | (1 << SMFD_FAN_ZONE_SYS);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "limit") == 0) {
+			safety->limit = smfd_parse_int(value, "limit");
+			if (safety->limit < 0 || safety->limit > 150) {
+				SMFD_CFG_FATAL("limit (%d) must be between 0 and 150\n",
+					       value, safety->limit);
+			}
+		}
+		else if (strcmp((char *)key->data.scalar.value, "zones") == 0) {
+			smfd_check_sequence(value, "zones");
+			safety->zones = 0;
+			for (item = value->data.sequence.items.start;
+					item < value->data.sequence.items.top; ++item) {
+				zone = smfd_parse_zone(yaml_document_get_node(doc, *item));
+				safety->zones |= 1 << zone;
+			}
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (safety->limit == INT_MAX)
+		SMFD_CFG_FATAL("%s requires limit\n", node, name);
+}
+
+/* Parse the safety envelope (hard limits of any sensor groups) from a mapping node */
+static void smfd_parse_safety_limits(const yaml_node_t *const node, yaml_document_t *const doc,
+				     const char *const restrict name,
+				     void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	enum smfd_group group;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		value = yaml_document_get_node(doc, pair->value);
+
+		group = smfd_parse_group(key);
+		smfd_parse_safety_limit(value, doc, (char *)key->data.scalar.value,
+					&smfd_safety_limits[group]);
+	}
+}
+
+/* Parse the RAID/HBA controller temperature sources from a sequence of mappings */
+static void smfd_parse_controller_temps(const yaml_node_t *const node, yaml_document_t *const doc,
+					const char *const restrict name,
+					void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *map, *key, *value;
+	struct smfd_ctrl_source *sources;
+	const yaml_node_item_t *item;
+	const yaml_node_pair_t *kv;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, name);
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	if ((sources = calloc(len, sizeof *sources)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	for (i = 0, item = node->data.sequence.items.start; i < len; ++i, ++item) {
+
+		map = yaml_document_get_node(doc, *item);
+		smfd_check_mapping(map, name);
+
+		for (kv = map->data.mapping.pairs.start; kv < map->data.mapping.pairs.top; ++kv) {
+
+			key = yaml_document_get_node(doc, kv->key);
+			if (key->type != YAML_SCALAR_NODE)
+				SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+			value = yaml_document_get_node(doc, kv->value);
+
+			if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+				sources[i].name = smfd_parse_string(value, "name");
+			}
+			else if (strcmp((char *)key->data.scalar.value, "path") == 0) {
+				sources[i].path = smfd_parse_string(value, "path");
+			}
+			else if (strcmp((char *)key->data.scalar.value, "driver") == 0) {
+				sources[i].driver = smfd_parse_string(value, "driver");
+			}
+			else if (strcmp((char *)key->data.scalar.value, "group") == 0) {
+				sources[i].group = smfd_parse_group(value);
+				sources[i].have_group = 1;
+			}
+			else {
+				SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+					       key, key->data.scalar.value, name);
+			}
+		}
+
+		if (sources[i].name == NULL)
+			smfd_missing_field(map, name, "name");
+		if (!sources[i].have_group)
+			smfd_missing_field(map, name, "group");
+		if ((sources[i].path == NULL) == (sources[i].driver == NULL)) {
+			SMFD_CFG_FATAL("%s element requires path or driver (not both)\n",
+				       map, name);
+		}
+	}
+
+	smfd_ctrl_sources = sources;
+	smfd_ctrl_source_count = len;
+}
+
+/* Parse the plugins to load from a sequence of mappings */
+static void smfd_parse_plugin_list(const yaml_node_t *const node, yaml_document_t *const doc,
+				   const char *const restrict name)
+{
+	const yaml_node_t *map, *key, *value;
+	struct smfd_plugin_lib *libs;
+	const yaml_node_item_t *item;
+	const yaml_node_pair_t *kv;
+	ptrdiff_t len;
+	int i;
+
+	smfd_check_sequence(node, name);
+
+	len = node->data.sequence.items.top - node->data.sequence.items.start;
+	assert(len > 0);
+
+	if ((libs = calloc(len, sizeof *libs)) == NULL)
+		SMFD_ABORT("calloc: %m\n");
+
+	smfd_plugin_libs = libs;
+
+	for (i = 0, item = node->data.sequence.items.start; i < len; ++i, ++item) {
+
+		map = yaml_document_get_node(doc, *item);
+		smfd_check_mapping(map, name);
+
+		for (kv = map->data.mapping.pairs.start; kv < map->data.mapping.pairs.top; ++kv) {
+
+			key = yaml_document_get_node(doc, kv->key);
+			if (key->type != YAML_SCALAR_NODE)
+				SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+			value = yaml_document_get_node(doc, kv->value);
+
+			if (strcmp((char *)key->data.scalar.value, "name") == 0) {
+				libs[i].name = smfd_parse_string(value, "name");
+				if (strchr(libs[i].name, '/') != NULL || libs[i].name[0] == '.') {
+					SMFD_CFG_FATAL("plugin name (%s) is not a file name\n",
+						       value, libs[i].name);
+				}
+				if (smfd_plugin_find(libs[i].name) != NULL) {
+					SMFD_CFG_FATAL("duplicate plugin name (%s)\n",
+						       value, libs[i].name);
+				}
+			}
+			else if (strcmp((char *)key->data.scalar.value, "group") == 0) {
+				libs[i].group = smfd_parse_group(value);
+				libs[i].have_group = 1;
+			}
+			else if (strcmp((char *)key->data.scalar.value, "argument") == 0) {
+				libs[i].argument = smfd_parse_string(value, "argument");
+			}
+			else {
+				SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+					       key, key->data.scalar.value, name);
+			}
+		}
+
+		if (libs[i].name == NULL)
+			smfd_missing_field(map, name, "name");
+
+		++smfd_plugin_lib_count;
+	}
+}
+
+/* Parse the plugin directory & the plugins to load from a mapping node */
+static void smfd_parse_plugins(const yaml_node_t *const node, yaml_document_t *const doc,
+			       const char *const restrict name,
+			       void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "directory") == 0) {
+			smfd_plugin_dir = smfd_parse_string(value, "directory");
+		}
+		else if (strcmp((char *)key->data.scalar.value, "load") == 0) {
+			smfd_parse_plugin_list(value, doc, "load");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+
+	if (smfd_plugin_lib_count == 0)
+		SMFD_CFG_FATAL("%s requires load\n", node, name);
+}
+
+/* Parse the control socket path from a scalar node */
+static void smfd_parse_control_socket(const yaml_node_t *const node,
+				      yaml_document_t *const doc __attribute__((unused)),
+				      const char *const restrict name,
+				      void *const restrict data __attribute__((unused)))
+{
+	smfd_ctl_path = smfd_parse_string(node, name);
+
+	if (strlen(smfd_ctl_path) >= sizeof ((struct sockaddr_un *)NULL)->sun_path)
+		SMFD_CFG_FATAL("%s (%s) is too long\n", node, name, smfd_ctl_path);
+}
+
+/* Parse the flight recorder settings from a mapping node */
+static void smfd_parse_flight_recorder(const yaml_node_t *const node, yaml_document_t *const doc,
+				       const char *const restrict name,
+				       void *const restrict data __attribute__((unused)))
+{
+	const yaml_node_t *key, *value;
+	const yaml_node_pair_t *pair;
+	int window;
+
+	smfd_check_mapping(node, name);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		value = yaml_document_get_node(doc, pair->value);
+
+		if (strcmp((char *)key->data.scalar.value, "window") == 0) {
+			if ((window = smfd_parse_int(value, "window")) < 0)
+				SMFD_CFG_FATAL("window (%d) is negative\n", value, window);
+			smfd_rec_window = window;
+		}
+		else if (strcmp((char *)key->data.scalar.value, "directory") == 0) {
+			smfd_rec_dir = smfd_parse_string(value, "directory");
+		}
+		else {
+			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
+				       key, key->data.scalar.value, name);
+		}
+	}
+}
+
+/* Parse the CPU affinity setting from a scalar node */
+static void smfd_parse_cpu_affinity(const yaml_node_t *const node,
+				    yaml_document_t *const doc __attribute__((unused)),
+				    const char *const restrict name,
+				    void *const restrict data __attribute__((unused)))
+{
+	cpu_set_t set;
+
+	smfd_cpu_affinity = smfd_parse_string(node, name);
+
+	if (strcmp(smfd_cpu_affinity, "auto") == 0 || strcmp(smfd_cpu_affinity, "none") == 0)
+		return;
+
+	if (!smfd_cpu_parse_list(smfd_cpu_affinity, &set) || CPU_COUNT(&set) == 0) {
+		SMFD_CFG_FATAL("%s (%s) must be auto, none, or a CPU list (e.g. 0-1,4)\n",
+			       node, name, smfd_cpu_affinity);
+	}
+}
+
+/* Fatal error due to missing key in configuration file */
+__attribute__((noreturn))
+static void smfd_missing_config(const char *const name)
+{
+	SMFD_FATAL("Invalid configuration: %s: %s not set\n", smfd_config_file, name);
+}
+
+/*
+ * Load and parse the configuration file.  When reloading, only policy settings (base fan speeds,
+ * triggers, intervals, optimizer) are parsed; settings that describe hardware require a restart.
+ */
+static void smfd_load_config(const _Bool reload)
+{
+	static const struct {
+		const char *name;
+		void (*parse_fn)(const yaml_node_t *node, yaml_document_t *const doc,
+				 const char *restrict name, void *data);
+		void *data;
+		_Bool reload;
+	}
+	parse_fns[] = {
+		{ "cpu_fan_base",	smfd_parse_fan_speed,
+					&smfd_default_profile.fan_base[SMFD_FAN_ZONE_CPU],	1 },
+		{ "sys_fan_base",	smfd_parse_fan_speed,
+					&smfd_default_profile.fan_base[SMFD_FAN_ZONE_SYS],	1 },
+		{ "log_interval",	smfd_parse_log_interval,	&smfd_log_interval,	1 },
+		{ "cpu_temp_triggers",	smfd_parse_triggers,
+					&smfd_default_profile.triggers[SMFD_GROUP_CPU],		1 },
+		{ "pch_temp_triggers",	smfd_parse_triggers,
+					&smfd_default_profile.triggers[SMFD_GROUP_PCH],		1 },
+		{ "disk_temp_triggers",	smfd_parse_triggers,
+					&smfd_default_profile.triggers[SMFD_GROUP_DISK],	1 },
+		{ "ramp_down",		smfd_parse_ramp_down,
+					&smfd_default_profile.ramp_down,			1 },
+		{ "profiles",		smfd_parse_profiles,		NULL,			1 },
+		{ "ipmi_fans",		smfd_parse_ipmi_fans,		NULL,			0 },
+		{ "smart_disks",	smfd_parse_smart_disks,		NULL,			0 },
+		{ "sdr_cache_file",	smfd_parse_sdr_cache,		NULL,			0 },
+		{ "optimizer",		smfd_parse_optimizer,		NULL,			1 },
+		{ "coupling",		smfd_parse_coupling,		NULL,			0 },
+		{ "fleet",		smfd_parse_fleet,		NULL,			0 },
+		{ "zones",		smfd_parse_zones,		NULL,			0 },
+		{ "sample_interval",	smfd_parse_sample_interval,	&smfd_sample_interval,	1 },
+		{ "control_socket",	smfd_parse_control_socket,	NULL,			0 },
+		{ "sensor_failure",	smfd_parse_sensor_failure,	NULL,			1 },
+		{ "disk_polling",	smfd_parse_disk_polling,	NULL,			1 },
+		{ "experiment",		smfd_parse_experiment,		NULL,			0 },
+		{ "cpu_affinity",	smfd_parse_cpu_affinity,	NULL,			0 },
+		{ "flight_recorder",	smfd_parse_flight_recorder,	NULL,			0 },
+		{ "disk_anomaly",	smfd_parse_disk_anomaly,	NULL,			0 },
+		{ "disk_throttle",	smfd_parse_disk_throttle,	NULL,			0 },
+		{ "disk_aging",		smfd_parse_disk_aging,		NULL,			0 },
+		{ "plugins",		smfd_parse_plugins,		NULL,			0 },
+		{ "controller_temps",	smfd_parse_controller_temps,	NULL,			0 },
+		{ "safety_limits",	smfd_parse_safety_limits,	NULL,			0 },
+		{ NULL }
+	};
+
+	const yaml_node_t *node, *key;
+	const yaml_node_pair_t *pair;
+	yaml_parser_t parser;
+	yaml_document_t doc;
+	unsigned int i;
+	FILE *fp;
+
+	if ((fp = fopen(smfd_config_file, "r")) == NULL)
+		SMFD_FATAL("%s: %m\n", smfd_config_file);
+
+	if (!yaml_parser_initialize(&parser))
+		SMFD_LIBYAML_FATAL(smfd_config_file, &parser);
+
+	yaml_parser_set_input_file(&parser, fp);
+
+	if (!yaml_parser_load(&parser, &doc))
+		SMFD_LIBYAML_FATAL(smfd_config_file, &parser);
+
+	yaml_parser_delete(&parser);
+
+	if (fclose(fp) != 0)
+		SMFD_FATAL("fclose: %m\n");
+
+	if ((node = yaml_document_get_root_node(&doc)) == NULL)
+		SMFD_ABORT("yaml_document_get_root_node: %m\n");
+
+	if (node->type != YAML_MAPPING_NODE)
+		SMFD_FATAL("Invalid configuration: %s: not a YAML mapping\n", smfd_config_file);
+
+	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+
+		key = yaml_document_get_node(&doc, pair->key);
+		if (key->type != YAML_SCALAR_NODE)
+			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+
+		for (i = 0; parse_fns[i].name != NULL; ++i) {
+			if (strcmp((char *)key->data.scalar.value, parse_fns[i].name) == 0) {
+				if (reload && !parse_fns[i].reload)
+					break;
+				parse_fns[i].parse_fn(yaml_document_get_node(&doc, pair->value),
+						&doc, parse_fns[i].name, parse_fns[i].data);
+				break;
+			}
+		}
+
+		if (parse_fns[i].name == NULL)
+			SMFD_CFG_FATAL("unknown key (%s)\n", key, key->data.scalar.value);
+	}
+
+	yaml_document_delete(&doc);
+
+	if (smfd_default_profile.fan_base[SMFD_FAN_ZONE_CPU] == 255)
+		smfd_missing_config("cpu_fan_base");
+	if (smfd_default_profile.fan_base[SMFD_FAN_ZONE_SYS] == 255)
+		smfd_missing_config("sys_fan_base");
+	if (smfd_log_interval == UINT_MAX)	smfd_missing_config("log_interval");
+	if (smfd_default_profile.triggers[SMFD_GROUP_CPU] == NULL)
+		smfd_missing_config("cpu_temp_triggers");
+	if (smfd_default_profile.triggers[SMFD_GROUP_PCH] == NULL)
+		smfd_missing_config("pch_temp_triggers");
+	if (smfd_default_profile.triggers[SMFD_GROUP_DISK] == NULL)
+		smfd_missing_config("disk_temp_triggers");
+
+	smfd_profiles_inherit();
+
+	/* Coupling identification raises each zone by the perturbation (or lowers it) */
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		if (smfd_default_profile.fan_base[i] + smfd_coupling_step > 100
+				&& smfd_default_profile.fan_base[i] < smfd_coupling_step) {
+			SMFD_FATAL("Invalid configuration: %s: coupling perturbation "
+				   "(%" PRIu8 "%%) doesn't fit above or below %s base duty cycle "
+				   "(%" PRIu8 "%%)\n",
+				   smfd_config_file, smfd_coupling_step, smfd_zone_names[i],
+				   smfd_default_profile.fan_base[i]);
+		}
+	}
+
+	/* Local sensors & fans aren't used in fleet mode */
+	if (smfd_fleet_host_count > 0) {
+		if (smfd_opt_enabled)
+			SMFD_WARNING("The optimizer is not supported in fleet mode; ignoring\n");
+		smfd_opt_enabled = 0;
+		return;
+	}
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		if (smfd_zones[i].ops == NULL)
+			smfd_zones[i].ops = &smfd_ipmi_actuator;
+	}
+
+	if (smfd_disk_patterns == NULL)		smfd_missing_config("smart_disks");
+
+	if (smfd_ipmi_fans == NULL && smfd_zones_use_ipmi())
+		smfd_missing_config("ipmi_fans");
+
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+		if (smfd_zones[i].ops == &smfd_plugin_actuator
+				&& smfd_plugin_find(smfd_zones[i].plugin_name) == NULL) {
+			SMFD_FATAL("Invalid configuration: %s: %s fan zone plugin (%s) is not in "
+				   "plugins\n", smfd_config_file, smfd_zone_names[i],
+				   smfd_zones[i].plugin_name);
+		}
+	}
+
+	if (smfd_exp_enabled && smfd_exp_arms[0].policy == SMFD_EXP_BMC
+			&& smfd_exp_arms[1].policy == SMFD_EXP_BMC) {
+		SMFD_FATAL("Invalid configuration: %s: experiment arms %s and %s both use the "
+			   "BMC's fan mode\n", smfd_config_file, smfd_exp_arms[0].name,
+			   smfd_exp_arms[1].name);
+	}
+
+	for (i = 0; smfd_exp_enabled && i < 2; ++i) {
+
+		if (smfd_exp_arms[i].policy == SMFD_EXP_OPTIMIZER && !smfd_opt_enabled) {
+			SMFD_FATAL("Invalid configuration: %s: experiment arm %s requires "
+				   "optimizer\n", smfd_config_file, smfd_exp_arms[i].name);
+		}
+
+		if (smfd_exp_arms[i].policy == SMFD_EXP_BMC
+				&& (smfd_zones[SMFD_FAN_ZONE_CPU].ops != &smfd_ipmi_actuator
+				    || smfd_zones[SMFD_FAN_ZONE_SYS].ops != &smfd_ipmi_actuator)) {
+			SMFD_FATAL("Invalid configuration: %s: experiment arm %s requires IPMI "
+				   "fan control of both zones\n", smfd_config_file,
+				   smfd_exp_arms[i].name);
+		}
+	}
+}
+
+
+/***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **
+ **
+ **	Control socket
+ **
+ **
+ ***************************************************************************************************
+ ***************************************************************************************************
+ ***************************************************************************************************
+ **************************************************************************************************/
+
+/*
+ * Requests and responses are single lines of JSON.  Requests are flat objects with a "cmd" member:
+ *
+ *	{"cmd":"status"}
+ *	{"cmd":"stats","reset":true}
+ *	{"cmd":"debug","on":false}
+ *	{"cmd":"set-override","zone":"system","duty":100,"ttl":600}	(ttl 0 clears)
+ *	{"cmd":"reload"}
+ *
+ * status and stats are answered from in-memory state; they never perform hardware I/O.  Commands
+ * that change state (stats with reset, debug, set-override & reload) are only accepted from root
+ * or the daemon's own user (checked with SO_PEERCRED).
+ */
+
+#define SMFD_CTL_MAX_CLIENTS	8
+
+static struct smfd_ctl_client smfd_ctl_clients[SMFD_CTL_MAX_CLIENTS];
+static int smfd_ctl_fd = -1;
+
+/* Sleep for up to the given number of milliseconds; returns early if a signal is caught */
+static void smfd_sleep_ms(const int64_t ms)
+{
+	const struct timespec ts = {
+		.tv_sec		= ms / 1000,
+		.tv_nsec	= (ms % 1000) * 1000000
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+/* Forward declarations needed by smfd_ctl_reload */
+static void smfd_log_init(void);
+static void smfd_free_policy(void);
+
+/* Find a member of a flat JSON object and copy its value (without quotes) */
+static _Bool smfd_json_get(const char *p, const char *const restrict key,
+			   char *const restrict value, const size_t size)
+{
+	const size_t key_len = strlen(key);
+	const char *end;
+	size_t len;
+
+	/* Each iteration consumes 1 string token (a member name or a string value) */
+	while ((p = strchr(p, '"')) != NULL) {
+
+		++p;
+
+		if (strncmp(p, key, key_len) == 0 && p[key_len] == '"') {
+
+			p += key_len + 1;
+			p += strspn(p, " \t");
+			if (*p != ':')
+				continue;
+
+			++p;
+			p += strspn(p, " \t");
+
+			if (*p == '"') {
+				if ((end = strchr(++p, '"')) == NULL)
+					return 0;
+			}
+			else {
+				end = p + strcspn(p, " \t,}");
+			}
+
+			if ((len = end - p) >= size)
+				return 0;
+
+			memcpy(value, p, len);
+			value[len] = 0;
+			return 1;
+		}
+
+		if ((p = strchr(p, '"')) == NULL)
+			return 0;
+
+		++p;
+	}
+
+	return 0;
+}
+
+/* Write a JSON string (with escaping) */
+static void smfd_json_string(FILE *const fp, const char *s)
 {
-	smfd_check_node_type(node, name, YAML_SEQUENCE_NODE, "sequence");
+	fputc('"', fp);
+
+	for (; *s != 0; ++s) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+
+	fputc('"', fp);
 }
 
-/* Fatal error if the node is not a YAML_MAPPING_NODE */
-static void smfd_check_mapping(const yaml_node_t *node, const char *const restrict name)
+/* Write 1 temperature as a JSON object -- current reading or periodic statistics */
+static void smfd_ctl_temp(FILE *const fp, const char *const restrict name,
+			  const char *const restrict group,
+			  const struct smfd_temperature *const temp,
+			  const _Bool stats, const _Bool first)
 {
-	smfd_check_node_type(node, name, YAML_MAPPING_NODE, "mapping");
+	fputs(first ? "{\"name\":" : ",{\"name\":", fp);
+	smfd_json_string(fp, name);
+	fprintf(fp, ",\"group\":\"%s\"", group);
+
+	if (!stats) {
+		fprintf(fp, ",\"current\":%d,\"state\":\"%s\"}",
+			temp->current, smfd_sensor_state_names[temp->state]);
+	}
+	else if (temp->samples == 0) {
+		fputs(",\"samples\":0}", fp);
+	}
+	else {
+		fprintf(fp, ",\"high\":%d,\"low\":%d,\"mean\":%d,\"samples\":%d}",
+			temp->high, temp->low,
+			(temp->accumulator + temp->samples / 2) / temp->samples, temp->samples);
+	}
 }
 
-/* Parse an integer from a scalar node */
-static int smfd_parse_int(const yaml_node_t *const node, const char *const restrict name)
+/* Write all temperatures as a JSON array */
+static void smfd_ctl_temps(FILE *const fp, const _Bool stats)
 {
-	long value;
-	char *end;
+	unsigned int i;
 
-	smfd_check_scalar(node, name);
+	fputs(",\"temps\":[", fp);
 
-	if (*node->data.scalar.value == 0 || isspace(*node->data.scalar.value)) {
-		SMFD_CFG_FATAL("value of %s (%s) is not a valid integer\n",
-			       node, name, node->data.scalar.value);
+	smfd_ctl_temp(fp, "PCH", "pch", &smfd_pch_temp, stats, 1);
+
+	for (i = 0; i < smfd_coretemp_count; ++i)
+		smfd_ctl_temp(fp, smfd_coretemps[i].name, "cpu", &smfd_coretemps[i].temp, stats, 0);
+
+	for (i = 0; i < smfd_ctrl_temp_count; ++i) {
+		smfd_ctl_temp(fp, smfd_ctrl_temps[i].name,
+			      smfd_group_keys[smfd_ctrl_temps[i].group],
+			      &smfd_ctrl_temps[i].temp, stats, 0);
 	}
 
-	errno = 0;
-	value = strtol((char *)node->data.scalar.value, &end, 0);
+	for (i = 0; i < smfd_disk_count; ++i)
+		smfd_ctl_temp(fp, smfd_disks[i].name, "disk", &smfd_disks[i].temp, stats, 0);
 
-	if (errno != 0 || *end != 0 || value < INT_MIN || value > INT_MAX) {
-		SMFD_CFG_FATAL("value of %s (%s) is not a valid integer\n",
-			       node, name, node->data.scalar.value);
+	for (i = 0; i < smfd_plugin_temp_count; ++i) {
+		smfd_ctl_temp(fp, smfd_plugin_temps[i].name,
+			      smfd_group_keys[smfd_plugin_temps[i].lib->group],
+			      &smfd_plugin_temps[i].temp, stats, 0);
 	}
 
-	return (int)value;
+	fputc(']', fp);
 }
 
-/* Parse (allocate & copy) a string from a scalar node */
-static char *smfd_parse_string(const yaml_node_t *const node, const char *const restrict name)
+/* Write a latency histogram summary as a JSON object */
+static void smfd_ctl_hist(FILE *const fp, const char *const name,
+			  const struct smfd_histogram *const hist)
 {
-	char *value;
+	fprintf(fp, "\"%s\":{\"count\":%u,\"mean_ms\":%" PRId64 ",\"max_ms\":%" PRId64 "}", name,
+		hist->count, (hist->count == 0) ? 0 : hist->total / hist->count, hist->max);
+}
 
-	smfd_check_scalar(node, name);
+/* Write each disk's deviation from its peers as a JSON array */
+static void smfd_ctl_peers(FILE *const fp)
+{
+	const struct smfd_disk *disk;
+	unsigned int i;
 
-	if ((value = malloc(node->data.scalar.length + 1)) == NULL)
-		SMFD_ABORT("malloc: %m\n");
+	fputs(",\"disk_peers\":[", fp);
 
-	memcpy(value, node->data.scalar.value, node->data.scalar.length + 1);
+	for (i = 0; i < smfd_disk_count; ++i) {
 
-	return value;
-}
+		disk = &smfd_disks[i];
 
-static void smfd_parse_sdr_cache(const yaml_node_t *const node,
-				 yaml_document_t *const doc __attribute__((unused)),
-				 const char *const restrict name,
-				 void *const restrict data __attribute__((unused)))
-{
-	smfd_sdr_cache = smfd_parse_string(node, name);
+		fputs((i == 0) ? "{\"name\":" : ",{\"name\":", fp);
+		smfd_json_string(fp, disk->name);
+		fputs(",\"cage\":", fp);
+
+		if (disk->cage < smfd_disk_cage_count)
+			smfd_json_string(fp, smfd_disk_cages[disk->cage].name);
+		else
+			fputs("null", fp);
+
+		fprintf(fp, ",\"score\":%.1f,\"util\":", disk->score);
+
+		if (disk->util >= 0)
+			fprintf(fp, "%d", disk->util);
+		else
+			fputs("null", fp);
+
+		fprintf(fp, ",\"anomaly\":%s}", disk->anomaly ? "true" : "false");
+	}
+
+	fputc(']', fp);
 }
 
-/* Parse a fan speed (percentage) from a scalar node */
-static void smfd_parse_fan_speed(const yaml_node_t *const node,
-				 yaml_document_t *const doc __attribute__((unused)),
-				 const char *const restrict name, void *const restrict data)
+/* Write each disk's accumulated thermal stress as a JSON array */
+static void smfd_ctl_aging(FILE *const fp)
 {
-	uint8_t *const speed = data;
-	int value;
+	const struct smfd_aging *aging;
+	unsigned int i;
 
-	value = smfd_parse_int(node, name);
+	fprintf(fp, ",\"disk_aging\":{\"reference\":%d,\"activation_energy\":%g,\"disks\":[",
+		smfd_aging_reference, smfd_aging_energy);
 
-	if (value < 0 || value > 100)
-		SMFD_CFG_FATAL("%s (%d%%) is not a valid fan speed\n", node, name, value);
+	for (i = 0; i < smfd_disk_count; ++i) {
 
-	if (value < 25) {
-		SMFD_WARNING("Fan speeds below 25%% may cause problems (%s = %d%%)\n",
-			     name, value);
+		aging = &smfd_agings[smfd_disks[i].aging];
+
+		fputs((i == 0) ? "{\"name\":" : ",{\"name\":", fp);
+		smfd_json_string(fp, smfd_disks[i].name);
+		fputs(",\"id\":", fp);
+		smfd_json_string(fp, aging->id);
+		fprintf(fp, ",\"hours\":%.2f,\"degree_hours\":%.2f,\"aged_hours\":%.2f,"
+			    "\"aging_factor\":", aging->hours, aging->degree_hours,
+			    aging->aged_hours);
+
+		if (aging->hours > 0)
+			fprintf(fp, "%.3f}", aging->aged_hours / aging->hours);
+		else
+			fputs("null}", fp);
 	}
 
-	*speed = (uint8_t)value;
+	fputs("]}", fp);
 }
 
-/* Parse a logging interval (seconds) from a scalar node */
-static void smfd_parse_log_interval(const yaml_node_t *const node,
-				    yaml_document_t *const doc __attribute__((unused)),
-				    const char *const restrict name, void *const restrict data)
+/* Respond to a status request */
+static void smfd_ctl_status(FILE *const fp)
 {
-	unsigned int *const interval = data;
-	int value;
+	int64_t now;
+	unsigned int i;
 
-	value = smfd_parse_int(node, name);
+	now = smfd_mono_ms();
 
-	if (value < 0)
-		SMFD_CFG_FATAL("%s (%d) is not a valid logging interval\n", node, name, value);
+	fprintf(fp, "{\"ok\":true,\"uptime\":%lld,\"debug\":%s,\"optimizer\":%s,\"profile\":",
+		(long long)(time(NULL) - smfd_start_time), smfd_debug ? "true" : "false",
+		smfd_opt_enabled ? "true" : "false");
+	smfd_json_string(fp, smfd_policy->name);
+	fputs(",\"profiles\":[", fp);
+	smfd_json_string(fp, smfd_default_profile.name);
 
-	if (value != 0 && value < 30)
-		SMFD_WARNING("%s (%d) is less than 30 second sampling interval\n", name, value);
+	for (i = 0; i < smfd_profile_count; ++i) {
+		fputc(',', fp);
+		smfd_json_string(fp, smfd_profiles[i].name);
+	}
 
-	if (value != 0 && value < 600)
-		SMFD_WARNING("%s (%d seconds) may generate excessive log entries\n", name, value);
+	fputs("],\"zones\":[", fp);
 
-	if (value > 30000000) /* about 1 year */ {
-		SMFD_WARNING("Set %s to 0 to disable periodic logging (%s = %d)\n",
-			     name, name, value);
+	for (i = 0; i < SMFD_FAN_ZONE_COUNT; ++i) {
+
+		fprintf(fp, "%s{\"name\":\"%s\",\"backend\":\"%s\",\"duty\":%" PRIu8
+			    ",\"override\":",
+			(i == 0) ? "" : ",", smfd_zone_names[i], smfd_zones[i].ops->name,
+			smfd_fan_percent[i]);
+
+		if (smfd_overrides[i].active) {
+			fprintf(fp, "{\"duty\":%" PRIu8 ",\"ttl\":%" PRId64 "}}",
+				smfd_overrides[i].percent,
+				(smfd_overrides[i].expires - now + 999) / 1000);
+		}
+		else {
+			fputs("null}", fp);
+		}
 	}
 
-	*interval = (unsigned int)value;
+	fputs("],\"fans\":[", fp);
+
+	for (i = 0; i < smfd_ipmi_fan_count; ++i) {
+		fputs((i == 0) ? "{\"name\":" : ",{\"name\":", fp);
+		smfd_json_string(fp, smfd_ipmi_fans[i].name);
+		fprintf(fp, ",\"rpm\":%u}", smfd_ipmi_fans[i].rpm);
+	}
+
+	fputc(']', fp);
+	smfd_ctl_temps(fp, 0);
+
+	if (smfd_peer_threshold != 0)
+		smfd_ctl_peers(fp);
+
+	if (smfd_throttle_count > 0) {
+		fprintf(fp, ",\"disk_throttle\":{\"step\":%u,\"steps\":%u}",
+			smfd_throttle_level, smfd_throttle_steps);
+	}
+
+	if (smfd_aging_enabled)
+		smfd_ctl_aging(fp);
+
+	fputs("}\n", fp);
 }
 
-/* Parse a temperature from a scalar node */
-static int smfd_parse_temp(const yaml_node_t *const node, const char *const restrict name)
+/* Write the shadow mode comparison as a JSON object */
+static void smfd_ctl_shadow(FILE *const fp)
 {
-	int value;
+	const struct smfd_shadow_stats *const st = &smfd_shadow_stats;
+	unsigned int i;
+	_Bool first;
 
-	value = smfd_parse_int(node, name);
+	fprintf(fp, ",\"shadow\":{\"samples\":%u,\"zones\":[", st->samples);
 
-	if (value < -273 || value > 999)
-		SMFD_CFG_FATAL("%s (%d) is not a valid temperature\n", node, name, value);
+	for (i = 0; st->samples > 0 && i < SMFD_FAN_ZONE_COUNT; ++i) {
+		fprintf(fp, "%s{\"name\":\"%s\",\"duty_diff\":%.1f,\"energy_savings\":%.1f}",
+			(i == 0) ? "" : ",", smfd_zone_names[i], st->duty_diff[i] / st->samples,
+			(st->actual_power[i] > 0) ?
+				100.0 * (1.0 - st->shadow_power[i] / st->actual_power[i]) : 0.0);
+	}
 
-	if (value < 25 || value > 80) {
-		SMFD_WARNING("Temperatures outside 25°C - 80°C are probably not useful (%s = %d)\n",
-			     name, value);
+	fputs("],\"temp_delta\":{", fp);
+
+	for (first = 1, i = 0; st->samples > 0 && i < SMFD_GROUP_COUNT; ++i) {
+		if (!st->have_model[i])
+			continue;
+		fprintf(fp, "%s\"%s\":{\"mean\":%.2f,\"max\":%.2f}", first ? "" : ",",
+			smfd_group_keys[i], st->temp_delta[i] / st->samples, st->temp_delta_max[i]);
+		first = 0;
 	}
 
-	return value;
+	fputs("}}", fp);
 }
 
-/* Parse an IPMI SDR record ID from a scalar node */
-static uint16_t smfd_parse_record_id(const yaml_node_t *const node)
+/* Write the outcome of each experiment arm as a JSON object */
+static void smfd_ctl_experiment(FILE *const fp)
 {
-	int value;
+	const struct smfd_exp_stats *st;
+	unsigned int arm, i;
 
-	value = smfd_parse_int(node, "record_id");
+	fputs(",\"experiment\":{\"active\":", fp);
+	smfd_json_string(fp, smfd_exp_arms[smfd_exp_current].name);
+	fputs(",\"arms\":[", fp);
 
-	if (value < 0 || value >= 0xffff)
-		SMFD_CFG_FATAL("record_id (%d) is not a valid IPMI SDR ID\n", node, value);
+	for (arm = 0; arm < 2; ++arm) {
 
-	return (uint16_t)value;
+		st = &smfd_exp_arms[arm].stats;
+
+		fputs((arm == 0) ? "{\"name\":" : ",{\"name\":", fp);
+		smfd_json_string(fp, smfd_exp_arms[arm].name);
+		fprintf(fp, ",\"policy\":\"%s\",\"blocks\":%u,\"samples\":%u,\"throttles\":%lu"
+			",\"safety_ends\":%u", smfd_exp_policy_names[smfd_exp_arms[arm].policy],
+			st->blocks, st->samples, st->throttles, st->safety_ends);
+
+		if (st->samples > 0)
+			fprintf(fp, ",\"fan_power\":%.4f", smfd_exp_fan_power(st));
+
+		if (st->cpu_seconds > 0)
+			fprintf(fp, ",\"cpu_watts\":%.1f", st->cpu_energy / st->cpu_seconds);
+
+		if (st->aging_samples > 0)
+			fprintf(fp, ",\"disk_aging\":%.3f", st->disk_aging / st->aging_samples);
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+			if (smfd_exp_percentile(st->temps[i], 50) < 0)
+				continue;
+			fprintf(fp, ",\"%s_p50\":%d,\"%s_p95\":%d,\"%s_p99\":%d",
+				smfd_group_keys[i], smfd_exp_percentile(st->temps[i], 50),
+				smfd_group_keys[i], smfd_exp_percentile(st->temps[i], 95),
+				smfd_group_keys[i], smfd_exp_percentile(st->temps[i], 99));
+		}
+
+		fputc('}', fp);
+	}
+
+	fputs("]}", fp);
 }
 
-/* Fatal error due to missing field (key) in a mapping node */
-__attribute__((noreturn))
-static void smfd_missing_field(const yaml_node_t *const node, const char *const restrict seq_name,
-			       const char *const restrict field_name)
+/* Respond to a stats request, optionally resetting the statistics */
+static void smfd_ctl_stats(FILE *const fp, const _Bool reset)
 {
-	SMFD_CFG_FATAL("%s not set in %s element\n", node, field_name, seq_name);
+	struct smfd_ipmiq_stats ipmiq;
+	unsigned int i;
+
+	fprintf(fp, "{\"ok\":true,\"since\":%lld", (long long)smfd_log_start);
+	smfd_ctl_temps(fp, 1);
+	fputs(",\"latency\":{", fp);
+	smfd_ctl_hist(fp, "duty_set", &smfd_set_latency);
+	fputc(',', fp);
+	smfd_ctl_hist(fp, "rpm_90", &smfd_rpm_latency);
+	fputc(',', fp);
+	smfd_ctl_hist(fp, "temp_falling", &smfd_turn_latency);
+	fputc('}', fp);
+
+	if (smfd_ipmiq_running) {
+		smfd_ipmiq_get_stats(&ipmiq, reset);
+		fputs(",\"ipmi_queue\":{", fp);
+		smfd_ctl_hist(fp, "wait", &ipmiq.wait);
+		fprintf(fp, ",\"written\":%u,\"safety\":%u,\"coalesced\":%u,\"unchanged\":%u,"
+			"\"mode_checks\":%u,\"mode_restores\":%u}", ipmiq.written, ipmiq.urgent,
+			ipmiq.coalesced, ipmiq.unchanged, ipmiq.mode_checks, ipmiq.mode_restores);
+	}
+
+	if (smfd_shadow)
+		smfd_ctl_shadow(fp);
+
+	if (smfd_exp_enabled)
+		smfd_ctl_experiment(fp);
+
+	if (smfd_peer_threshold != 0) {
+		fprintf(fp, ",\"disk_anomalies\":{\"raised\":%u,\"active\":%u}",
+			smfd_peer_events, smfd_peer_active());
+	}
+
+	fputs("}\n", fp);
+
+	if (!reset)
+		return;
+
+	smfd_temp_reset(&smfd_pch_temp);
+
+	for (i = 0; i < smfd_coretemp_count; ++i)
+		smfd_temp_reset(&smfd_coretemps[i].temp);
+
+	for (i = 0; i < smfd_ctrl_temp_count; ++i)
+		smfd_temp_reset(&smfd_ctrl_temps[i].temp);
+
+	for (i = 0; i < smfd_disk_count; ++i)
+		smfd_temp_reset(&smfd_disks[i].temp);
+
+	for (i = 0; i < smfd_plugin_temp_count; ++i)
+		smfd_temp_reset(&smfd_plugin_temps[i].temp);
+
+	memset(&smfd_set_latency, 0, sizeof smfd_set_latency);
+	memset(&smfd_rpm_latency, 0, sizeof smfd_rpm_latency);
+	memset(&smfd_turn_latency, 0, sizeof smfd_turn_latency);
+	memset(&smfd_shadow_stats, 0, sizeof smfd_shadow_stats);
+	memset(&smfd_exp_arms[0].stats, 0, sizeof smfd_exp_arms[0].stats);
+	memset(&smfd_exp_arms[1].stats, 0, sizeof smfd_exp_arms[1].stats);
+	smfd_peer_events = 0;
+
+	smfd_log_start = time(NULL);
 }
 
-/* Parse smfd_ipmi_fans and smfd_ipmi_fan_count from a sequence node */
-static void smfd_parse_ipmi_fans(const yaml_node_t *const node, yaml_document_t *const doc,
-				 const char *const restrict name,
-				 void *const restrict data __attribute__((unused)))
+/* Set or clear (ttl = 0) a zone's duty cycle override; returns an error message or NULL */
+static const char *smfd_ctl_override(const char *const request)
 {
-	const yaml_node_t *map, *key, *value;
-	const yaml_node_item_t *item;
-	const yaml_node_pair_t *kv;
-	struct smfd_ipmi_fan *fans;
-	ptrdiff_t len;
-	int i;
+	char zone_name[16], duty_str[16], ttl_str[16], *end;
+	long duty, ttl;
+	uint8_t zone;
 
-	smfd_check_sequence(node, name);
+	if (!smfd_json_get(request, "zone", zone_name, sizeof zone_name)
+			|| !smfd_json_get(request, "ttl", ttl_str, sizeof ttl_str)) {
+		return "zone and ttl are required";
+	}
 
-	len = node->data.sequence.items.top - node->data.sequence.items.start;
-	assert(len > 0);
+	/* Accept the names that status reports ("CPU") as well as the configuration's ("cpu") */
+	if (strcasecmp(zone_name, "cpu") == 0)
+		zone = SMFD_FAN_ZONE_CPU;
+	else if (strcasecmp(zone_name, "system") == 0)
+		zone = SMFD_FAN_ZONE_SYS;
+	else
+		return "zone must be cpu or system";
 
-	if ((fans = malloc(len * sizeof *fans)) == NULL)
-		SMFD_ABORT("malloc: %m\n");
+	ttl = strtol(ttl_str, &end, 10);
+	if (*end != 0 || ttl < 0 || ttl > 86400)
+		return "ttl must be 0 - 86400 seconds";
 
-	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item) {
+	if (ttl == 0) {
+		SMFD_NOTICE("%s fan override cleared\n", smfd_zone_names[zone]);
+		smfd_overrides[zone].active = 0;
+		return NULL;
+	}
 
-		map = yaml_document_get_node(doc, *item);
-		smfd_check_mapping(map, name);
-		fans[i].name = NULL;
-		fans[i].record_id = 0xffff;
+	if (!smfd_json_get(request, "duty", duty_str, sizeof duty_str))
+		return "duty is required";
 
-		for (kv = map->data.mapping.pairs.start; kv < map->data.mapping.pairs.top; ++kv) {
+	duty = strtol(duty_str, &end, 10);
+	if (*end != 0 || duty < 0 || duty > 100)
+		return "duty must be 0 - 100";
 
-			key = yaml_document_get_node(doc, kv->key);
-			if (key->type != YAML_SCALAR_NODE)
-				SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+	smfd_overrides[zone].percent = duty;
+	smfd_overrides[zone].expires = smfd_mono_ms() + ttl * 1000;
+	smfd_overrides[zone].active = 1;
 
-			value = yaml_document_get_node(doc, kv->value);
+	SMFD_NOTICE("%s fan override: %ld%% for %ld seconds\n", smfd_zone_names[zone], duty, ttl);
 
-			if (strcmp((char *)key->data.scalar.value, "name") == 0) {
-				fans[i].name = smfd_parse_string(value, "name");
-			}
-			else if (strcmp((char *)key->data.scalar.value, "record_id") == 0) {
-				fans[i].record_id = smfd_parse_record_id(value);
-			}
-			else {
-				SMFD_CFG_FATAL("unknown key (%s) in ipmi_fans\n",
-					       key, key->data.scalar.value);
-			}
-		}
+	/* Apply immediately, rather than at the next sample */
+	smfd_update_fan(zone, duty, NULL, "override");
 
-		if (fans[i].name == NULL)
-			smfd_missing_field(map, "ipmi_fans", "name");
-		if (fans[i].record_id == 0xffff)
-			smfd_missing_field(map, "ipmi_fans", "record_id");
-	}
+	return NULL;
+}
 
-	smfd_ipmi_fans = fans;
-	smfd_ipmi_fan_count = len;
+/* Switch to a named profile, and apply it immediately; returns an error message or NULL */
+static const char *smfd_ctl_profile(const char *const request)
+{
+	char name[64];
+	const char *err;
+
+	if (!smfd_json_get(request, "name", name, sizeof name))
+		return "name is required";
+
+	if ((err = smfd_profile_select(name)) != NULL)
+		return err;
+
+	/* Re-run the control cycle with the cached sensor readings, rather than wait */
+	smfd_process_all_temps();
+
+	return NULL;
 }
 
 /*
- * Parse a trigger in smfd_cfg_cpu_temp, smfd_cfg_pch_temp or smfd_cfg_disk_temp from a mapping node
+ * Check the whole configuration file (including settings that a reload doesn't apply) in a child
+ * process, so that errors aren't fatal to the daemon.  The child re-executes smfd, so that it
+ * parses the file from the same initial state as a restart would.
  */
-static void smfd_parse_trigger(const yaml_node_t *const node, yaml_document_t *const doc,
-			       const char *const restrict name,
-			       struct smfd_temp_threshold *const trigger)
+static _Bool smfd_config_valid(void)
 {
-	static const struct smfd_temp_threshold init = {
-		.name			= NULL,
-		.threshold		= INT_MIN,
-		.hysteresis		= INT_MIN,
-		.cpu_fan_percent	= 255,
-		.sys_fan_percent	= 255,
-		.active			= 1	/* not a flag value; all triggers start active */
-	};
+	int status;
+	pid_t pid;
+
+	fflush(NULL);
+
+	if ((pid = fork()) < 0) {
+		SMFD_ERR("fork: %m\n");
+		return 0;
+	}
+
+	if (pid == 0) {
+		execl("/proc/self/exe", "smfd", "--check-config", "-c", smfd_config_file,
+		      smfd_use_syslog ? "-s" : NULL, (char *)NULL);
+		SMFD_ERR("/proc/self/exe: %m\n");
+		_exit(EXIT_FAILURE);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		SMFD_ERR("waitpid: %m\n");
+		return 0;
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/* Reload policy settings from the configuration file; returns an error message or NULL */
+static const char *smfd_ctl_reload(void)
+{
+	char *profile;
+
+	if (!smfd_config_valid())
+		return "configuration file is invalid (see log)";
 
-	const yaml_node_t *key, *value;
-	const yaml_node_pair_t *pair;
+	SMFD_NOTICE("Reloading configuration from %s\n", smfd_config_file);
 
-	smfd_check_mapping(node, name);
-	memcpy(trigger, &init, sizeof *trigger);
+	profile = smfd_strdup(smfd_policy->name);
 
-	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+	smfd_free_policy();
+	smfd_load_config(1);
 
-		key = yaml_document_get_node(doc, pair->key);
-		if (key->type != YAML_SCALAR_NODE)
-			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+	/* Stay in the same profile, if it still exists */
+	if (smfd_profile_select(profile) != NULL)
+		SMFD_WARNING("Profile %s no longer exists; using default profile\n", profile);
 
-		value = yaml_document_get_node(doc, pair->value);
+	free(profile);
 
-		if (strcmp((char *)key->data.scalar.value, "name") == 0) {
-			trigger->name = smfd_parse_string(value, "name");
-		}
-		else if (strcmp((char *)key->data.scalar.value, "threshold") == 0) {
-			trigger->threshold = smfd_parse_temp(value, "threshold");
-		}
-		else if (strcmp((char *)key->data.scalar.value, "hysteresis") == 0) {
-			trigger->hysteresis = smfd_parse_temp(value, "hysteresis");
+	if (smfd_opt_enabled || smfd_coupling_assign)
+		smfd_coupling_load();
+
+	smfd_exp_reloaded();
+	smfd_log_init();
+	smfd_dump_config();
+
+	return NULL;
+}
+
+/* Handle 1 request line and send the response; returns -1 if the client should be dropped */
+static int smfd_ctl_request(struct smfd_ctl_client *const client, const char *const request)
+{
+	char cmd[32], arg[16], *response = NULL;
+	const char *err = NULL;
+	size_t response_len;
+	_Bool privileged;
+	FILE *fp;
+	int rc;
+
+	privileged = client->uid == 0 || client->uid == geteuid();
+
+	if ((fp = open_memstream(&response, &response_len)) == NULL)
+		SMFD_ABORT("open_memstream: %m\n");
+
+	if (!smfd_json_get(request, "cmd", cmd, sizeof cmd)) {
+		err = "missing cmd";
+	}
+	else if (strcmp(cmd, "status") == 0) {
+		smfd_ctl_status(fp);
+	}
+	else if (strcmp(cmd, "stats") == 0) {
+		if (smfd_json_get(request, "reset", arg, sizeof arg) && strcmp(arg, "true") == 0) {
+			if (privileged)
+				smfd_ctl_stats(fp, 1);
+			else
+				err = "permission denied";
 		}
-		else if (strcmp((char *)key->data.scalar.value, "cpu_fan_speed") == 0) {
-			smfd_parse_fan_speed(value, doc, "cpu_fan_speed",
-					     &trigger->cpu_fan_percent);
+		else {
+			smfd_ctl_stats(fp, 0);
 		}
-		else if (strcmp((char *)key->data.scalar.value, "sys_fan_speed") == 0) {
-			smfd_parse_fan_speed(value, doc, "sys_fan_speed",
-					     &trigger->sys_fan_percent);
+	}
+	else if (!privileged) {
+		err = "permission denied";
+	}
+	else if (strcmp(cmd, "debug") == 0) {
+		if (!smfd_json_get(request, "on", arg, sizeof arg)) {
+			err = "on is required";
 		}
 		else {
-			SMFD_CFG_FATAL("unknown key (%s) in %s\n",
-				       key, key->data.scalar.value, name);
+			smfd_debug = strcmp(arg, "true") == 0;
+			SMFD_NOTICE("Debugging %s (control socket)\n", smfd_debug ? "ON" : "OFF");
 		}
 	}
+	else if (strcmp(cmd, "set-override") == 0) {
+		err = smfd_ctl_override(request);
+	}
+	else if (strcmp(cmd, "reload") == 0) {
+		err = smfd_ctl_reload();
+	}
+	else if (strcmp(cmd, "profile") == 0) {
+		err = smfd_ctl_profile(request);
+	}
+	else {
+		err = "unknown cmd";
+	}
 
-	if (trigger->name == NULL)
-		smfd_missing_field(node, name, "name");
-	if (trigger->threshold == INT_MIN)
-		smfd_missing_field(node, name, "threshold");
-	if (trigger->hysteresis == INT_MIN)
-		smfd_missing_field(node, name, "hysteresis");
+	if (err != NULL)
+		fprintf(fp, "{\"ok\":false,\"error\":\"%s\"}\n", err);
+	else if (ftell(fp) == 0)
+		fputs("{\"ok\":true}\n", fp);
 
-	if (trigger->cpu_fan_percent == 255 && trigger->sys_fan_percent == 255)
-		SMFD_CFG_FATAL("no cpu_fan_speed or sys_fan_speed in %s element\n", node, name);
+	if (fclose(fp) != 0)
+		SMFD_ABORT("fclose: %m\n");
 
-	trigger->cpu_fan_percent = (trigger->cpu_fan_percent == 255) ? 0 : trigger->cpu_fan_percent;
-	trigger->sys_fan_percent = (trigger->sys_fan_percent == 255) ? 0 : trigger->sys_fan_percent;
+	rc = (write(client->fd, response, response_len) == (ssize_t)response_len) ? 0 : -1;
+	free(response);
 
-	if (trigger->hysteresis >= trigger->threshold) {
-		SMFD_CFG_FATAL("hysteresis (%d) >= threshold (%d) in %s element\n",
-			       node, trigger->hysteresis, trigger->threshold, name);
-	}
+	return rc;
 }
 
-/* Parse smfd_cfg_cpu_temp, smfd_cfg_pch_temp or smfd_cfg_disk_temp from a sequence node */
-static void smfd_parse_triggers(const yaml_node_t *const node, yaml_document_t *const doc,
-				const char *const restrict name, void *const restrict data)
+/* Close a client connection */
+static void smfd_ctl_drop(struct smfd_ctl_client *const client)
 {
-	struct smfd_temp_threshold **const triggers = data;
+	if (close(client->fd) != 0)
+		SMFD_ERR("close: %m\n");
 
-	const yaml_node_item_t *item;
-	ptrdiff_t len;
-	int i;
+	client->fd = -1;
+}
 
-	smfd_check_sequence(node, name);
+/* Read from a client and handle any complete request lines */
+static void smfd_ctl_read(struct smfd_ctl_client *const client)
+{
+	char *nl, *line;
+	ssize_t len;
 
-	len = node->data.sequence.items.top - node->data.sequence.items.start;
-	assert(len > 0);
+	len = read(client->fd, client->buf + client->len, sizeof client->buf - client->len - 1);
 
-	if ((*triggers = malloc((len + 1) * sizeof **triggers)) == NULL)
-		SMFD_ABORT("malloc: %m\n");
+	if (len <= 0) {
+		if (len == 0 || (errno != EAGAIN && errno != EINTR))
+			smfd_ctl_drop(client);
+		return;
+	}
 
-	(*triggers)[len].name = NULL;
+	client->len += len;
+	client->buf[client->len] = 0;
 
-	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item)
-		smfd_parse_trigger(yaml_document_get_node(doc, *item), doc, name, &(*triggers)[i]);
+	for (line = client->buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+		*nl = 0;
+		if (smfd_ctl_request(client, line) < 0) {
+			smfd_ctl_drop(client);
+			return;
+		}
+	}
+
+	client->len -= line - client->buf;
+	memmove(client->buf, line, client->len);
+
+	if (client->len == sizeof client->buf - 1) {
+		SMFD_WARNING("Control socket request too long; dropping client\n");
+		smfd_ctl_drop(client);
+	}
 }
 
-/* Parse smfd_disks and smfd_disk_count from a sequence node */
-static void smfd_parse_smart_disks(const yaml_node_t *const node, yaml_document_t *const doc,
-				   const char *const restrict name,
-				   void *const restrict data __attribute__((unused)))
+/* Accept a new client connection */
+static void smfd_ctl_accept(void)
 {
-	const yaml_node_item_t *item;
-	struct smfd_disk *disks;
-	ptrdiff_t len;
-	int i;
+	struct ucred cred;
+	socklen_t len;
+	unsigned int i;
+	int fd;
 
-	smfd_check_sequence(node, name);
+	if ((fd = accept4(smfd_ctl_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			SMFD_ERR("accept4: %m\n");
+		return;
+	}
 
-	len = node->data.sequence.items.top - node->data.sequence.items.start;
-	assert(len > 0);
+	len = sizeof cred;
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+		SMFD_ERR("getsockopt: %m\n");
+		close(fd);
+		return;
+	}
 
-	if ((disks = malloc(len * sizeof *disks)) == NULL)
-		SMFD_ABORT("malloc: %m\n");
+	for (i = 0; i < SMFD_CTL_MAX_CLIENTS; ++i) {
+		if (smfd_ctl_clients[i].fd < 0)
+			break;
+	}
 
-	for (i = 0, item = node->data.sequence.items.start ; i < len; ++i, ++item)
-		disks[i].name = smfd_parse_string(yaml_document_get_node(doc, *item), name);
+	if (i == SMFD_CTL_MAX_CLIENTS) {
+		SMFD_WARNING("Too many control socket clients\n");
+		close(fd);
+		return;
+	}
 
-	smfd_disks = disks;
-	smfd_disk_count = len;
-}
+	smfd_ctl_clients[i].fd = fd;
+	smfd_ctl_clients[i].uid = cred.uid;
+	smfd_ctl_clients[i].len = 0;
 
-/* Fatal error due to missing key in configuration file */
-__attribute__((noreturn))
-static void smfd_missing_config(const char *const name)
-{
-	SMFD_FATAL("Invalid configuration: %s: %s not set\n", smfd_config_file, name);
+	SMFD_DEBUG("Control socket client connected (PID %ld, UID %ld)\n",
+		   (long)cred.pid, (long)cred.uid);
 }
 
-/* Load and parse the configuration file */
-static void smfd_load_config(void)
+/* Create the control socket (if configured) */
+static void smfd_ctl_init(void)
 {
-	static const struct {
-		const char *name;
-		void (*parse_fn)(const yaml_node_t *node, yaml_document_t *const doc,
-				 const char *restrict name, void *data);
-		void *data;
-	}
-	parse_fns[] = {
-		{ "cpu_fan_base",	smfd_parse_fan_speed,		&smfd_cpu_fan_base	},
-		{ "sys_fan_base",	smfd_parse_fan_speed,		&smfd_sys_fan_base	},
-		{ "log_interval",	smfd_parse_log_interval,	&smfd_log_interval	},
-		{ "cpu_temp_triggers",	smfd_parse_triggers,		&smfd_cfg_cpu_temp	},
-		{ "pch_temp_triggers",	smfd_parse_triggers,		&smfd_cfg_pch_temp	},
-		{ "disk_temp_triggers",	smfd_parse_triggers,		&smfd_cfg_disk_temp	},
-		{ "ipmi_fans",		smfd_parse_ipmi_fans,		NULL			},
-		{ "smart_disks",	smfd_parse_smart_disks,		NULL			},
-		{ "sdr_cache_file",	smfd_parse_sdr_cache,		NULL			},
-		{ NULL }
-	};
-
-	const yaml_node_t *node, *key;
-	const yaml_node_pair_t *pair;
-	yaml_parser_t parser;
-	yaml_document_t doc;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
 	unsigned int i;
-	FILE *fp;
 
-	if ((fp = fopen(smfd_config_file, "r")) == NULL)
-		SMFD_FATAL("%s: %m\n", smfd_config_file);
+	for (i = 0; i < SMFD_CTL_MAX_CLIENTS; ++i)
+		smfd_ctl_clients[i].fd = -1;
 
-	if (!yaml_parser_initialize(&parser))
-		SMFD_LIBYAML_FATAL(smfd_config_file, &parser);
+	if (smfd_ctl_path == NULL)
+		return;
 
-	yaml_parser_set_input_file(&parser, fp);
+	strcpy(addr.sun_path, smfd_ctl_path);
 
-	if (!yaml_parser_load(&parser, &doc))
-		SMFD_LIBYAML_FATAL(smfd_config_file, &parser);
+	if (unlink(smfd_ctl_path) != 0 && errno != ENOENT)
+		SMFD_FATAL("%s: %m\n", smfd_ctl_path);
 
-	yaml_parser_delete(&parser);
+	if ((smfd_ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		SMFD_FATAL("socket: %m\n");
 
-	if (fclose(fp) != 0)
-		SMFD_FATAL("fclose: %m\n");
+	if (bind(smfd_ctl_fd, (struct sockaddr *)&addr, sizeof addr) != 0)
+		SMFD_FATAL("%s: %m\n", smfd_ctl_path);
 
-	if ((node = yaml_document_get_root_node(&doc)) == NULL)
-		SMFD_ABORT("yaml_document_get_root_node: %m\n");
+	/* Anyone may query; SO_PEERCRED restricts commands that change state */
+	if (chmod(smfd_ctl_path, 0666) != 0)
+		SMFD_FATAL("%s: %m\n", smfd_ctl_path);
 
-	if (node->type != YAML_MAPPING_NODE)
-		SMFD_FATAL("Invalid configuration: %s: not a YAML mapping\n", smfd_config_file);
+	if (listen(smfd_ctl_fd, SMFD_CTL_MAX_CLIENTS) != 0)
+		SMFD_FATAL("listen: %m\n");
 
-	for (pair = node->data.mapping.pairs.start; pair < node->data.mapping.pairs.top; ++pair) {
+	SMFD_DEBUG("smfd_ctl_init finished\n");
+}
 
-		key = yaml_document_get_node(&doc, pair->key);
-		if (key->type != YAML_SCALAR_NODE)
-			SMFD_CFG_FATAL("mapping key is not a scalar\n", key);
+/* Close the control socket & any client connections */
+static void smfd_ctl_fini(void)
+{
+	unsigned int i;
 
-		for (i = 0; parse_fns[i].name != NULL; ++i) {
-			if (strcmp((char *)key->data.scalar.value, parse_fns[i].name) == 0) {
-				parse_fns[i].parse_fn(yaml_document_get_node(&doc, pair->value),
-						&doc, parse_fns[i].name, parse_fns[i].data);
-				break;
-			}
-		}
+	if (smfd_ctl_fd < 0)
+		return;
 
-		if (parse_fns[i].name == NULL)
-			SMFD_CFG_FATAL("unknown key (%s)\n", key, key->data.scalar.value);
+	for (i = 0; i < SMFD_CTL_MAX_CLIENTS; ++i) {
+		if (smfd_ctl_clients[i].fd >= 0)
+			smfd_ctl_drop(&smfd_ctl_clients[i]);
 	}
 
-	yaml_document_delete(&doc);
+	if (close(smfd_ctl_fd) != 0)
+		SMFD_ERR("close: %m\n");
 
-	if (smfd_cpu_fan_base == 255)		smfd_missing_config("cpu_fan_base");
-	if (smfd_sys_fan_base == 255)		smfd_missing_config("sys_fan_base");
-	if (smfd_log_interval == UINT_MAX)	smfd_missing_config("log_interval");
-	if (smfd_disks == NULL)			smfd_missing_config("smart_disks");
-	if (smfd_ipmi_fans == NULL)		smfd_missing_config("ipmi_fans");
-	if (smfd_cfg_cpu_temp == NULL)		smfd_missing_config("cpu_temp_triggers");
-	if (smfd_cfg_pch_temp == NULL)		smfd_missing_config("pch_temp_triggers");
-	if (smfd_cfg_disk_temp == NULL)		smfd_missing_config("disk_temp_triggers");
+	if (unlink(smfd_ctl_path) != 0)
+		SMFD_ERR("%s: %m\n", smfd_ctl_path);
+
+	free(smfd_ctl_path);
 }
 
 
@@ -1641,28 +10930,97 @@ static void smfd_signal_init(void)
 	}
 }
 
-/* Close files, free memory, etc. */
-static void smfd_cleanup(void)
+/* Free a trigger table (if any) */
+static void smfd_free_triggers(struct smfd_temp_threshold *const triggers)
 {
 	struct smfd_temp_threshold *trigger;
 
-	smfd_disk_fini();
-	smfd_ipmi_fini();
-	smfd_pch_temp_fini();
-	smfd_coretemp_fini();
+	if (triggers == NULL)
+		return;
 
-	for (trigger = smfd_cfg_cpu_temp; trigger->name != NULL; ++trigger)
+	for (trigger = triggers; trigger->name != NULL; ++trigger)
 		free(trigger->name);
 
-	for (trigger = smfd_cfg_pch_temp; trigger->name != NULL; ++trigger)
-		free(trigger->name);
+	free(triggers);
+}
 
-	for (trigger = smfd_cfg_disk_temp; trigger->name != NULL; ++trigger)
-		free(trigger->name);
+/* Free a profile's trigger tables and restore its defaults */
+static void smfd_free_profile(struct smfd_profile *const profile)
+{
+	unsigned int i;
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		smfd_free_triggers(profile->triggers[i]);
+		profile->triggers[i] = NULL;
+	}
+
+	profile->fan_base[SMFD_FAN_ZONE_CPU] = 255;
+	profile->fan_base[SMFD_FAN_ZONE_SYS] = 255;
+	profile->ramp_down = 0;
+}
+
+/* Free reloadable (policy) settings and restore their defaults */
+static void smfd_free_policy(void)
+{
+	unsigned int i;
+
+	smfd_free_profile(&smfd_default_profile);
 
-	free(smfd_cfg_cpu_temp);
-	free(smfd_cfg_pch_temp);
-	free(smfd_cfg_disk_temp);
+	for (i = 0; i < smfd_profile_count; ++i) {
+		smfd_free_profile(&smfd_profiles[i]);
+		free(smfd_profiles[i].name);
+	}
+
+	free(smfd_profiles);
+	smfd_profiles = NULL;
+	smfd_profile_count = 0;
+	smfd_policy = &smfd_default_profile;
+	smfd_log_interval = UINT_MAX;
+	smfd_sample_interval = 30000;
+	smfd_disk_max_staleness = 0;
+	smfd_disk_budget = 0;
+	smfd_disk_max_per_cycle = 0;
+
+	smfd_opt_enabled = 0;
+	smfd_opt_horizon = 120;
+	smfd_opt_time_constant = 300;
+	smfd_opt_step = 5;
+	smfd_opt_fan_min[SMFD_FAN_ZONE_CPU] = 25;
+	smfd_opt_fan_min[SMFD_FAN_ZONE_SYS] = 25;
+	memset(smfd_opt_groups, 0, sizeof smfd_opt_groups);
+
+	for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+		smfd_sensor_policies[i].policy = SMFD_FAIL_HOLD;
+		smfd_sensor_policies[i].hold_time = 120;
+	}
+}
+
+/* Close files, free memory, etc. */
+static void smfd_cleanup(void)
+{
+	if (smfd_fleet_host_count > 0) {
+		smfd_fleet_fini();
+	}
+	else {
+		smfd_report_fini();
+		smfd_exp_fini();
+		smfd_ctl_fini();
+		smfd_rec_fini();
+		smfd_throttle_fini();
+		smfd_disk_fini();
+		smfd_aging_fini();
+		smfd_zone_fini();
+		smfd_ipmi_fini();
+		smfd_plugin_fini();
+		smfd_ctrl_fini();
+		smfd_pch_temp_fini();
+		smfd_coretemp_fini();
+	}
+
+	smfd_free_policy();
+	free(smfd_cpu_affinity);
+	free(smfd_rec_dir);
+	free(smfd_aging_file);
 }
 
 /* Process smfd_debug_signal and smfd_dump_signal */
@@ -1679,11 +11037,98 @@ static void smfd_check_signals(void)
 
 	if (smfd_dump_signal) {
 		SMFD_NOTICE("Got SIGUSR2; logging some stuff\n");
-		smfd_log_info();
+		if (smfd_fleet_host_count > 0)
+			smfd_fleet_log_info();
+		else
+			smfd_log_info();
 		smfd_dump_signal = 0;
 	}
 }
 
+/*
+ * Wait up to timeout milliseconds for control socket activity or udev (disk hotplug) events, and
+ * handle them.  Returns 1 if the wait was interrupted by a signal.
+ */
+static _Bool smfd_poll_events(const int timeout)
+{
+	struct pollfd fds[SMFD_CTL_MAX_CLIENTS + 2];
+	struct smfd_ctl_client *clients[SMFD_CTL_MAX_CLIENTS + 2];
+	unsigned int i, n;
+	int rc;
+
+	n = 0;
+
+	if ((fds[n].fd = smfd_disk_monitor_fd()) >= 0) {
+		fds[n].events = POLLIN;
+		clients[n++] = NULL;
+	}
+
+	if ((fds[n].fd = smfd_ctl_fd) >= 0) {
+		fds[n].events = POLLIN;
+		clients[n++] = NULL;
+	}
+
+	for (i = 0; i < SMFD_CTL_MAX_CLIENTS; ++i) {
+		if (smfd_ctl_clients[i].fd < 0)
+			continue;
+		fds[n].fd = smfd_ctl_clients[i].fd;
+		fds[n].events = POLLIN;
+		clients[n++] = &smfd_ctl_clients[i];
+	}
+
+	if (n == 0) {
+		smfd_sleep_ms(timeout);
+		return smfd_debug_signal || smfd_dump_signal || smfd_quit_signal;
+	}
+
+	if ((rc = poll(fds, n, timeout)) < 0) {
+		if (errno == EINTR)
+			return 1;
+		SMFD_FATAL("poll: %m\n");
+	}
+
+	for (i = 0; rc > 0 && i < n; ++i) {
+
+		if (fds[i].revents == 0)
+			continue;
+
+		if (clients[i] != NULL)
+			smfd_ctl_read(clients[i]);
+		else if (fds[i].fd == smfd_ctl_fd)
+			smfd_ctl_accept();
+		else
+			smfd_disk_monitor();
+	}
+
+	return 0;
+}
+
+/* Wait until the next sampling cycle, handling events & sampling responding fans */
+static void smfd_wait(const unsigned int ms)
+{
+	int64_t now, end, next_poll;
+	_Bool pending;
+
+	end = smfd_mono_ms() + ms;
+	next_poll = 0;
+
+	while (!smfd_quit_signal && (now = smfd_mono_ms()) < end) {
+
+		pending = smfd_responses[SMFD_FAN_ZONE_CPU].rpm_pending
+				|| smfd_responses[SMFD_FAN_ZONE_SYS].rpm_pending;
+
+		if (pending && now >= next_poll) {
+			if (next_poll != 0)
+				smfd_response_poll();
+			next_poll = now + 1000;
+			continue;
+		}
+
+		if (smfd_poll_events((pending && next_poll < end) ? next_poll - now : end - now))
+			break;
+	}
+}
+
 static void smfd_log_init(void)
 {
 	if (smfd_log_interval == 0)
@@ -1713,33 +11158,125 @@ static void smfd_log_check(void)
 
 int main(const int argc, char **const argv)
 {
+	unsigned int i;
+
 	mtrace();
 
+	smfd_start_time = time(NULL);
 	smfd_parse_args(argc, argv);
-	smfd_load_config();
+
+	if (smfd_commission && smfd_shadow)
+		SMFD_FATAL("Coupling identification can't be run in shadow mode\n");
+
+	smfd_load_config(0);
+
+	if (smfd_config_check) {
+		if (smfd_opt_enabled || smfd_coupling_assign)
+			smfd_coupling_load();
+		return 0;
+	}
+
+	if (smfd_boot_config_file != NULL) {
+		smfd_boot_write();
+		return 0;
+	}
+
+	if (smfd_exp_enabled && (smfd_shadow || smfd_commission))
+		SMFD_FATAL("Experiments can't be run in shadow mode or with -k\n");
+
+	if ((smfd_opt_enabled || smfd_coupling_assign) && !smfd_commission)
+		smfd_coupling_load();
+
 	smfd_dump_config();
 
 	smfd_signal_init();
+	smfd_cpu_init();
+
+	if (smfd_fleet_host_count > 0) {
+
+		if (smfd_commission)
+			SMFD_FATAL("Coupling identification is not supported in fleet mode\n");
+
+		if (smfd_shadow)
+			SMFD_FATAL("Shadow mode is not supported in fleet mode\n");
+
+		if (smfd_exp_enabled)
+			SMFD_FATAL("Experiments are not supported in fleet mode\n");
+
+		if (smfd_throttle_count > 0)
+			SMFD_FATAL("Background I/O throttling is not supported in fleet mode\n");
+
+		if (smfd_aging_enabled)
+			SMFD_FATAL("Disk aging accounting is not supported in fleet mode\n");
+
+		if (smfd_plugin_lib_count > 0)
+			SMFD_FATAL("Plugins are not supported in fleet mode\n");
+
+		if (smfd_ctrl_source_count > 0)
+			SMFD_FATAL("Controller temperatures are not supported in fleet mode\n");
+
+		for (i = 0; i < SMFD_GROUP_COUNT; ++i) {
+			if (smfd_safety_limits[i].limit != INT_MAX)
+				SMFD_FATAL("Safety limits are not supported in fleet mode\n");
+		}
+
+		smfd_fleet_run();
+
+		SMFD_NOTICE("Got shutdown signal\n");
+		smfd_cleanup();
+		return 0;
+	}
+
 	smfd_coretemp_init();
 	smfd_pch_temp_init();
+	smfd_ctrl_init();
+	smfd_plugin_init();
+
+	if (!smfd_shadow)
+		smfd_boot_takeover();
+
 	smfd_ipmi_init();
+	smfd_zone_init();
+	smfd_aging_init();
 	smfd_disk_init();
+	smfd_throttle_init();
+	smfd_rec_init();
 	smfd_log_init();
-
+	smfd_report_init();
+	smfd_ctl_init();
+	smfd_exp_init();
+	smfd_cpu_verify();
+
+	if (smfd_commission) {
+		smfd_coupling_run();
+		smfd_cleanup();
+		return 0;
+	}
 
 	while (!smfd_quit_signal) {
 
 		smfd_check_signals();
 
+		smfd_sample_time = smfd_mono_ms();
 		smfd_coretemp_read();
 		smfd_pch_temp_read();
+		smfd_ctrl_read();
+		smfd_plugin_read();
 		smfd_disk_read();
+		smfd_peer_cycle();
 
 		smfd_process_all_temps();
 
+		if (smfd_shadow)
+			smfd_shadow_sample();
+
+		if (smfd_exp_enabled)
+			smfd_exp_sample();
+
 		smfd_log_check();
+		smfd_aging_check();
 
-		sleep(30);
+		smfd_wait(smfd_sample_interval);
 	};
 
 	SMFD_NOTICE("Got shutdown signal\n");